@@ -66,8 +66,7 @@ done
 
 ## Set up the features
 echo "$0: feature: norm_vars(${norm_vars}) add_deltas(${add_deltas})"
-feats="ark,s,cs:apply-cmvn --norm-vars=$norm_vars --utt2spk=ark:$sdata/JOB/utt2spk scp:$sdata/JOB/cmvn.scp scp:$sdata/JOB/feats.scp ark:- |"
-$add_deltas && feats="$feats add-deltas ark:- ark:- |"
+feats="ark,s,cs:apply-cmvn-and-deltas --norm-vars=$norm_vars --add-deltas=$add_deltas --utt2spk=ark:$sdata/JOB/utt2spk scp:$sdata/JOB/cmvn.scp scp:$sdata/JOB/feats.scp ark:- |"
 ##
 
 # Decode for each of the acoustic scales
@@ -663,6 +663,62 @@ template void CompressedMatrix::CopyToMat(int32,
                int32,
                MatrixBase<double> *dest) const;
 
+void CompressedMatrix::AddColSumsAndSquares(const VectorBase<BaseFloat> *weights,
+                                            VectorBase<double> *sum,
+                                            VectorBase<double> *sumsq) const {
+  int32 num_rows = NumRows(), num_cols = NumCols();
+  KALDI_ASSERT(sum->Dim() == num_cols && sumsq->Dim() == num_cols);
+  KALDI_ASSERT(weights == NULL || weights->Dim() == num_rows);
+  if (data_ == NULL) return;
+  GlobalHeader *h = reinterpret_cast<GlobalHeader*>(data_);
+  const BaseFloat *w = (weights == NULL ? NULL : weights->Data());
+
+  if (h->format == 1) {
+    PerColHeader *per_col_header = reinterpret_cast<PerColHeader*>(h+1);
+    const unsigned char *byte_data =
+        reinterpret_cast<unsigned char*>(per_col_header + num_cols);
+    // counts[b] is the (weighted) number of times byte b occurs in the
+    // column.
+    std::vector<double> counts(256);
+    for (int32 c = 0; c < num_cols;
+         c++, per_col_header++, byte_data += num_rows) {
+      std::fill(counts.begin(), counts.end(), 0.0);
+      if (w == NULL) {
+        for (int32 r = 0; r < num_rows; r++)
+          counts[byte_data[r]] += 1.0;
+      } else {
+        for (int32 r = 0; r < num_rows; r++)
+          counts[byte_data[r]] += w[r];
+      }
+      float p0 = Uint16ToFloat(*h, per_col_header->percentile_0),
+          p25 = Uint16ToFloat(*h, per_col_header->percentile_25),
+          p75 = Uint16ToFloat(*h, per_col_header->percentile_75),
+          p100 = Uint16ToFloat(*h, per_col_header->percentile_100);
+      double this_sum = 0.0, this_sumsq = 0.0;
+      for (int32 b = 0; b < 256; b++) {
+        if (counts[b] == 0.0) continue;
+        double f = CharToFloat(p0, p25, p75, p100,
+                               static_cast<unsigned char>(b));
+        this_sum += counts[b] * f;
+        this_sumsq += counts[b] * f * f;
+      }
+      (*sum)(c) += this_sum;
+      (*sumsq)(c) += this_sumsq;
+    }
+  } else {
+    KALDI_ASSERT(h->format == 2);  // uint16 format; at most 8 rows.
+    const uint16 *data = reinterpret_cast<uint16*>(h + 1);
+    for (int32 r = 0; r < num_rows; r++) {
+      double weight = (w == NULL ? 1.0 : w[r]);
+      for (int32 c = 0; c < num_cols; c++, data++) {
+        double f = Uint16ToFloat(*h, *data);
+        (*sum)(c) += weight * f;
+        (*sumsq)(c) += weight * f * f;
+      }
+    }
+  }
+}
+
 void CompressedMatrix::Destroy() {
   if (data_ != NULL) {
     delete [] static_cast<float*>(data_);
@@ -109,6 +109,15 @@ class CompressedMatrix {
                  int32 column_offset,
                  MatrixBase<Real> *dest) const;
 
+  /// Adds to (*sum)(c) the sum of the elements of column c, and to
+  /// (*sumsq)(c) the sum of their squares; if weights != NULL, row r is
+  /// weighted by (*weights)(r).  This works on the compressed data: in the
+  /// one-byte format each column has only 256 distinct values, so we count
+  /// how often each occurs and decompress each of them just once.
+  void AddColSumsAndSquares(const VectorBase<BaseFloat> *weights,
+                            VectorBase<double> *sum,
+                            VectorBase<double> *sumsq) const;
+
   void Swap(CompressedMatrix *other) { std::swap(data_, other->data_); }
   
   friend class Matrix<float>;
@@ -0,0 +1,342 @@
+// decoder/ctc-prefix-decoder.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "decoder/ctc-prefix-decoder.h"
+
+namespace eesen {
+
+// The smallest number of nodes at which the prefix tree is garbage collected.
+static const size_t kMinGcThreshold = 16384;
+
+CtcPrefixDecoder::CtcPrefixDecoder(const CtcPrefixDecoderConfig &config):
+    config_(config), lm_(NULL), spellings_(NULL), space_token_(-1),
+    unk_word_(-1), gc_threshold_(0), root_(NULL), num_frames_decoded_(0),
+    decoding_finalized_(false) {
+  config_.Check();
+}
+
+CtcPrefixDecoder::CtcPrefixDecoder(const CtcPrefixDecoderConfig &config,
+                                   fst::DeterministicOnDemandFst<Arc> *lm,
+                                   const SpellingMap *spellings,
+                                   int32 space_token,
+                                   int32 unk_word):
+    config_(config), lm_(lm), spellings_(spellings), space_token_(space_token),
+    unk_word_(unk_word), gc_threshold_(0), root_(NULL),
+    num_frames_decoded_(0), decoding_finalized_(false) {
+  config_.Check();
+  if (spellings_ != NULL) {
+    KALDI_ASSERT(lm_ != NULL && "Spellings are only used with a word LM.");
+    if (space_token_ <= 0 || unk_word_ <= 0)
+      KALDI_ERR << "Decoding with a word LM needs a space token and an "
+                << "unknown word (got " << space_token_ << " and "
+                << unk_word_ << ")";
+  }
+}
+
+CtcPrefixDecoder::PrefixNode *CtcPrefixDecoder::NewNode(PrefixNode *parent,
+                                                        int32 token) {
+  nodes_.resize(nodes_.size() + 1);
+  PrefixNode *node = &(nodes_.back());
+  node->parent = parent;
+  node->token = token;
+  node->word = -1;
+  node->lm_state = (parent != NULL ? parent->lm_state :
+                    (lm_ != NULL ? lm_->Start() : 0));
+  node->lm_cost = (parent != NULL ? parent->lm_cost : 0.0);
+  node->num_symbols = (parent != NULL ? parent->num_symbols : 0);
+  node->word_start = (parent != NULL ? parent->word_start : node);
+  node->log_b = kLogZeroFloat;
+  node->log_nb = kLogZeroFloat;
+  node->next_log_b = kLogZeroFloat;
+  node->next_log_nb = kLogZeroFloat;
+  node->next_frame = -1;
+  node->final_cost = 0.0;
+  node->gc_index = -1;
+  return node;
+}
+
+void CtcPrefixDecoder::InitDecoding() {
+  nodes_.clear();
+  active_.clear();
+  root_ = NewNode(NULL, -1);
+  root_->log_b = 0.0;
+  active_.push_back(root_);
+  gc_threshold_ = kMinGcThreshold;
+  num_frames_decoded_ = 0;
+  decoding_finalized_ = false;
+}
+
+bool CtcPrefixDecoder::ScoreSymbol(StateId lm_state, int32 symbol,
+                                   StateId *next_state, BaseFloat *cost) {
+  Arc arc;
+  if (!lm_->GetArc(lm_state, symbol, &arc))
+    return false;
+  *next_state = arc.nextstate;
+  *cost = arc.weight.Value();
+  return true;
+}
+
+int32 CtcPrefixDecoder::PendingWord(const PrefixNode *node) const {
+  std::vector<int32> spelling;
+  for (const PrefixNode *n = node; n != node->word_start; n = n->parent)
+    spelling.push_back(n->token);
+  if (spelling.empty())
+    return -1;
+  std::reverse(spelling.begin(), spelling.end());
+  SpellingMap::const_iterator iter = spellings_->find(spelling);
+  return (iter == spellings_->end() ? unk_word_ : iter->second);
+}
+
+CtcPrefixDecoder::PrefixNode *CtcPrefixDecoder::Extend(PrefixNode *node,
+                                                       int32 token) {
+  std::vector<std::pair<int32, PrefixNode*> > &children = node->children;
+  for (size_t i = 0; i < children.size(); i++)
+    if (children[i].first == token)
+      return children[i].second;
+
+  PrefixNode *child = NULL;
+  if (lm_ == NULL) {
+    child = NewNode(node, token);
+  } else if (spellings_ == NULL) {
+    // The LM is over tokens.
+    StateId next_state;
+    BaseFloat cost;
+    if (ScoreSymbol(node->lm_state, token, &next_state, &cost)) {
+      child = NewNode(node, token);
+      child->lm_state = next_state;
+      child->lm_cost += cost;
+      child->num_symbols++;
+    }
+  } else if (token != space_token_) {
+    child = NewNode(node, token);
+  } else {
+    // A space ends the word spelled since the previous space (if any).
+    int32 word = PendingWord(node);
+    StateId next_state = node->lm_state;
+    BaseFloat cost = 0.0;
+    if (word == -1 || ScoreSymbol(node->lm_state, word, &next_state, &cost)) {
+      child = NewNode(node, token);
+      child->word_start = child;
+      if (word != -1) {
+        child->word = word;
+        child->lm_state = next_state;
+        child->lm_cost += cost;
+        child->num_symbols++;
+      }
+    }
+  }
+  // We also remember extensions that the LM disallows (child == NULL).
+  children.push_back(std::make_pair(token, child));
+  return child;
+}
+
+void CtcPrefixDecoder::Touch(PrefixNode *node,
+                             std::vector<PrefixNode*> *next_active) {
+  if (node->next_frame != num_frames_decoded_) {
+    node->next_frame = num_frames_decoded_;
+    node->next_log_b = kLogZeroFloat;
+    node->next_log_nb = kLogZeroFloat;
+    next_active->push_back(node);
+  }
+}
+
+namespace {
+struct PrefixScoreGreater {
+  PrefixScoreGreater(const std::vector<BaseFloat> &scores): scores(scores) { }
+  bool operator () (int32 a, int32 b) const { return scores[a] > scores[b]; }
+  const std::vector<BaseFloat> &scores;
+};
+}
+
+void CtcPrefixDecoder::ProcessFrame(const SubVector<BaseFloat> &loglikes) {
+  KALDI_ASSERT(loglikes.Dim() > 1);
+  // The tokens (not blank) close enough to the best on this frame.
+  BaseFloat cutoff = loglikes.Max() - config_.token_beam;
+  tokens_.clear();
+  for (int32 c = 1; c < loglikes.Dim(); c++)
+    if (loglikes(c) >= cutoff)
+      tokens_.push_back(c);
+
+  next_active_.clear();
+  BaseFloat blank_loglike = loglikes(0);
+  for (size_t i = 0; i < active_.size(); i++) {
+    PrefixNode *node = active_[i];
+    BaseFloat log_tot = LogAdd(node->log_b, node->log_nb);
+    // The prefix stays the same if we emit blank, or repeat its last token.
+    Touch(node, &next_active_);
+    node->next_log_b = LogAdd(node->next_log_b, log_tot + blank_loglike);
+    if (node->token > 0)
+      node->next_log_nb = LogAdd(node->next_log_nb,
+                                 node->log_nb + loglikes(node->token));
+    // Otherwise it is extended by a token; a repeat of the last token only
+    // extends it if there was a blank in between.
+    for (size_t j = 0; j < tokens_.size(); j++) {
+      int32 token = tokens_[j];
+      PrefixNode *child = Extend(node, token);
+      if (child == NULL) continue;
+      Touch(child, &next_active_);
+      BaseFloat log_prev = (token == node->token ? node->log_b : log_tot);
+      child->next_log_nb = LogAdd(child->next_log_nb,
+                                  log_prev + loglikes(token));
+    }
+  }
+
+  // Keep the best config_.beam prefixes.
+  std::vector<BaseFloat> scores(next_active_.size());
+  for (size_t i = 0; i < next_active_.size(); i++) {
+    PrefixNode *node = next_active_[i];
+    node->log_b = node->next_log_b;
+    node->log_nb = node->next_log_nb;
+    scores[i] = Score(node);
+  }
+  std::vector<int32> order(next_active_.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  size_t num_keep = std::min<size_t>(config_.beam, order.size());
+  std::partial_sort(order.begin(), order.begin() + num_keep, order.end(),
+                    PrefixScoreGreater(scores));
+  active_.resize(num_keep);
+  for (size_t i = 0; i < num_keep; i++)
+    active_[i] = next_active_[order[i]];
+  num_frames_decoded_++;
+}
+
+void CtcPrefixDecoder::GarbageCollect() {
+  // Mark the active nodes and their ancestors (which include their
+  // word_start nodes); gc_index is -1 for the others.
+  for (size_t i = 0; i < active_.size(); i++)
+    for (PrefixNode *node = active_[i]; node != NULL && node->gc_index != 0;
+         node = node->parent)
+      node->gc_index = 0;
+  // A parent is always created before its children, so numbering the nodes
+  // in order moves each one to the same or an earlier position.
+  typedef std::deque<PrefixNode>::iterator IterType;
+  int32 num_kept = 0;
+  for (IterType iter = nodes_.begin(); iter != nodes_.end(); ++iter)
+    if (iter->gc_index == 0)
+      iter->gc_index = num_kept++;
+  // Point everything at the new positions while the nodes are in place.
+  IterType begin = nodes_.begin();
+  for (IterType iter = nodes_.begin(); iter != nodes_.end(); ++iter) {
+    PrefixNode &node = *iter;
+    if (node.gc_index == -1) continue;
+    if (node.parent != NULL)
+      node.parent = &(begin[node.parent->gc_index]);
+    node.word_start = &(begin[node.word_start->gc_index]);
+    // Forget the pruned extensions; those the LM disallows (NULL) stay.
+    size_t num_children = 0;
+    for (size_t j = 0; j < node.children.size(); j++) {
+      PrefixNode *child = node.children[j].second;
+      if (child != NULL && child->gc_index == -1) continue;
+      node.children[num_children].first = node.children[j].first;
+      node.children[num_children].second =
+          (child == NULL ? NULL : &(begin[child->gc_index]));
+      num_children++;
+    }
+    node.children.resize(num_children);
+  }
+  for (size_t i = 0; i < active_.size(); i++)
+    active_[i] = &(begin[active_[i]->gc_index]);
+  IterType dest = nodes_.begin();
+  for (IterType iter = nodes_.begin(); iter != nodes_.end(); ++iter) {
+    if (iter->gc_index == -1) continue;
+    if (dest != iter) {
+      std::vector<std::pair<int32, PrefixNode*> > children;
+      children.swap(iter->children);
+      *dest = *iter;
+      dest->children.swap(children);
+    }
+    dest->gc_index = -1;
+    ++dest;
+  }
+  nodes_.resize(num_kept);
+  root_ = &(nodes_[0]);
+}
+
+void CtcPrefixDecoder::AdvanceDecoding(const MatrixBase<BaseFloat> &loglikes) {
+  KALDI_ASSERT(root_ != NULL && !decoding_finalized_ &&
+               "You must call InitDecoding() before AdvanceDecoding()");
+  for (int32 t = 0; t < loglikes.NumRows(); t++) {
+    ProcessFrame(loglikes.Row(t));
+    // Collecting when the number of nodes has doubled keeps the cost
+    // proportional to the number of nodes created.
+    if (nodes_.size() >= gc_threshold_) {
+      GarbageCollect();
+      gc_threshold_ = std::max(kMinGcThreshold, 2 * nodes_.size());
+    }
+  }
+}
+
+void CtcPrefixDecoder::FinalizeDecoding() {
+  KALDI_ASSERT(root_ != NULL && !decoding_finalized_);
+  decoding_finalized_ = true;
+  if (lm_ == NULL) return;
+  for (size_t i = 0; i < active_.size(); i++) {
+    PrefixNode *node = active_[i];
+    StateId state = node->lm_state;
+    BaseFloat cost = 0.0;
+    if (spellings_ != NULL) {
+      int32 word = PendingWord(node);
+      if (word != -1) {
+        BaseFloat word_cost;
+        if (!ScoreSymbol(state, word, &state, &word_cost)) {
+          node->final_cost = std::numeric_limits<BaseFloat>::infinity();
+          continue;
+        }
+        cost += word_cost;
+        node->num_symbols++;
+      }
+    }
+    node->final_cost = cost + lm_->Final(state).Value();
+  }
+}
+
+BaseFloat CtcPrefixDecoder::GetBestPath(std::vector<int32> *tokens,
+                                        std::vector<int32> *words) const {
+  KALDI_ASSERT(root_ != NULL);
+  tokens->clear();
+  if (words != NULL) words->clear();
+  const PrefixNode *best = NULL;
+  BaseFloat best_score = kLogZeroFloat;
+  for (size_t i = 0; i < active_.size(); i++) {
+    BaseFloat score = Score(active_[i]);
+    if (best == NULL || score > best_score) {
+      best = active_[i];
+      best_score = score;
+    }
+  }
+  if (best == NULL || best_score == kLogZeroFloat)
+    return kLogZeroFloat;
+
+  for (const PrefixNode *node = best; node != root_; node = node->parent) {
+    tokens->push_back(node->token);
+    if (words != NULL && node->word != -1)
+      words->push_back(node->word);
+  }
+  std::reverse(tokens->begin(), tokens->end());
+  if (words != NULL) {
+    std::reverse(words->begin(), words->end());
+    if (decoding_finalized_ && spellings_ != NULL) {
+      int32 word = PendingWord(best);
+      if (word != -1) words->push_back(word);
+    }
+  }
+  return best_score;
+}
+
+} // end namespace eesen.
@@ -0,0 +1,195 @@
+// decoder/ctc-prefix-decoder.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_CTC_PREFIX_DECODER_H_
+#define KALDI_DECODER_CTC_PREFIX_DECODER_H_
+
+#include <deque>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "cpucompute/matrix-lib.h"
+#include "util/options-itf.h"
+#include "util/stl-utils.h"
+#include "fst/fstlib.h"
+#include "fstext/deterministic-fst.h"
+
+namespace eesen {
+
+struct CtcPrefixDecoderConfig {
+  int32 beam;
+  BaseFloat token_beam;
+  BaseFloat lm_weight;
+  BaseFloat insertion_bonus;
+
+  CtcPrefixDecoderConfig(): beam(16), token_beam(10.0), lm_weight(0.5),
+                            insertion_bonus(0.0) { }
+  void Register(OptionsItf *po) {
+    po->Register("beam", &beam, "Number of prefixes kept after each frame.");
+    po->Register("token-beam", &token_beam, "On each frame, prefixes are only "
+                 "extended by tokens whose log-posterior is within this of the "
+                 "best token on that frame.");
+    po->Register("lm-weight", &lm_weight, "Scale on the language model "
+                 "log-probabilities (only relevant if an LM is given).");
+    po->Register("insertion-bonus", &insertion_bonus, "Bonus added to the score "
+                 "for each LM symbol (word, or token if the LM is over tokens) "
+                 "in the prefix.");
+  }
+  void Check() const {
+    KALDI_ASSERT(beam > 0 && token_beam > 0.0 && lm_weight >= 0.0);
+  }
+};
+
+
+/** CtcPrefixDecoder does CTC prefix beam search directly on the matrix of
+    log-posteriors output by the network, without a decoding graph.  Column 0
+    of the matrix is the blank, and column c > 0 is token c (the numbering of
+    units.txt).  Each prefix (token sequence with repeats and blanks removed)
+    carries the probabilities of all alignments that end in blank and in
+    non-blank, so the search sums over alignments rather than taking the best
+    one.
+
+    A language model can optionally be applied by shallow fusion, in the form
+    of a DeterministicOnDemandFst such as ConstArpaLmDeterministicFst.  There
+    are two ways of using it:
+      - If no spellings are given, the LM is over tokens (e.g. a character
+        n-gram), and it is applied each time a prefix is extended.
+      - If spellings are given, the LM is over words.  The token space_token
+        separates words; when a prefix is extended with it, the tokens since the
+        previous space are looked up in the spellings to get the word id
+        (unk_word for words not in the map), and the word is scored by the LM.
+        This gives open-vocabulary decoding of character models.
+ */
+class CtcPrefixDecoder {
+ public:
+  typedef fst::StdArc Arc;
+  typedef Arc::StateId StateId;
+  typedef Arc::Label Label;
+  typedef unordered_map<std::vector<int32>, int32,
+                        VectorHasher<int32> > SpellingMap;
+
+  /// Decoding without a language model.
+  explicit CtcPrefixDecoder(const CtcPrefixDecoderConfig &config);
+
+  /// Decoding with a language model over tokens (spellings == NULL), or
+  /// over words (see the class comment).  Does not take ownership of the
+  /// pointers.
+  CtcPrefixDecoder(const CtcPrefixDecoderConfig &config,
+                   fst::DeterministicOnDemandFst<Arc> *lm,
+                   const SpellingMap *spellings = NULL,
+                   int32 space_token = -1,
+                   int32 unk_word = -1);
+
+  /// Decodes a whole utterance.
+  void Decode(const MatrixBase<BaseFloat> &loglikes) {
+    InitDecoding();
+    AdvanceDecoding(loglikes);
+    FinalizeDecoding();
+  }
+
+  /// InitDecoding, AdvanceDecoding and FinalizeDecoding allow decoding a chunk
+  /// of frames at a time.
+  void InitDecoding();
+  void AdvanceDecoding(const MatrixBase<BaseFloat> &loglikes);
+  /// Adds the final LM costs (end of the last word and end of sentence).
+  void FinalizeDecoding();
+
+  /// Outputs the tokens of the best prefix, and, if decoding with a word LM,
+  /// its words (for the last word, only if FinalizeDecoding() was called).
+  /// Returns the total score (log-posterior plus weighted LM log-probability
+  /// and bonus).  Returns -infinity if nothing survived.
+  BaseFloat GetBestPath(std::vector<int32> *tokens,
+                        std::vector<int32> *words) const;
+
+  int32 NumFramesDecoded() const { return num_frames_decoded_; }
+
+  ~CtcPrefixDecoder() { }
+
+ private:
+  // One node per distinct prefix; the nodes form a tree (trie).
+  struct PrefixNode {
+    PrefixNode *parent;
+    int32 token;        // last token of the prefix (-1 for the empty prefix)
+    int32 word;         // word completed by this token (word LM only), or -1
+    StateId lm_state;
+    BaseFloat lm_cost;  // accumulated LM cost (negated log-prob), unscaled
+    int32 num_symbols;  // number of words (or tokens) scored by the LM
+    PrefixNode *word_start;  // node of the last space (word LM only)
+    // Log-probabilities of the alignments of this prefix ending in blank and
+    // in non-blank, up to the current frame...
+    BaseFloat log_b, log_nb;
+    // ... and up to the next frame (accumulated while processing a frame).
+    BaseFloat next_log_b, next_log_nb;
+    int32 next_frame;   // the frame for which next_log_{b,nb} are valid.
+    BaseFloat final_cost;  // LM final cost, set by FinalizeDecoding().
+    int32 gc_index;     // used by GarbageCollect().
+    std::vector<std::pair<int32, PrefixNode*> > children;
+  };
+
+  BaseFloat Score(const PrefixNode *node) const {
+    return LogAdd(node->log_b, node->log_nb) +
+        config_.lm_weight * -(node->lm_cost + node->final_cost) +
+        config_.insertion_bonus * node->num_symbols;
+  }
+
+  // Returns the node for "node" extended with "token", creating it and working
+  // out its LM cost if necessary.  Returns NULL if the LM disallows it.
+  PrefixNode *Extend(PrefixNode *node, int32 token);
+
+  // Works out the word spelled by the tokens after word_start and up to and
+  // including "node".  Returns -1 if there are no such tokens.
+  int32 PendingWord(const PrefixNode *node) const;
+
+  // Applies the LM arc for "word" from "lm_state"; returns false if the LM
+  // has no such arc.
+  bool ScoreSymbol(StateId lm_state, int32 symbol, StateId *next_state,
+                   BaseFloat *cost);
+
+  PrefixNode *NewNode(PrefixNode *parent, int32 token);
+
+  // Marks "node" as active on the next frame (resetting its next_log_b and
+  // next_log_nb if it is the first time this frame).
+  void Touch(PrefixNode *node, std::vector<PrefixNode*> *next_active);
+
+  void ProcessFrame(const SubVector<BaseFloat> &loglikes);
+
+  // Removes the nodes of prefixes that are no longer in the beam and are not
+  // prefixes of those that are, renumbering the rest so that nodes_ stays
+  // contiguous.
+  void GarbageCollect();
+
+  CtcPrefixDecoderConfig config_;
+  fst::DeterministicOnDemandFst<Arc> *lm_;
+  const SpellingMap *spellings_;
+  int32 space_token_;
+  int32 unk_word_;
+
+  std::deque<PrefixNode> nodes_;  // owns the nodes; deque keeps them in place.
+  size_t gc_threshold_;  // GarbageCollect() when nodes_ reaches this size.
+  PrefixNode *root_;
+  std::vector<PrefixNode*> active_;  // prefixes in the beam
+  std::vector<PrefixNode*> next_active_;  // temporary
+  std::vector<int32> tokens_;  // temporary, tokens surviving the token beam.
+  int32 num_frames_decoded_;
+  bool decoding_finalized_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CtcPrefixDecoder);
+};
+
+} // end namespace eesen.
+
+#endif
@@ -61,6 +61,123 @@ class DecodableMatrixScaled: public DecodableInterface {
   KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableMatrixScaled);
 };
 
+/// This is a version of DecodableMatrixScaled for CTC models that collapses
+/// each run of consecutive frames dominated by blank into a single frame, so
+/// the decoder does not have to expand the blank self-loops of the token FST
+/// on every one of them.  A frame is "blank-dominated" if the posterior of the
+/// blank (column blank_index, renormalized over the row so it works for
+/// log-posteriors as well as for prior-scaled log-likelihoods) is at least
+/// blank_threshold.  The log-likelihood of a collapsed frame is the sum over
+/// the frames it stands for, so a path that stays on one token through the run
+/// gets exactly the score it would get without collapsing.  Runs are collapsed
+/// rather than dropped so that the blank separating two repeated tokens is
+/// kept.  FrameLengths() says how many input frames each decoded frame stands
+/// for; use it with ExpandLatticeFrames() or ExpandCompactLatticeFrames() to
+/// map the output back to the original frame rate (e.g. for nbest-to-ctm).
+/// A blank_threshold of 1.0 or more disables collapsing.
+class DecodableMatrixScaledCollapsed: public DecodableInterface {
+ public:
+  DecodableMatrixScaledCollapsed(const Matrix<BaseFloat> &likes,
+                                 BaseFloat scale,
+                                 BaseFloat blank_threshold,
+                                 int32 blank_index = 0): scale_(scale) {
+    KALDI_ASSERT(blank_index >= 0 && blank_index < likes.NumCols() &&
+                 blank_threshold > 0.0);
+    int32 num_frames = likes.NumRows();
+    std::vector<bool> is_blank(num_frames, false);
+    for (int32 t = 0; t < num_frames && blank_threshold < 1.0; t++) {
+      SubVector<BaseFloat> row(likes, t);
+      BaseFloat blank_logprob = row(blank_index) - row.LogSumExp();
+      is_blank[t] = (blank_logprob >= Log(blank_threshold));
+    }
+    for (int32 t = 0; t < num_frames; t++) {
+      if (t > 0 && is_blank[t] && is_blank[t-1]) frame_lengths_.back()++;
+      else frame_lengths_.push_back(1);
+    }
+    likes_.Resize(frame_lengths_.size(), likes.NumCols());
+    for (int32 f = 0, t = 0; f < static_cast<int32>(frame_lengths_.size());
+         f++) {
+      for (int32 i = 0; i < frame_lengths_[f]; i++, t++)
+        likes_.Row(f).AddVec(1.0, likes.Row(t));
+    }
+  }
+
+  virtual int32 NumFramesReady() const { return likes_.NumRows(); }
+
+  virtual bool IsLastFrame(int32 frame) const {
+    KALDI_ASSERT(frame < NumFramesReady());
+    return (frame == NumFramesReady() - 1);
+  }
+
+  virtual BaseFloat LogLikelihood(int32 frame, int32 tid) {
+    return scale_ * likes_(frame, tid-1);
+  }
+
+  virtual int32 NumIndices() const { return likes_.NumCols(); }
+
+  /// For each decoded frame, the number of input frames it stands for.
+  const std::vector<int32> &FrameLengths() const { return frame_lengths_; }
+
+ private:
+  Matrix<BaseFloat> likes_;  // one (summed) row per collapsed frame.
+  std::vector<int32> frame_lengths_;
+  BaseFloat scale_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableMatrixScaledCollapsed);
+};
+
+/// This is the online version of DecodableMatrixScaled: the log-likelihoods
+/// arrive a chunk at a time through AcceptLoglikes(), e.g. as the network
+/// output for a piece of audio becomes available.  NumFramesReady() returns the
+/// number of frames received so far, and IsLastFrame() only returns true once
+/// InputFinished() has been called.  Token ids are shifted by one as in
+/// DecodableMatrixScaled.
+class DecodableMatrixScaledOnline: public DecodableInterface {
+ public:
+  explicit DecodableMatrixScaledOnline(BaseFloat scale):
+      num_frames_(0), scale_(scale), input_finished_(false) { }
+
+  /// Appends a chunk of log-likelihoods (one row per frame).
+  void AcceptLoglikes(const MatrixBase<BaseFloat> &loglikes) {
+    KALDI_ASSERT(!input_finished_);
+    if (loglikes.NumRows() == 0) return;
+    if (num_frames_ == 0 && likes_.NumRows() == 0)
+      likes_.Resize(std::max<int32>(loglikes.NumRows(), 100),
+                    loglikes.NumCols(), kUndefined);
+    KALDI_ASSERT(loglikes.NumCols() == likes_.NumCols());
+    int32 needed = num_frames_ + loglikes.NumRows();
+    if (needed > likes_.NumRows())  // grow geometrically to keep appends cheap.
+      likes_.Resize(std::max(needed, 2 * likes_.NumRows()), likes_.NumCols(),
+                    kCopyData);
+    likes_.RowRange(num_frames_, loglikes.NumRows()).CopyFromMat(loglikes);
+    num_frames_ = needed;
+  }
+
+  /// Call this once no more log-likelihoods will arrive.
+  void InputFinished() { input_finished_ = true; }
+
+  virtual int32 NumFramesReady() const { return num_frames_; }
+
+  virtual bool IsLastFrame(int32 frame) const {
+    KALDI_ASSERT(frame < NumFramesReady());
+    return input_finished_ && (frame == NumFramesReady() - 1);
+  }
+
+  virtual BaseFloat LogLikelihood(int32 frame, int32 tid) {
+    KALDI_ASSERT(frame < num_frames_);
+    return scale_ * likes_(frame, tid-1);
+  }
+
+  virtual int32 NumIndices() const { return likes_.NumCols(); }
+
+ private:
+  Matrix<BaseFloat> likes_;  // has spare rows at the end; only the first
+                             // num_frames_ rows are valid.
+  int32 num_frames_;
+  BaseFloat scale_;
+  bool input_finished_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableMatrixScaledOnline);
+};
+
 
 }  // namespace eesen
 
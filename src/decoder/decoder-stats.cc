@@ -0,0 +1,220 @@
+// decoder/decoder-stats.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+
+#include "decoder/decoder-stats.h"
+
+namespace eesen {
+
+void DecoderStats::Reset() {
+  num_utterances = 0;
+  num_frames = 0;
+  frame_active_tokens.clear();
+  frame_arcs.clear();
+  active_tokens_hist.clear();
+  arcs_hist.clear();
+  num_emitting_arcs = 0;
+  num_nonemitting_arcs = 0;
+  num_max_active_cutoffs = 0;
+  num_min_active_cutoffs = 0;
+  num_prune_calls = 0;
+  num_beam_decreases = 0;
+  num_beam_increases = 0;
+  tot_beam = 0.0;
+  raw_lattice_states = 0;
+  raw_lattice_arcs = 0;
+  det_lattice_states = 0;
+  det_lattice_arcs = 0;
+  emitting_time = 0.0;
+  nonemitting_time = 0.0;
+  prune_time = 0.0;
+  determinize_time = 0.0;
+}
+
+// static
+void DecoderStats::AddToHist(int32 value, std::vector<int64> *hist) {
+  // bucket 0 is for 0, bucket b > 0 for 2^(b-1) <= value < 2^b.
+  size_t bucket = 0;
+  while (value > 0) {
+    bucket++;
+    value >>= 1;
+  }
+  if (hist->size() <= bucket) hist->resize(bucket + 1, 0);
+  (*hist)[bucket]++;
+}
+
+void DecoderStats::AddFrame(int32 num_active_tokens, int32 num_arcs) {
+  num_frames++;
+  frame_active_tokens.push_back(num_active_tokens);
+  frame_arcs.push_back(num_arcs);
+  AddToHist(num_active_tokens, &active_tokens_hist);
+  AddToHist(num_arcs, &arcs_hist);
+}
+
+static void AddHist(const std::vector<int64> &src, std::vector<int64> *dest) {
+  if (dest->size() < src.size()) dest->resize(src.size(), 0);
+  for (size_t i = 0; i < src.size(); i++)
+    (*dest)[i] += src[i];
+}
+
+void DecoderStats::Add(const DecoderStats &other) {
+  num_utterances += other.num_utterances;
+  num_frames += other.num_frames;
+  AddHist(other.active_tokens_hist, &active_tokens_hist);
+  AddHist(other.arcs_hist, &arcs_hist);
+  num_emitting_arcs += other.num_emitting_arcs;
+  num_nonemitting_arcs += other.num_nonemitting_arcs;
+  num_max_active_cutoffs += other.num_max_active_cutoffs;
+  num_min_active_cutoffs += other.num_min_active_cutoffs;
+  num_prune_calls += other.num_prune_calls;
+  num_beam_decreases += other.num_beam_decreases;
+  num_beam_increases += other.num_beam_increases;
+  tot_beam += other.tot_beam;
+  raw_lattice_states += other.raw_lattice_states;
+  raw_lattice_arcs += other.raw_lattice_arcs;
+  det_lattice_states += other.det_lattice_states;
+  det_lattice_arcs += other.det_lattice_arcs;
+  emitting_time += other.emitting_time;
+  nonemitting_time += other.nonemitting_time;
+  prune_time += other.prune_time;
+  determinize_time += other.determinize_time;
+}
+
+static void PrintHist(const std::vector<int64> &hist, std::ostream &os) {
+  int64 total = 0;
+  for (size_t i = 0; i < hist.size(); i++) total += hist[i];
+  for (size_t i = 0; i < hist.size(); i++) {
+    if (hist[i] == 0) continue;
+    if (i == 0) os << "  0";
+    else if (i == 1) os << "  1";
+    else os << "  " << (1 << (i - 1)) << '-' << ((1 << i) - 1);
+    os << ": " << hist[i] << " (" << (100.0 * hist[i] / total) << "%)\n";
+  }
+}
+
+std::string DecoderStats::Info() const {
+  std::ostringstream os;
+  int32 num_frames_safe = std::max<int32>(num_frames, 1);
+  os << num_frames << " frames";
+  if (num_utterances > 0) os << " in " << num_utterances << " utterances";
+  os << ".\nArcs expanded per frame: "
+     << (num_emitting_arcs / static_cast<double>(num_frames_safe))
+     << " emitting, "
+     << (num_nonemitting_arcs / static_cast<double>(num_frames_safe))
+     << " nonemitting.\n"
+     << "Cutoff set by max-active on " << num_max_active_cutoffs
+     << " frames, by min-active on " << num_min_active_cutoffs
+     << " frames; " << num_prune_calls << " calls to lattice pruning.\n";
+  if (tot_beam > 0.0)
+    os << "Average beam " << (tot_beam / num_frames_safe) << "; scaled down "
+       << num_beam_decreases << " times and up " << num_beam_increases
+       << " times.\n";
+  if (raw_lattice_states > 0)
+    os << "Lattice size: raw " << raw_lattice_states << " states, "
+       << raw_lattice_arcs << " arcs; determinized " << det_lattice_states
+       << " states, " << det_lattice_arcs << " arcs.\n";
+  os << "Time (s): emitting " << emitting_time << ", nonemitting "
+     << nonemitting_time << ", pruning " << prune_time << ", determinization "
+     << determinize_time << ".\n";
+  os << "Frames by number of active tokens:\n";
+  PrintHist(active_tokens_hist, os);
+  os << "Frames by number of arcs expanded:\n";
+  PrintHist(arcs_hist, os);
+  return os.str();
+}
+
+void DecoderStats::Write(std::ostream &os, bool binary) const {
+  WriteToken(os, binary, "<DecoderStats>");
+  WriteToken(os, binary, "<NumUtterances>");
+  WriteBasicType(os, binary, num_utterances);
+  WriteToken(os, binary, "<NumFrames>");
+  WriteBasicType(os, binary, num_frames);
+  WriteToken(os, binary, "<FrameActiveTokens>");
+  WriteIntegerVector(os, binary, frame_active_tokens);
+  WriteToken(os, binary, "<FrameArcs>");
+  WriteIntegerVector(os, binary, frame_arcs);
+  WriteToken(os, binary, "<ActiveTokensHist>");
+  WriteIntegerVector(os, binary, active_tokens_hist);
+  WriteToken(os, binary, "<ArcsHist>");
+  WriteIntegerVector(os, binary, arcs_hist);
+  WriteToken(os, binary, "<Arcs>");
+  WriteBasicType(os, binary, num_emitting_arcs);
+  WriteBasicType(os, binary, num_nonemitting_arcs);
+  WriteToken(os, binary, "<Cutoffs>");
+  WriteBasicType(os, binary, num_max_active_cutoffs);
+  WriteBasicType(os, binary, num_min_active_cutoffs);
+  WriteToken(os, binary, "<PruneCalls>");
+  WriteBasicType(os, binary, num_prune_calls);
+  WriteToken(os, binary, "<BeamAdjustments>");
+  WriteBasicType(os, binary, num_beam_decreases);
+  WriteBasicType(os, binary, num_beam_increases);
+  WriteBasicType(os, binary, tot_beam);
+  WriteToken(os, binary, "<LatticeSize>");
+  WriteBasicType(os, binary, raw_lattice_states);
+  WriteBasicType(os, binary, raw_lattice_arcs);
+  WriteBasicType(os, binary, det_lattice_states);
+  WriteBasicType(os, binary, det_lattice_arcs);
+  WriteToken(os, binary, "<Time>");
+  WriteBasicType(os, binary, emitting_time);
+  WriteBasicType(os, binary, nonemitting_time);
+  WriteBasicType(os, binary, prune_time);
+  WriteBasicType(os, binary, determinize_time);
+  WriteToken(os, binary, "</DecoderStats>");
+  if (!binary) os << '\n';
+}
+
+void DecoderStats::Read(std::istream &is, bool binary) {
+  ExpectToken(is, binary, "<DecoderStats>");
+  ExpectToken(is, binary, "<NumUtterances>");
+  ReadBasicType(is, binary, &num_utterances);
+  ExpectToken(is, binary, "<NumFrames>");
+  ReadBasicType(is, binary, &num_frames);
+  ExpectToken(is, binary, "<FrameActiveTokens>");
+  ReadIntegerVector(is, binary, &frame_active_tokens);
+  ExpectToken(is, binary, "<FrameArcs>");
+  ReadIntegerVector(is, binary, &frame_arcs);
+  ExpectToken(is, binary, "<ActiveTokensHist>");
+  ReadIntegerVector(is, binary, &active_tokens_hist);
+  ExpectToken(is, binary, "<ArcsHist>");
+  ReadIntegerVector(is, binary, &arcs_hist);
+  ExpectToken(is, binary, "<Arcs>");
+  ReadBasicType(is, binary, &num_emitting_arcs);
+  ReadBasicType(is, binary, &num_nonemitting_arcs);
+  ExpectToken(is, binary, "<Cutoffs>");
+  ReadBasicType(is, binary, &num_max_active_cutoffs);
+  ReadBasicType(is, binary, &num_min_active_cutoffs);
+  ExpectToken(is, binary, "<PruneCalls>");
+  ReadBasicType(is, binary, &num_prune_calls);
+  ExpectToken(is, binary, "<BeamAdjustments>");
+  ReadBasicType(is, binary, &num_beam_decreases);
+  ReadBasicType(is, binary, &num_beam_increases);
+  ReadBasicType(is, binary, &tot_beam);
+  ExpectToken(is, binary, "<LatticeSize>");
+  ReadBasicType(is, binary, &raw_lattice_states);
+  ReadBasicType(is, binary, &raw_lattice_arcs);
+  ReadBasicType(is, binary, &det_lattice_states);
+  ReadBasicType(is, binary, &det_lattice_arcs);
+  ExpectToken(is, binary, "<Time>");
+  ReadBasicType(is, binary, &emitting_time);
+  ReadBasicType(is, binary, &nonemitting_time);
+  ReadBasicType(is, binary, &prune_time);
+  ReadBasicType(is, binary, &determinize_time);
+  ExpectToken(is, binary, "</DecoderStats>");
+}
+
+}  // namespace eesen
@@ -0,0 +1,106 @@
+// decoder/decoder-stats.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_DECODER_STATS_H_
+#define KALDI_DECODER_DECODER_STATS_H_
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/kaldi-holder.h"
+#include "util/kaldi-table.h"
+
+namespace eesen {
+
+/**
+   DecoderStats describes the search effort of a decoder, so that beam,
+   max-active and so on can be tuned by looking at where the time goes.  A
+   decoder fills it in if you give it one with SetStats(); it is reset by
+   InitDecoding(), so after an utterance it holds the stats of that
+   utterance, which can be written to a table (e.g. with --stats-wspecifier)
+   and added to a total with Add().
+
+   The per-frame vectors are only kept for single utterances (Add() does not
+   append them); the histograms, which count frames by their number of
+   active tokens or arcs in buckets 0, 1, 2-3, 4-7, 8-15, ..., are kept for
+   the total as well.
+*/
+struct DecoderStats {
+  int32 num_utterances;  // 1 for the stats of an utterance.
+  int32 num_frames;
+  // For each frame: the number of tokens active on the previous frame before
+  // pruning with the beam, and the number of emitting arcs expanded.
+  std::vector<int32> frame_active_tokens;
+  std::vector<int32> frame_arcs;
+  std::vector<int64> active_tokens_hist;
+  std::vector<int64> arcs_hist;
+
+  int64 num_emitting_arcs;     // arcs expanded in ProcessEmitting().
+  int64 num_nonemitting_arcs;  // arcs expanded in ProcessNonemitting().
+  // Number of frames on which max_active (resp. min_active) decided the
+  // cutoff, instead of the beam.
+  int32 num_max_active_cutoffs;
+  int32 num_min_active_cutoffs;
+  int32 num_prune_calls;  // calls to the lattice pruning (PruneActiveTokens).
+
+  // Adjustments of the beam for --target-rtf (LatticeFasterDecoder only):
+  // how often it was scaled down and up, and the sum over frames of the beam
+  // used, to get the average.
+  int32 num_beam_decreases;
+  int32 num_beam_increases;
+  double tot_beam;
+
+  // Lattice sizes (LatticeFasterDecoder only).  With incremental
+  // determinization the raw sizes are summed over the chunks.
+  int64 raw_lattice_states, raw_lattice_arcs;
+  int64 det_lattice_states, det_lattice_arcs;
+
+  // Time in seconds spent in each phase.
+  double emitting_time;
+  double nonemitting_time;
+  double prune_time;
+  double determinize_time;
+
+  DecoderStats() { Reset(); }
+
+  void Reset();
+
+  /// Records the number of active tokens and arcs expanded on a frame.
+  void AddFrame(int32 num_active_tokens, int32 num_arcs);
+
+  /// Adds the stats of "other" (e.g. of an utterance) to these, except for
+  /// the per-frame vectors.
+  void Add(const DecoderStats &other);
+
+  /// Returns a human-readable summary, including the histograms.
+  std::string Info() const;
+
+  void Write(std::ostream &os, bool binary) const;
+  void Read(std::istream &is, bool binary);
+
+ private:
+  static void AddToHist(int32 value, std::vector<int64> *hist);
+};
+
+typedef TableWriter<KaldiObjectHolder<DecoderStats> > DecoderStatsWriter;
+typedef SequentialTableReader<KaldiObjectHolder<DecoderStats> >
+    SequentialDecoderStatsReader;
+
+}  // namespace eesen
+
+#endif  // KALDI_DECODER_DECODER_STATS_H_
@@ -19,6 +19,7 @@
 
 #include "decoder/decoder-wrappers.h"
 #include "decoder/faster-decoder.h"
+#include "lat/lattice-functions.h"
 
 namespace eesen {
 
@@ -34,13 +35,34 @@ bool DecodeUtteranceLatticeFaster(
     Int32VectorWriter *words_writer,
     CompactLatticeWriter *compact_lattice_writer,
     LatticeWriter *lattice_writer,
-    double *like_ptr) { // puts utterance's like in like_ptr on success.
-  using fst::VectorFst;
-
+    double *like_ptr, // puts utterance's like in like_ptr on success.
+    const std::vector<int32> *frame_lengths) {
   if (!decoder.Decode(&decodable)) {
     KALDI_WARN << "Failed to decode file " << utt;
     return false;
   }
+  return OutputUtteranceLatticeFaster(decoder, word_syms, utt, acoustic_scale,
+                                      determinize, allow_partial,
+                                      alignment_writer, words_writer,
+                                      compact_lattice_writer, lattice_writer,
+                                      like_ptr, frame_lengths);
+}
+
+bool OutputUtteranceLatticeFaster(
+    LatticeFasterDecoder &decoder, // not const but is really an input.
+    const fst::SymbolTable *word_syms,
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    bool allow_partial,
+    Int32VectorWriter *alignment_writer,
+    Int32VectorWriter *words_writer,
+    CompactLatticeWriter *compact_lattice_writer,
+    LatticeWriter *lattice_writer,
+    double *like_ptr,
+    const std::vector<int32> *frame_lengths) {
+  using fst::VectorFst;
+
   if (!decoder.ReachedFinal()) {
     if (allow_partial) {
       KALDI_WARN << "Outputting partial output for utterance " << utt
@@ -65,6 +87,12 @@ bool DecodeUtteranceLatticeFaster(
     std::vector<int32> alignment;
     std::vector<int32> words;
     GetLinearSymbolSequence(decoded, &alignment, &words, &weight);
+    if (frame_lengths != NULL) {  // map back to the original frames.
+      std::vector<int32> collapsed(alignment);
+      alignment.clear();
+      for (size_t i = 0; i < collapsed.size(); i++)
+        alignment.insert(alignment.end(), (*frame_lengths)[i], collapsed[i]);
+    }
     num_frames = alignment.size();
     if (words_writer->IsOpen())
       words_writer->Write(utt, words);
@@ -83,26 +111,35 @@ bool DecodeUtteranceLatticeFaster(
     likelihood = -(weight.Value1() + weight.Value2());
   }
 
-  // Get lattice, and do determinization if requested.
-  Lattice lat;
-  decoder.GetRawLattice(&lat);
-  if (lat.NumStates() == 0)
-    KALDI_ERR << "Unexpected problem getting lattice for utterance " << utt;
-  fst::Connect(&lat);
+  // Get lattice, and do determinization if requested.  With
+  // --determinize-period the decoder has determinized most of it already.
   if (determinize) {
     CompactLattice clat;
-    if (!DeterminizeLatticePhonePrunedWrapper(
-            &lat,
-            decoder.GetOptions().lattice_beam,
-            &clat,
-            decoder.GetOptions().det_opts))
+    if (!decoder.GetDeterminizedLattice(&clat)) {
+      if (clat.NumStates() == 0)
+        KALDI_ERR << "Unexpected problem getting lattice for utterance "
+                  << utt;
       KALDI_WARN << "Determinization finished earlier than the beam for "
                  << "utterance " << utt;
+    }
+    if (frame_lengths != NULL) {
+      TopSortCompactLatticeIfNeeded(&clat);
+      ExpandCompactLatticeFrames(*frame_lengths, &clat);
+    }
     // We'll write the lattice without acoustic scaling.
     if (acoustic_scale != 0.0)
       fst::ScaleLattice(fst::AcousticLatticeScale(1.0 / acoustic_scale), &clat);
     compact_lattice_writer->Write(utt, clat);
   } else {
+    Lattice lat;
+    decoder.GetRawLattice(&lat);
+    if (lat.NumStates() == 0)
+      KALDI_ERR << "Unexpected problem getting lattice for utterance " << utt;
+    fst::Connect(&lat);
+    if (frame_lengths != NULL) {
+      TopSortLatticeIfNeeded(&lat);
+      ExpandLatticeFrames(*frame_lengths, &lat);
+    }
     // We'll write the lattice without acoustic scaling.
     if (acoustic_scale != 0.0)
       fst::ScaleLattice(fst::AcousticLatticeScale(1.0 / acoustic_scale), &lat);
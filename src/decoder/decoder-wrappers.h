@@ -41,7 +41,29 @@ bool DecodeUtteranceLatticeFaster(
     Int32VectorWriter *words_writer,
     CompactLatticeWriter *compact_lattice_writer,
     LatticeWriter *lattice_writer,
-    double *like_ptr);
+    double *like_ptr,
+    const std::vector<int32> *frame_lengths = NULL);
+
+/// This is the second half of DecodeUtteranceLatticeFaster(): it writes out
+/// the best path and the lattice of an utterance that has already been
+/// decoded, e.g. by calling InitDecoding(), AdvanceDecoding() and
+/// FinalizeDecoding() as online decoding does.
+/// If frame_lengths is non-NULL, the utterance was decoded with collapsed
+/// frames (see DecodableMatrixScaledCollapsed) and the alignment and lattice
+/// are expanded back to the original frames before being written.
+bool OutputUtteranceLatticeFaster(
+    LatticeFasterDecoder &decoder, // not const but is really an input.
+    const fst::SymbolTable *word_syms,
+    std::string utt,
+    double acoustic_scale,
+    bool determinize,
+    bool allow_partial,
+    Int32VectorWriter *alignments_writer,
+    Int32VectorWriter *words_writer,
+    CompactLatticeWriter *compact_lattice_writer,
+    LatticeWriter *lattice_writer,
+    double *like_ptr,
+    const std::vector<int32> *frame_lengths = NULL);
 
 } // end namespace eesen.
 
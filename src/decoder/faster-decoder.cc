@@ -25,7 +25,7 @@ namespace eesen {
 
 FasterDecoder::FasterDecoder(const fst::Fst<fst::StdArc> &fst,
                              const FasterDecoderOptions &opts):
-    fst_(fst), config_(opts), num_frames_decoded_(-1) {
+    fst_(fst), config_(opts), num_frames_decoded_(-1), stats_(NULL) {
   KALDI_ASSERT(config_.hash_ratio >= 1.0);  // less doesn't make much sense.
   KALDI_ASSERT(config_.max_active > 1);
   KALDI_ASSERT(config_.min_active >= 0 && config_.min_active < config_.max_active);
@@ -36,6 +36,10 @@ FasterDecoder::FasterDecoder(const fst::Fst<fst::StdArc> &fst,
 void FasterDecoder::InitDecoding() {
   // clean up from last time:
   ClearToks(toks_.Clear());
+  if (stats_ != NULL) {
+    stats_->Reset();
+    stats_->num_utterances = 1;
+  }
   StateId start_state = fst_.Start();
   KALDI_ASSERT(start_state != fst::kNoStateId);
   Arc dummy_arc(0, 0, Weight::One(), start_state);
@@ -198,10 +202,12 @@ double FasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
     }
 
     if (max_active_cutoff < beam_cutoff) { // max_active is tighter than beam.
+      if (stats_ != NULL) stats_->num_max_active_cutoffs++;
       if (adaptive_beam)
         *adaptive_beam = max_active_cutoff - best_cost + config_.beam_delta;
       return max_active_cutoff;
     } else if (min_active_cutoff > beam_cutoff) { // min_active is looser than beam.
+      if (stats_ != NULL) stats_->num_min_active_cutoffs++;
       if (adaptive_beam)
         *adaptive_beam = min_active_cutoff - best_cost + config_.beam_delta;
       return min_active_cutoff;
@@ -223,6 +229,7 @@ void FasterDecoder::PossiblyResizeHash(size_t num_toks) {
 // ProcessEmitting returns the likelihood cutoff used.
 double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   int32 frame = num_frames_decoded_;
+  if (stats_ != NULL) stats_timer_.Reset();
   Elem *last_toks = toks_.Clear();
   size_t tok_cnt;
   BaseFloat adaptive_beam;
@@ -256,6 +263,7 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   }
 
   // int32 n = 0, np = 0;
+  int32 num_arcs = 0;  // for stats_.
 
   // the tokens are now owned here, in last_toks, and the hash is empty.
   // 'owned' is a complex thing here; the point is we need to call TokenDelete
@@ -273,6 +281,7 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
            aiter.Next()) {
         Arc arc = aiter.Value();
         if (arc.ilabel != 0) {  // propagate..
+          num_arcs++;
           BaseFloat ac_cost =  - decodable->LogLikelihood(frame, arc.ilabel);
           double new_weight = arc.weight.Value() + tok->cost_ + ac_cost;
           if (new_weight < next_weight_cutoff) {  // not pruned..
@@ -299,6 +308,11 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
     toks_.Delete(e);
   }
   num_frames_decoded_++;
+  if (stats_ != NULL) {
+    stats_->AddFrame(tok_cnt, num_arcs);
+    stats_->num_emitting_arcs += num_arcs;
+    stats_->emitting_time += stats_timer_.Elapsed();
+  }
   return next_weight_cutoff;
 }
 
@@ -306,6 +320,8 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
 void FasterDecoder::ProcessNonemitting(double cutoff) {
   // Processes nonemitting arcs for one frame. 
   KALDI_ASSERT(queue_.empty());
+  if (stats_ != NULL) stats_timer_.Reset();
+  int32 num_arcs = 0;  // for stats_.
   for (const Elem *e = toks_.GetList(); e != NULL;  e = e->tail)
     queue_.push_back(e->key);
   while (!queue_.empty()) {
@@ -322,6 +338,7 @@ void FasterDecoder::ProcessNonemitting(double cutoff) {
          aiter.Next()) {
       const Arc &arc = aiter.Value();
       if (arc.ilabel == 0) {  // propagate nonemitting only...
+        num_arcs++;
         Token *new_tok = new Token(arc, tok);
         if (new_tok->cost_ > cutoff) {  // prune
           Token::TokenDelete(new_tok);
@@ -343,6 +360,10 @@ void FasterDecoder::ProcessNonemitting(double cutoff) {
       }
     }
   }
+  if (stats_ != NULL) {
+    stats_->num_nonemitting_arcs += num_arcs;
+    stats_->nonemitting_time += stats_timer_.Elapsed();
+  }
 }
 
 void FasterDecoder::ClearToks(Elem *list) {
@@ -21,11 +21,13 @@
 #ifndef KALDI_DECODER_FASTER_DECODER_H_
 #define KALDI_DECODER_FASTER_DECODER_H_
 
+#include "base/timer.h"
 #include "util/stl-utils.h"
 #include "util/options-itf.h"
 #include "util/hash-list.h"
 #include "fst/fstlib.h"
 #include "decoder/decodable-itf.h"
+#include "decoder/decoder-stats.h"
 #include "lat/kaldi-lattice.h" // for CompactLatticeArc
 
 namespace eesen {
@@ -69,6 +71,11 @@ class FasterDecoder {
                 const FasterDecoderOptions &config);
 
   void SetOptions(const FasterDecoderOptions &config) { config_ = config; }
+
+  /// If "stats" is non-NULL, the decoder records statistics about the search
+  /// in it (see DecoderStats); it is reset by InitDecoding().  We don't take
+  /// ownership.
+  void SetStats(DecoderStats *stats) { stats_ = stats; }
   
   ~FasterDecoder() { ClearToks(toks_.Clear()); }
 
@@ -176,6 +183,11 @@ class FasterDecoder {
   // Keep track of the number of frames decoded in the current file.
   int32 num_frames_decoded_;
 
+  // Statistics, if requested with SetStats(); not owned here.
+  DecoderStats *stats_;
+  // Times the phases for stats_.
+  Timer stats_timer_;
+
   // It might seem unclear why we call ClearToks(toks_.Clear()).
   // There are two separate cleanup tasks we need to do at when we start a new file.
   // one is to delete the Token objects in the list; the other is to delete
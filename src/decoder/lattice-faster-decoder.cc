@@ -26,22 +26,44 @@
 
 #include "decoder/lattice-faster-decoder.h"
 #include "lat/lattice-functions.h"
+#include "lat/minimize-lattice.h"
+#include "lat/push-lattice.h"
 
 namespace eesen {
 
 // instantiate this class once for each thing you have to decode.
 LatticeFasterDecoder::LatticeFasterDecoder(const fst::Fst<fst::StdArc> &fst,
                                            const LatticeFasterDecoderConfig &config):
-    fst_(fst), delete_fst_(false), config_(config), num_toks_(0) {
+    fst_(fst), delete_fst_(false), lm_diff_fst_(NULL), config_(config),
+    num_toks_(0), determinizer_(config.lattice_beam, config.det_opts),
+    stats_(NULL) {
   config.Check();
+  SetBeamScale(1.0);
   toks_.SetSize(1000);  // just so on the first frame we do something reasonable.
 }
 
 
 LatticeFasterDecoder::LatticeFasterDecoder(const LatticeFasterDecoderConfig &config,
                                            fst::Fst<fst::StdArc> *fst):
-    fst_(*fst), delete_fst_(true), config_(config), num_toks_(0) {
+    fst_(*fst), delete_fst_(true), lm_diff_fst_(NULL), config_(config),
+    num_toks_(0), determinizer_(config.lattice_beam, config.det_opts),
+    stats_(NULL) {
   config.Check();
+  SetBeamScale(1.0);
+  toks_.SetSize(1000);  // just so on the first frame we do something reasonable.
+}
+
+
+LatticeFasterDecoder::LatticeFasterDecoder(
+    const fst::Fst<fst::StdArc> &fst,
+    const LatticeFasterDecoderConfig &config,
+    fst::DeterministicOnDemandFst<fst::StdArc> *lm_diff_fst):
+    fst_(fst), delete_fst_(false), lm_diff_fst_(lm_diff_fst), config_(config),
+    num_toks_(0), determinizer_(config.lattice_beam, config.det_opts),
+    stats_(NULL) {
+  config.Check();
+  KALDI_ASSERT(lm_diff_fst != NULL);
+  SetBeamScale(1.0);
   toks_.SetSize(1000);  // just so on the first frame we do something reasonable.
 }
 
@@ -58,15 +80,30 @@ void LatticeFasterDecoder::InitDecoding() {
   cost_offsets_.clear();
   ClearActiveTokens();
   warned_ = false;
+  warned_noarc_ = false;
   num_toks_ = 0;
   decoding_finalized_ = false;
   final_costs_.clear();
+  determinizer_.Init();
+  num_frames_determinized_ = 0;
+  token2label_.clear();
+  determinize_ok_ = true;
+  determinized_all_ = false;
+  SetBeamScale(1.0);
+  rtf_time_ = 0.0;
+  rtf_num_frames_ = 0;
+  if (stats_ != NULL) {
+    stats_->Reset();
+    stats_->num_utterances = 1;
+  }
   StateId start_state = fst_.Start();
   KALDI_ASSERT(start_state != fst::kNoStateId);
   active_toks_.resize(1);
-  Token *start_tok = new Token(0.0, 0.0, NULL, NULL);
+  Token *start_tok = new Token(0.0, 0.0, NULL, NULL, NULL);
   active_toks_[0].toks = start_tok;
-  toks_.Insert(start_state, start_tok);
+  StateId lm_start_state = (lm_diff_fst_ != NULL ? lm_diff_fst_->Start() : 0);
+  KALDI_ASSERT(lm_start_state != fst::kNoStateId);
+  toks_.Insert(ConstructPair(start_state, lm_start_state), start_tok);
   num_toks_++;
   ProcessNonemitting();
 }
@@ -82,12 +119,20 @@ bool LatticeFasterDecoder::Decode(DecodableInterface *decodable) {
   // numbering, which we have to correct for when we call it.
 
   while (!decodable->IsLastFrame(NumFramesDecoded() - 1)) {
-    if (NumFramesDecoded() % config_.prune_interval == 0)
+    if (config_.target_rtf > 0.0) rtf_timer_.Reset();
+    if (NumFramesDecoded() % config_.prune_interval == 0) {
       PruneActiveTokens(config_.lattice_beam * config_.prune_scale);
+      if (DeterminizeIncrementally()) MaybeDeterminizeChunk();
+      if (config_.target_rtf > 0.0) AdaptBeam();
+    }
     ProcessEmitting(decodable);  // Note: the value returned by
                                  // NumFramesDecoded() is incremented by
                                  // ProcessEmitting().
     ProcessNonemitting();
+    if (config_.target_rtf > 0.0) {
+      rtf_time_ += rtf_timer_.Elapsed();
+      rtf_num_frames_++;
+    }
   }
   FinalizeDecoding();
 
@@ -193,6 +238,149 @@ bool LatticeFasterDecoder::GetRawLattice(Lattice *ofst,
 }
 
 
+LatticeFasterDecoder::BestPathIterator LatticeFasterDecoder::BestPathEnd(
+    bool use_final_probs,
+    BaseFloat *final_cost_out) const {
+  if (decoding_finalized_ && !use_final_probs)
+    KALDI_ERR << "You cannot call FinalizeDecoding() and then call "
+              << "BestPathEnd() with use_final_probs == false";
+  KALDI_ASSERT(NumFramesDecoded() > 0 &&
+               "You cannot call BestPathEnd if no frames were decoded.");
+
+  unordered_map<Token*, BaseFloat> final_costs_local;
+
+  const unordered_map<Token*, BaseFloat> &final_costs =
+      (decoding_finalized_ ? final_costs_ : final_costs_local);
+  if (!decoding_finalized_ && use_final_probs)
+    ComputeFinalCosts(&final_costs_local, NULL, NULL);
+
+  // Singly linked list of tokens on last frame (access list through "next"
+  // pointer).
+  BaseFloat best_cost = std::numeric_limits<BaseFloat>::infinity();
+  BaseFloat best_final_cost = 0;
+  Token *best_tok = NULL;
+  for (Token *tok = active_toks_.back().toks; tok != NULL; tok = tok->next) {
+    BaseFloat cost = tok->tot_cost, final_cost = 0.0;
+    if (use_final_probs && !final_costs.empty()) {
+      // if we are instructed to use final-probs, and any final tokens were
+      // active on final frame, include the final-prob in the cost of the token.
+      unordered_map<Token*, BaseFloat>::const_iterator iter =
+          final_costs.find(tok);
+      if (iter != final_costs.end()) {
+        final_cost = iter->second;
+        cost += final_cost;
+      } else {
+        cost = std::numeric_limits<BaseFloat>::infinity();
+      }
+    }
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_tok = tok;
+      best_final_cost = final_cost;
+    }
+  }
+  if (best_tok == NULL) {  // this should not happen, and is likely a code error
+    // or caused by infinities in likelihoods, but I'm not making it a fatal
+    // error for now.
+    KALDI_WARN << "No final token found.";
+  }
+  if (final_cost_out)
+    *final_cost_out = best_final_cost;
+  return BestPathIterator(best_tok, NumFramesDecoded() - 1);
+}
+
+
+LatticeFasterDecoder::BestPathIterator LatticeFasterDecoder::TraceBackBestPath(
+    BestPathIterator iter, LatticeArc *oarc) const {
+  KALDI_ASSERT(!iter.Done() && oarc != NULL);
+  Token *tok = static_cast<Token*>(iter.tok);
+  int32 cur_t = iter.frame, ret_t = cur_t;
+  if (tok->backpointer != NULL) {
+    ForwardLink *link;
+    for (link = tok->backpointer->links;
+         link != NULL; link = link->next) {
+      if (link->next_tok == tok) { // this is the link to "tok"
+        oarc->ilabel = link->ilabel;
+        oarc->olabel = link->olabel;
+        BaseFloat graph_cost = link->graph_cost,
+            acoustic_cost = link->acoustic_cost;
+        if (link->ilabel != 0) {
+          KALDI_ASSERT(static_cast<size_t>(cur_t) < cost_offsets_.size());
+          acoustic_cost -= cost_offsets_[cur_t];
+          ret_t--;
+        }
+        oarc->weight = LatticeWeight(graph_cost, acoustic_cost);
+        break;
+      }
+    }
+    if (link == NULL) { // Did not find correct link.
+      KALDI_ERR << "Error tracing best-path back (likely "
+                << "bug in token-pruning algorithm)";
+    }
+  } else {
+    oarc->ilabel = 0;
+    oarc->olabel = 0;
+    oarc->weight = LatticeWeight::One(); // zero costs.
+  }
+  return BestPathIterator(tok->backpointer, ret_t);
+}
+
+
+int32 LatticeFasterDecoder::GetStableBestPath(Lattice *olat) const {
+  olat->DeleteStates();
+  if (NumFramesDecoded() == 0) return 0;
+  BestPathIterator end = BestPathEnd(decoding_finalized_);
+  if (end.Done()) return 0;
+
+  // "chain_pos" maps each token on the best path to its distance from the
+  // end of the path, and later also every token we visit while tracing back
+  // the other active tokens to the position where they join the best path.
+  unordered_map<Token*, int32> chain_pos;
+  int32 chain_length = 0;
+  for (Token *tok = static_cast<Token*>(end.tok); tok != NULL;
+       tok = tok->backpointer)
+    chain_pos[tok] = chain_length++;
+
+  // All backpointer chains end at the start token, which is on the best path,
+  // so each of these loops terminates.  The deepest point at which some
+  // active token joins the best path is their common ancestor.
+  int32 stable_pos = 0;
+  std::vector<Token*> visited;
+  for (Token *tok = active_toks_.back().toks; tok != NULL; tok = tok->next) {
+    visited.clear();
+    Token *t = tok;
+    unordered_map<Token*, int32>::const_iterator iter;
+    while ((iter = chain_pos.find(t)) == chain_pos.end()) {
+      visited.push_back(t);
+      t = t->backpointer;
+      KALDI_ASSERT(t != NULL);
+    }
+    int32 pos = iter->second;
+    for (size_t i = 0; i < visited.size(); i++)
+      chain_pos[visited[i]] = pos;
+    stable_pos = std::max(stable_pos, pos);
+  }
+
+  // Skip the unstable arcs at the end of the best path, then output the rest.
+  BestPathIterator iter = end;
+  LatticeArc arc;
+  for (int32 i = 0; i < stable_pos; i++)
+    iter = TraceBackBestPath(iter, &arc);
+  int32 num_frames = iter.frame + 1;
+  StateId state = olat->AddState();
+  olat->SetFinal(state, LatticeWeight::One());
+  while (!iter.Done()) {
+    iter = TraceBackBestPath(iter, &arc);
+    arc.nextstate = state;
+    StateId new_state = olat->AddState();
+    olat->AddArc(new_state, arc);
+    state = new_state;
+  }
+  olat->SetStart(state);
+  return num_frames;
+}
+
+
 // This function is now deprecated, since now we do determinization from outside
 // the LatticeFasterDecoder class.  Outputs an FST corresponding to the
 // lattice-determinized lattice (one path per word sequence).
@@ -218,6 +406,193 @@ bool LatticeFasterDecoder::GetLattice(CompactLattice *ofst,
   return (ofst->NumStates() != 0);
 }
 
+bool LatticeFasterDecoder::GetDeterminizedLattice(CompactLattice *ofst,
+                                                  bool use_final_probs) {
+  if (!DeterminizeIncrementally()) {
+    Lattice raw_fst;
+    GetRawLattice(&raw_fst, use_final_probs);
+    Connect(&raw_fst);
+    if (stats_ != NULL) {
+      stats_->raw_lattice_states += raw_fst.NumStates();
+      stats_->raw_lattice_arcs += fst::NumArcs(raw_fst);
+      stats_timer_.Reset();
+    }
+    bool ans = fst::DeterminizeLatticePhonePrunedWrapper(
+        &raw_fst, config_.lattice_beam, ofst, config_.det_opts);
+    if (stats_ != NULL) {
+      stats_->determinize_time += stats_timer_.Elapsed();
+      stats_->det_lattice_states = ofst->NumStates();
+      stats_->det_lattice_arcs = fst::NumArcs(*ofst);
+    }
+    return ans && ofst->NumStates() != 0;
+  }
+  if (decoding_finalized_ && !use_final_probs)
+    KALDI_ERR << "You cannot call FinalizeDecoding() and then call "
+              << "GetDeterminizedLattice() with use_final_probs == false";
+  if (!determinized_all_) {
+    KALDI_ASSERT(NumFramesDecoded() > 0);
+    DeterminizeChunk(NumFramesDecoded(), true, use_final_probs);
+    determinized_all_ = true;
+  }
+  *ofst = determinizer_.GetDeterminizedLattice();
+  Connect(ofst);
+  if (config_.det_opts.minimize && ofst->NumStates() != 0) {
+    // as in DeterminizeLatticePhonePrunedWrapper(); the determinizer can't
+    // minimize the chunks.
+    if (stats_ != NULL) stats_timer_.Reset();
+    fst::PushCompactLatticeStrings<LatticeWeight, int32>(ofst);
+    fst::PushCompactLatticeWeights<LatticeWeight, int32>(ofst);
+    fst::MinimizeCompactLattice<LatticeWeight, int32>(ofst);
+    if (stats_ != NULL) stats_->determinize_time += stats_timer_.Elapsed();
+  }
+  if (stats_ != NULL) {
+    stats_->det_lattice_states = ofst->NumStates();
+    stats_->det_lattice_arcs = fst::NumArcs(*ofst);
+  }
+  return determinize_ok_ && ofst->NumStates() != 0;
+}
+
+void LatticeFasterDecoder::MaybeDeterminizeChunk() {
+  int32 latest_frame = NumFramesDecoded() - config_.determinize_delay;
+  if (latest_frame - num_frames_determinized_ < config_.determinize_period)
+    return;
+  // Ending the chunk where there are few tokens keeps the part that has to be
+  // determinized again small.
+  int32 begin_frame = std::max(num_frames_determinized_ + 1,
+                               latest_frame - config_.determinize_period / 2),
+      best_frame = latest_frame;
+  size_t best_num_toks = std::numeric_limits<size_t>::max();
+  for (int32 f = begin_frame; f <= latest_frame; f++) {
+    size_t num_toks = 0;
+    for (Token *tok = active_toks_[f].toks; tok != NULL; tok = tok->next)
+      num_toks++;
+    if (num_toks < best_num_toks) {
+      best_num_toks = num_toks;
+      best_frame = f;
+    }
+  }
+  DeterminizeChunk(best_frame, false, false);
+}
+
+void LatticeFasterDecoder::DeterminizeChunk(int32 end_frame, bool is_last,
+                                            bool use_final_probs) {
+  typedef LatticeArc Arc;
+  typedef Arc::StateId StateId;
+  typedef Arc::Weight Weight;
+  typedef Arc::Label Label;
+  int32 begin_frame = num_frames_determinized_;
+  KALDI_ASSERT(end_frame >= begin_frame &&
+               end_frame < static_cast<int32>(active_toks_.size()));
+
+  Lattice raw_fst;
+  unordered_map<Label, StateId> token_label2state;
+  determinizer_.InitializeRawLatticeChunk(&raw_fst, &token_label2state);
+
+  // Create the states.  The tokens on begin_frame were given token labels by
+  // the last chunk; they take the states the determinizer made for them.
+  unordered_map<Token*, StateId> tok_map;
+  std::vector<Token*> token_list;
+  for (int32 f = begin_frame; f <= end_frame; f++) {
+    if (active_toks_[f].toks == NULL) {
+      KALDI_WARN << "DeterminizeChunk: no tokens active on frame " << f;
+      determinize_ok_ = false;
+      continue;
+    }
+    TopSortTokens(active_toks_[f].toks, &token_list);
+    for (size_t i = 0; i < token_list.size(); i++) {
+      Token *tok = token_list[i];
+      if (tok == NULL) continue;
+      StateId s = fst::kNoStateId;
+      if (f == begin_frame && begin_frame > 0) {
+        unordered_map<Token*, Label>::const_iterator iter =
+            token2label_.find(tok);
+        if (iter != token2label_.end()) {
+          unordered_map<Label, StateId>::const_iterator siter =
+              token_label2state.find(iter->second);
+          if (siter != token_label2state.end()) s = siter->second;
+        }
+      }
+      if (s == fst::kNoStateId) s = raw_fst.AddState();
+      if (f == 0 && raw_fst.Start() == fst::kNoStateId)
+        raw_fst.SetStart(s);  // the tokens are topologically sorted.
+      tok_map[tok] = s;
+    }
+  }
+
+  // Create the arcs, as in GetRawLattice(); the links out of end_frame belong
+  // to the next chunk, unless this is the last.
+  int32 links_end = (is_last ? end_frame + 1 : end_frame);
+  for (int32 f = begin_frame; f < links_end; f++) {
+    for (Token *tok = active_toks_[f].toks; tok != NULL; tok = tok->next) {
+      StateId cur_state = tok_map[tok];
+      for (ForwardLink *l = tok->links; l != NULL; l = l->next) {
+        unordered_map<Token*, StateId>::const_iterator iter =
+            tok_map.find(l->next_tok);
+        KALDI_ASSERT(iter != tok_map.end());
+        BaseFloat cost_offset = 0.0;
+        if (l->ilabel != 0) {  // emitting..
+          KALDI_ASSERT(f >= 0 && f < cost_offsets_.size());
+          cost_offset = cost_offsets_[f];
+        }
+        raw_fst.AddArc(cur_state,
+                       Arc(l->ilabel, l->olabel,
+                           Weight(l->graph_cost, l->acoustic_cost - cost_offset),
+                           iter->second));
+      }
+    }
+  }
+
+  unordered_map<Label, BaseFloat> token_label2final_cost;
+  token2label_.clear();
+  if (is_last) {
+    unordered_map<Token*, BaseFloat> final_costs_local;
+    const unordered_map<Token*, BaseFloat> &final_costs =
+        (decoding_finalized_ ? final_costs_ : final_costs_local);
+    if (!decoding_finalized_ && use_final_probs)
+      ComputeFinalCosts(&final_costs_local, NULL, NULL);
+    for (Token *tok = active_toks_[end_frame].toks; tok != NULL;
+         tok = tok->next) {
+      StateId s = tok_map[tok];
+      if (use_final_probs && !final_costs.empty()) {
+        unordered_map<Token*, BaseFloat>::const_iterator iter =
+            final_costs.find(tok);
+        if (iter != final_costs.end())
+          raw_fst.SetFinal(s, LatticeWeight(iter->second, 0));
+      } else {
+        raw_fst.SetFinal(s, LatticeWeight::One());
+      }
+    }
+  } else {
+    // Each token on end_frame gets an arc with its token label to a final
+    // state.  Its cost is extra_cost - tot_cost, which is (up to a constant)
+    // the cost of the best path from the token to the end, so that pruning
+    // in determinization works as if the rest of the utterance was there.
+    StateId final_state = raw_fst.AddState();
+    raw_fst.SetFinal(final_state, LatticeWeight::One());
+    Label next_label = LatticeIncrementalDeterminizer::kTokenLabelOffset;
+    for (Token *tok = active_toks_[end_frame].toks; tok != NULL;
+         tok = tok->next) {
+      if (tok->extra_cost == std::numeric_limits<BaseFloat>::infinity())
+        continue;
+      Label label = next_label++;
+      BaseFloat final_cost = tok->extra_cost - tok->tot_cost;
+      token2label_[tok] = label;
+      token_label2final_cost[label] = final_cost;
+      raw_fst.AddArc(tok_map[tok], Arc(0, label, Weight(final_cost, 0),
+                                       final_state));
+    }
+  }
+  if (stats_ != NULL) {
+    stats_->raw_lattice_states += raw_fst.NumStates();
+    stats_->raw_lattice_arcs += fst::NumArcs(raw_fst);
+    stats_timer_.Reset();
+  }
+  if (!determinizer_.AcceptRawLatticeChunk(&raw_fst, token_label2final_cost))
+    determinize_ok_ = false;
+  if (stats_ != NULL) stats_->determinize_time += stats_timer_.Elapsed();
+  num_frames_determinized_ = end_frame;
+}
+
 void LatticeFasterDecoder::PossiblyResizeHash(size_t num_toks) {
   size_t new_sz = static_cast<size_t>(static_cast<BaseFloat>(num_toks)
                                       * config_.hash_ratio);
@@ -226,13 +601,43 @@ void LatticeFasterDecoder::PossiblyResizeHash(size_t num_toks) {
   }
 }
 
+inline LatticeFasterDecoder::StateId LatticeFasterDecoder::PropagateLm(
+    StateId lm_state, Arc *arc) {
+  if (arc->olabel == 0 || lm_diff_fst_ == NULL)
+    return lm_state;  // no change in LM state if no word crossed.
+  Arc lm_arc;
+  if (!lm_diff_fst_->GetArc(lm_state, arc->olabel, &lm_arc)) {
+    // this case is unexpected for statistical LMs.
+    if (!warned_noarc_) {
+      warned_noarc_ = true;
+      KALDI_WARN << "No arc available in LM (unlikely to be correct "
+                 << "if a statistical language model); will not warn again";
+    }
+    arc->weight = Weight::Zero();
+    return lm_state;  // doesn't really matter what we return here; will
+                      // be pruned.
+  }
+  arc->weight = Times(arc->weight, lm_arc.weight);
+  arc->olabel = lm_arc.olabel;  // probably will be the same.
+  return lm_arc.nextstate;
+}
+
+inline BaseFloat LatticeFasterDecoder::FinalCost(PairId state_pair) const {
+  BaseFloat final_cost = fst_.Final(PairToState(state_pair)).Value();
+  if (lm_diff_fst_ != NULL &&
+      final_cost != std::numeric_limits<BaseFloat>::infinity())
+    final_cost += lm_diff_fst_->Final(PairToLmState(state_pair)).Value();
+  return final_cost;
+}
+
 // FindOrAddToken either locates a token in hash of toks_,
 // or if necessary inserts a new, empty token (i.e. with no forward links)
 // for the current frame.  [note: it's inserted if necessary into hash toks_
 // and also into the singly linked list of tokens active on this frame
 // (whose head is at active_toks_[frame]).
 inline LatticeFasterDecoder::Token *LatticeFasterDecoder::FindOrAddToken(
-    StateId state, int32 frame_plus_one, BaseFloat tot_cost, bool *changed) {
+    PairId state, int32 frame_plus_one, BaseFloat tot_cost,
+    Token *backpointer, bool *changed) {
   // Returns the Token pointer.  Sets "changed" (if non-NULL) to true
   // if the token was newly created or the cost changed.
   KALDI_ASSERT(frame_plus_one < active_toks_.size());
@@ -243,7 +648,7 @@ inline LatticeFasterDecoder::Token *LatticeFasterDecoder::FindOrAddToken(
     // tokens on the currently final frame have zero extra_cost
     // as any of them could end up
     // on the winning path.
-    Token *new_tok = new Token (tot_cost, extra_cost, NULL, toks);
+    Token *new_tok = new Token (tot_cost, extra_cost, NULL, toks, backpointer);
     // NULL: no forward links yet
     toks = new_tok;
     num_toks_++;
@@ -254,6 +659,7 @@ inline LatticeFasterDecoder::Token *LatticeFasterDecoder::FindOrAddToken(
     Token *tok = e_found->val;  // There is an existing Token for this state.
     if (tok->tot_cost > tot_cost) {  // replace old token
       tok->tot_cost = tot_cost;
+      tok->backpointer = backpointer;
       // we don't allocate a new token, the old stays linked in active_toks_
       // we only replace the tot_cost
       // in the current frame, there are no forward links (and no extra_cost)
@@ -478,6 +884,7 @@ void LatticeFasterDecoder::PruneTokensForFrame(int32 frame_plus_one) {
 void LatticeFasterDecoder::PruneActiveTokens(BaseFloat delta) {
   int32 cur_frame_plus_one = NumFramesDecoded();
   int32 num_toks_begin = num_toks_;
+  if (stats_ != NULL) stats_timer_.Reset();
   // The index "f" below represents a "frame plus one", i.e. you'd have to subtract
   // one to get the corresponding index for the decodable object.
   for (int32 f = cur_frame_plus_one - 1; f >= 0; f--) {
@@ -502,6 +909,10 @@ void LatticeFasterDecoder::PruneActiveTokens(BaseFloat delta) {
   }
   KALDI_VLOG(4) << "PruneActiveTokens: pruned tokens from " << num_toks_begin
                 << " to " << num_toks_;
+  if (stats_ != NULL) {
+    stats_->num_prune_calls++;
+    stats_->prune_time += stats_timer_.Elapsed();
+  }
 }
 
 void LatticeFasterDecoder::ComputeFinalCosts(
@@ -516,10 +927,10 @@ void LatticeFasterDecoder::ComputeFinalCosts(
   BaseFloat best_cost = infinity,
       best_cost_with_final = infinity;
   while (final_toks != NULL) {
-    StateId state = final_toks->key;
+    PairId state_pair = final_toks->key;
     Token *tok = final_toks->val;
     const Elem *next = final_toks->tail;
-    BaseFloat final_cost = fst_.Final(state).Value();
+    BaseFloat final_cost = FinalCost(state_pair);
     BaseFloat cost = tok->tot_cost,
         cost_with_final = cost + final_cost;
     best_cost = std::min(cost, best_cost);
@@ -550,6 +961,8 @@ void LatticeFasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
                                              int32 max_num_frames) {
   KALDI_ASSERT(!active_toks_.empty() && !decoding_finalized_ &&
                "You must call InitDecoding() before AdvanceDecoding");
+  KALDI_ASSERT(!determinized_all_ &&
+               "You cannot call AdvanceDecoding() after GetDeterminizedLattice()");
   int32 num_frames_ready = decodable->NumFramesReady();
   // num_frames_ready must be >= num_frames_decoded, or else
   // the number of frames ready must have decreased (which doesn't
@@ -561,12 +974,21 @@ void LatticeFasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
     target_frames_decoded = std::min(target_frames_decoded,
                                      NumFramesDecoded() + max_num_frames);
   while (NumFramesDecoded() < target_frames_decoded) {
+    // We time each frame separately, so that time spent waiting for input
+    // between calls does not count.
+    if (config_.target_rtf > 0.0) rtf_timer_.Reset();
     if (NumFramesDecoded() % config_.prune_interval == 0) {
       PruneActiveTokens(config_.lattice_beam * config_.prune_scale);
+      if (DeterminizeIncrementally()) MaybeDeterminizeChunk();
+      if (config_.target_rtf > 0.0) AdaptBeam();
     }
     // note: ProcessEmitting() increments NumFramesDecoded().
     ProcessEmitting(decodable);
     ProcessNonemitting();
+    if (config_.target_rtf > 0.0) {
+      rtf_time_ += rtf_timer_.Elapsed();
+      rtf_num_frames_++;
+    }
   }
 }
 
@@ -576,6 +998,7 @@ void LatticeFasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
 void LatticeFasterDecoder::FinalizeDecoding() {
   int32 final_frame_plus_one = NumFramesDecoded();
   int32 num_toks_begin = num_toks_;
+  if (stats_ != NULL) stats_timer_.Reset();
   // PruneForwardLinksFinal() prunes final frame (with final-probs), and
   // sets decoding_finalized_.
   PruneForwardLinksFinal();
@@ -588,6 +1011,46 @@ void LatticeFasterDecoder::FinalizeDecoding() {
   PruneTokensForFrame(0);
   KALDI_VLOG(4) << "pruned tokens from " << num_toks_begin
                 << " to " << num_toks_;
+  if (stats_ != NULL) {
+    stats_->num_prune_calls++;
+    stats_->prune_time += stats_timer_.Elapsed();
+  }
+}
+
+void LatticeFasterDecoder::SetBeamScale(BaseFloat scale) {
+  beam_scale_ = scale;
+  cur_beam_ = config_.beam * scale;
+  cur_max_active_ = config_.max_active;
+  if (config_.max_active != std::numeric_limits<int32>::max() && scale < 1.0)
+    cur_max_active_ = std::max(static_cast<int32>(config_.max_active * scale),
+                               std::min(config_.max_active,
+                                        config_.min_active + 1));
+}
+
+void LatticeFasterDecoder::AdaptBeam() {
+  if (rtf_num_frames_ == 0) return;
+  double budget = rtf_num_frames_ * config_.rtf_frame_shift *
+      config_.target_rtf,
+      ratio = rtf_time_ / budget;
+  rtf_time_ = 0.0;
+  rtf_num_frames_ = 0;
+  // We only scale back up when there is some headroom, so the scale doesn't
+  // keep going up and down.
+  const BaseFloat kHeadroom = 0.8;
+  BaseFloat scale = beam_scale_;
+  if (ratio > 1.0)
+    scale = std::max(config_.rtf_min_scale, scale * config_.rtf_scale_step);
+  else if (ratio < kHeadroom)
+    scale = std::min<BaseFloat>(1.0, scale / config_.rtf_scale_step);
+  if (scale == beam_scale_) return;
+  if (stats_ != NULL) {
+    if (scale < beam_scale_) stats_->num_beam_decreases++;
+    else stats_->num_beam_increases++;
+  }
+  KALDI_VLOG(3) << "Real-time factor " << (ratio * config_.target_rtf)
+                << " at frame " << NumFramesDecoded() << "; setting beam to "
+                << (config_.beam * scale);
+  SetBeamScale(scale);
 }
 
 /// Gets the weight cutoff.  Also counts the active tokens.
@@ -596,7 +1059,7 @@ BaseFloat LatticeFasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
   BaseFloat best_weight = std::numeric_limits<BaseFloat>::infinity();
   // positive == high cost == bad.
   size_t count = 0;
-  if (config_.max_active == std::numeric_limits<int32>::max() &&
+  if (cur_max_active_ == std::numeric_limits<int32>::max() &&
       config_.min_active == 0) {
     for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
       BaseFloat w = static_cast<BaseFloat>(e->val->tot_cost);
@@ -606,8 +1069,8 @@ BaseFloat LatticeFasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
       }
     }
     if (tok_count != NULL) *tok_count = count;
-    if (adaptive_beam != NULL) *adaptive_beam = config_.beam;
-    return best_weight + config_.beam;
+    if (adaptive_beam != NULL) *adaptive_beam = cur_beam_;
+    return best_weight + cur_beam_;
   } else {
     tmp_array_.clear();
     for (Elem *e = list_head; e != NULL; e = e->tail, count++) {
@@ -620,38 +1083,40 @@ BaseFloat LatticeFasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
     }
     if (tok_count != NULL) *tok_count = count;
 
-    BaseFloat beam_cutoff = best_weight + config_.beam,
+    BaseFloat beam_cutoff = best_weight + cur_beam_,
         min_active_cutoff = std::numeric_limits<BaseFloat>::infinity(),
         max_active_cutoff = std::numeric_limits<BaseFloat>::infinity();
 
-    if (tmp_array_.size() > static_cast<size_t>(config_.max_active)) {
+    if (tmp_array_.size() > static_cast<size_t>(cur_max_active_)) {
       std::nth_element(tmp_array_.begin(),
-                       tmp_array_.begin() + config_.max_active,
+                       tmp_array_.begin() + cur_max_active_,
                        tmp_array_.end());
-      max_active_cutoff = tmp_array_[config_.max_active];
+      max_active_cutoff = tmp_array_[cur_max_active_];
     }
     if (tmp_array_.size() > static_cast<size_t>(config_.min_active)) {
       if (config_.min_active == 0) min_active_cutoff = best_weight;
       else {
         std::nth_element(tmp_array_.begin(),
                          tmp_array_.begin() + config_.min_active,
-                         tmp_array_.size() > static_cast<size_t>(config_.max_active) ?
-                         tmp_array_.begin() + config_.max_active :
+                         tmp_array_.size() > static_cast<size_t>(cur_max_active_) ?
+                         tmp_array_.begin() + cur_max_active_ :
                          tmp_array_.end());
         min_active_cutoff = tmp_array_[config_.min_active];
       }
     }
 
     if (max_active_cutoff < beam_cutoff) { // max_active is tighter than beam.
+      if (stats_ != NULL) stats_->num_max_active_cutoffs++;
       if (adaptive_beam)
         *adaptive_beam = max_active_cutoff - best_weight + config_.beam_delta;
       return max_active_cutoff;
     } else if (min_active_cutoff > beam_cutoff) { // min_active is looser than beam.
+      if (stats_ != NULL) stats_->num_min_active_cutoffs++;
       if (adaptive_beam)
         *adaptive_beam = min_active_cutoff - best_weight + config_.beam_delta;
       return min_active_cutoff;
     } else {
-      *adaptive_beam = config_.beam;
+      *adaptive_beam = cur_beam_;
       return beam_cutoff;
     }
   }
@@ -663,6 +1128,7 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
                                          // (zero-based) used to get likelihoods
                                          // from the decodable object.
   active_toks_.resize(active_toks_.size() + 1);
+  if (stats_ != NULL) stats_timer_.Reset();
 
   Elem *final_toks = toks_.Clear(); // analogous to swapping prev_toks_ / cur_toks_
                                    // in simple-decoder.h.   Removes the Elems from
@@ -683,7 +1149,7 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   // reasonably tight bound on the next cutoff.  The only
   // products of the next block are "next_cutoff" and "cost_offset".
   if (best_elem) {
-    StateId state = best_elem->key;
+    StateId state = PairToState(best_elem->key);
     Token *tok = best_elem->val;
     cost_offset = - tok->tot_cost;
     for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
@@ -710,28 +1176,33 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   // the tokens are now owned here, in final_toks, and the hash is empty.
   // 'owned' is a complex thing here; the point is we need to call DeleteElem
   // on each elem 'e' to let toks_ know we're done with them.
+  int32 num_arcs = 0;  // for stats_.
   for (Elem *e = final_toks, *e_tail; e != NULL; e = e_tail) {
     // loop this way because we delete "e" as we go.
-    StateId state = e->key;
+    StateId state = PairToState(e->key),
+        lm_state = PairToLmState(e->key);
     Token *tok = e->val;
     if (tok->tot_cost <=  cur_cutoff) {
       for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
            !aiter.Done();
            aiter.Next()) {
-        const Arc &arc = aiter.Value();
+        Arc arc = aiter.Value();
         if (arc.ilabel != 0) {  // propagate..
+          num_arcs++;
+          StateId next_lm_state = PropagateLm(lm_state, &arc);
           BaseFloat ac_cost = cost_offset -
               decodable->LogLikelihood(frame, arc.ilabel),
               graph_cost = arc.weight.Value(),
               cur_cost = tok->tot_cost,
               tot_cost = cur_cost + ac_cost + graph_cost;
           if (tot_cost > next_cutoff) continue;
-          else if (tot_cost + config_.beam < next_cutoff)
-            next_cutoff = tot_cost + config_.beam; // prune by best current token
+          else if (tot_cost + cur_beam_ < next_cutoff)
+            next_cutoff = tot_cost + cur_beam_; // prune by best current token
           // Note: the frame indexes into active_toks_ are one-based,
           // hence the + 1.
-          Token *next_tok = FindOrAddToken(arc.nextstate,
-                                           frame + 1, tot_cost, NULL);
+          Token *next_tok = FindOrAddToken(
+              ConstructPair(arc.nextstate, next_lm_state),
+              frame + 1, tot_cost, tok, NULL);
           // NULL: no change indicator needed
 
           // Add ForwardLink from tok to next_tok (put on head of list tok->links)
@@ -743,6 +1214,12 @@ void LatticeFasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
     e_tail = e->tail;
     toks_.Delete(e); // delete Elem
   }
+  if (stats_ != NULL) {
+    stats_->AddFrame(tok_cnt, num_arcs);
+    stats_->tot_beam += cur_beam_;
+    stats_->num_emitting_arcs += num_arcs;
+    stats_->emitting_time += stats_timer_.Elapsed();
+  }
 }
 
 // TODO: could possibly add adaptive_beam back as an argument here (was
@@ -761,6 +1238,8 @@ void LatticeFasterDecoder::ProcessNonemitting() {
   // problem did not improve overall speed.
 
   KALDI_ASSERT(queue_.empty());
+  if (stats_ != NULL) stats_timer_.Reset();
+  int32 num_arcs = 0;  // for stats_.
   BaseFloat best_cost = std::numeric_limits<BaseFloat>::infinity();
   for (const Elem *e = toks_.GetList(); e != NULL;  e = e->tail) {
     queue_.push_back(e->key);
@@ -773,13 +1252,15 @@ void LatticeFasterDecoder::ProcessNonemitting() {
       warned_ = true;
     }
   }
-  BaseFloat cutoff = best_cost + config_.beam;
+  BaseFloat cutoff = best_cost + cur_beam_;
 
   while (!queue_.empty()) {
-    StateId state = queue_.back();
+    PairId state_pair = queue_.back();
     queue_.pop_back();
+    StateId state = PairToState(state_pair),
+        lm_state = PairToLmState(state_pair);
 
-    Token *tok = toks_.Find(state)->val;  // would segfault if state not in toks_ but this can't happen.
+    Token *tok = toks_.Find(state_pair)->val;  // would segfault if state not in toks_ but this can't happen.
     BaseFloat cur_cost = tok->tot_cost;
     if (cur_cost > cutoff) // Don't bother processing successors.
       continue;
@@ -792,26 +1273,33 @@ void LatticeFasterDecoder::ProcessNonemitting() {
     for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
          !aiter.Done();
          aiter.Next()) {
-      const Arc &arc = aiter.Value();
+      Arc arc = aiter.Value();
       if (arc.ilabel == 0) {  // propagate nonemitting only...
+        num_arcs++;
+        StateId next_lm_state = PropagateLm(lm_state, &arc);
+        PairId next_pair = ConstructPair(arc.nextstate, next_lm_state);
         BaseFloat graph_cost = arc.weight.Value(),
             tot_cost = cur_cost + graph_cost;
         if (tot_cost < cutoff) {
           bool changed;
 
-          Token *new_tok = FindOrAddToken(arc.nextstate, frame + 1, tot_cost,
-                                          &changed);
+          Token *new_tok = FindOrAddToken(next_pair, frame + 1, tot_cost,
+                                          tok, &changed);
 
           tok->links = new ForwardLink(new_tok, 0, arc.olabel,
                                        graph_cost, 0, tok->links);
 
           // "changed" tells us whether the new token has a different
           // cost from before, or is new [if so, add into queue].
-          if (changed) queue_.push_back(arc.nextstate);
+          if (changed) queue_.push_back(next_pair);
         }
       }
     } // for all arcs
   } // while queue not empty
+  if (stats_ != NULL) {
+    stats_->num_nonemitting_arcs += num_arcs;
+    stats_->nonemitting_time += stats_timer_.Elapsed();
+  }
 }
 
 
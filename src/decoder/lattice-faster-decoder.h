@@ -29,12 +29,15 @@
 #define KALDI_DECODER_LATTICE_FASTER_DECODER_H_
 
 
+#include "base/timer.h"
 #include "util/stl-utils.h"
 #include "util/hash-list.h"
 #include "fst/fstlib.h"
 #include "decoder/decodable-itf.h"
+#include "decoder/decoder-stats.h"
 #include "fstext/fstext-lib.h"
 #include "lat/determinize-lattice-pruned.h"
+#include "lat/determinize-lattice-incremental.h"
 #include "lat/kaldi-lattice.h"
 
 namespace eesen {
@@ -45,8 +48,25 @@ struct LatticeFasterDecoderConfig {
   int32 min_active;
   BaseFloat lattice_beam;
   int32 prune_interval;
-  bool determinize_lattice; // not inspected by this class... used in
-                            // command-line program.
+  bool determinize_lattice; // not inspected by this class (except with
+                            // determinize_period)... used in command-line
+                            // program.
+  // If determinize_period > 0 (and determinize_lattice), the lattice is
+  // determinized in chunks of about this many frames during decoding, lagging
+  // determinize_delay frames behind the frames decoded; see
+  // GetDeterminizedLattice().
+  int32 determinize_period;
+  int32 determinize_delay;
+  // If target_rtf > 0, the beam (and max_active, if set) are scaled down
+  // during decoding when the decoder is slower than target_rtf times real
+  // time, and back up when it is faster, between rtf_min_scale and 1.  The
+  // speed is measured every prune_interval frames, taking rtf_frame_shift
+  // seconds of audio per frame.
+  BaseFloat target_rtf;
+  BaseFloat rtf_frame_shift;
+  BaseFloat rtf_min_scale;
+  BaseFloat rtf_scale_step;  // Not configurable on the command line: the
+                             // factor by which the scale changes each time.
   BaseFloat beam_delta; // has nothing to do with beam_ratio
   BaseFloat hash_ratio;
   BaseFloat prune_scale;   // Note: we don't make this configurable on the command line,
@@ -63,6 +83,12 @@ struct LatticeFasterDecoderConfig {
                                 lattice_beam(10.0),
                                 prune_interval(25),
                                 determinize_lattice(true),
+                                determinize_period(0),
+                                determinize_delay(25),
+                                target_rtf(0.0),
+                                rtf_frame_shift(0.01),
+                                rtf_min_scale(0.5),
+                                rtf_scale_step(0.9),
                                 beam_delta(0.5),
                                 hash_ratio(2.0),
                                 prune_scale(0.1) { }
@@ -77,6 +103,22 @@ struct LatticeFasterDecoderConfig {
     po->Register("determinize-lattice", &determinize_lattice, "If true, "
                  "determinize the lattice (in a special sense, keeping only "
                  "best pdf-sequence for each word-sequence).");
+    po->Register("determinize-period", &determinize_period, "If >0, "
+                 "determinize the lattice incrementally during decoding, in "
+                 "chunks of about this many frames, so there is less to do at "
+                 "the end of the utterance (only if --determinize-lattice=true).");
+    po->Register("determinize-delay", &determinize_delay, "With "
+                 "--determinize-period, the number of most recent frames that "
+                 "are not determinized yet (their tokens may still be pruned).");
+    po->Register("target-rtf", &target_rtf, "If >0, adjust the beam (and "
+                 "max-active) during decoding to keep the decoding time within "
+                 "this real-time factor (time spent in the decoder divided by "
+                 "the duration of the audio).");
+    po->Register("rtf-frame-shift", &rtf_frame_shift, "With --target-rtf, "
+                 "the duration of audio per frame of the decodable, in seconds.");
+    po->Register("rtf-min-scale", &rtf_min_scale, "With --target-rtf, the "
+                 "smallest factor by which beam and max-active may be scaled "
+                 "down.");
     po->Register("beam-delta", &beam_delta, "Increment used in decoding-- this "
                  "parameter is obscure and relates to a speedup in the way the "
                  "max-active constraint is applied.  Larger is more accurate.");
@@ -86,7 +128,11 @@ struct LatticeFasterDecoderConfig {
   void Check() const {
     KALDI_ASSERT(beam > 0.0 && max_active > 1 && lattice_beam > 0.0
                  && prune_interval > 0 && beam_delta > 0.0 && hash_ratio >= 1.0
-                 && prune_scale > 0.0 && prune_scale < 1.0);
+                 && prune_scale > 0.0 && prune_scale < 1.0
+                 && determinize_period >= 0 && determinize_delay >= 0
+                 && target_rtf >= 0.0 && rtf_frame_shift > 0.0
+                 && rtf_min_scale > 0.0 && rtf_min_scale <= 1.0
+                 && rtf_scale_step > 0.0 && rtf_scale_step < 1.0);
   }
 };
 
@@ -111,14 +157,36 @@ class LatticeFasterDecoder {
   LatticeFasterDecoder(const LatticeFasterDecoderConfig &config,
                        fst::Fst<fst::StdArc> *fst);
 
+  /// This version of the initializer decodes with the composition of "fst"
+  /// with "lm_diff_fst", done on the fly: the output labels (words) of "fst"
+  /// are the input labels of "lm_diff_fst".  The usual use is to build "fst"
+  /// (TLG) with a small LM, and make "lm_diff_fst" the difference between a
+  /// big LM and the small one, so we effectively decode with the big LM but
+  /// never build its graph.  Note that lm_diff_fst has to be deterministic and
+  /// not have epsilon inputs; typically it would be a
+  /// CacheDeterministicOnDemandFst wrapping a ComposeDeterministicOnDemandFst
+  /// of the negated small LM and the big LM.  It should have fewer than 2^32
+  /// states.  We don't take ownership of either argument.
+  LatticeFasterDecoder(const fst::Fst<fst::StdArc> &fst,
+                       const LatticeFasterDecoderConfig &config,
+                       fst::DeterministicOnDemandFst<fst::StdArc> *lm_diff_fst);
+
 
   void SetOptions(const LatticeFasterDecoderConfig &config) {
     config_ = config;
+    determinizer_ = LatticeIncrementalDeterminizer(config.lattice_beam,
+                                                   config.det_opts);
+    SetBeamScale(1.0);
   }
 
   const LatticeFasterDecoderConfig &GetOptions() const {
     return config_;
   }
+
+  /// If "stats" is non-NULL, the decoder records statistics about the search
+  /// in it (see DecoderStats); it is reset by InitDecoding().  We don't take
+  /// ownership.
+  void SetStats(DecoderStats *stats) { stats_ = stats; }
   
   ~LatticeFasterDecoder();
 
@@ -164,6 +232,17 @@ class LatticeFasterDecoder {
   bool GetLattice(CompactLattice *ofst,
                   bool use_final_probs = true) const;
 
+  /// Outputs the raw lattice (after Connect()) determinized as by
+  /// DeterminizeLatticePhonePrunedWrapper() with config.lattice_beam and
+  /// config.det_opts.  If config.determinize_period > 0, most of it was
+  /// already determinized during decoding, and only the last frames are
+  /// determinized here.  Returns false if determinization terminated early
+  /// (e.g. because of max_mem) or the lattice is empty.  "use_final_probs" is
+  /// as for GetRawLattice().  After calling this with incremental
+  /// determinization you cannot call AdvanceDecoding() again.
+  bool GetDeterminizedLattice(CompactLattice *ofst,
+                              bool use_final_probs = true);
+
   /// InitDecoding initializes the decoding, and should only be used if you
   /// intend to call AdvanceDecoding().  If you call Decode(), you don't need
   /// to call this.  You can call InitDecoding if you have already decoded an
@@ -203,6 +282,52 @@ class LatticeFasterDecoder {
 
   inline int32 NumFramesDecoded() const { return active_toks_.size() - 1; }
 
+  /// BestPathIterator is an opaque handle used by BestPathEnd() and
+  /// TraceBackBestPath() to trace back the best path one arc at a time,
+  /// following the token backpointers.  This is much cheaper than
+  /// GetBestPath(), which has to build the raw lattice, and is intended for
+  /// getting partial results during online decoding.
+  struct BestPathIterator {
+    void *tok;
+    int32 frame;
+    // note, "frame" is the frame-index of the frame you'll get the
+    // transition-id for next time, if you call TraceBackBestPath on this
+    // iterator (assuming it's not an epsilon transition).  Note that this
+    // is one less than you might reasonably expect, e.g. it's -1 for
+    // the nonemitting transitions before the first frame.
+    BestPathIterator(void *t, int32 f): tok(t), frame(f) { }
+    bool Done() const { return tok == NULL; }
+  };
+
+  /// This function returns an iterator that can be used to trace back
+  /// the best path.  If use_final_probs == true and at least one final state
+  /// survived till the end, it will use the final-probs in working out the best
+  /// final Token, and will output the final cost to *final_cost (if non-NULL),
+  /// else it will use only the forward likelihood, and will put zero in
+  /// *final_cost (if non-NULL).
+  /// Requires that NumFramesDecoded() > 0.
+  BestPathIterator BestPathEnd(bool use_final_probs,
+                               BaseFloat *final_cost = NULL) const;
+
+  /// This function can be used in conjunction with BestPathEnd() to trace back
+  /// the best path one link at a time (e.g. this can be useful in endpoint
+  /// detection).  By "link" we mean a link in the graph; not all links cross
+  /// frame boundaries, but each time you see a nonzero ilabel you can interpret
+  /// that as a frame.  The return value is the updated iterator.  It outputs
+  /// the ilabel and olabel, and the (graph and acoustic) weight to the "arc"
+  /// pointer, while leaving its "nextstate" variable unchanged.
+  BestPathIterator TraceBackBestPath(BestPathIterator iter,
+                                     LatticeArc *arc) const;
+
+  /// Outputs in "olat" the linear FST corresponding to the part of the best
+  /// path (without final-probs) that is shared by all tokens active on the
+  /// most recent frame.  This part of the traceback is "stable": it can no
+  /// longer change however decoding proceeds, so it can be shown to the user
+  /// as a partial result.  Returns the number of frames the stable part
+  /// covers (zero if nothing is stable yet).  Costs a pointer-chase back from
+  /// each active token; the raw lattice is not built.
+  int32 GetStableBestPath(Lattice *olat) const;
+
  private:
   // ForwardLinks are the links from a token to a token on the next frame.
   // or sometimes on the current frame (for input-epsilon links).
@@ -240,9 +365,14 @@ class LatticeFasterDecoder {
 
     Token *next; // Next in list of tokens for this frame.
 
+    Token *backpointer; // best preceding Token (could be on this frame or a
+                        // previous frame).  This is only required for
+                        // TraceBackBestPath(), used in online decoding.
+
     inline Token(BaseFloat tot_cost, BaseFloat extra_cost, ForwardLink *links,
-                 Token *next):
-        tot_cost(tot_cost), extra_cost(extra_cost), links(links), next(next) { }
+                 Token *next, Token *backpointer):
+        tot_cost(tot_cost), extra_cost(extra_cost), links(links), next(next),
+        backpointer(backpointer) { }
     inline void DeleteForwardLinks() {
       ForwardLink *l = links, *m;
       while (l != NULL) {
@@ -264,7 +394,29 @@ class LatticeFasterDecoder {
                  must_prune_tokens(true) { }
   };
 
-  typedef HashList<StateId, Token*>::Elem Elem;
+  // The tokens are indexed by a pair of the state in fst_ and the state in
+  // lm_diff_fst_ (zero if we don't have one).
+  typedef uint64 PairId;
+  typedef HashList<PairId, Token*>::Elem Elem;
+
+  static inline PairId ConstructPair(StateId fst_state, StateId lm_state) {
+    return static_cast<PairId>(fst_state) +
+        (static_cast<PairId>(lm_state) << 32);
+  }
+  static inline StateId PairToState(PairId state_pair) {
+    return static_cast<StateId>(static_cast<uint32>(state_pair));
+  }
+  static inline StateId PairToLmState(PairId state_pair) {
+    return static_cast<StateId>(static_cast<uint32>(state_pair >> 32));
+  }
+
+  // If "arc" has a word on its output and we have an lm_diff_fst_, adds the
+  // cost of the word in the LM to the arc and returns the new LM state;
+  // otherwise returns lm_state unchanged.
+  inline StateId PropagateLm(StateId lm_state, Arc *arc);
+
+  // Returns the final cost of the state pair (including the LM's final-cost).
+  inline BaseFloat FinalCost(PairId state_pair) const;
 
   void PossiblyResizeHash(size_t num_toks);
 
@@ -274,10 +426,13 @@ class LatticeFasterDecoder {
   // singly linked list of tokens active on this frame (whose head is at
   // active_toks_[frame]).  The frame_plus_one argument is the acoustic frame
   // index plus one, which is used to index into the active_toks_ array.
+  // "backpointer" is the Token we reached this one from; it is stored if the
+  // token is new or its cost improves.
   // Returns the Token pointer.  Sets "changed" (if non-NULL) to true if the
   // token was newly created or the cost changed.
-  inline Token *FindOrAddToken(StateId state, int32 frame_plus_one,
-                               BaseFloat tot_cost, bool *changed);
+  inline Token *FindOrAddToken(PairId state, int32 frame_plus_one,
+                               BaseFloat tot_cost, Token *backpointer,
+                               bool *changed);
 
   // prunes outgoing links for all tokens in active_toks_[frame]
   // it's called by PruneActiveTokens
@@ -333,6 +488,15 @@ class LatticeFasterDecoder {
   // less far.
   void PruneActiveTokens(BaseFloat delta);
 
+  /// Sets the beam and max-active that are used to config.beam and
+  /// config.max_active times "scale".
+  void SetBeamScale(BaseFloat scale);
+
+  /// With config.target_rtf: called every prune_interval frames, compares
+  /// the time spent decoding the frames since the last call with the
+  /// target, and changes the beam scale if needed.
+  void AdaptBeam();
+
   /// Gets the weight cutoff.  Also counts the active tokens.
   BaseFloat GetCutoff(Elem *list_head, size_t *tok_count,
                       BaseFloat *adaptive_beam, Elem **best_elem);
@@ -353,22 +517,25 @@ class LatticeFasterDecoder {
   // That is, the emitting probs of frame t are accounted for in tokens at
   // toks_[t+1].  The zeroth frame is for nonemitting transition at the start of
   // the graph.
-  HashList<StateId, Token*> toks_;
+  HashList<PairId, Token*> toks_;
 
   std::vector<TokenList> active_toks_; // Lists of tokens, indexed by
   // frame (members of TokenList are toks, must_prune_forward_links,
   // must_prune_tokens).
-  std::vector<StateId> queue_;  // temp variable used in ProcessNonemitting,
+  std::vector<PairId> queue_;  // temp variable used in ProcessNonemitting,
   std::vector<BaseFloat> tmp_array_;  // used in GetCutoff.
   // make it class member to avoid internal new/delete.
   const fst::Fst<fst::StdArc> &fst_;
   bool delete_fst_;
+  // Optional on-the-fly LM rescoring; not owned here.
+  fst::DeterministicOnDemandFst<fst::StdArc> *lm_diff_fst_;
   std::vector<BaseFloat> cost_offsets_; // This contains, for each
   // frame, an offset that was added to the acoustic likelihoods on that
   // frame in order to keep everything in a nice dynamic range.
   LatticeFasterDecoderConfig config_;
   int32 num_toks_; // current total #toks allocated...
   bool warned_;
+  bool warned_noarc_;
 
   /// decoding_finalized_ is true if someone called FinalizeDecoding().  [note,
   /// calling this is optional].  If true, it's forbidden to decode more.  Also,
@@ -408,6 +575,50 @@ class LatticeFasterDecoder {
 
   void ClearActiveTokens();
 
+  // Returns true if we determinize the lattice during decoding.
+  bool DeterminizeIncrementally() const {
+    return config_.determinize_lattice && config_.determinize_period > 0;
+  }
+
+  // Called after PruneActiveTokens() during decoding; if enough frames have
+  // been decoded since the last chunk, determinizes the next chunk, ending at
+  // the frame within the last determinize_period / 2 allowed frames that has
+  // the fewest tokens.
+  void MaybeDeterminizeChunk();
+
+  // Builds the raw lattice of the frames num_frames_determinized_ ...
+  // end_frame (indexes into active_toks_) and gives it to determinizer_.
+  // If "is_last" it includes all frames to the end, with final-probs (if
+  // use_final_probs); otherwise the tokens on end_frame get token labels.
+  void DeterminizeChunk(int32 end_frame, bool is_last, bool use_final_probs);
+
+  // Incremental determinization (see DeterminizeIncrementally()).
+  LatticeIncrementalDeterminizer determinizer_;
+  // The frame (index into active_toks_) the last chunk ended at.
+  int32 num_frames_determinized_;
+  // The token labels of the tokens on that frame.
+  unordered_map<Token*, LatticeArc::Label> token2label_;
+  // False if determinization of any chunk terminated early.
+  bool determinize_ok_;
+  // True once the last chunk was determinized; then no more decoding is
+  // allowed.
+  bool determinized_all_;
+
+  // The beam and max-active in use: those of config_, unless scaled by
+  // AdaptBeam().
+  BaseFloat beam_scale_;
+  BaseFloat cur_beam_;
+  int32 cur_max_active_;
+  // For AdaptBeam(): the decoding time and number of frames since its last
+  // call.  The timer measures each frame.
+  double rtf_time_;
+  int32 rtf_num_frames_;
+  Timer rtf_timer_;
+
+  // Statistics, if requested with SetStats(); not owned here.
+  DecoderStats *stats_;
+  // Times the phases for stats_.
+  Timer stats_timer_;
 };
 
 
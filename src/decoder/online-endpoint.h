@@ -0,0 +1,163 @@
+// decoder/online-endpoint.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_ONLINE_ENDPOINT_H_
+#define KALDI_DECODER_ONLINE_ENDPOINT_H_
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/options-itf.h"
+#include "util/parse-options.h"
+#include "decoder/lattice-faster-decoder.h"
+
+namespace eesen {
+
+/**
+   This header contains the endpointing rules used in online decoding, i.e.
+   the rules that decide when the user has stopped talking so we can stop
+   decoding the utterance.  With CTC models the natural notion of "silence"
+   is the blank token: the trailing silence is the number of frames at the end
+   of the best path that carry blank (or other configured) tokens.
+
+   An endpoint is detected if any of the rules fires.  Each rule has the
+   following parameters:
+     - must_contain_nonsilence: if true, the rule only applies once the best
+       path contains a non-blank token.
+     - min_trailing_silence: the trailing blank duration, in seconds, must be
+       at least this.
+     - max_relative_cost: the cost of the best final token relative to the
+       best token (see LatticeFasterDecoder::FinalRelativeCost()) must be no
+       more than this.  Infinity means "no constraint".
+     - min_utterance_length: the number of seconds decoded must be at least
+       this.
+
+   The defaults of the rules are:
+     rule1: stop after 5 seconds of blank even if nothing was decoded.
+     rule2: stop after 0.5 seconds of trailing blank if we reached a final
+            state with a good probability (relative cost < 2).
+     rule3: stop after 1.0 seconds of trailing blank if we reached a final
+            state with a reasonable probability (relative cost < 8).
+     rule4: stop after 2.0 seconds of trailing blank whether or not we
+            reached a final state.
+     rule5: stop once the utterance reaches 20 seconds, whatever happens.
+*/
+
+struct OnlineEndpointRule {
+  bool must_contain_nonsilence;
+  BaseFloat min_trailing_silence;
+  BaseFloat max_relative_cost;
+  BaseFloat min_utterance_length;
+
+  OnlineEndpointRule(bool must_contain_nonsilence = true,
+                     BaseFloat min_trailing_silence = 1.0,
+                     BaseFloat max_relative_cost =
+                     std::numeric_limits<BaseFloat>::infinity(),
+                     BaseFloat min_utterance_length = 0.0):
+      must_contain_nonsilence(must_contain_nonsilence),
+      min_trailing_silence(min_trailing_silence),
+      max_relative_cost(max_relative_cost),
+      min_utterance_length(min_utterance_length) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("must-contain-nonsilence", &must_contain_nonsilence,
+                 "If true, for this endpointing rule to apply there must "
+                 "be non-blank in the best-path traceback.");
+    po->Register("min-trailing-silence", &min_trailing_silence,
+                 "This endpointing rule requires duration of trailing blank "
+                 "(in seconds) to be >= this value.");
+    po->Register("max-relative-cost", &max_relative_cost,
+                 "This endpointing rule requires relative-cost of final-states "
+                 "to be <= this value (describes how good the probability "
+                 "of final-states is).");
+    po->Register("min-utterance-length", &min_utterance_length,
+                 "This endpointing rule requires utterance-length (in seconds) "
+                 "to be >= this value.");
+  }
+  // for convenience add this RegisterWithPrefix function, because
+  // we'll be registering this as a member of a higher-level object.
+  void RegisterWithPrefix(const std::string &prefix, OptionsItf *po) {
+    ParseOptions po_prefix(prefix, po);
+    this->Register(&po_prefix);
+  }
+};
+
+
+struct OnlineEndpointConfig {
+  /// Colon-separated list of the token ids that count as silence, e.g. "1"
+  /// for the blank of a standard EESEN token FST (where <blk> is token 1).
+  std::string silence_tokens;
+
+  BaseFloat frame_shift_in_seconds;
+
+  OnlineEndpointRule rule1;
+  OnlineEndpointRule rule2;
+  OnlineEndpointRule rule3;
+  OnlineEndpointRule rule4;
+  OnlineEndpointRule rule5;
+
+  OnlineEndpointConfig():
+      silence_tokens("1"),
+      frame_shift_in_seconds(0.01),
+      rule1(false, 5.0, std::numeric_limits<BaseFloat>::infinity(), 0.0),
+      rule2(true, 0.5, 2.0, 0.0),
+      rule3(true, 1.0, 8.0, 0.0),
+      rule4(true, 2.0, std::numeric_limits<BaseFloat>::infinity(), 0.0),
+      rule5(false, 0.0, std::numeric_limits<BaseFloat>::infinity(), 20.0) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("endpoint.silence-tokens", &silence_tokens, "List of token "
+                 "ids that are considered to be silence (e.g. the blank), "
+                 "colon-separated; used for endpointing.");
+    po->Register("endpoint.frame-shift", &frame_shift_in_seconds, "Duration "
+                 "in seconds of one decoded frame (larger than 0.01 if the "
+                 "network subsamples frames); used for endpointing.");
+    rule1.RegisterWithPrefix("endpoint.rule1", po);
+    rule2.RegisterWithPrefix("endpoint.rule2", po);
+    rule3.RegisterWithPrefix("endpoint.rule3", po);
+    rule4.RegisterWithPrefix("endpoint.rule4", po);
+    rule5.RegisterWithPrefix("endpoint.rule5", po);
+  }
+};
+
+
+/// This function returns true if this set of endpointing rules thinks we
+/// should terminate decoding.  Note: in verbose mode it will print logging
+/// information when returning true.
+bool EndpointDetected(const OnlineEndpointConfig &config,
+                      int32 num_frames_decoded,
+                      int32 trailing_silence_frames,
+                      BaseFloat final_relative_cost);
+
+/// Returns the number of frames at the end of the best path that carry
+/// silence tokens (see OnlineEndpointConfig::silence_tokens).  Returns
+/// num-frames-decoded if the best path contains no non-silence tokens.
+/// This traces back the best path through the token backpointers, and does
+/// not build the lattice.
+int32 TrailingSilenceLength(const OnlineEndpointConfig &config,
+                            const LatticeFasterDecoder &decoder);
+
+/// This is a higher-level convenience function that works out the
+/// arguments to the EndpointDetected function above, from the decoder.
+bool EndpointDetected(const OnlineEndpointConfig &config,
+                      const LatticeFasterDecoder &decoder);
+
+
+}  // namespace eesen
+
+#endif  // KALDI_DECODER_ONLINE_ENDPOINT_H_
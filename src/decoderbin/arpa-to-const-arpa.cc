@@ -0,0 +1,102 @@
+// decoderbin/arpa-to-const-arpa.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+
+#ifndef _MSC_VER
+#include <sys/resource.h>
+#endif
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/common-utils.h"
+#include "lm/const-arpa-lm.h"
+
+int main(int argc, char *argv[]) {
+  using namespace eesen;
+  try {
+    const char *usage =
+        "Converts an Arpa format language model into ConstArpaLm format,\n"
+        "which is an in-memory representation of the pre-built Arpa language\n"
+        "model.  The output can be used for lattice rescoring, or as the\n"
+        "language model of decode-ctc-prefix.  The words in the Arpa file\n"
+        "must already have been mapped to integers (e.g. with\n"
+        "utils/map_arpa_lm.pl).\n"
+        "\n"
+        "Usage: arpa-to-const-arpa [opts] <input-arpa> <const-arpa>\n"
+        " e.g.: arpa-to-const-arpa --bos-symbol=1 --eos-symbol=2 \\\n"
+        "                          arpa.txt const_arpa\n";
+
+    ParseOptions po(usage);
+
+    int32 unk_symbol = -1;
+    int32 bos_symbol = -1;
+    int32 eos_symbol = -1;
+    bool natural_base = true;
+    int32 quantize_bits = 0;
+    int32 num_threads = 1;
+    po.Register("natural-base", &natural_base, "True if we use natural base "
+                "for log-probabilities, false if we use base 10 as in the "
+                "Arpa file.");
+    po.Register("unk-symbol", &unk_symbol, "Integer corresponds to unknown-word "
+                "in language model. -1 if no such word is provided.");
+    po.Register("bos-symbol", &bos_symbol, "Integer corresponds to <s>. You "
+                "must set this to your actual BOS integer.");
+    po.Register("eos-symbol", &eos_symbol, "Integer corresponds to </s>. You "
+                "must set this to your actual EOS integer.");
+    po.Register("quantize-bits", &quantize_bits, "If 8 or 16, store the "
+                "log-probabilities as indexes of that many bits into a "
+                "codebook for each n-gram order, which saves memory at some "
+                "cost in precision (0 means store them as floats).");
+    po.Register("num-threads", &num_threads, "Number of threads used to parse "
+                "the Arpa file and build the language model; the output is "
+                "the same for any number of threads.");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    if (bos_symbol == -1 || eos_symbol == -1)
+      KALDI_ERR << "Please set --bos-symbol and --eos-symbol.";
+
+    std::string arpa_rxfilename = po.GetArg(1),
+        const_arpa_wxfilename = po.GetArg(2);
+
+    Timer timer;
+    bool ans = BuildConstArpaLm(natural_base, bos_symbol, eos_symbol,
+                                unk_symbol, arpa_rxfilename,
+                                const_arpa_wxfilename, quantize_bits,
+                                num_threads);
+    KALDI_LOG << "Built ConstArpaLm in " << timer.Elapsed() << " seconds.";
+#ifndef _MSC_VER
+    struct rusage resource_usage;
+    if (getrusage(RUSAGE_SELF, &resource_usage) == 0)
+      KALDI_LOG << "Peak memory usage was " << (resource_usage.ru_maxrss / 1024)
+                << " MB.";  // ru_maxrss is in kilobytes.
+#endif
+    if (ans)
+      return 0;
+    else
+      return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -28,6 +28,7 @@
 
 #include <string>
 #include "lm/kaldi-lm.h"
+#include "lm/streaming-lm-fst.h"
 #include "util/parse-options.h"
 
 int main(int argc, char *argv[]) {
@@ -38,7 +39,12 @@ int main(int argc, char *argv[]) {
     eesen::ParseOptions po(usage);
 
     bool natural_base = true;
+    bool low_memory = false;
     po.Register("natural-base", &natural_base, "Use log-base e (not log-base 10)");
+    po.Register("low-memory", &low_memory, "Read the n-grams one at a time and "
+                "write the FST from a compact representation, without building "
+                "it in memory; the output is the same, and the peak memory is "
+                "close to the size of the output FST.");
     po.Read(argc, argv);
 
     if (po.NumArgs() != 1 && po.NumArgs() != 2) {
@@ -48,6 +54,16 @@ int main(int argc, char *argv[]) {
     std::string arpa_filename = po.GetArg(1),
         fst_filename = po.GetOptArg(2);
     
+    if (low_memory) {
+      eesen::StreamingLmFstConverter converter;
+      {
+        eesen::Input ki(arpa_filename);
+        converter.Read(ki.Stream(), natural_base);
+      }
+      if (!converter.Write(fst_filename))
+        KALDI_ERR << "Error writing language model FST to " << fst_filename;
+      exit(0);
+    }
     eesen::LangModelFst lm;
     // read from standard input and write to standard output
     lm.Read(arpa_filename, eesen::kArpaLm, NULL, natural_base);
@@ -0,0 +1,224 @@
+// decoderbin/decode-ctc-prefix.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/ctc-prefix-decoder.h"
+#include "lm/const-arpa-lm.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+// Splits a UTF-8 string into its characters.
+static void SplitUtf8(const std::string &str, std::vector<std::string> *chars) {
+  chars->clear();
+  for (size_t i = 0; i < str.size(); ) {
+    size_t len = 1;
+    unsigned char c = str[i];
+    if (c >= 0xF0) len = 4;
+    else if (c >= 0xE0) len = 3;
+    else if (c >= 0xC0) len = 2;
+    chars->push_back(str.substr(i, len));
+    i += len;
+  }
+}
+
+// Works out the spelling (sequence of units) of each word in word_syms whose
+// characters are all in unit_syms.  Returns the number of words skipped.
+static int32 BuildSpellings(const fst::SymbolTable &word_syms,
+                            const fst::SymbolTable &unit_syms,
+                            CtcPrefixDecoder::SpellingMap *spellings) {
+  int32 num_skipped = 0;
+  std::vector<std::string> chars;
+  for (fst::SymbolTableIterator iter(word_syms); !iter.Done(); iter.Next()) {
+    std::string word = iter.Symbol();
+    if (iter.Value() == 0 || word.empty() || word[0] == '<' || word[0] == '#')
+      continue;  // <eps>, <s>, </s>, <UNK>, disambiguation symbols.
+    SplitUtf8(word, &chars);
+    std::vector<int32> spelling(chars.size());
+    size_t i;
+    for (i = 0; i < chars.size(); i++) {
+      int64 unit = unit_syms.Find(chars[i]);
+      if (unit <= 0) break;
+      spelling[i] = unit;
+    }
+    if (i < chars.size()) {
+      num_skipped++;
+      continue;
+    }
+    (*spellings)[spelling] = iter.Value();
+  }
+  return num_skipped;
+}
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+
+    const char *usage =
+        "Decode CTC log-posteriors with prefix beam search, without a decoding\n"
+        "graph.  The log-posteriors should not be divided by priors (e.g. use\n"
+        "net-output-extract --apply-log=true); column 0 is the blank and column\n"
+        "c > 0 is the unit with id c in units.txt.  A language model in\n"
+        "ConstArpaLm format (see arpa-to-const-arpa) can be given with --lm.\n"
+        "If --word-symbol-table is also given, the LM is over words, which are\n"
+        "formed from the characters between occurrences of --space-unit, and\n"
+        "the output is words; otherwise the LM (if any) is over units and the\n"
+        "output is units.\n"
+        "Usage: decode-ctc-prefix [options] loglikes-rspecifier "
+        "transcriptions-wspecifier\n"
+        " e.g.: decode-ctc-prefix --lm=G.carpa --unit-symbol-table=units.txt \\\n"
+        "         --word-symbol-table=words.txt ark:loglikes.ark ark,t:words.txt\n";
+    ParseOptions po(usage);
+    Timer timer;
+    CtcPrefixDecoderConfig config;
+    std::string lm_rxfilename, unit_syms_filename, word_syms_filename,
+        space_unit = "<SPACE>", unk_word = "<UNK>";
+
+    config.Register(&po);
+    po.Register("lm", &lm_rxfilename, "Language model in ConstArpaLm format "
+                "(optional).");
+    po.Register("unit-symbol-table", &unit_syms_filename, "Symbol table for "
+                "units (units.txt); needed for word-level decoding, otherwise "
+                "only used for debug output.");
+    po.Register("word-symbol-table", &word_syms_filename, "Symbol table for "
+                "words; if given, decoding is done at the word level.");
+    po.Register("space-unit", &space_unit, "Unit that separates words "
+                "(word-level decoding only).");
+    po.Register("unk-word", &unk_word, "Word that words not in the word symbol "
+                "table are mapped to (word-level decoding only).");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string loglikes_rspecifier = po.GetArg(1),
+        transcript_wspecifier = po.GetArg(2);
+
+    fst::SymbolTable *unit_syms = NULL, *word_syms = NULL;
+    if (unit_syms_filename != "")
+      if (!(unit_syms = fst::SymbolTable::ReadText(unit_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                  << unit_syms_filename;
+    if (word_syms_filename != "") {
+      if (!(word_syms = fst::SymbolTable::ReadText(word_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                  << word_syms_filename;
+      if (unit_syms == NULL || lm_rxfilename == "")
+        KALDI_ERR << "Word-level decoding needs --unit-symbol-table and --lm.";
+    }
+
+    ConstArpaLm *const_arpa = NULL;
+    ConstArpaLmDeterministicFst *lm_fst = NULL;
+    if (lm_rxfilename != "") {
+      const_arpa = new ConstArpaLm();
+      ReadConstArpaLm(lm_rxfilename, const_arpa);
+      lm_fst = new ConstArpaLmDeterministicFst(*const_arpa);
+    }
+
+    CtcPrefixDecoder::SpellingMap spellings;
+    int32 space_id = -1, unk_id = -1;
+    if (word_syms != NULL) {
+      space_id = unit_syms->Find(space_unit);
+      unk_id = word_syms->Find(unk_word);
+      if (space_id <= 0)
+        KALDI_ERR << "Space unit " << space_unit << " is not in "
+                  << unit_syms_filename;
+      if (unk_id <= 0)
+        KALDI_ERR << "Unknown word " << unk_word << " is not in "
+                  << word_syms_filename;
+      int32 num_skipped = BuildSpellings(*word_syms, *unit_syms, &spellings);
+      KALDI_LOG << "Built spellings of " << spellings.size() << " words; "
+                << num_skipped << " words could not be spelled with the units.";
+    }
+
+    CtcPrefixDecoder decoder(config, lm_fst,
+                             (word_syms != NULL ? &spellings : NULL),
+                             space_id, unk_id);
+
+    SequentialBaseFloatMatrixReader loglike_reader(loglikes_rspecifier);
+    Int32VectorWriter transcript_writer(transcript_wspecifier);
+
+    double tot_score = 0.0;
+    int64 frame_count = 0;
+    int32 num_success = 0, num_fail = 0;
+    for (; !loglike_reader.Done(); loglike_reader.Next()) {
+      std::string utt = loglike_reader.Key();
+      const Matrix<BaseFloat> &loglikes = loglike_reader.Value();
+      if (loglikes.NumRows() == 0) {
+        KALDI_WARN << "Zero-length utterance: " << utt;
+        num_fail++;
+        continue;
+      }
+
+      decoder.Decode(loglikes);
+      std::vector<int32> tokens, words;
+      BaseFloat score = decoder.GetBestPath(&tokens, &words);
+      if (score == kLogZeroFloat) {
+        KALDI_WARN << "No prefix survived for utterance " << utt;
+        num_fail++;
+        continue;
+      }
+      const std::vector<int32> &output = (word_syms != NULL ? words : tokens);
+      transcript_writer.Write(utt, output);
+
+      const fst::SymbolTable *syms = (word_syms != NULL ? word_syms : unit_syms);
+      if (syms != NULL) {
+        std::cerr << utt << ' ';
+        for (size_t i = 0; i < output.size(); i++) {
+          std::string s = syms->Find(output[i]);
+          if (s == "")
+            KALDI_ERR << "Word-id " << output[i] << " not in symbol table.";
+          std::cerr << s << ' ';
+        }
+        std::cerr << '\n';
+      }
+      KALDI_VLOG(1) << "Score for utterance " << utt << " is " << score
+                    << " over " << loglikes.NumRows() << " frames.";
+      tot_score += score;
+      frame_count += loglikes.NumRows();
+      num_success++;
+    }
+
+    double elapsed = timer.Elapsed();
+    KALDI_LOG << "Time taken "<< elapsed
+              << "s: real-time factor assuming 100 frames/sec is "
+              << (elapsed*100.0/frame_count);
+    KALDI_LOG << "Done " << num_success << " utterances, failed for "
+              << num_fail;
+    KALDI_LOG << "Overall score per frame is " << (tot_score/frame_count)
+              << " over " << frame_count << " frames.";
+
+    delete lm_fst;
+    delete const_arpa;
+    delete unit_syms;
+    delete word_syms;
+    if (num_success != 0) return 0;
+    else return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -44,14 +44,23 @@ int main(int argc, char *argv[]) {
     ParseOptions po(usage);
     bool binary = true;
     BaseFloat acoustic_scale = 0.1;
+    BaseFloat blank_threshold = 1.0;
     bool allow_partial = true;
-    std::string word_syms_filename;
+    std::string word_syms_filename, stats_wspecifier;
     FasterDecoderOptions decoder_opts;
     decoder_opts.Register(&po, true);  // true == include obscure settings.
     po.Register("binary", &binary, "Write output in binary mode");
     po.Register("allow-partial", &allow_partial, "Produce output even when final state was not reached");
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
+    po.Register("blank-threshold", &blank_threshold, "If < 1.0, each run of "
+                "frames whose blank posterior is >= this value is collapsed "
+                "into one frame for decoding (speeds up CTC decoding); the "
+                "alignments keep the original frame timing.");
+    po.Register("stats-wspecifier", &stats_wspecifier, "If supplied, write "
+                "decoder statistics for each utterance (active tokens and arcs "
+                "per frame, max/min-active cutoffs and time per phase) to this "
+                "table, and log a summary at the end.");
 
     po.Read(argc, argv);
 
@@ -69,6 +78,9 @@ int main(int argc, char *argv[]) {
 
     Int32VectorWriter alignment_writer(alignment_wspecifier);
 
+    DecoderStatsWriter stats_writer(stats_wspecifier);
+    DecoderStats utt_stats, total_stats;
+
     fst::SymbolTable *word_syms = NULL;
     if (word_syms_filename != "") {
       word_syms = fst::SymbolTable::ReadText(word_syms_filename);
@@ -89,6 +101,7 @@ int main(int argc, char *argv[]) {
     eesen::int64 frame_count = 0;
     int num_success = 0, num_fail = 0;
     FasterDecoder decoder(*decode_fst, decoder_opts);
+    if (stats_writer.IsOpen()) decoder.SetStats(&utt_stats);
 
     Timer timer;
 
@@ -102,8 +115,20 @@ int main(int argc, char *argv[]) {
         continue;
       }
 
-      DecodableMatrixScaled decodable(loglikes, acoustic_scale);
-      decoder.Decode(&decodable);
+      std::vector<int32> frame_lengths;  // set if frames are collapsed.
+      if (blank_threshold < 1.0) {
+        DecodableMatrixScaledCollapsed decodable(loglikes, acoustic_scale,
+                                                 blank_threshold);
+        decoder.Decode(&decodable);
+        frame_lengths = decodable.FrameLengths();
+      } else {
+        DecodableMatrixScaled decodable(loglikes, acoustic_scale);
+        decoder.Decode(&decodable);
+      }
+      if (stats_writer.IsOpen()) {
+        stats_writer.Write(key, utt_stats);
+        total_stats.Add(utt_stats);
+      }
 
       VectorFst<LatticeArc> decoded;  // linear FST.
 
@@ -119,6 +144,12 @@ int main(int argc, char *argv[]) {
         frame_count += loglikes.NumRows();
 
         GetLinearSymbolSequence(decoded, &alignment, &words, &weight);
+        if (blank_threshold < 1.0) {  // map back to the original frames.
+          std::vector<int32> collapsed(alignment);
+          alignment.clear();
+          for (size_t i = 0; i < collapsed.size(); i++)
+            alignment.insert(alignment.end(), frame_lengths[i], collapsed[i]);
+        }
 
         words_writer.Write(key, words);
         if (alignment_writer.IsOpen())
@@ -154,6 +185,8 @@ int main(int argc, char *argv[]) {
               << num_fail;
     KALDI_LOG << "Overall log-likelihood per frame is " << (tot_like/frame_count)
               << " over " << frame_count << " frames.";
+    if (stats_writer.IsOpen())
+      KALDI_LOG << "Decoder statistics: " << total_stats.Info();
 
     if (word_syms) delete word_syms;
     delete decode_fst;
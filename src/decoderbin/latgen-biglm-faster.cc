@@ -0,0 +1,172 @@
+// decoderbin/latgen-biglm-faster.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/decoder-wrappers.h"
+#include "decoder/decodable-matrix.h"
+#include "lm/const-arpa-lm.h"
+#include "base/timer.h"
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+    using fst::SymbolTable;
+    using fst::VectorFst;
+    using fst::StdArc;
+
+    const char *usage =
+        "Generate lattices, reading log-likelihoods as matrices, with on-the-fly\n"
+        "rescoring by a big language model.  The decoding graph is built with a\n"
+        "small LM (old-lm-fst-in is the G.fst of that LM); during search, the\n"
+        "small LM's scores are subtracted and the big LM's scores (in\n"
+        "ConstArpaLm format, see arpa-to-const-arpa) are added as each word is\n"
+        "crossed, so the result is as if the graph had been built with the big\n"
+        "LM.\n"
+        "Usage: latgen-biglm-faster [options] fst-in old-lm-fst-in new-lm-in "
+        "loglikes-rspecifier lattice-wspecifier [ words-wspecifier "
+        "[alignments-wspecifier] ]\n"
+        " e.g.: latgen-biglm-faster TLG.fst G.fst G.carpa ark:loglikes.ark "
+        "ark:lat.ark\n";
+    ParseOptions po(usage);
+    Timer timer;
+    bool allow_partial = false;
+    BaseFloat acoustic_scale = 0.1;
+    int32 lm_cache_size = 100000;
+    LatticeFasterDecoderConfig config;
+    CompactLatticeWriteOptions lat_write_opts;
+
+    std::string word_syms_filename;
+    config.Register(&po);
+    lat_write_opts.Register(&po);
+    po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
+
+    po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
+    po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+    po.Register("lm-cache-size", &lm_cache_size, "Number of LM arcs (pairs of "
+                "LM state and word) cached during decoding.");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 5 || po.NumArgs() > 7) {
+      po.PrintUsage();
+      exit(1);
+    }
+    SetCompactLatticeWriteOptions(lat_write_opts);
+
+    std::string fst_in_str = po.GetArg(1),
+        old_lm_fst_rxfilename = po.GetArg(2),
+        new_lm_rxfilename = po.GetArg(3),
+        feature_rspecifier = po.GetArg(4),
+        lattice_wspecifier = po.GetArg(5),
+        words_wspecifier = po.GetOptArg(6),
+        alignment_wspecifier = po.GetOptArg(7);
+
+    // The old LM's backoff arcs have #0 on the input side, but epsilon on
+    // the output side, which is what BackoffDeterministicOnDemandFst expects.
+    VectorFst<StdArc> *old_lm_fst = fst::ReadFstKaldi(old_lm_fst_rxfilename);
+    fst::Project(old_lm_fst, fst::PROJECT_OUTPUT);
+    fst::ArcSort(old_lm_fst, fst::ILabelCompare<StdArc>());
+    fst::BackoffDeterministicOnDemandFst<StdArc> old_lm_dfst(*old_lm_fst);
+    fst::ScaleDeterministicOnDemandFst<StdArc> old_lm_neg_dfst(-1.0,
+                                                               &old_lm_dfst);
+
+    ConstArpaLm new_lm;
+    ReadConstArpaLm(new_lm_rxfilename, &new_lm);
+    ConstArpaLmDeterministicFst new_lm_dfst(new_lm);
+
+    fst::ComposeDeterministicOnDemandFst<StdArc> lm_diff_dfst(&old_lm_neg_dfst,
+                                                              &new_lm_dfst);
+    fst::CacheDeterministicOnDemandFst<StdArc> cached_lm_diff_dfst(
+        &lm_diff_dfst, lm_cache_size);
+
+    bool determinize = config.determinize_lattice;
+    CompactLatticeWriter compact_lattice_writer;
+    LatticeWriter lattice_writer;
+    if (! (determinize ? compact_lattice_writer.Open(lattice_wspecifier)
+           : lattice_writer.Open(lattice_wspecifier)))
+      KALDI_ERR << "Could not open table for writing lattices: "
+                 << lattice_wspecifier;
+
+    Int32VectorWriter words_writer(words_wspecifier);
+
+    Int32VectorWriter alignment_writer(alignment_wspecifier);
+
+    fst::SymbolTable *word_syms = NULL;
+    if (word_syms_filename != "")
+      if (!(word_syms = fst::SymbolTable::ReadText(word_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                   << word_syms_filename;
+
+    double tot_like = 0.0;
+    eesen::int64 frame_count = 0;
+    int num_success = 0, num_fail = 0;
+
+    SequentialBaseFloatMatrixReader loglike_reader(feature_rspecifier);
+    // Read the FST after the table reader, see decode-faster.cc.
+    VectorFst<StdArc> *decode_fst = fst::ReadFstKaldi(fst_in_str);
+
+    {
+      LatticeFasterDecoder decoder(*decode_fst, config, &cached_lm_diff_dfst);
+
+      for (; !loglike_reader.Done(); loglike_reader.Next()) {
+        std::string utt = loglike_reader.Key();
+        Matrix<BaseFloat> loglikes (loglike_reader.Value());
+        loglike_reader.FreeCurrent();
+        if (loglikes.NumRows() == 0) {
+          KALDI_WARN << "Zero-length utterance: " << utt;
+          num_fail++;
+          continue;
+        }
+
+        DecodableMatrixScaled decodable(loglikes, acoustic_scale);
+        double like;
+        if (DecodeUtteranceLatticeFaster(
+                decoder, decodable, word_syms, utt,
+                acoustic_scale, determinize, allow_partial, &alignment_writer,
+                &words_writer, &compact_lattice_writer, &lattice_writer,
+                &like)) {
+          tot_like += like;
+          frame_count += loglikes.NumRows();
+          num_success++;
+        } else num_fail++;
+      }
+    }
+    delete decode_fst; // delete this only after decoder goes out of scope.
+    delete old_lm_fst;
+
+    double elapsed = timer.Elapsed();
+    KALDI_LOG << "Time taken "<< elapsed
+              << "s: real-time factor assuming 100 frames/sec is "
+              << (elapsed*100.0/frame_count);
+    KALDI_LOG << "Done " << num_success << " utterances, failed for "
+              << num_fail;
+    KALDI_LOG << "Overall log-likelihood per frame is " << (tot_like/frame_count) << " over "
+              << frame_count<<" frames.";
+
+    if (word_syms) delete word_syms;
+    if (num_success != 0) return 0;
+    else return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,195 @@
+// decoderbin/latgen-faster-online.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/decoder-wrappers.h"
+#include "decoder/decodable-matrix.h"
+#include "decoder/online-endpoint.h"
+#include "base/timer.h"
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+    using fst::SymbolTable;
+    using fst::VectorFst;
+    using fst::StdArc;
+
+    const char *usage =
+        "Generate lattices in online mode, reading log-likelihoods as matrices.\n"
+        "The log-likelihoods of each utterance are fed to the decoder a chunk\n"
+        "at a time, as they would arrive from a streaming front end, and the\n"
+        "stable part of the best path is output as a partial result after each\n"
+        "chunk.  With --do-endpointing=true, decoding of an utterance stops\n"
+        "once an endpoint is detected.\n"
+        "Usage: latgen-faster-online [options] fst-in loglikes-rspecifier"
+        " lattice-wspecifier [ words-wspecifier [alignments-wspecifier] ]\n";
+    ParseOptions po(usage);
+    Timer timer;
+    bool allow_partial = true;
+    BaseFloat acoustic_scale = 0.1;
+    int32 chunk_length = 20;
+    bool do_endpointing = false;
+    LatticeFasterDecoderConfig config;
+    CompactLatticeWriteOptions lat_write_opts;
+    OnlineEndpointConfig endpoint_config;
+
+    std::string word_syms_filename;
+    config.Register(&po);
+    endpoint_config.Register(&po);
+    lat_write_opts.Register(&po);
+    po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
+    po.Register("chunk-length", &chunk_length, "Number of frames of "
+                "log-likelihoods passed to the decoder at a time");
+    po.Register("do-endpointing", &do_endpointing, "If true, apply endpoint "
+                "detection and stop decoding an utterance at the endpoint");
+    po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
+    po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 3 || po.NumArgs() > 5) {
+      po.PrintUsage();
+      exit(1);
+    }
+    SetCompactLatticeWriteOptions(lat_write_opts);
+    if (chunk_length <= 0)
+      KALDI_ERR << "--chunk-length must be positive.";
+
+    std::string fst_in_str = po.GetArg(1),
+        loglikes_rspecifier = po.GetArg(2),
+        lattice_wspecifier = po.GetArg(3),
+        words_wspecifier = po.GetOptArg(4),
+        alignment_wspecifier = po.GetOptArg(5);
+
+    bool determinize = config.determinize_lattice;
+    CompactLatticeWriter compact_lattice_writer;
+    LatticeWriter lattice_writer;
+    if (! (determinize ? compact_lattice_writer.Open(lattice_wspecifier)
+           : lattice_writer.Open(lattice_wspecifier)))
+      KALDI_ERR << "Could not open table for writing lattices: "
+                 << lattice_wspecifier;
+
+    Int32VectorWriter words_writer(words_wspecifier);
+
+    Int32VectorWriter alignment_writer(alignment_wspecifier);
+
+    fst::SymbolTable *word_syms = NULL;
+    if (word_syms_filename != "")
+      if (!(word_syms = fst::SymbolTable::ReadText(word_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                   << word_syms_filename;
+
+    SequentialBaseFloatMatrixReader loglike_reader(loglikes_rspecifier);
+    // Read the FST after the table reader, see decode-faster.cc.
+    VectorFst<StdArc> *decode_fst = fst::ReadFstKaldi(fst_in_str);
+
+    double tot_like = 0.0, max_chunk_time = 0.0;
+    eesen::int64 frame_count = 0, chunk_count = 0;
+    int num_success = 0, num_fail = 0, num_endpoint = 0;
+
+    {
+      LatticeFasterDecoder decoder(*decode_fst, config);
+
+      for (; !loglike_reader.Done(); loglike_reader.Next()) {
+        std::string utt = loglike_reader.Key();
+        const Matrix<BaseFloat> &loglikes = loglike_reader.Value();
+        if (loglikes.NumRows() == 0) {
+          KALDI_WARN << "Zero-length utterance: " << utt;
+          num_fail++;
+          continue;
+        }
+
+        DecodableMatrixScaledOnline decodable(acoustic_scale);
+        decoder.InitDecoding();
+        int32 num_stable_words = 0;
+        for (int32 offset = 0; offset < loglikes.NumRows();
+             offset += chunk_length) {
+          Timer chunk_timer;
+          int32 this_chunk = std::min(chunk_length,
+                                      loglikes.NumRows() - offset);
+          decodable.AcceptLoglikes(loglikes.RowRange(offset, this_chunk));
+          decoder.AdvanceDecoding(&decodable);
+
+          // Output the partial result if its stable part has grown.
+          Lattice partial;
+          decoder.GetStableBestPath(&partial);
+          std::vector<int32> alignment, words;
+          LatticeWeight weight;
+          GetLinearSymbolSequence(partial, &alignment, &words, &weight);
+          if (words.size() > num_stable_words) {
+            num_stable_words = words.size();
+            if (word_syms != NULL) {
+              std::cerr << utt << " [partial, frame "
+                        << decoder.NumFramesDecoded() << "] ";
+              for (size_t i = 0; i < words.size(); i++)
+                std::cerr << word_syms->Find(words[i]) << ' ';
+              std::cerr << '\n';
+            }
+          }
+          bool endpoint = do_endpointing &&
+              EndpointDetected(endpoint_config, decoder);
+          double elapsed = chunk_timer.Elapsed();
+          max_chunk_time = std::max(max_chunk_time, elapsed);
+          chunk_count++;
+          if (endpoint) {
+            KALDI_VLOG(1) << "Endpoint detected for utterance " << utt
+                          << " at frame " << decoder.NumFramesDecoded();
+            num_endpoint++;
+            break;
+          }
+        }
+        decodable.InputFinished();
+        decoder.FinalizeDecoding();
+
+        double like;
+        if (OutputUtteranceLatticeFaster(
+                decoder, word_syms, utt, acoustic_scale, determinize,
+                allow_partial, &alignment_writer, &words_writer,
+                &compact_lattice_writer, &lattice_writer, &like)) {
+          tot_like += like;
+          frame_count += decoder.NumFramesDecoded();
+          num_success++;
+        } else num_fail++;
+      }
+    }
+    delete decode_fst; // delete this only after decoder goes out of scope.
+
+    double elapsed = timer.Elapsed();
+    KALDI_LOG << "Time taken "<< elapsed
+              << "s: real-time factor assuming 100 frames/sec is "
+              << (elapsed*100.0/frame_count);
+    KALDI_LOG << "Average time per chunk of " << chunk_length << " frames is "
+              << (elapsed / chunk_count) << "s, maximum is " << max_chunk_time
+              << "s";
+    KALDI_LOG << "Done " << num_success << " utterances, failed for "
+              << num_fail << "; endpoint detected in " << num_endpoint;
+    KALDI_LOG << "Overall log-likelihood per frame is " << (tot_like/frame_count) << " over "
+              << frame_count<<" frames.";
+
+    if (word_syms) delete word_syms;
+    if (num_success != 0) return 0;
+    else return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -47,14 +47,25 @@ int main(int argc, char *argv[]) {
     Timer timer;
     bool allow_partial = false;
     BaseFloat acoustic_scale = 0.1;
+    BaseFloat blank_threshold = 1.0;
     LatticeFasterDecoderConfig config;
+    CompactLatticeWriteOptions lat_write_opts;
     
-    std::string word_syms_filename;
+    std::string word_syms_filename, stats_wspecifier;
     config.Register(&po);
+    lat_write_opts.Register(&po);
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
 
     po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
     po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+    po.Register("blank-threshold", &blank_threshold, "If < 1.0, each run of "
+                "frames whose blank posterior is >= this value is collapsed "
+                "into one frame for decoding (speeds up CTC decoding); the "
+                "output keeps the original frame timing.");
+    po.Register("stats-wspecifier", &stats_wspecifier, "If supplied, write "
+                "decoder statistics for each utterance (active tokens and arcs "
+                "per frame, max/min-active cutoffs, pruning, lattice sizes and "
+                "time per phase) to this table, and log a summary at the end.");
     
     po.Read(argc, argv);
 
@@ -62,6 +73,7 @@ int main(int argc, char *argv[]) {
       po.PrintUsage();
       exit(1);
     }
+    SetCompactLatticeWriteOptions(lat_write_opts);
 
     std::string fst_in_str = po.GetArg(1),
         feature_rspecifier = po.GetArg(2),
@@ -81,6 +93,9 @@ int main(int argc, char *argv[]) {
 
     Int32VectorWriter alignment_writer(alignment_wspecifier);
 
+    DecoderStatsWriter stats_writer(stats_wspecifier);
+    DecoderStats utt_stats, total_stats;
+
     fst::SymbolTable *word_syms = NULL;
     if (word_syms_filename != "") 
       if (!(word_syms = fst::SymbolTable::ReadText(word_syms_filename)))
@@ -98,6 +113,7 @@ int main(int argc, char *argv[]) {
 
       {
         LatticeFasterDecoder decoder(*decode_fst, config);
+        if (stats_writer.IsOpen()) decoder.SetStats(&utt_stats);
     
         for (; !loglike_reader.Done(); loglike_reader.Next()) {
           std::string utt = loglike_reader.Key();
@@ -109,19 +125,33 @@ int main(int argc, char *argv[]) {
             continue;
           }
      
-          DecodableMatrixScaled decodable(loglikes, acoustic_scale); 
-//          DecodableMatrixScaledMapped decodable(trans_model, loglikes, acoustic_scale);
-
           double like;
-          if (DecodeUtteranceLatticeFaster(
-                  decoder, decodable, word_syms, utt,
-                  acoustic_scale, determinize, allow_partial, &alignment_writer,
-                  &words_writer, &compact_lattice_writer, &lattice_writer,
-                  &like)) {
+          bool ans;
+          if (blank_threshold < 1.0) {
+            DecodableMatrixScaledCollapsed decodable(loglikes, acoustic_scale,
+                                                     blank_threshold);
+            ans = DecodeUtteranceLatticeFaster(
+                decoder, decodable, word_syms, utt,
+                acoustic_scale, determinize, allow_partial, &alignment_writer,
+                &words_writer, &compact_lattice_writer, &lattice_writer,
+                &like, &decodable.FrameLengths());
+          } else {
+            DecodableMatrixScaled decodable(loglikes, acoustic_scale);
+            ans = DecodeUtteranceLatticeFaster(
+                decoder, decodable, word_syms, utt,
+                acoustic_scale, determinize, allow_partial, &alignment_writer,
+                &words_writer, &compact_lattice_writer, &lattice_writer,
+                &like);
+          }
+          if (ans) {
             tot_like += like;
             frame_count += loglikes.NumRows();
             num_success++;
           } else num_fail++;
+          if (stats_writer.IsOpen()) {
+            stats_writer.Write(utt, utt_stats);
+            total_stats.Add(utt_stats);
+          }
         }
       }
       delete decode_fst; // delete this only after decoder goes out of scope.
@@ -165,6 +195,8 @@ int main(int argc, char *argv[]) {
               << num_fail;
     KALDI_LOG << "Overall log-likelihood per frame is " << (tot_like/frame_count) << " over "
               << frame_count<<" frames.";
+    if (stats_writer.IsOpen())
+      KALDI_LOG << "Decoder statistics: " << total_stats.Info();
 
     if (word_syms) delete word_syms;
     if (num_success != 0) return 0;
@@ -23,6 +23,54 @@
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
 #include "lat/lattice-functions.h"
+#include "thread/kaldi-table-map.h"
+
+namespace eesen {
+
+// Computes the best path of a lattice (see RunTableMap()).
+class Lattice1BestFunc {
+ public:
+  typedef CompactLattice Input;
+  typedef CompactLattice Output;
+
+  Lattice1BestFunc(BaseFloat lm_scale, BaseFloat acoustic_scale,
+                   CompactLatticeWriter *writer):
+      lm_scale_(lm_scale), acoustic_scale_(acoustic_scale), writer_(writer),
+      num_done_(0), num_err_(0) { }
+
+  bool Process(const std::string &key, CompactLattice *clat,
+               CompactLattice *best_path) const {
+    fst::ScaleLattice(fst::LatticeScale(lm_scale_, acoustic_scale_), clat);
+    CompactLatticeShortestPath(*clat, best_path);
+    if (best_path->Start() == fst::kNoStateId) return false;
+    fst::ScaleLattice(fst::LatticeScale(1.0 / lm_scale_, 1.0 / acoustic_scale_),
+                      best_path);
+    return true;
+  }
+
+  void Write(const std::string &key, bool ok, const CompactLattice &best_path) {
+    if (!ok) {
+      KALDI_WARN << "Possibly empty lattice for utterance-id " << key
+                 << "(no output)";
+      num_err_++;
+    } else {
+      writer_->Write(key, best_path);
+      num_done_++;
+    }
+  }
+
+  int32 NumDone() const { return num_done_; }
+  int32 NumErr() const { return num_err_; }
+
+ private:
+  BaseFloat lm_scale_;
+  BaseFloat acoustic_scale_;
+  CompactLatticeWriter *writer_;
+  int32 num_done_;
+  int32 num_err_;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -42,6 +90,8 @@ int main(int argc, char *argv[]) {
         " e.g.: lattice-1best --acoustic-scale=0.1 ark:1.lats ark:1best.lats\n";
       
     ParseOptions po(usage);
+    TaskSequencerConfig sequencer_config;
+    CompactLatticeWriteOptions lat_write_opts;
     BaseFloat acoustic_scale = 1.0;
     BaseFloat ascale_factor = 1.0;
     BaseFloat lm_scale = 1.0;
@@ -49,6 +99,8 @@ int main(int argc, char *argv[]) {
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("ascale-factor", &ascale_factor, "Scaling factor for acoustic_scale.");
     po.Register("lm-scale", &lm_scale, "Scaling factor for language mdoel scores.");
+    sequencer_config.Register(&po);
+    lat_write_opts.Register(&po);
     
     po.Read(argc, argv);
 
@@ -56,6 +108,7 @@ int main(int argc, char *argv[]) {
       po.PrintUsage();
       exit(1);
     }
+    SetCompactLatticeWriteOptions(lat_write_opts);
 
     acoustic_scale *= ascale_factor;
 
@@ -67,30 +120,11 @@ int main(int argc, char *argv[]) {
     // Write as compact lattice.
     CompactLatticeWriter compact_1best_writer(lats_wspecifier); 
 
-    int32 n_done = 0, n_err = 0;
-
     if (acoustic_scale == 0.0 || lm_scale == 0.0)
       KALDI_ERR << "Do not use exactly zero acoustic or LM scale (cannot be inverted)";
-    for (; !clat_reader.Done(); clat_reader.Next()) {
-      std::string key = clat_reader.Key();
-      CompactLattice clat = clat_reader.Value();
-      clat_reader.FreeCurrent();
-      fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), &clat);
-
-      CompactLattice best_path;
-      CompactLatticeShortestPath(clat, &best_path);
-      
-      if (best_path.Start() == fst::kNoStateId) {
-        KALDI_WARN << "Possibly empty lattice for utterance-id " << key
-                   << "(no output)";
-        n_err++;
-      } else {
-        fst::ScaleLattice(fst::LatticeScale(1.0 / lm_scale, 1.0/acoustic_scale),
-                          &best_path);
-        compact_1best_writer.Write(key, best_path);
-        n_done++;
-      }
-    }
+    Lattice1BestFunc func(lm_scale, acoustic_scale, &compact_1best_writer);
+    RunTableMap(sequencer_config, &clat_reader, &func);
+    int32 n_done = func.NumDone(), n_err = func.NumErr();
     KALDI_LOG << "Done converting " << n_done << " to best path, "
               << n_err << " had errors.";
     return (n_done != 0 ? 0 : 1);
@@ -24,6 +24,94 @@
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
 #include "lat/lattice-functions.h"
+#include "thread/kaldi-table-map.h"
+
+namespace eesen {
+
+struct LatticeBestPath {
+  std::vector<int32> alignment;
+  std::vector<int32> words;
+  LatticeWeight weight;
+};
+
+// Computes the best path of a lattice as words and alignment (see
+// RunTableMap()).
+class LatticeBestPathFunc {
+ public:
+  typedef CompactLattice Input;
+  typedef LatticeBestPath Output;
+
+  LatticeBestPathFunc(BaseFloat lm_scale, BaseFloat acoustic_scale,
+                      const fst::SymbolTable *word_syms,
+                      Int32VectorWriter *transcriptions_writer,
+                      Int32VectorWriter *alignments_writer):
+      lm_scale_(lm_scale), acoustic_scale_(acoustic_scale),
+      word_syms_(word_syms), transcriptions_writer_(transcriptions_writer),
+      alignments_writer_(alignments_writer), num_done_(0), num_fail_(0),
+      num_frames_(0), tot_weight_(LatticeWeight::One()) { }
+
+  bool Process(const std::string &key, CompactLattice *clat,
+               LatticeBestPath *best) const {
+    fst::ScaleLattice(fst::LatticeScale(lm_scale_, acoustic_scale_), clat);
+    CompactLattice clat_best_path;
+    CompactLatticeShortestPath(*clat, &clat_best_path);  // A specialized
+    // implementation of shortest-path for CompactLattice.
+    Lattice best_path;
+    ConvertLattice(clat_best_path, &best_path);
+    if (best_path.Start() == fst::kNoStateId) return false;
+    GetLinearSymbolSequence(best_path, &(best->alignment), &(best->words),
+                            &(best->weight));
+    return true;
+  }
+
+  void Write(const std::string &key, bool ok, const LatticeBestPath &best) {
+    if (!ok) {
+      KALDI_WARN << "Best-path failed for key " << key;
+      num_fail_++;
+      return;
+    }
+    const LatticeWeight &weight = best.weight;
+    KALDI_LOG << "For utterance " << key << ", best cost "
+              << weight.Value1() << " + " << weight.Value2() << " = "
+              << (weight.Value1() + weight.Value2()) 
+              << " over " << best.alignment.size() << " frames.";
+    if (transcriptions_writer_->IsOpen())
+      transcriptions_writer_->Write(key, best.words);
+    if (alignments_writer_->IsOpen())
+      alignments_writer_->Write(key, best.alignment);
+    if (word_syms_ != NULL) {
+      std::cerr << key << ' ';
+      for (size_t i = 0; i < best.words.size(); i++) {
+        std::string s = word_syms_->Find(best.words[i]);
+        if (s == "")
+          KALDI_ERR << "Word-id " << best.words[i] <<" not in symbol table.";
+        std::cerr << s << ' ';
+      }
+      std::cerr << '\n';
+    }
+    num_done_++;
+    num_frames_ += best.alignment.size();
+    tot_weight_ = Times(tot_weight_, weight);
+  }
+
+  int32 NumDone() const { return num_done_; }
+  int32 NumFail() const { return num_fail_; }
+  int64 NumFrames() const { return num_frames_; }
+  const LatticeWeight &TotWeight() const { return tot_weight_; }
+
+ private:
+  BaseFloat lm_scale_;
+  BaseFloat acoustic_scale_;
+  const fst::SymbolTable *word_syms_;
+  Int32VectorWriter *transcriptions_writer_;
+  Int32VectorWriter *alignments_writer_;
+  int32 num_done_;
+  int32 num_fail_;
+  int64 num_frames_;
+  LatticeWeight tot_weight_;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -44,12 +132,14 @@ int main(int argc, char *argv[]) {
     ParseOptions po(usage);
     BaseFloat acoustic_scale = 1.0;
     BaseFloat lm_scale = 1.0;
+    TaskSequencerConfig sequencer_config;
 
     std::string word_syms_filename;
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("lm-scale", &lm_scale, "Scaling factor for LM probabilities. "
                 "Note: the ratio acoustic-scale/lm-scale is all that matters.");
     po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
+    sequencer_config.Register(&po);
     
     po.Read(argc, argv);
 
@@ -75,51 +165,12 @@ int main(int argc, char *argv[]) {
                    << word_syms_filename;
 
 
-    int32 n_done = 0, n_fail = 0;
-    int64 n_frame = 0;
-    LatticeWeight tot_weight = LatticeWeight::One();
-    
-    for (; !clat_reader.Done(); clat_reader.Next()) {
-      std::string key = clat_reader.Key();
-      CompactLattice clat = clat_reader.Value();
-      clat_reader.FreeCurrent();
-      fst::ScaleLattice(fst::LatticeScale(lm_scale, acoustic_scale), &clat);
-      CompactLattice clat_best_path;
-      CompactLatticeShortestPath(clat, &clat_best_path);  // A specialized
-      // implementation of shortest-path for CompactLattice.
-      Lattice best_path;
-      ConvertLattice(clat_best_path, &best_path);
-      if (best_path.Start() == fst::kNoStateId) {
-        KALDI_WARN << "Best-path failed for key " << key;
-        n_fail++;
-      } else {
-        std::vector<int32> alignment;
-        std::vector<int32> words;
-        LatticeWeight weight;
-        GetLinearSymbolSequence(best_path, &alignment, &words, &weight);
-        KALDI_LOG << "For utterance " << key << ", best cost "
-                  << weight.Value1() << " + " << weight.Value2() << " = "
-                  << (weight.Value1() + weight.Value2()) 
-                  << " over " << alignment.size() << " frames.";
-        if (transcriptions_wspecifier != "")
-          transcriptions_writer.Write(key, words);
-        if (alignments_wspecifier != "")
-          alignments_writer.Write(key, alignment);
-        if (word_syms != NULL) {
-          std::cerr << key << ' ';
-          for (size_t i = 0; i < words.size(); i++) {
-            std::string s = word_syms->Find(words[i]);
-            if (s == "")
-              KALDI_ERR << "Word-id " << words[i] <<" not in symbol table.";
-            std::cerr << s << ' ';
-          }
-          std::cerr << '\n';
-        }
-        n_done++;
-        n_frame += alignment.size();
-        tot_weight = Times(tot_weight, weight);
-      }
-    }
+    LatticeBestPathFunc func(lm_scale, acoustic_scale, word_syms,
+                             &transcriptions_writer, &alignments_writer);
+    RunTableMap(sequencer_config, &clat_reader, &func);
+    int32 n_done = func.NumDone(), n_fail = func.NumFail();
+    int64 n_frame = func.NumFrames();
+    LatticeWeight tot_weight = func.TotWeight();
 
     BaseFloat tot_weight_float = tot_weight.Value1() + tot_weight.Value2();
     KALDI_LOG << "Overall score per frame is " << (tot_weight_float/n_frame)
@@ -0,0 +1,258 @@
+// decoderbin/lattice-lmrescore-const-arpa.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "fstext/fstext-lib.h"
+#include "lat/kaldi-lattice.h"
+#include "lat/lattice-functions.h"
+#include "lm/const-arpa-lm.h"
+#include "thread/kaldi-mutex.h"
+#include "thread/kaldi-task-sequence.h"
+
+namespace eesen {
+
+// Copies of the old LM's G.fst, one for each task that can be rescoring at
+// the same time.  They can't share one VectorFst: looking up an arc makes a
+// shallow Copy() of it (in the SortedMatcher), and the reference count of the
+// shared implementation is not thread-safe.
+class OldLmFstPool {
+ public:
+  // Takes ownership of "fst", and makes num_copies - 1 deep copies of it.
+  OldLmFstPool(fst::VectorFst<fst::StdArc> *fst, int32 num_copies):
+      num_copies_(num_copies) {
+    KALDI_ASSERT(num_copies > 0);
+    // The copies would share the symbol tables' implementation.
+    fst->SetInputSymbols(NULL);
+    fst->SetOutputSymbols(NULL);
+    free_.push_back(fst);
+    for (int32 i = 1; i < num_copies; i++)
+      free_.push_back(new fst::VectorFst<fst::StdArc>(
+          static_cast<const fst::Fst<fst::StdArc>&>(*fst)));
+  }
+  // Returns a copy that no other task is using.
+  fst::VectorFst<fst::StdArc> *Get() {
+    mutex_.Lock();
+    KALDI_ASSERT(!free_.empty() && "More rescoring tasks than copies.");
+    fst::VectorFst<fst::StdArc> *ans = free_.back();
+    free_.pop_back();
+    mutex_.Unlock();
+    return ans;
+  }
+  void Release(fst::VectorFst<fst::StdArc> *fst) {
+    mutex_.Lock();
+    free_.push_back(fst);
+    mutex_.Unlock();
+  }
+  ~OldLmFstPool() {
+    KALDI_ASSERT(free_.size() == num_copies_);
+    DeletePointers(&free_);
+  }
+ private:
+  Mutex mutex_;
+  std::vector<fst::VectorFst<fst::StdArc>*> free_;
+  size_t num_copies_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(OldLmFstPool);
+};
+
+// Rescores one lattice.  The rescoring is done in operator () (in a worker
+// thread), and the lattice is written in the destructor, which TaskSequencer
+// calls in the order the lattices were read.  The LMs are shared between the
+// threads: the DeterministicOnDemandFst wrappers, which hold mutable state,
+// are created per lattice, and each task borrows a copy of the old LM for as
+// long as it is rescoring.
+class ConstArpaRescoreTask {
+ public:
+  ConstArpaRescoreTask(BaseFloat lm_scale,
+                       int32 lm_cache_size,
+                       const ConstArpaLm &new_lm,
+                       OldLmFstPool *old_lm_fsts,
+                       const std::string &key,
+                       const CompactLattice &clat,
+                       CompactLatticeWriter *clat_writer,
+                       int32 *num_done, int32 *num_err):
+      lm_scale_(lm_scale), lm_cache_size_(lm_cache_size), new_lm_(new_lm),
+      old_lm_fsts_(old_lm_fsts),
+      key_(key), clat_(clat), clat_writer_(clat_writer),
+      num_done_(num_done), num_err_(num_err) { }
+
+  void operator () () {
+    using fst::StdArc;
+    if (lm_scale_ != 0.0) {
+      // Scale the graph costs by 1/lm_scale, so that after adding the LM
+      // difference and scaling back, it has been added with scale lm_scale.
+      fst::ScaleLattice(fst::GraphLatticeScale(1.0 / lm_scale_), &clat_);
+      ArcSort(&clat_, fst::OLabelCompare<CompactLatticeArc>());
+
+      ConstArpaLmDeterministicFst new_lm_dfst(new_lm_, lm_cache_size_);
+      CompactLattice composed_clat;
+      if (old_lm_fsts_ != NULL) {
+        fst::VectorFst<StdArc> *old_lm_fst = old_lm_fsts_->Get();
+        {
+          fst::BackoffDeterministicOnDemandFst<StdArc> old_lm_dfst(
+              *old_lm_fst);
+          fst::ScaleDeterministicOnDemandFst<StdArc> old_lm_neg_dfst(
+              -1.0, &old_lm_dfst);
+          fst::ComposeDeterministicOnDemandFst<StdArc> lm_diff_dfst(
+              &old_lm_neg_dfst, &new_lm_dfst);
+          ComposeCompactLatticeDeterministic(clat_, &lm_diff_dfst,
+                                             &composed_clat);
+        }
+        old_lm_fsts_->Release(old_lm_fst);
+      } else {
+        ComposeCompactLatticeDeterministic(clat_, &new_lm_dfst,
+                                           &composed_clat);
+      }
+
+      // Determinizes the composed lattice.
+      Lattice composed_lat;
+      ConvertLattice(composed_clat, &composed_lat);
+      Invert(&composed_lat);
+      DeterminizeLattice(composed_lat, &clat_);
+      fst::ScaleLattice(fst::GraphLatticeScale(lm_scale_), &clat_);
+      KALDI_VLOG(2) << "For utterance " << key_ << ", "
+                    << new_lm_dfst.NumCacheHits() << " of "
+                    << new_lm_dfst.NumQueries()
+                    << " LM queries were answered from the cache.";
+    }
+  }
+
+  ~ConstArpaRescoreTask() {
+    if (clat_.Start() == fst::kNoStateId) {
+      KALDI_WARN << "Empty lattice for utterance " << key_
+                 << " (incompatible LM?)";
+      (*num_err_)++;
+    } else {
+      clat_writer_->Write(key_, clat_);
+      (*num_done_)++;
+    }
+  }
+
+ private:
+  BaseFloat lm_scale_;
+  int32 lm_cache_size_;
+  const ConstArpaLm &new_lm_;
+  OldLmFstPool *old_lm_fsts_;  // or NULL.
+  std::string key_;
+  CompactLattice clat_;
+  CompactLatticeWriter *clat_writer_;
+  int32 *num_done_;
+  int32 *num_err_;
+};
+
+}  // namespace eesen
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+    using fst::StdArc;
+
+    const char *usage =
+        "Rescores lattices with a language model in ConstArpaLm format (see\n"
+        "arpa-to-const-arpa).  If --old-lm-fst is given, the scores of the LM\n"
+        "the lattices were generated with are removed first; otherwise they\n"
+        "should have been removed beforehand (e.g. lattice-lmrescore\n"
+        "--lm-scale=-1.0).  Lattices are rescored in parallel with\n"
+        "--num-threads, and written in the order they were read.\n"
+        "\n"
+        "Usage: lattice-lmrescore-const-arpa [options] lattice-rspecifier \\\n"
+        "                   const-arpa-in lattice-wspecifier\n"
+        " e.g.: lattice-lmrescore-const-arpa --old-lm-fst=G.fst --num-threads=4 \\\n"
+        "                   ark:in.lats G.carpa ark:out.lats\n";
+
+    ParseOptions po(usage);
+    BaseFloat lm_scale = 1.0;
+    int32 lm_cache_size = 100000;
+    std::string old_lm_fst_rxfilename;
+    TaskSequencerConfig sequencer_config;
+    CompactLatticeWriteOptions lat_write_opts;
+
+    po.Register("lm-scale", &lm_scale, "Scaling factor for the language model "
+                "costs (the difference between the new and old LM, if "
+                "--old-lm-fst is given).");
+    po.Register("old-lm-fst", &old_lm_fst_rxfilename, "G.fst of the language "
+                "model the lattices were generated with; its scores are "
+                "subtracted.  Each of the --num-threads threads keeps its own "
+                "copy of it in memory.");
+    po.Register("lm-cache-size", &lm_cache_size, "Number of LM arcs cached "
+                "per lattice (the least recently used are dropped); 0 "
+                "disables the cache.");
+    sequencer_config.Register(&po);
+    lat_write_opts.Register(&po);
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 3) {
+      po.PrintUsage();
+      exit(1);
+    }
+    SetCompactLatticeWriteOptions(lat_write_opts);
+
+    std::string lats_rspecifier = po.GetArg(1),
+        lm_rxfilename = po.GetArg(2),
+        lats_wspecifier = po.GetArg(3);
+
+    // Reads the language models once (memory-mapping the ConstArpaLm if it is
+    // a file in the current format); they are shared by all the threads.
+    ConstArpaLm const_arpa;
+    ReadConstArpaLm(lm_rxfilename, &const_arpa);
+
+    OldLmFstPool *old_lm_fsts = NULL;
+    if (old_lm_fst_rxfilename != "") {
+      // The backoff arcs of G.fst have #0 on the input side but epsilon on
+      // the output side, which is what BackoffDeterministicOnDemandFst
+      // expects.
+      fst::VectorFst<StdArc> *old_lm_fst =
+          fst::ReadFstKaldi(old_lm_fst_rxfilename);
+      fst::Project(old_lm_fst, fst::PROJECT_OUTPUT);
+      fst::ArcSort(old_lm_fst, fst::ILabelCompare<StdArc>());
+      old_lm_fsts = new OldLmFstPool(old_lm_fst,
+                                     sequencer_config.num_threads);
+    }
+
+    SequentialCompactLatticeReader compact_lattice_reader(lats_rspecifier);
+    CompactLatticeWriter compact_lattice_writer(lats_wspecifier);
+
+    int32 num_done = 0, num_err = 0;
+    {
+      TaskSequencer<ConstArpaRescoreTask> sequencer(sequencer_config);
+      for (; !compact_lattice_reader.Done(); compact_lattice_reader.Next()) {
+        ConstArpaRescoreTask *task = new ConstArpaRescoreTask(
+            lm_scale, lm_cache_size, const_arpa, old_lm_fsts,
+            compact_lattice_reader.Key(), compact_lattice_reader.Value(),
+            &compact_lattice_writer, &num_done, &num_err);
+        // The task's lattice shares its data with the reader's, so the
+        // reader must let go of it before the task runs in another thread.
+        compact_lattice_reader.FreeCurrent();
+        sequencer.Run(task);
+      }
+      sequencer.Wait();
+    }
+
+    delete old_lm_fsts;
+
+    KALDI_LOG << "Rescored " << num_done << " lattices with " << num_err
+              << " errors.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -23,6 +23,41 @@
 #include "util/common-utils.h"
 #include "fstext/fstext-lib.h"
 #include "lat/kaldi-lattice.h"
+#include "thread/kaldi-table-map.h"
+
+namespace eesen {
+
+// Scales the weights of a lattice (see RunTableMap()).
+class LatticeScaleFunc {
+ public:
+  typedef CompactLattice Input;
+  typedef CompactLattice Output;
+
+  LatticeScaleFunc(const std::vector<std::vector<double> > &scale,
+                   CompactLatticeWriter *writer):
+      scale_(scale), writer_(writer), num_done_(0) { }
+
+  bool Process(const std::string &key, CompactLattice *lat,
+               CompactLattice *scaled_lat) const {
+    ScaleLattice(scale_, lat);
+    *scaled_lat = *lat;  // Shallow copy; VectorFst shares its implementation.
+    return true;
+  }
+
+  void Write(const std::string &key, bool ok, const CompactLattice &lat) {
+    writer_->Write(key, lat);
+    num_done_++;
+  }
+
+  int32 NumDone() const { return num_done_; }
+
+ private:
+  std::vector<std::vector<double> > scale_;
+  CompactLatticeWriter *writer_;
+  int32 num_done_;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -45,6 +80,8 @@ int main(int argc, char *argv[]) {
     BaseFloat lm_scale = 1.0;
     BaseFloat acoustic2lm_scale = 0.0;
     BaseFloat lm2acoustic_scale = 0.0;
+    TaskSequencerConfig sequencer_config;
+    CompactLatticeWriteOptions lat_write_opts;
     
     po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
     po.Register("ascale-factor", &ascale_factor, "Scaling factor for acoustic_scale.");
@@ -53,6 +90,8 @@ int main(int argc, char *argv[]) {
     po.Register("lm-scale", &lm_scale, "Scaling factor for graph/lm costs");
     po.Register("acoustic2lm-scale", &acoustic2lm_scale, "Add this times original acoustic costs to LM costs");
     po.Register("lm2acoustic-scale", &lm2acoustic_scale, "Add this times original LM costs to acoustic costs");
+    sequencer_config.Register(&po);
+    lat_write_opts.Register(&po);
 
     po.Read(argc, argv);
 
@@ -60,6 +99,7 @@ int main(int argc, char *argv[]) {
       po.PrintUsage();
       exit(1);
     }
+    SetCompactLatticeWriteOptions(lat_write_opts);
     
     acoustic_scale *= ascale_factor;
     
@@ -71,8 +111,6 @@ int main(int argc, char *argv[]) {
     // Write as compact lattice.
     CompactLatticeWriter compact_lattice_writer(lats_wspecifier); 
 
-    int32 n_done = 0; 
-
     KALDI_ASSERT(acoustic_scale == 1.0 || inv_acoustic_scale == 1.0);
     if (inv_acoustic_scale != 1.0)
       acoustic_scale = 1.0 / inv_acoustic_scale;
@@ -85,12 +123,9 @@ int main(int argc, char *argv[]) {
     scale[1][0] = lm2acoustic_scale;
     scale[1][1] = acoustic_scale;
     
-    for (; !compact_lattice_reader.Done(); compact_lattice_reader.Next()) {
-      CompactLattice lat = compact_lattice_reader.Value();
-      ScaleLattice(scale, &lat);
-      compact_lattice_writer.Write(compact_lattice_reader.Key(), lat);
-      n_done++;
-    }
+    LatticeScaleFunc func(scale, &compact_lattice_writer);
+    RunTableMap(sequencer_config, &compact_lattice_reader, &func);
+    int32 n_done = func.NumDone();
     KALDI_LOG << "Done " << n_done << " lattices.";
     return (n_done != 0 ? 0 : 1);
   } catch(const std::exception &e) {
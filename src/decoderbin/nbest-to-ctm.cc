@@ -21,6 +21,58 @@
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "lat/lattice-functions.h"
+#include "thread/kaldi-table-map.h"
+
+namespace eesen {
+
+struct WordAlignment {
+  std::vector<int32> words, times, lengths;
+};
+
+// Converts a linear lattice to ctm lines (see RunTableMap()).
+class NbestToCtmFunc {
+ public:
+  typedef CompactLattice Input;
+  typedef WordAlignment Output;
+
+  NbestToCtmFunc(BaseFloat frame_shift, std::ostream *os):
+      frame_shift_(frame_shift), os_(os), num_done_(0), num_err_(0) { }
+
+  bool Process(const std::string &key, CompactLattice *clat,
+               WordAlignment *ali) const {
+    return CompactLatticeToWordAlignment(*clat, &(ali->words), &(ali->times),
+                                         &(ali->lengths));
+  }
+
+  void Write(const std::string &key, bool ok, const WordAlignment &ali) {
+    if (!ok) {
+      num_err_++;
+      KALDI_WARN << "Format conversion failed for key " << key;
+      return;
+    }
+    KALDI_ASSERT(ali.words.size() == ali.times.size() &&
+                 ali.words.size() == ali.lengths.size());
+    for (size_t i = 0; i < ali.words.size(); i++) {
+      if (ali.words[i] == 0)  // Don't output anything for <eps> links, which
+        continue; // correspond to silence....
+      *os_ << key << " 1 " << (frame_shift_ * ali.times[i]) << ' '
+           << (frame_shift_ * ali.lengths[i]) << ' ' << ali.words[i]
+           << std::endl;
+    }
+    num_done_++;
+  }
+
+  int32 NumDone() const { return num_done_; }
+  int32 NumErr() const { return num_err_; }
+
+ private:
+  BaseFloat frame_shift_;
+  std::ostream *os_;
+  int32 num_done_;
+  int32 num_err_;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -48,9 +100,11 @@ int main(int argc, char *argv[]) {
 
     BaseFloat frame_shift = 0.01;
     int32 precision = 2;
+    TaskSequencerConfig sequencer_config;
     po.Register("frame-shift", &frame_shift, "Time in seconds between frames.\n");
     po.Register("precision", &precision,
                 "Number of decimal places for start duration times\n");
+    sequencer_config.Register(&po);
 
     po.Read(argc, argv);
 
@@ -64,34 +118,14 @@ int main(int argc, char *argv[]) {
 
     SequentialCompactLatticeReader clat_reader(lats_rspecifier);
     
-    int32 n_done = 0, n_err = 0;
-
     Output ko(ctm_wxfilename, false); // false == non-binary write mode.
     ko.Stream() << std::fixed;  // Set to "fixed" floating point model, where precision() specifies
     // the #digits after the decimal point.
     ko.Stream().precision(precision);
     
-    for (; !clat_reader.Done(); clat_reader.Next()) {
-      std::string key = clat_reader.Key();
-      CompactLattice clat = clat_reader.Value();
-
-      std::vector<int32> words, times, lengths;
-
-      if (!CompactLatticeToWordAlignment(clat, &words, &times, &lengths)) {
-        n_err++;
-        KALDI_WARN << "Format conversion failed for key " << key;
-      } else {
-        KALDI_ASSERT(words.size() == times.size() &&
-                     words.size() == lengths.size());
-        for (size_t i = 0; i < words.size(); i++) {
-          if (words[i] == 0)  // Don't output anything for <eps> links, which
-            continue; // correspond to silence....
-          ko.Stream() << key << " 1 " << (frame_shift * times[i]) << ' '
-                      << (frame_shift * lengths[i]) << ' ' << words[i] <<std::endl;
-        }
-        n_done++;
-      }
-    }
+    NbestToCtmFunc func(frame_shift, &(ko.Stream()));
+    RunTableMap(sequencer_config, &clat_reader, &func);
+    int32 n_done = func.NumDone(), n_err = func.NumErr();
     ko.Close(); // Note: we don't normally call Close() on these things,
     // we just let them go out of scope and it happens automatically.
     // We do it this time in order to avoid wrongly printing out a success message
@@ -0,0 +1,505 @@
+// decoderbin/net-decode-wav.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdexcept>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/cmvn.h"
+#include "feat/feature-fbank.h"
+#include "feat/online-feature.h"
+#include "feat/wave-reader.h"
+#include "net/net.h"
+#include "net/class-prior.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/decoder-wrappers.h"
+#include "decoder/decodable-matrix.h"
+#include "thread/kaldi-mutex.h"
+#include "thread/kaldi-queue.h"
+#include "thread/kaldi-thread.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+// An utterance on its way through the pipeline: the feature stage puts its
+// features in "mat", which the network stage replaces with the
+// log-likelihoods.  An empty "mat" means the utterance failed.
+struct PipelineItem {
+  std::string utt;
+  Matrix<BaseFloat> mat;
+};
+
+// The first error in a pipeline thread; the main thread rethrows it after
+// joining the threads, since an exception can't leave a thread.
+class PipelineError {
+ public:
+  void Set(const std::string &message) {
+    mutex_.Lock();
+    if (message_.empty())
+      message_ = (message.empty() ? "Unknown error" : message);
+    mutex_.Unlock();
+  }
+  // Call only after the threads have been joined.
+  void Check() const {
+    if (!message_.empty())
+      throw std::runtime_error(message_);
+  }
+ private:
+  Mutex mutex_;
+  std::string message_;
+};
+
+struct WavFeatureOptions {
+  FbankOptions fbank_opts;
+  OnlineCmvnOptions cmvn_opts;
+  DeltaFeaturesOptions delta_opts;
+  OnlineSpliceOptions splice_opts;
+  bool add_deltas;
+  bool splice_feats;
+  std::string cmvn_rspecifier;  // speaker or utterance CMVN stats.
+  std::string utt2spk_rspecifier;
+  std::string global_cmvn_stats_rxfilename;  // for online CMVN.
+
+  WavFeatureOptions(): add_deltas(false), splice_feats(false) { }
+};
+
+// Reads the waveforms and computes the features: filterbank energies, CMVN,
+// deltas and splicing, as compute-fbank-feats, apply-cmvn, add-deltas and
+// splice-feats would.  Runs in its own thread.
+class FeatureStage: public MultiThreadable {
+ public:
+  FeatureStage(const WavFeatureOptions &opts,
+               SequentialTableReader<WaveHolder> *wav_reader,
+               Fbank *fbank,
+               RandomAccessDoubleMatrixReaderMapped *cmvn_reader,
+               const Matrix<double> *global_cmvn_stats,
+               BoundedQueue<PipelineItem> *out, PipelineError *error):
+      opts_(opts), wav_reader_(wav_reader), fbank_(fbank),
+      cmvn_reader_(cmvn_reader), global_cmvn_stats_(global_cmvn_stats),
+      out_(out), error_(error) { }
+
+  void operator () () {
+    try {
+      for (; !wav_reader_->Done(); wav_reader_->Next()) {
+        PipelineItem *item = new PipelineItem;
+        item->utt = wav_reader_->Key();
+        ComputeFeatures(item->utt, wav_reader_->Value(), &(item->mat));
+        wav_reader_->FreeCurrent();
+        if (!out_->Push(item)) return;  // A later stage failed.
+      }
+      out_->Close();
+    } catch(const std::exception &e) {
+      error_->Set(e.what());
+      out_->Abort();
+    }
+  }
+
+ private:
+  void ComputeFeatures(const std::string &utt, const WaveData &wave_data,
+                       Matrix<BaseFloat> *feats) {
+    if (wave_data.Data().NumRows() != 1)
+      KALDI_WARN << "Utterance " << utt << " has "
+                 << wave_data.Data().NumRows() << " channels; using the first.";
+    if (wave_data.SampFreq() != opts_.fbank_opts.frame_opts.samp_freq) {
+      KALDI_WARN << "Sample frequency mismatch: you specified "
+                 << opts_.fbank_opts.frame_opts.samp_freq << " but data has "
+                 << wave_data.SampFreq() << " (use --sample-frequency in the "
+                 << "--fbank-config).  Utterance is " << utt;
+      return;
+    }
+    SubVector<BaseFloat> waveform(wave_data.Data(), 0);
+    if (NumFrames(waveform.Dim(), opts_.fbank_opts.frame_opts) == 0) {
+      KALDI_WARN << "Utterance " << utt << " is too short for one frame ("
+                 << waveform.Dim() << " samples), producing no output.";
+      return;
+    }
+    Matrix<BaseFloat> fbank_feats;
+    fbank_->Compute(waveform, 1.0, &fbank_feats, NULL);
+
+    if (global_cmvn_stats_ == NULL) {
+      // CMVN with offline statistics, deltas and splicing in one pass.
+      const MatrixBase<double> *cmvn_stats = NULL;
+      if (cmvn_reader_ != NULL) {
+        if (!cmvn_reader_->HasKey(utt)) {
+          KALDI_WARN << "No normalization statistics available for key "
+                     << utt << ", producing no output for this utterance";
+          return;
+        }
+        cmvn_stats = &(cmvn_reader_->Value(utt));
+      }
+      CmvnAndDeltasOptions cmvn_deltas_opts;
+      cmvn_deltas_opts.norm_vars = opts_.cmvn_opts.normalize_variance;
+      cmvn_deltas_opts.add_deltas = opts_.add_deltas;
+      cmvn_deltas_opts.delta_opts = opts_.delta_opts;
+      if (opts_.splice_feats) {
+        cmvn_deltas_opts.left_context = opts_.splice_opts.left_context;
+        cmvn_deltas_opts.right_context = opts_.splice_opts.right_context;
+      }
+      ApplyCmvnAndDeltas(cmvn_deltas_opts, cmvn_stats, fbank_feats, feats);
+      return;
+    }
+
+    // Online CMVN is done with the online feature classes, on the whole
+    // utterance.
+    OnlineMatrixFeature base_feature(fbank_feats);
+    OnlineCmvn cmvn(opts_.cmvn_opts, OnlineCmvnState(*global_cmvn_stats_),
+                    &base_feature);
+    OnlineFeatureInterface *feature = &cmvn;
+    OnlineDeltaFeature *delta = NULL;
+    OnlineSpliceFrames *splice = NULL;
+    if (opts_.add_deltas) {
+      delta = new OnlineDeltaFeature(opts_.delta_opts, feature);
+      feature = delta;
+    }
+    if (opts_.splice_feats) {
+      splice = new OnlineSpliceFrames(opts_.splice_opts, feature);
+      feature = splice;
+    }
+    feats->Resize(feature->NumFramesReady(), feature->Dim(), kUndefined);
+    for (int32 t = 0; t < feats->NumRows(); t++) {
+      SubVector<BaseFloat> row(*feats, t);
+      feature->GetFrame(t, &row);
+    }
+    delete splice;
+    delete delta;
+  }
+
+  const WavFeatureOptions &opts_;
+  SequentialTableReader<WaveHolder> *wav_reader_;
+  Fbank *fbank_;
+  RandomAccessDoubleMatrixReaderMapped *cmvn_reader_;  // or NULL.
+  const Matrix<double> *global_cmvn_stats_;  // or NULL.
+  BoundedQueue<PipelineItem> *out_;
+  PipelineError *error_;
+};
+
+// Does the forward pass through the network, as net-output-extract would.
+// Runs in its own thread.
+class NetStage: public MultiThreadable {
+ public:
+  NetStage(Net *net, ClassPrior *class_prior, bool apply_log,
+           BoundedQueue<PipelineItem> *in, BoundedQueue<PipelineItem> *out,
+           PipelineError *error):
+      net_(net), class_prior_(class_prior), apply_log_(apply_log),
+      in_(in), out_(out), error_(error) { }
+
+  void operator () () {
+    CuMatrix<BaseFloat> net_out;
+    PipelineItem *item = NULL;
+    try {
+      while ((item = in_->Pop()) != NULL) {
+        if (item->mat.NumRows() != 0) {
+          net_->Feedforward(CuMatrix<BaseFloat>(item->mat), &net_out);
+          if (apply_log_)
+            net_out.ApplyLog();
+          if (class_prior_ != NULL)
+            class_prior_->SubtractOnLogpost(&net_out);
+          item->mat.Resize(net_out.NumRows(), net_out.NumCols(), kUndefined);
+          net_out.CopyToMat(&(item->mat));
+        }
+        PipelineItem *pushed = item;
+        item = NULL;
+        if (!out_->Push(pushed)) {  // A later stage failed.
+          in_->Abort();
+          return;
+        }
+      }
+      out_->Close();
+    } catch(const std::exception &e) {
+      delete item;
+      error_->Set(e.what());
+      in_->Abort();
+      out_->Abort();
+    }
+  }
+
+ private:
+  Net *net_;
+  ClassPrior *class_prior_;  // or NULL.
+  bool apply_log_;
+  BoundedQueue<PipelineItem> *in_;
+  BoundedQueue<PipelineItem> *out_;
+  PipelineError *error_;
+};
+
+}  // namespace eesen
+
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+    typedef eesen::int32 int32;
+    using fst::SymbolTable;
+    using fst::VectorFst;
+    using fst::StdArc;
+
+    const char *usage =
+        "Compute the network outputs for waveforms, and optionally decode them,\n"
+        "in one process.  This does what the pipe compute-fbank-feats | apply-cmvn |\n"
+        "add-deltas | net-output-extract [| latgen-faster] does, without writing\n"
+        "and reading the intermediate matrices: feature extraction, the forward\n"
+        "pass and decoding each run in their own thread, on different utterances.\n"
+        "With 3 arguments it writes the log-likelihoods, otherwise lattices.\n"
+        "\n"
+        "Usage: net-decode-wav [options] <model-in> <wav-rspecifier> <loglikes-wspecifier>\n"
+        " or:   net-decode-wav [options] <model-in> <fst-in> <wav-rspecifier>"
+        " <lattice-wspecifier> [ <words-wspecifier> [<alignments-wspecifier>] ]\n"
+        "e.g.: \n"
+        " net-decode-wav --fbank-config=conf/fbank.conf --add-deltas=true \\\n"
+        "   --cmvn-stats=scp:cmvn.scp --utt2spk=ark:utt2spk \\\n"
+        "   --class-frame-counts=label.counts --apply-log=true \\\n"
+        "   final.nnet TLG.fst scp:wav.scp ark:lat.ark\n";
+
+    ParseOptions po(usage);
+    Timer timer;
+    WavFeatureOptions feature_opts;
+    std::string fbank_config, cmvn_config, delta_config, splice_config;
+    po.Register("fbank-config", &fbank_config, "Configuration file for "
+                "filterbank features (e.g. conf/fbank.conf)");
+    po.Register("cmvn-config", &cmvn_config, "Configuration file for CMVN "
+                "(see OnlineCmvnOptions; --norm-vars also applies to "
+                "--cmvn-stats)");
+    po.Register("delta-config", &delta_config, "Configuration file for "
+                "deltas (--delta-order, --delta-window)");
+    po.Register("splice-config", &splice_config, "Configuration file for "
+                "splicing (--left-context, --right-context)");
+    po.Register("add-deltas", &feature_opts.add_deltas, "If true, append "
+                "delta features, as add-deltas does");
+    po.Register("splice-feats", &feature_opts.splice_feats, "If true, splice "
+                "frames, as splice-feats does");
+    po.Register("cmvn-stats", &feature_opts.cmvn_rspecifier, "rspecifier "
+                "for CMVN stats, applied as apply-cmvn does");
+    po.Register("utt2spk", &feature_opts.utt2spk_rspecifier, "rspecifier "
+                "for the utterance to speaker map of --cmvn-stats");
+    po.Register("global-cmvn-stats", &feature_opts.global_cmvn_stats_rxfilename,
+                "If supplied, apply online (sliding-window) CMVN initialized "
+                "with these stats instead of --cmvn-stats");
+
+    ClassPriorOptions prior_opts;
+    prior_opts.Register(&po);
+    bool apply_log = false;
+    po.Register("apply-log", &apply_log, "Transform network output to logscale");
+    std::string use_gpu = "no";
+    po.Register("use-gpu", &use_gpu, "yes|no|optional, only has effect if "
+                "compiled with CUDA");
+
+    bool allow_partial = false;
+    BaseFloat acoustic_scale = 0.1;
+    BaseFloat blank_threshold = 1.0;
+    LatticeFasterDecoderConfig config;
+    CompactLatticeWriteOptions lat_write_opts;
+    std::string word_syms_filename;
+    config.Register(&po);
+    lat_write_opts.Register(&po);
+    po.Register("acoustic-scale", &acoustic_scale, "Scaling factor for acoustic likelihoods");
+    po.Register("word-symbol-table", &word_syms_filename, "Symbol table for words [for debug output]");
+    po.Register("allow-partial", &allow_partial, "If true, produce output even if end state was not reached.");
+    po.Register("blank-threshold", &blank_threshold, "If < 1.0, each run of "
+                "frames whose blank posterior is >= this value is collapsed "
+                "into one frame for decoding (see latgen-faster)");
+
+    int32 queue_size = 4;
+    po.Register("queue-size", &queue_size, "Number of utterances that can "
+                "wait between two stages of the pipeline; controls memory use");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 3 || po.NumArgs() > 6) {
+      po.PrintUsage();
+      exit(1);
+    }
+    SetCompactLatticeWriteOptions(lat_write_opts);
+
+    if (fbank_config != "")
+      ReadConfigFromFile(fbank_config, &feature_opts.fbank_opts);
+    if (cmvn_config != "")
+      ReadConfigFromFile(cmvn_config, &feature_opts.cmvn_opts);
+    if (delta_config != "")
+      ReadConfigFromFile(delta_config, &feature_opts.delta_opts);
+    if (splice_config != "")
+      ReadConfigFromFile(splice_config, &feature_opts.splice_opts);
+    if (feature_opts.cmvn_rspecifier != "" &&
+        feature_opts.global_cmvn_stats_rxfilename != "")
+      KALDI_ERR << "--cmvn-stats and --global-cmvn-stats cannot be used together.";
+    if (feature_opts.utt2spk_rspecifier != "" &&
+        feature_opts.cmvn_rspecifier == "")
+      KALDI_ERR << "--utt2spk requires --cmvn-stats.";
+    if (queue_size <= 0)
+      KALDI_ERR << "--queue-size must be positive.";
+
+    bool decode = (po.NumArgs() > 3);
+    std::string model_filename = po.GetArg(1),
+        fst_in_filename = (decode ? po.GetArg(2) : ""),
+        wav_rspecifier = po.GetArg(decode ? 3 : 2),
+        output_wspecifier = po.GetArg(decode ? 4 : 3),
+        words_wspecifier = po.GetOptArg(5),
+        alignment_wspecifier = po.GetOptArg(6);
+
+#if HAVE_CUDA==1
+    CuDevice::Instantiate().SelectGpuId(use_gpu);
+    CuDevice::Instantiate().DisableCaching();
+#endif
+
+    Net net;
+    net.Read(model_filename);
+    ClassPrior *class_prior = NULL;
+    if (prior_opts.class_frame_counts != "")
+      class_prior = new ClassPrior(prior_opts);
+
+    Fbank fbank(feature_opts.fbank_opts);
+    RandomAccessDoubleMatrixReaderMapped *cmvn_reader = NULL;
+    if (feature_opts.cmvn_rspecifier != "")
+      cmvn_reader = new RandomAccessDoubleMatrixReaderMapped(
+          feature_opts.cmvn_rspecifier, feature_opts.utt2spk_rspecifier);
+    Matrix<double> *global_cmvn_stats = NULL;
+    if (feature_opts.global_cmvn_stats_rxfilename != "") {
+      global_cmvn_stats = new Matrix<double>;
+      ReadKaldiObject(feature_opts.global_cmvn_stats_rxfilename,
+                      global_cmvn_stats);
+    }
+
+    BaseFloatMatrixWriter loglikes_writer;
+    bool determinize = config.determinize_lattice;
+    CompactLatticeWriter compact_lattice_writer;
+    LatticeWriter lattice_writer;
+    if (!decode) {
+      if (!loglikes_writer.Open(output_wspecifier))
+        KALDI_ERR << "Could not open table for writing log-likelihoods: "
+                  << output_wspecifier;
+    } else if (! (determinize ? compact_lattice_writer.Open(output_wspecifier)
+                  : lattice_writer.Open(output_wspecifier))) {
+      KALDI_ERR << "Could not open table for writing lattices: "
+                << output_wspecifier;
+    }
+    Int32VectorWriter words_writer(words_wspecifier);
+    Int32VectorWriter alignment_writer(alignment_wspecifier);
+
+    fst::SymbolTable *word_syms = NULL;
+    if (word_syms_filename != "")
+      if (!(word_syms = fst::SymbolTable::ReadText(word_syms_filename)))
+        KALDI_ERR << "Could not read symbol table from file "
+                  << word_syms_filename;
+
+    SequentialTableReader<WaveHolder> wav_reader(wav_rspecifier);
+    // Read the FST after the table reader, see decode-faster.cc.
+    VectorFst<StdArc> *decode_fst = NULL;
+    LatticeFasterDecoder *decoder = NULL;
+    if (decode) {
+      decode_fst = fst::ReadFstKaldi(fst_in_filename);
+      decoder = new LatticeFasterDecoder(*decode_fst, config);
+    }
+
+    double tot_like = 0.0;
+    eesen::int64 frame_count = 0;
+    int num_success = 0, num_fail = 0;
+
+    BoundedQueue<PipelineItem> features_queue(queue_size),
+        loglikes_queue(queue_size);
+    PipelineError pipeline_error;
+    {
+      // The feature extraction and forward pass run in their own threads;
+      // the decoding (or writing) is done here.
+      MultiThreader<FeatureStage> feature_thread(
+          1, FeatureStage(feature_opts, &wav_reader, &fbank, cmvn_reader,
+                          global_cmvn_stats, &features_queue,
+                          &pipeline_error));
+      MultiThreader<NetStage> net_thread(
+          1, NetStage(&net, class_prior, apply_log, &features_queue,
+                      &loglikes_queue, &pipeline_error));
+
+      PipelineItem *item = NULL;
+      try {
+        while ((item = loglikes_queue.Pop()) != NULL) {
+          const std::string &utt = item->utt;
+          const Matrix<BaseFloat> &loglikes = item->mat;
+          if (loglikes.NumRows() == 0) {
+            KALDI_WARN << "Zero-length utterance: " << utt;
+            num_fail++;
+          } else if (!decode) {
+            loglikes_writer.Write(utt, loglikes);
+            frame_count += loglikes.NumRows();
+            num_success++;
+          } else {
+            double like;
+            bool ans;
+            if (blank_threshold < 1.0) {
+              DecodableMatrixScaledCollapsed decodable(loglikes, acoustic_scale,
+                                                       blank_threshold);
+              ans = DecodeUtteranceLatticeFaster(
+                  *decoder, decodable, word_syms, utt,
+                  acoustic_scale, determinize, allow_partial, &alignment_writer,
+                  &words_writer, &compact_lattice_writer, &lattice_writer,
+                  &like, &decodable.FrameLengths());
+            } else {
+              DecodableMatrixScaled decodable(loglikes, acoustic_scale);
+              ans = DecodeUtteranceLatticeFaster(
+                  *decoder, decodable, word_syms, utt,
+                  acoustic_scale, determinize, allow_partial, &alignment_writer,
+                  &words_writer, &compact_lattice_writer, &lattice_writer,
+                  &like);
+            }
+            if (ans) {
+              tot_like += like;
+              frame_count += loglikes.NumRows();
+              num_success++;
+            } else num_fail++;
+          }
+          delete item;
+          item = NULL;
+        }
+      } catch(...) {
+        // Stop the other stages, which may be waiting for us to pop, so that
+        // the destructors of the MultiThreaders can join them.
+        delete item;
+        features_queue.Abort();
+        loglikes_queue.Abort();
+        throw;
+      }
+    }  // The destructors of the MultiThreaders wait for the threads.
+    pipeline_error.Check();
+
+    double elapsed = timer.Elapsed();
+    KALDI_LOG << "Time taken "<< elapsed
+              << "s: real-time factor assuming 100 frames/sec is "
+              << (elapsed*100.0/frame_count);
+    KALDI_LOG << "Done " << num_success << " utterances, failed for "
+              << num_fail;
+    if (decode)
+      KALDI_LOG << "Overall log-likelihood per frame is "
+                << (tot_like/frame_count) << " over " << frame_count
+                << " frames.";
+
+#if HAVE_CUDA==1
+    if (eesen::g_kaldi_verbose_level >= 1) {
+      CuDevice::Instantiate().PrintProfile();
+    }
+#endif
+
+    delete decoder;
+    delete decode_fst;  // delete this only after the decoder.
+    delete word_syms;
+    delete global_cmvn_stats;
+    delete cmvn_reader;
+    delete class_prior;
+    if (num_success != 0) return 0;
+    else return 1;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,62 @@
+// feat/cmvn-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feat/cmvn.h"
+
+namespace eesen {
+
+// Checks that the stats accumulated from a compressed matrix are those of the
+// decompressed matrix.
+void UnitTestAccCmvnStatsCompressed() {
+  for (int32 i = 0; i < 100; i++) {
+    // Matrices with 8 rows or fewer use the uint16 format.
+    int32 num_frames = 1 + Rand() % (i % 2 == 0 ? 8 : 200),
+        dim = 1 + Rand() % 40;
+    Matrix<BaseFloat> feats(num_frames, dim);
+    feats.SetRandn();
+    feats.Scale(10.0);
+    CompressedMatrix compressed(feats);
+    Matrix<BaseFloat> decompressed(num_frames, dim);
+    compressed.CopyToMat(&decompressed);
+
+    Vector<BaseFloat> weights(num_frames);
+    for (int32 t = 0; t < num_frames; t++)
+      weights(t) = (Rand() % 3 == 0 ? 0.0 : RandUniform());
+    const VectorBase<BaseFloat> *w = (Rand() % 2 == 0 ? &weights : NULL);
+
+    Matrix<double> stats, stats2;
+    InitCmvnStats(dim, &stats);
+    InitCmvnStats(dim, &stats2);
+    AccCmvnStats(decompressed, w, &stats);
+    AccCmvnStats(compressed, w, &stats2);
+    AssertEqual(stats, stats2, 1.0e-05);
+  }
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  try {
+    UnitTestAccCmvnStatsCompressed();
+    std::cout << "Tests succeeded.\n";
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return 1;
+  }
+}
@@ -61,16 +61,26 @@ void AccCmvnStats(const MatrixBase<BaseFloat> &feats,
   }
 }
 
-void ApplyCmvn(const MatrixBase<double> &stats,
-               bool var_norm,
-               MatrixBase<BaseFloat> *feats) {
-  KALDI_ASSERT(feats != NULL);
+void AccCmvnStats(const CompressedMatrix &feats,
+                  const VectorBase<BaseFloat> *weights,
+                  MatrixBase<double> *stats) {
+  int32 dim = feats.NumCols();
+  KALDI_ASSERT(stats != NULL);
+  KALDI_ASSERT(stats->NumRows() == 2 && stats->NumCols() == dim + 1);
+  SubVector<double> mean_stats(stats->RowData(0), dim),
+      var_stats(stats->RowData(1), dim);
+  feats.AddColSumsAndSquares(weights, &mean_stats, &var_stats);
+  (*stats)(0, dim) += (weights == NULL ? feats.NumRows() : weights->Sum());
+}
+
+void GetCmvnTransform(const MatrixBase<double> &stats,
+                      bool var_norm,
+                      Vector<BaseFloat> *offset,
+                      Vector<BaseFloat> *scale) {
   int32 dim = stats.NumCols() - 1;
-  if (stats.NumRows() > 2 || stats.NumRows() < 1 || feats->NumCols() != dim) {
-    KALDI_ERR << "Dim mismatch in ApplyCmvn: cmvn "
-              << stats.NumRows() << 'x' << stats.NumCols()
-              << ", feats " << feats->NumRows() << 'x' << feats->NumCols();
-  }
+  if (stats.NumRows() > 2 || stats.NumRows() < 1 || dim < 0)
+    KALDI_ERR << "Bad CMVN stats: " << stats.NumRows() << 'x'
+              << stats.NumCols();
   if (stats.NumRows() == 1 && var_norm)
     KALDI_ERR << "You requested variance normalization but no variance stats "
               << "are supplied.";
@@ -82,14 +92,14 @@ void ApplyCmvn(const MatrixBase<double> &stats,
     KALDI_ERR << "Insufficient stats for cepstral mean and variance normalization: "
               << "count = " << count;
   
-  Matrix<BaseFloat> norm(2, dim);  // norm(0, d) = mean offset
-  // norm(1, d) = scale, e.g. x(d) <-- x(d)*norm(1, d) + norm(0, d).
+  offset->Resize(dim, kUndefined);
+  scale->Resize(dim, kUndefined);
   for (int32 d = 0; d < dim; d++) {
-    double mean, offset, scale;
+    double mean, this_offset, this_scale;
     mean = stats(0, d)/count;
     if (!var_norm) {
-      scale = 1.0;
-      offset = -mean;
+      this_scale = 1.0;
+      this_offset = -mean;
     } else {
       double var = (stats(1, d)/count) - mean*mean,
           floor = 1.0e-20;
@@ -98,22 +108,36 @@ void ApplyCmvn(const MatrixBase<double> &stats,
                    << floor;
         var = floor;
       }
-      scale = 1.0 / sqrt(var);
-      if (scale != scale || 1/scale == 0.0)
+      this_scale = 1.0 / sqrt(var);
+      if (this_scale != this_scale || 1/this_scale == 0.0)
         KALDI_ERR << "NaN or infinity in cepstral mean/variance computation";
-      offset = -(mean*scale);
+      this_offset = -(mean*this_scale);
     }
-    norm(0, d) = offset;
-    norm(1, d) = scale;
+    (*offset)(d) = this_offset;
+    (*scale)(d) = this_scale;
+  }
+}
+
+void ApplyCmvn(const MatrixBase<double> &stats,
+               bool var_norm,
+               MatrixBase<BaseFloat> *feats) {
+  KALDI_ASSERT(feats != NULL);
+  int32 dim = stats.NumCols() - 1;
+  if (stats.NumRows() > 2 || stats.NumRows() < 1 || feats->NumCols() != dim) {
+    KALDI_ERR << "Dim mismatch in ApplyCmvn: cmvn "
+              << stats.NumRows() << 'x' << stats.NumCols()
+              << ", feats " << feats->NumRows() << 'x' << feats->NumCols();
   }
+  Vector<BaseFloat> offset, scale;
+  GetCmvnTransform(stats, var_norm, &offset, &scale);
   int32 num_frames = feats->NumRows();
 
   // Apply the normalization.
+  const BaseFloat *offset_data = offset.Data(), *scale_data = scale.Data();
   for (int32 i = 0; i < num_frames; i++) {
-    for (int32 d = 0; d < dim; d++) {
-      BaseFloat &f = (*feats)(i, d);
-      f = norm(0, d) + f*norm(1, d);
-    }
+    BaseFloat *row = feats->RowData(i);
+    for (int32 d = 0; d < dim; d++)
+      row[d] = offset_data[d] + row[d] * scale_data[d];
   }
 }
 
@@ -43,6 +43,13 @@ void AccCmvnStats(const MatrixBase<BaseFloat> &feats,
                   const VectorBase<BaseFloat> *weights,  // or NULL
                   MatrixBase<double> *stats);
 
+/// As above, for features stored compressed (e.g. by copy-feats
+/// --compress=true); accumulates from the compressed data without first
+/// decompressing it to a float matrix.
+void AccCmvnStats(const CompressedMatrix &feats,
+                  const VectorBase<BaseFloat> *weights,  // or NULL
+                  MatrixBase<double> *stats);
+
 /// Apply cepstral mean and variance normalization to a matrix of features.
 /// If norm_vars == true, expects stats to be of dimension 2 by (dim+1), but
 /// if norm_vars == false, will accept stats of dimension 1 by (dim+1); these
@@ -52,6 +59,14 @@ void ApplyCmvn(const MatrixBase<double> &stats,
                bool norm_vars,
                MatrixBase<BaseFloat> *feats);
 
+/// Computes the normalization that ApplyCmvn() does with these stats:
+/// x(d) <-- x(d) * (*scale)(d) + (*offset)(d).  Useful when the features are
+/// normalized one frame at a time.
+void GetCmvnTransform(const MatrixBase<double> &stats,
+                      bool var_norm,
+                      Vector<BaseFloat> *offset,
+                      Vector<BaseFloat> *scale);
+
 /// Modify the stats so that for some dimensions (specified in "dims"), we
 /// replace them with "fake" stats that have zero mean and unit variance; this
 /// is done to disable CMVN for those dimensions.
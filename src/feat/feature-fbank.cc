@@ -112,7 +112,8 @@ void Fbank::ComputeInternal(const VectorBase<BaseFloat> &wave,
   int32 cols_out = opts_.mel_opts.num_bins + opts_.use_energy;
   if (rows_out == 0) {
     output->Resize(0, 0);
-    *wave_remainder = wave;
+    if (wave_remainder != NULL)
+      *wave_remainder = wave;
     return;
   }
   // Prepare the output buffer
@@ -122,63 +123,40 @@ void Fbank::ComputeInternal(const VectorBase<BaseFloat> &wave,
   if (wave_remainder != NULL)
     ExtractWaveformRemainder(wave, opts_.frame_opts, wave_remainder);
 
-  // Buffers
-  Vector<BaseFloat> window;  // windowed waveform.
-  Vector<BaseFloat> mel_energies;
-  std::vector<BaseFloat> temp_buffer;  // used by srfft.  
-  BaseFloat log_energy;
-
-  // Compute all the freames, r is frame index..
-  for (int32 r = 0; r < rows_out; r++) {
-    // Cut the window, apply window function
-    ExtractWindow(wave, r, opts_.frame_opts, feature_window_function_, &window,
-                  (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
-
-    // Compute energy after window function (not the raw one)
-    if (opts_.use_energy && !opts_.raw_energy)
-      log_energy = log(std::max(VecVec(window, window),
-                                std::numeric_limits<BaseFloat>::min()));
-
-    if (srfft_ != NULL)  // Compute FFT using split-radix algorithm.
-      srfft_->Compute(window.Data(), true, &temp_buffer);
-    else  // An alternative algorithm that works for non-powers-of-two.
-      RealFft(&window, true);
-
-    // Convert the FFT into a power spectrum.
-    ComputePowerSpectrum(&window);
-    SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
-
-    // Sum with MelFiterbank over power spectrum
-    mel_banks.Compute(power_spectrum, &mel_energies);
-    if (opts_.use_log_fbank) {
-      // avoid log of zero (which should be prevented anyway by dithering).
-      mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
-      mel_energies.ApplyLog();  // take the log.
-    }
-
-    // Output buffers
-    SubVector<BaseFloat> this_output(output->Row(r));
-    SubVector<BaseFloat> this_fbank(this_output.Range((opts_.use_energy? 1 : 0),
-                                                      opts_.mel_opts.num_bins));
-
-    // Copy to output
-    this_fbank.CopyFromVec(mel_energies);
-    // Copy energy as first value
-    if (opts_.use_energy) {
-      if (opts_.energy_floor > 0.0 && log_energy < log_energy_floor_) {
-        log_energy = log_energy_floor_;
-      }
-      this_output(0) = log_energy;
-    }
-
-    // HTK compat: Shift features, so energy is last value
-    if (opts_.htk_compat && opts_.use_energy) {
-      BaseFloat energy = this_output(0);
-      for (int32 i = 0; i < opts_.mel_opts.num_bins; i++) {
-        this_output(i) = this_output(i+1);
-      }
-      this_output(opts_.mel_opts.num_bins) = energy;
-    }
+  // Cut the windows of all frames and apply the window function; the
+  // frames are processed together, as matrices with one row per frame.
+  Matrix<BaseFloat> windows;
+  Vector<BaseFloat> log_energy;
+  ExtractWindows(wave, opts_.frame_opts, feature_window_function_, &windows,
+                 (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
+
+  // Compute energy after window function (not the raw one)
+  if (opts_.use_energy && !opts_.raw_energy)
+    ComputeLogEnergies(windows, &log_energy);
+
+  // Convert the windows into power spectra.
+  ComputePowerSpectra(srfft_, &windows);
+  SubMatrix<BaseFloat> power_spectra(windows.ColRange(0,
+                                                      windows.NumCols()/2 + 1));
+
+  // Sum with MelFiterbank over power spectrum
+  Matrix<BaseFloat> mel_energies;
+  mel_banks.Compute(power_spectra, &mel_energies);
+  if (opts_.use_log_fbank) {
+    // avoid log of zero (which should be prevented anyway by dithering).
+    mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
+    mel_energies.ApplyLog();  // take the log.
+  }
+
+  // Energy is the first value, or with HTK compat the last one.
+  int32 fbank_offset = (opts_.use_energy && !opts_.htk_compat ? 1 : 0);
+  output->ColRange(fbank_offset, opts_.mel_opts.num_bins).CopyFromMat(
+      mel_energies);
+  if (opts_.use_energy) {
+    if (opts_.energy_floor > 0.0)
+      log_energy.ApplyFloor(log_energy_floor_);
+    output->CopyColFromVec(log_energy, (opts_.htk_compat ?
+                                        opts_.mel_opts.num_bins : 0));
   }
 }
 
@@ -24,6 +24,7 @@
 #include "base/kaldi-math.h"
 #include "cpucompute/matrix-inl.h"
 #include "feat/wave-reader.h"
+#include "feat/cmvn.h"
 
 
 // TODO: some of the other functions should be tested.  
@@ -93,6 +94,165 @@ void UnitTestOnlineCmvn() {
 }
 
 
+void UnitTestExtractWindows() {
+  for (int32 i = 0; i < 20; i++) {
+    FrameExtractionOptions opts;
+    opts.snip_edges = (Rand() % 2 == 0);
+    opts.round_to_power_of_two = (Rand() % 2 == 0);
+    opts.remove_dc_offset = (Rand() % 2 == 0);
+    opts.preemph_coeff = (Rand() % 2 == 0 ? 0.0 : 0.97);
+    opts.window_type = (Rand() % 2 == 0 ? "hamming" : "povey");
+    int32 wave_length = Rand() % 8000;
+    Vector<BaseFloat> wave(wave_length);
+    wave.SetRandn();
+    FeatureWindowFunction window_function(opts);
+
+    // Dithering uses the random numbers in the same order either way.
+    int32 seed = Rand();
+    srand(seed);
+    Matrix<BaseFloat> windows;
+    Vector<BaseFloat> log_energy;
+    ExtractWindows(wave, opts, window_function, &windows, &log_energy);
+    srand(seed);
+    KALDI_ASSERT(windows.NumRows() == NumFrames(wave_length, opts) &&
+                 log_energy.Dim() == windows.NumRows());
+    for (int32 f = 0; f < windows.NumRows(); f++) {
+      Vector<BaseFloat> window;
+      BaseFloat this_log_energy;
+      ExtractWindow(wave, f, opts, window_function, &window, &this_log_energy);
+      KALDI_ASSERT(window.ApproxEqual(windows.Row(f), 0.0001));
+      KALDI_ASSERT(ApproxEqual(this_log_energy, log_energy(f)));
+    }
+
+    if (windows.NumRows() == 0) continue;
+    ComputePowerSpectra(NULL, &windows);
+    SubMatrix<BaseFloat> power_spectra(windows.ColRange(
+        0, windows.NumCols() / 2 + 1));
+    MelBanksOptions mel_opts(10 + Rand() % 15);
+    MelBanks mel_banks(mel_opts, opts, 1.0);
+    Matrix<BaseFloat> mel_energies;
+    mel_banks.Compute(power_spectra, &mel_energies);
+    for (int32 f = 0; f < windows.NumRows(); f++) {
+      Vector<BaseFloat> this_mel_energies;
+      mel_banks.Compute(power_spectra.Row(f), &this_mel_energies);
+      KALDI_ASSERT(this_mel_energies.ApproxEqual(mel_energies.Row(f), 0.001));
+    }
+  }
+}
+
+void UnitTestDeltaFeatures() {
+  for (int32 i = 0; i < 100; i++) {
+    DeltaFeaturesOptions opts(Rand() % 4, 1 + Rand() % 4);
+    int32 num_frames = 1 + Rand() % 30, dim = 1 + Rand() % 50;
+    Matrix<BaseFloat> feats(num_frames, dim);
+    feats.SetRandn();
+    Matrix<BaseFloat> deltas;
+    ComputeDeltas(opts, feats, &deltas);
+    // Compare with a direct computation, one delta order at a time: the
+    // deltas of order o are those of order o-1 filtered with the window
+    // [ -window ... window ] / (2 * sum_j j^2), where the features are padded
+    // by replicating the first and last frames.
+    int32 padding = opts.order * opts.window;
+    Matrix<BaseFloat> padded(num_frames + 2 * padding, dim);
+    for (int32 t = 0; t < padded.NumRows(); t++) {
+      int32 t2 = std::min(std::max(t - padding, 0), num_frames - 1);
+      padded.Row(t).CopyFromVec(feats.Row(t2));
+    }
+    BaseFloat normalizer = 0.0;
+    for (int32 j = 1; j <= opts.window; j++)
+      normalizer += 2 * j * j;
+    for (int32 o = 0; o <= opts.order; o++) {
+      for (int32 t = 0; t < num_frames; t++) {
+        SubVector<BaseFloat> ans(deltas.Row(t), o * dim, dim);
+        KALDI_ASSERT(ans.ApproxEqual(padded.Row(t + padding), 0.001));
+      }
+      Matrix<BaseFloat> next(padded.NumRows(), dim);
+      for (int32 t = opts.window; t + opts.window < padded.NumRows(); t++)
+        for (int32 j = -opts.window; j <= opts.window; j++)
+          next.Row(t).AddVec(j / normalizer, padded.Row(t + j));
+      padded.Swap(&next);
+    }
+  }
+}
+
+void UnitTestApplyCmvnAndDeltas() {
+  for (int32 i = 0; i < 100; i++) {
+    CmvnAndDeltasOptions opts;
+    opts.norm_vars = (Rand() % 2 == 0);
+    opts.add_deltas = (Rand() % 2 == 0);
+    opts.delta_opts.order = Rand() % 3;
+    opts.delta_opts.window = 1 + Rand() % 3;
+    opts.left_context = Rand() % 4;
+    opts.right_context = Rand() % 4;
+    int32 num_frames = 1 + Rand() % 20, dim = 1 + Rand() % 20;
+    Matrix<BaseFloat> feats(num_frames, dim);
+    feats.SetRandn();
+    Matrix<double> stats;
+    InitCmvnStats(dim, &stats);
+    AccCmvnStats(feats, NULL, &stats);
+    bool use_cmvn = (Rand() % 2 == 0);
+
+    Matrix<BaseFloat> ans;
+    ApplyCmvnAndDeltas(opts, use_cmvn ? &stats : NULL, feats, &ans);
+
+    // The same with the separate functions.
+    Matrix<BaseFloat> normalized(feats), with_deltas, spliced;
+    if (use_cmvn)
+      ApplyCmvn(stats, opts.norm_vars, &normalized);
+    if (opts.add_deltas)
+      ComputeDeltas(opts.delta_opts, normalized, &with_deltas);
+    else
+      with_deltas = normalized;
+    SpliceFrames(with_deltas, opts.left_context, opts.right_context,
+                 &spliced);
+    AssertEqual(ans, spliced, 1.0e-05);
+  }
+}
+
+void UnitTestComputeSegmentFeatures() {
+  for (int32 i = 0; i < 10; i++) {
+    MfccOptions opts;
+    opts.frame_opts.dither = 0.0;
+    opts.frame_opts.snip_edges = (i % 2 == 0);
+    Mfcc mfcc(opts);
+    int32 frame_shift = opts.frame_opts.WindowShift(),
+        wave_size = 2000 + Rand() % 10000;
+    Vector<BaseFloat> wave(wave_size);
+    for (int32 j = 0; j < wave_size; j++)
+      wave(j) = RandInt(-32768, 32767);
+
+    // Some segments start a multiple of the frame shift after "base", so they
+    // can share frames; the others start anywhere.  Some are too short for
+    // one frame.
+    int32 num_segments = 1 + Rand() % 8, base = Rand() % 1000;
+    std::vector<int32> first_samp(num_segments), num_samp(num_segments);
+    std::vector<BaseFloat> vtln_warp(num_segments);
+    for (int32 j = 0; j < num_segments; j++) {
+      if (Rand() % 2 == 0)
+        first_samp[j] = base + frame_shift * (Rand() % 10);
+      else
+        first_samp[j] = Rand() % (wave_size / 2);
+      num_samp[j] = 1 + Rand() % (wave_size - first_samp[j]);
+      vtln_warp[j] = (Rand() % 3 == 0 ? 0.9 : 1.0);
+    }
+
+    std::vector<Matrix<BaseFloat> > features;
+    ComputeSegmentFeatures(mfcc, opts.frame_opts, wave, first_samp, num_samp,
+                           vtln_warp, &features);
+    KALDI_ASSERT(features.size() == num_segments);
+    for (int32 j = 0; j < num_segments; j++) {
+      Matrix<BaseFloat> ref;
+      if (NumFrames(num_samp[j], opts.frame_opts) > 0) {
+        SubVector<BaseFloat> segment(wave, first_samp[j], num_samp[j]);
+        mfcc.Compute(segment, vtln_warp[j], &ref, NULL);
+      }
+      KALDI_ASSERT(features[j].NumRows() == ref.NumRows());
+      if (ref.NumRows() != 0)
+        AssertEqual(features[j], ref, 1.0e-04);
+    }
+  }
+}
+
 }
 
 
@@ -101,6 +261,10 @@ int main() {
   using namespace eesen;
   try {
     UnitTestOnlineCmvn();
+    UnitTestExtractWindows();
+    UnitTestDeltaFeatures();
+    UnitTestApplyCmvnAndDeltas();
+    UnitTestComputeSegmentFeatures();
     std::cout << "Tests succeeded.\n";
     return 0;
   } catch (const std::exception &e) {
@@ -20,7 +20,16 @@
 // limitations under the License.
 
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 #include "feat/feature-functions.h"
+#include "feat/cmvn.h"
 #include "cpucompute/matrix-functions.h"
 
 
@@ -84,26 +93,20 @@ FeatureWindowFunction::FeatureWindowFunction(const FrameExtractionOptions &opts)
   }
 }
 
-// ExtractWindow extracts a windowed frame of waveform with a power-of-two,
-// padded size.  It does mean subtraction, pre-emphasis and dithering as
-// requested.
-
-void ExtractWindow(const VectorBase<BaseFloat> &wave,
-                   int32 f,  // with 0 <= f < NumFrames(feats, opts)
-                   const FrameExtractionOptions &opts,
-                   const FeatureWindowFunction &window_function,
-                   Vector<BaseFloat> *window,
-                   BaseFloat *log_energy_pre_window) {
+// Copies the samples of frame f of "wave" into "wave_part", which has
+// dimension opts.WindowSize(); with --snip-edges=false, the samples beyond
+// the edges of the file are obtained by reflection.
+static void ExtractWaveformPart(const VectorBase<BaseFloat> &wave,
+                                int32 f,
+                                const FrameExtractionOptions &opts,
+                                VectorBase<BaseFloat> *wave_part) {
   int32 frame_shift = opts.WindowShift();
   int32 frame_length = opts.WindowSize();
-  KALDI_ASSERT(window_function.window.Dim() == frame_length);
-  KALDI_ASSERT(frame_shift != 0 && frame_length != 0);
-
-  Vector<BaseFloat> wave_part(frame_length);
+  KALDI_ASSERT(wave_part->Dim() == frame_length);
   if (opts.snip_edges) {
     int32 start = frame_shift*f, end = start + frame_length;
     KALDI_ASSERT(start >= 0 && end <= wave.Dim());
-    wave_part.CopyFromVec(wave.Range(start, frame_length));
+    wave_part->CopyFromVec(wave.Range(start, frame_length));
   } else {
     // If opts.snip_edges = false, we allow the frames to go slightly over the
     // edges of the file; we'll extend the data by reflection.
@@ -115,7 +118,7 @@ void ExtractWindow(const VectorBase<BaseFloat> &wave,
         length_limited = end_limited - begin_limited;
 
     // Copy the main part.  Usually this will be the entire window.
-    wave_part.Range(begin_limited - begin, length_limited).
+    wave_part->Range(begin_limited - begin, length_limited).
         CopyFromVec(wave.Range(begin_limited, length_limited));
     
     // Deal with any end effects by reflection, if needed.  This code will
@@ -125,7 +128,7 @@ void ExtractWindow(const VectorBase<BaseFloat> &wave,
       // The next statement will only have an effect in the case of files
       // shorter than a single frame, it's to avoid a crash in those cases.
       reflected_f = reflected_f % wave.Dim(); 
-      wave_part(f - begin) = wave(reflected_f);
+      (*wave_part)(f - begin) = wave(reflected_f);
     }
     for (int32 f = wave.Dim(); f < end; f++) {
       int32 distance_to_end = f - wave.Dim();
@@ -133,9 +136,29 @@ void ExtractWindow(const VectorBase<BaseFloat> &wave,
       // shorter than a single frame, it's to avoid a crash in those cases.
       distance_to_end = distance_to_end % wave.Dim();
       int32 reflected_f = wave.Dim() - 1 - distance_to_end;
-      wave_part(f - begin) = wave(reflected_f);
+      (*wave_part)(f - begin) = wave(reflected_f);
     }
   }
+}
+
+// ExtractWindow extracts a windowed frame of waveform with a power-of-two,
+// padded size.  It does mean subtraction, pre-emphasis and dithering as
+// requested.
+
+void ExtractWindow(const VectorBase<BaseFloat> &wave,
+                   int32 f,  // with 0 <= f < NumFrames(feats, opts)
+                   const FrameExtractionOptions &opts,
+                   const FeatureWindowFunction &window_function,
+                   Vector<BaseFloat> *window,
+                   BaseFloat *log_energy_pre_window) {
+  int32 frame_shift = opts.WindowShift();
+  int32 frame_length = opts.WindowSize();
+  KALDI_ASSERT(window_function.window.Dim() == frame_length);
+  KALDI_ASSERT(frame_shift != 0 && frame_length != 0);
+
+  Vector<BaseFloat> wave_part(frame_length);
+  ExtractWaveformPart(wave, f, opts, &wave_part);
+
   KALDI_ASSERT(window != NULL);
   int32 frame_length_padded = opts.PaddedWindowSize();
 
@@ -166,6 +189,62 @@ void ExtractWindow(const VectorBase<BaseFloat> &wave,
                          frame_length_padded-frame_length).SetZero();
 }
 
+void ExtractWindows(const VectorBase<BaseFloat> &wave,
+                    const FrameExtractionOptions &opts,
+                    const FeatureWindowFunction &window_function,
+                    Matrix<BaseFloat> *windows,
+                    Vector<BaseFloat> *log_energy_pre_window) {
+  int32 frame_length = opts.WindowSize(),
+      num_frames = NumFrames(wave.Dim(), opts);
+  KALDI_ASSERT(window_function.window.Dim() == frame_length);
+  KALDI_ASSERT(windows != NULL);
+  // kSetZero takes care of the padding.
+  windows->Resize(num_frames, opts.PaddedWindowSize());
+  if (num_frames == 0) {
+    if (log_energy_pre_window != NULL) log_energy_pre_window->Resize(0);
+    return;
+  }
+  SubMatrix<BaseFloat> frames(windows->ColRange(0, frame_length));
+
+  for (int32 f = 0; f < num_frames; f++) {
+    SubVector<BaseFloat> frame(frames, f);
+    ExtractWaveformPart(wave, f, opts, &frame);
+    // Dither row by row, so we use the random numbers in the same order as
+    // ExtractWindow().
+    if (opts.dither != 0.0) Dither(&frame, opts.dither);
+  }
+
+  if (opts.remove_dc_offset) {
+    Vector<BaseFloat> sums(num_frames);
+    sums.AddColSumMat(1.0, frames, 0.0);
+    frames.AddVecToCols(-1.0 / frame_length, sums);
+  }
+
+  if (log_energy_pre_window != NULL)
+    ComputeLogEnergies(*windows, log_energy_pre_window);
+
+  if (opts.preemph_coeff != 0.0) {
+    KALDI_ASSERT(opts.preemph_coeff >= 0.0 && opts.preemph_coeff <= 1.0);
+    // As Preemphasize(), for all frames at once: each sample is reduced by
+    // preemph_coeff times the previous (original) one; the first sample by
+    // preemph_coeff times itself.
+    Matrix<BaseFloat> orig(frames);
+    frames.ColRange(1, frame_length - 1).AddMat(
+        -opts.preemph_coeff, orig.ColRange(0, frame_length - 1));
+    frames.ColRange(0, 1).AddMat(-opts.preemph_coeff, orig.ColRange(0, 1));
+  }
+
+  frames.MulColsVec(window_function.window);
+}
+
+void ComputeLogEnergies(const MatrixBase<BaseFloat> &windows,
+                        Vector<BaseFloat> *log_energy) {
+  log_energy->Resize(windows.NumRows(), kUndefined);
+  log_energy->AddDiagMat2(1.0, windows, kNoTrans, 0.0);
+  log_energy->ApplyFloor(std::numeric_limits<BaseFloat>::min());
+  log_energy->ApplyLog();
+}
+
 void ExtractWaveformRemainder(const VectorBase<BaseFloat> &wave,
                               const FrameExtractionOptions &opts,
                               Vector<BaseFloat> *wave_remainder) {
@@ -206,6 +285,19 @@ void ComputePowerSpectrum(VectorBase<BaseFloat> *waveform) {
   // if the signal has been bandlimited sensibly this should be zero.
 }
 
+void ComputePowerSpectra(const SplitRadixRealFft<BaseFloat> *srfft,
+                         MatrixBase<BaseFloat> *windows) {
+  std::vector<BaseFloat> temp_buffer;  // used by srfft.
+  if (srfft != NULL)  // Split-radix FFT, several frames at a time.
+    srfft->Compute(windows, true, &temp_buffer);
+  for (int32 r = 0; r < windows->NumRows(); r++) {
+    SubVector<BaseFloat> window(*windows, r);
+    if (srfft == NULL)  // An alternative algorithm that works for non-powers-of-two.
+      RealFft(&window, true);
+    ComputePowerSpectrum(&window);
+  }
+}
+
 
 DeltaFeatures::DeltaFeatures(const DeltaFeaturesOptions &opts): opts_(opts) {
   KALDI_ASSERT(opts.order >= 0 && opts.order < 1000);  // just make sure we don't get binary junk.
@@ -241,28 +333,154 @@ DeltaFeatures::DeltaFeatures(const DeltaFeaturesOptions &opts): opts_(opts) {
   }
 }
 
+// Returns row t of "x", where t is limited to the rows of x: the features
+// of the first and last frames are replicated at the edges.
+template<typename Real>
+static inline const Real *LimitedRow(const MatrixBase<Real> &x, int32 t) {
+  if (t < 0) t = 0;
+  else if (t >= x.NumRows()) t = x.NumRows() - 1;
+  return x.RowData(t);
+}
+
+// DeltaLanes<Real> has the operations on a SIMD vector of kWidth values,
+// i.e. kWidth dimensions of a frame.  The generic version is for one value;
+// there are specializations for SSE and AVX below.
+template<typename Real>
+struct DeltaLanes {
+  typedef Real Vec;
+  static const int kWidth = 1;
+  static inline Vec Load(const Real *p) { return *p; }
+  static inline void Store(Real *p, Vec v) { *p = v; }
+  static inline Vec Set(Real r) { return r; }
+  static inline Vec Add(Vec a, Vec b) { return a + b; }
+  static inline Vec Mul(Vec a, Vec b) { return a * b; }
+};
+
+#if defined(__AVX__)
+template<>
+struct DeltaLanes<float> {
+  typedef __m256 Vec;
+  static const int kWidth = 8;
+  static inline Vec Load(const float *p) { return _mm256_loadu_ps(p); }
+  static inline void Store(float *p, Vec v) { _mm256_storeu_ps(p, v); }
+  static inline Vec Set(float r) { return _mm256_set1_ps(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+};
+template<>
+struct DeltaLanes<double> {
+  typedef __m256d Vec;
+  static const int kWidth = 4;
+  static inline Vec Load(const double *p) { return _mm256_loadu_pd(p); }
+  static inline void Store(double *p, Vec v) { _mm256_storeu_pd(p, v); }
+  static inline Vec Set(double r) { return _mm256_set1_pd(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+};
+#elif defined(__SSE__)
+template<>
+struct DeltaLanes<float> {
+  typedef __m128 Vec;
+  static const int kWidth = 4;
+  static inline Vec Load(const float *p) { return _mm_loadu_ps(p); }
+  static inline void Store(float *p, Vec v) { _mm_storeu_ps(p, v); }
+  static inline Vec Set(float r) { return _mm_set1_ps(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+};
+#if defined(__SSE2__)
+template<>
+struct DeltaLanes<double> {
+  typedef __m128d Vec;
+  static const int kWidth = 2;
+  static inline Vec Load(const double *p) { return _mm_loadu_pd(p); }
+  static inline void Store(double *p, Vec v) { _mm_storeu_pd(p, v); }
+  static inline Vec Set(double r) { return _mm_set1_pd(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+};
+#endif
+#endif
+
+// Sets y = sum_j scales[j] * (row first_frame + j of x) (see LimitedRow()),
+// adding the terms with nonzero scales in order of j.  This is the window of
+// DeltaFeatures, applied to all the dimensions of the frame at once: each
+// SIMD vector of y is summed in a register, and four of them at a time so
+// that the additions for the different terms can overlap.
+template<typename Real>
+static inline void DeltaFilter(const Real *scales, int32 num_taps,
+                               const MatrixBase<Real> &x, int32 first_frame,
+                               Real *y) {
+  typedef DeltaLanes<Real> Lanes;
+  typedef typename Lanes::Vec Vec;
+  const int32 kWidth = Lanes::kWidth, kMaxTaps = 64;
+  int32 dim = x.NumCols();
+
+  const Real *rows[kMaxTaps];
+  Real row_scales[kMaxTaps];
+  int32 n = 0;
+  for (int32 j = 0; j < num_taps; j++) {
+    if (scales[j] == 0.0) continue;
+    if (n == kMaxTaps) {
+      // A very wide window; just add the rows to y in turn.
+      for (int32 i = 0; i < dim; i++)
+        y[i] = 0.0;
+      for (j = 0; j < num_taps; j++) {
+        if (scales[j] == 0.0) continue;
+        const Real *row = LimitedRow(x, first_frame + j);
+        for (int32 i = 0; i < dim; i++)
+          y[i] += scales[j] * row[i];
+      }
+      return;
+    }
+    rows[n] = LimitedRow(x, first_frame + j);
+    row_scales[n++] = scales[j];
+  }
+
+  int32 i = 0;
+  for (; i + 4 * kWidth <= dim; i += 4 * kWidth) {
+    Vec sum0 = Lanes::Set(0.0), sum1 = sum0, sum2 = sum0, sum3 = sum0;
+    for (int32 j = 0; j < n; j++) {
+      Vec scale = Lanes::Set(row_scales[j]);
+      const Real *row = rows[j] + i;
+      sum0 = Lanes::Add(sum0, Lanes::Mul(scale, Lanes::Load(row)));
+      sum1 = Lanes::Add(sum1, Lanes::Mul(scale, Lanes::Load(row + kWidth)));
+      sum2 = Lanes::Add(sum2, Lanes::Mul(scale,
+                                         Lanes::Load(row + 2 * kWidth)));
+      sum3 = Lanes::Add(sum3, Lanes::Mul(scale,
+                                         Lanes::Load(row + 3 * kWidth)));
+    }
+    Lanes::Store(y + i, sum0);
+    Lanes::Store(y + i + kWidth, sum1);
+    Lanes::Store(y + i + 2 * kWidth, sum2);
+    Lanes::Store(y + i + 3 * kWidth, sum3);
+  }
+  for (; i + kWidth <= dim; i += kWidth) {
+    Vec sum = Lanes::Set(0.0);
+    for (int32 j = 0; j < n; j++)
+      sum = Lanes::Add(sum, Lanes::Mul(Lanes::Set(row_scales[j]),
+                                       Lanes::Load(rows[j] + i)));
+    Lanes::Store(y + i, sum);
+  }
+  for (; i < dim; i++) {
+    Real sum = 0.0;
+    for (int32 j = 0; j < n; j++)
+      sum += row_scales[j] * rows[j][i];
+    y[i] = sum;
+  }
+}
+
 void DeltaFeatures::Process(const MatrixBase<BaseFloat> &input_feats,
                             int32 frame,
                             VectorBase<BaseFloat> *output_frame) const {
   KALDI_ASSERT(frame < input_feats.NumRows());
-  int32 num_frames = input_feats.NumRows(),
-      feat_dim = input_feats.NumCols();
+  int32 feat_dim = input_feats.NumCols();
   KALDI_ASSERT(static_cast<int32>(output_frame->Dim()) == feat_dim * (opts_.order+1));
-  output_frame->SetZero();
   for (int32 i = 0; i <= opts_.order; i++) {
     const Vector<BaseFloat> &scales = scales_[i];
     int32 max_offset = (scales.Dim() - 1) / 2;
-    SubVector<BaseFloat> output(*output_frame, i*feat_dim, feat_dim);
-    for (int32 j = -max_offset; j <= max_offset; j++) {
-      // if asked to read
-      int32 offset_frame = frame + j;
-      if (offset_frame < 0) offset_frame = 0;
-      else if (offset_frame >= num_frames)
-        offset_frame = num_frames - 1;
-      BaseFloat scale = scales(j + max_offset);
-      if (scale != 0.0)
-        output.AddVec(scale, input_feats.Row(offset_frame));
-    }
+    DeltaFilter(scales.Data(), scales.Dim(), input_feats, frame - max_offset,
+                output_frame->Data() + i * feat_dim);
   }
 }
 
@@ -411,6 +629,87 @@ void SpliceFrames(const MatrixBase<BaseFloat> &input_features,
   }
 }
 
+void ApplyCmvnAndDeltas(const CmvnAndDeltasOptions &opts,
+                        const MatrixBase<double> *cmvn_stats,
+                        const MatrixBase<BaseFloat> &input_features,
+                        Matrix<BaseFloat> *output_features) {
+  int32 T = input_features.NumRows(), D = input_features.NumCols(),
+      left_context = opts.left_context, right_context = opts.right_context;
+  KALDI_ASSERT(left_context >= 0 && right_context >= 0);
+  int32 N = 1 + left_context + right_context,
+      delta_dim = D * (opts.add_deltas ? opts.delta_opts.order + 1 : 1);
+  output_features->Resize(T, delta_dim * N, kUndefined);
+  if (T == 0) return;
+
+  Vector<BaseFloat> offset, scale;
+  if (cmvn_stats != NULL) {
+    if (cmvn_stats->NumCols() != D + 1)
+      KALDI_ERR << "Dim mismatch in ApplyCmvnAndDeltas: cmvn "
+                << cmvn_stats->NumRows() << 'x' << cmvn_stats->NumCols()
+                << ", feats " << T << 'x' << D;
+    GetCmvnTransform(*cmvn_stats, opts.norm_vars, &offset, &scale);
+  }
+  const BaseFloat *offset_data = offset.Data(), *scale_data = scale.Data();
+
+  // The deltas are computed from "feats"; with CMVN, these are the
+  // normalized features, and each frame is normalized just before the first
+  // delta that needs it.
+  const MatrixBase<BaseFloat> *feats = &input_features;
+  Matrix<BaseFloat> normalized;
+  DeltaFeatures *delta = NULL;
+  int32 num_normalized = 0, lookahead = 0;
+  if (opts.add_deltas) {
+    delta = new DeltaFeatures(opts.delta_opts);
+    lookahead = opts.delta_opts.order * opts.delta_opts.window;
+    if (cmvn_stats != NULL) {
+      normalized.Resize(T, D, kUndefined);
+      feats = &normalized;
+    }
+  }
+
+  // We compute the features of frame t (after CMVN and deltas) into the
+  // middle block of output row t.  Once those of frame t + right_context are
+  // done, we can copy them into the other blocks of row t.
+  for (int32 t = 0; t < T + right_context; t++) {
+    if (t < T) {
+      BaseFloat *middle = output_features->RowData(t) + left_context * delta_dim;
+      if (delta != NULL) {
+        if (cmvn_stats != NULL) {
+          for (; num_normalized < T && num_normalized <= t + lookahead;
+               num_normalized++) {
+            const BaseFloat *in = input_features.RowData(num_normalized);
+            BaseFloat *out = normalized.RowData(num_normalized);
+            for (int32 d = 0; d < D; d++)
+              out[d] = offset_data[d] + in[d] * scale_data[d];
+          }
+        }
+        SubVector<BaseFloat> middle_vec(middle, delta_dim);
+        delta->Process(*feats, t, &middle_vec);
+      } else if (cmvn_stats != NULL) {
+        const BaseFloat *in = input_features.RowData(t);
+        for (int32 d = 0; d < D; d++)
+          middle[d] = offset_data[d] + in[d] * scale_data[d];
+      } else {
+        std::copy(input_features.RowData(t), input_features.RowData(t) + D,
+                  middle);
+      }
+    }
+    int32 t2 = t - right_context;  // the row we can now complete.
+    if (t2 < 0 || N == 1) continue;
+    BaseFloat *row = output_features->RowData(t2);
+    for (int32 n = 0; n < N; n++) {
+      if (n == left_context) continue;
+      int32 src = t2 + n - left_context;
+      if (src < 0) src = 0;
+      if (src >= T) src = T - 1;
+      const BaseFloat *src_middle = output_features->RowData(src) +
+          left_context * delta_dim;
+      std::copy(src_middle, src_middle + delta_dim, row + n * delta_dim);
+    }
+  }
+  delete delta;
+}
+
 void ReverseFrames(const MatrixBase<BaseFloat> &input_features,
                    Matrix<BaseFloat> *output_features) {
   int32 T = input_features.NumRows(), D = input_features.NumCols();
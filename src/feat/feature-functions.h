@@ -22,6 +22,7 @@
 #ifndef KALDI_FEAT_FEATURE_FUNCTIONS_H_
 #define KALDI_FEAT_FEATURE_FUNCTIONS_H_
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -29,6 +30,7 @@
 #include "util/common-utils.h"
 #include "base/kaldi-error.h"
 #include "feat/mel-computations.h"
+#include "feat/srfft.h"
 
 namespace eesen {
 /// @addtogroup  feat FeatureExtraction
@@ -153,6 +155,24 @@ void ExtractWindow(const VectorBase<BaseFloat> &wave,
                    Vector<BaseFloat> *window,
                    BaseFloat *log_energy_pre_window = NULL);
 
+// ExtractWindows is a batched version of ExtractWindow(): it puts the windows
+// of all NumFrames(wave.Dim(), opts) frames in the rows of "windows", which
+// will have opts.PaddedWindowSize() columns, and does the mean subtraction,
+// pre-emphasis and windowing as operations on the whole matrix.  The result
+// is the same as from calling ExtractWindow() for each frame (including the
+// dithering).  If log_energy_pre_window != NULL, outputs the log-energy of
+// each frame before preemphasis and windowing.
+void ExtractWindows(const VectorBase<BaseFloat> &wave,
+                    const FrameExtractionOptions &opts,
+                    const FeatureWindowFunction &window_function,
+                    Matrix<BaseFloat> *windows,
+                    Vector<BaseFloat> *log_energy_pre_window = NULL);
+
+// Sets (*log_energy)(r) to the log of the sum-of-squares of row r of
+// "windows", floored to avoid log of zero.
+void ComputeLogEnergies(const MatrixBase<BaseFloat> &windows,
+                        Vector<BaseFloat> *log_energy);
+
 // ExtractWaveformRemainder is useful if the waveform is coming in segments.
 // It extracts the bit of the waveform at the end of this block that you
 // would have to append the next bit of waveform to, if you wanted to have
@@ -161,6 +181,64 @@ void ExtractWaveformRemainder(const VectorBase<BaseFloat> &wave,
                               const FrameExtractionOptions &opts,
                               Vector<BaseFloat> *wave_remainder);
 
+// ComputeSegmentFeatures computes the features of several segments of "wave"
+// with "computer" (an Fbank, Mfcc or Plp object, or anything with the same
+// const Compute() function); segment i is samples first_samp[i] ...
+// first_samp[i] + num_samp[i] - 1, with VTLN warp factor vtln_warp[i].  The
+// frames that overlapping segments share are computed once: segments with
+// the same warp factor whose starts are a multiple of the frame shift apart
+// are computed as one region and their frames copied out of it.  With
+// snip_edges each frame depends only on its own samples, so this gives the
+// same features as computing the segments separately; without it, they are
+// computed separately.  Segments too short for one frame get empty features.
+template<class C>
+void ComputeSegmentFeatures(const C &computer,
+                            const FrameExtractionOptions &opts,
+                            const VectorBase<BaseFloat> &wave,
+                            const std::vector<int32> &first_samp,
+                            const std::vector<int32> &num_samp,
+                            const std::vector<BaseFloat> &vtln_warp,
+                            std::vector<Matrix<BaseFloat> > *features) {
+  size_t num_segments = first_samp.size();
+  KALDI_ASSERT(num_samp.size() == num_segments &&
+               vtln_warp.size() == num_segments);
+  int32 frame_shift = opts.WindowShift();
+  features->resize(num_segments);
+  std::vector<bool> done(num_segments, false);
+  for (size_t i = 0; i < num_segments; i++) {
+    if (done[i]) continue;
+    // The segments computed together with segment i, and the region of
+    // "wave" they span.
+    std::vector<size_t> members(1, i);
+    int32 start = first_samp[i], end = first_samp[i] + num_samp[i];
+    if (opts.snip_edges) {
+      for (size_t j = i + 1; j < num_segments; j++) {
+        if (!done[j] && vtln_warp[j] == vtln_warp[i] &&
+            (first_samp[j] - first_samp[i]) % frame_shift == 0) {
+          members.push_back(j);
+          start = std::min(start, first_samp[j]);
+          end = std::max(end, first_samp[j] + num_samp[j]);
+        }
+      }
+    }
+    Matrix<BaseFloat> region_features;
+    if (NumFrames(end - start, opts) > 0) {
+      SubVector<BaseFloat> region(wave, start, end - start);
+      computer.Compute(region, vtln_warp[i], &region_features, NULL);
+    }
+    for (size_t k = 0; k < members.size(); k++) {
+      size_t j = members[k];
+      int32 num_frames = NumFrames(num_samp[j], opts);
+      if (num_frames == 0)
+        (*features)[j].Resize(0, 0);
+      else
+        (*features)[j] = region_features.RowRange(
+            (first_samp[j] - start) / frame_shift, num_frames);
+      done[j] = true;
+    }
+  }
+}
+
 
 
 // ComputePowerSpectrum converts a complex FFT (as produced by the FFT
@@ -172,6 +250,13 @@ void ExtractWaveformRemainder(const VectorBase<BaseFloat> &wave,
 // remaining (n/2) - 1 elements are undefined at output.
 void ComputePowerSpectrum(VectorBase<BaseFloat> *complex_fft);
 
+// ComputePowerSpectra computes the FFT of each row of "windows" (using
+// "srfft" if non-NULL, which must have the dimension of the rows, else
+// RealFft()) and converts it into a power spectrum, as ComputePowerSpectrum()
+// does; so the energies are in the first NumCols()/2 + 1 columns at output.
+void ComputePowerSpectra(const SplitRadixRealFft<BaseFloat> *srfft,
+                         MatrixBase<BaseFloat> *windows);
+
 
 
 inline void MaxNormalizeEnergy(Matrix<BaseFloat> *feats) {
@@ -211,8 +296,8 @@ class DeltaFeatures {
   // The function takes as input a matrix of features and a frame index
   // that it should compute the deltas on.  It puts its output in an object
   // of type VectorBase, of size (original-feature-dimension) * (opts.order+1).
-  // This is not the most efficient way to do the computation, but it's
-  // state-free and thus easier to understand
+  // It's state-free and thus easy to understand; the window is applied to all
+  // the dimensions of the frame at once, with SSE or AVX if available.
 
   explicit DeltaFeatures(const DeltaFeaturesOptions &opts);
 
@@ -289,6 +374,39 @@ void SpliceFrames(const MatrixBase<BaseFloat> &input_features,
                   int32 right_context,
                   Matrix<BaseFloat> *output_features);
 
+/// Options for ApplyCmvnAndDeltas().
+struct CmvnAndDeltasOptions {
+  bool norm_vars;
+  bool add_deltas;
+  DeltaFeaturesOptions delta_opts;
+  int32 left_context;
+  int32 right_context;
+
+  CmvnAndDeltasOptions(): norm_vars(false), add_deltas(true),
+                          left_context(0), right_context(0) { }
+  void Register(OptionsItf *po) {
+    po->Register("norm-vars", &norm_vars, "If true, normalize variances.");
+    po->Register("add-deltas", &add_deltas, "If true, add deltas, as "
+                 "add-deltas does.");
+    delta_opts.Register(po);
+    po->Register("left-context", &left_context, "Number of frames of left "
+                 "context to splice, after adding the deltas.");
+    po->Register("right-context", &right_context, "Number of frames of right "
+                 "context to splice, after adding the deltas.");
+  }
+};
+
+/// ApplyCmvnAndDeltas does what ApplyCmvn() (if cmvn_stats != NULL),
+/// ComputeDeltas() (if opts.add_deltas) and SpliceFrames() (if there is any
+/// context) would do one after the other, in a single pass over the frames
+/// and without the intermediate matrices; the output is the same.  This is
+/// the usual transformation of the features before the network, in training
+/// and in decoding.
+void ApplyCmvnAndDeltas(const CmvnAndDeltasOptions &opts,
+                        const MatrixBase<double> *cmvn_stats,
+                        const MatrixBase<BaseFloat> &input_features,
+                        Matrix<BaseFloat> *output_features);
+
 // ReverseFrames reverses the frames in time (used for backwards decoding)
 void ReverseFrames(const MatrixBase<BaseFloat> &input_features,
                   Matrix<BaseFloat> *output_features);
@@ -123,54 +123,49 @@ void Mfcc::ComputeInternal(const VectorBase<BaseFloat> &wave,
       cols_out = opts_.num_ceps;
   if (rows_out == 0) {
     output->Resize(0, 0);
-    *wave_remainder = wave;
+    if (wave_remainder != NULL)
+      *wave_remainder = wave;
     return;
   }
   output->Resize(rows_out, cols_out);
   if (wave_remainder != NULL)
     ExtractWaveformRemainder(wave, opts_.frame_opts, wave_remainder);
-  Vector<BaseFloat> window;  // windowed waveform.
-  Vector<BaseFloat> mel_energies;
-  std::vector<BaseFloat> temp_buffer;  // used by srfft.
-  for (int32 r = 0; r < rows_out; r++) {  // r is frame index..
-    BaseFloat log_energy;
-    ExtractWindow(wave, r, opts_.frame_opts, feature_window_function_, &window,
-                  (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
+  // All frames are processed together, as matrices with one row per frame.
+  Matrix<BaseFloat> windows;  // windowed waveforms.
+  Vector<BaseFloat> log_energy;
+  ExtractWindows(wave, opts_.frame_opts, feature_window_function_, &windows,
+                 (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
 
-    if (opts_.use_energy && !opts_.raw_energy)
-      log_energy = log(std::max(VecVec(window, window),
-                                std::numeric_limits<BaseFloat>::min()));
+  if (opts_.use_energy && !opts_.raw_energy)
+    ComputeLogEnergies(windows, &log_energy);
 
-    if (srfft_ != NULL)  // Compute FFT using the split-radix algorithm.
-      srfft_->Compute(window.Data(), true, &temp_buffer);
-    else  // An alternative algorithm that works for non-powers-of-two.
-      RealFft(&window, true);
+  // Convert the windows into power spectra.
+  ComputePowerSpectra(srfft_, &windows);
+  SubMatrix<BaseFloat> power_spectra(windows.ColRange(0,
+                                                      windows.NumCols()/2 + 1));
 
-    // Convert the FFT into a power spectrum.
-    ComputePowerSpectrum(&window);
-    SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
+  Matrix<BaseFloat> mel_energies;
+  mel_banks.Compute(power_spectra, &mel_energies);
 
-    mel_banks.Compute(power_spectrum, &mel_energies);
+  // avoid log of zero (which should be prevented anyway by dithering).
+  mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
+  mel_energies.ApplyLog();  // take the log.
 
-    // avoid log of zero (which should be prevented anyway by dithering).
-    mel_energies.ApplyFloor(std::numeric_limits<BaseFloat>::min());
-    mel_energies.ApplyLog();  // take the log.
+  // output = mel_energies [which now have log] * dct_matrix_^T
+  output->AddMatMat(1.0, mel_energies, kNoTrans, dct_matrix_, kTrans, 0.0);
 
-    SubVector<BaseFloat> this_mfcc(output->Row(r));
+  if (opts_.cepstral_lifter != 0.0)
+    output->MulColsVec(lifter_coeffs_);
 
-    // this_mfcc = dct_matrix_ * mel_energies [which now have log]
-    this_mfcc.AddMatVec(1.0, dct_matrix_, kNoTrans, mel_energies, 0.0);
-
-    if (opts_.cepstral_lifter != 0.0)
-      this_mfcc.MulElements(lifter_coeffs_);
-
-    if (opts_.use_energy) {
-      if (opts_.energy_floor > 0.0 && log_energy < log_energy_floor_)
-        log_energy = log_energy_floor_;
-      this_mfcc(0) = log_energy;
-    }
+  if (opts_.use_energy) {
+    if (opts_.energy_floor > 0.0)
+      log_energy.ApplyFloor(log_energy_floor_);
+    output->CopyColFromVec(log_energy, 0);
+  }
 
-    if (opts_.htk_compat) {
+  if (opts_.htk_compat) {
+    for (int32 r = 0; r < rows_out; r++) {
+      SubVector<BaseFloat> this_mfcc(output->Row(r));
       BaseFloat energy = this_mfcc(0);
       for (int32 i = 0; i < opts_.num_ceps-1; i++)
         this_mfcc(i) = this_mfcc(i+1);
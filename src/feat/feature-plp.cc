@@ -168,62 +168,61 @@ void Plp::ComputeInternal(const VectorBase<BaseFloat> &wave,
       cols_out = opts_.num_ceps;
   if (rows_out == 0) {
     output->Resize(0, 0);
-    *wave_remainder = wave;
+    if (wave_remainder != NULL)
+      *wave_remainder = wave;
     return;
   }
   output->Resize(rows_out, cols_out);
   if (wave_remainder != NULL)
     ExtractWaveformRemainder(wave, opts_.frame_opts, wave_remainder);
-  Vector<BaseFloat> window;  // windowed waveform.
   int32 num_mel_bins = opts_.mel_opts.num_bins;
-  Vector<BaseFloat> mel_energies(num_mel_bins);
-  Vector<BaseFloat> mel_energies_duplicated(num_mel_bins+2);
-  Vector<BaseFloat> autocorr_coeffs(opts_.lpc_order+1);
   Vector<BaseFloat> lpc_coeffs(opts_.lpc_order);
   Vector<BaseFloat> raw_cepstrum(opts_.lpc_order);  // not including C0,
   // and size may differ from final size.
   Vector<BaseFloat> final_cepstrum(opts_.num_ceps);
-  std::vector<BaseFloat> temp_buffer;  // used by srfft.
   
   KALDI_ASSERT(opts_.num_ceps <= opts_.lpc_order+1);  // our num-ceps includes C0.
-  for (int32 r = 0; r < rows_out; r++) {  // r is frame index..
-    BaseFloat log_energy;
-    ExtractWindow(wave, r, opts_.frame_opts,
-                  feature_window_function_, &window,
-                  (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
 
-    if (opts_.use_energy && !opts_.raw_energy)
-      log_energy = log(std::max(VecVec(window, window),
-                                std::numeric_limits<BaseFloat>::min()));
+  // Everything up to the autocorrelation coefficients is done for all frames
+  // together, as matrices with one row per frame.
+  Matrix<BaseFloat> windows;  // windowed waveforms.
+  Vector<BaseFloat> log_energy;
+  ExtractWindows(wave, opts_.frame_opts, feature_window_function_, &windows,
+                 (opts_.use_energy && opts_.raw_energy ? &log_energy : NULL));
 
-    if (srfft_ != NULL)  // Compute FFT using split-radix algorithm.
-      srfft_->Compute(window.Data(), true, &temp_buffer);
-    else  // An alternative algorithm that works for non-powers-of-two.
-      RealFft(&window, true);
+  if (opts_.use_energy && !opts_.raw_energy)
+    ComputeLogEnergies(windows, &log_energy);
 
-    // Convert the FFT into a power spectrum.
-    ComputePowerSpectrum(&window);  // elements 0 ... window.Dim()/2
+  // Convert the windows into power spectra.
+  ComputePowerSpectra(srfft_, &windows);
+  SubMatrix<BaseFloat> power_spectra(windows.ColRange(0,
+                                                      windows.NumCols()/2 + 1));
 
-    SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
+  Matrix<BaseFloat> mel_energies;
+  mel_banks.Compute(power_spectra, &mel_energies);
 
-    mel_banks.Compute(power_spectrum, &mel_energies);
+  mel_energies.MulColsVec(equal_loudness);
 
-    mel_energies.MulElements(equal_loudness);
-    
-    mel_energies.ApplyPow(opts_.compress_factor);
-    
-    // duplicate first and last elements.
-    {
-      SubVector<BaseFloat> v(mel_energies_duplicated, 1, num_mel_bins);
-      v.CopyFromVec(mel_energies);
-    }
-    mel_energies_duplicated(0) = mel_energies(0);
-    mel_energies_duplicated(num_mel_bins+1) = mel_energies(num_mel_bins-1);
+  mel_energies.ApplyPow(opts_.compress_factor);
 
-    autocorr_coeffs.AddMatVec(1.0, idft_bases_, kNoTrans,
-                              mel_energies_duplicated,  0.0);
-    
-    BaseFloat energy = ComputeLpc(autocorr_coeffs, &lpc_coeffs);
+  // duplicate first and last elements.
+  Matrix<BaseFloat> mel_energies_duplicated(rows_out, num_mel_bins+2,
+                                            kUndefined);
+  mel_energies_duplicated.ColRange(1, num_mel_bins).CopyFromMat(mel_energies);
+  mel_energies_duplicated.ColRange(0, 1).CopyFromMat(
+      mel_energies.ColRange(0, 1));
+  mel_energies_duplicated.ColRange(num_mel_bins+1, 1).CopyFromMat(
+      mel_energies.ColRange(num_mel_bins-1, 1));
+
+  Matrix<BaseFloat> autocorr_coeffs(rows_out, opts_.lpc_order+1, kUndefined);
+  autocorr_coeffs.AddMatMat(1.0, mel_energies_duplicated, kNoTrans,
+                            idft_bases_, kTrans, 0.0);
+
+  if (opts_.use_energy && opts_.energy_floor > 0.0)
+    log_energy.ApplyFloor(log_energy_floor_);
+
+  for (int32 r = 0; r < rows_out; r++) {  // r is frame index..
+    BaseFloat energy = ComputeLpc(autocorr_coeffs.Row(r), &lpc_coeffs);
 
     energy = std::max(energy,
                       std::numeric_limits<BaseFloat>::min());
@@ -242,11 +241,8 @@ void Plp::ComputeInternal(const VectorBase<BaseFloat> &wave,
     if (opts_.cepstral_scale != 1.0)
       final_cepstrum.Scale(opts_.cepstral_scale);
 
-    if (opts_.use_energy) {
-      if (opts_.energy_floor > 0.0 && log_energy < log_energy_floor_)
-        log_energy = log_energy_floor_;
-      final_cepstrum(0) = log_energy;
-    }
+    if (opts_.use_energy)
+      final_cepstrum(0) = log_energy(r);
 
     if (opts_.htk_compat) {
       BaseFloat energy = final_cepstrum(0);
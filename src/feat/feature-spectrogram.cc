@@ -56,41 +56,28 @@ void Spectrogram::Compute(const VectorBase<BaseFloat> &wave,
   if (wave_remainder != NULL)
     ExtractWaveformRemainder(wave, opts_.frame_opts, wave_remainder);
 
-  // Buffers
-  Vector<BaseFloat> window;  // windowed waveform.
-  BaseFloat log_energy;
-
-  // Compute all the freames, r is frame index..
-  for (int32 r = 0; r < rows_out; r++) {
-    // Cut the window, apply window function
-    ExtractWindow(wave, r, opts_.frame_opts, feature_window_function_,
-                  &window, (opts_.raw_energy ? &log_energy : NULL));
-
-    // Compute energy after window function (not the raw one)
-    if (!opts_.raw_energy)
-      log_energy = log(std::max(VecVec(window, window),
-                                std::numeric_limits<BaseFloat>::min()));
-    
-    if (srfft_ != NULL)  // Compute FFT using split-radix algorithm.
-      srfft_->Compute(window.Data(), true);
-    else  // An alternative algorithm that works for non-powers-of-two
-      RealFft(&window, true);
-
-    // Convert the FFT into a power spectrum.
-    ComputePowerSpectrum(&window);
-    SubVector<BaseFloat> power_spectrum(window, 0, window.Dim()/2 + 1);
-
-    power_spectrum.ApplyFloor(std::numeric_limits<BaseFloat>::min());
-    power_spectrum.ApplyLog();
-
-    // Output buffers
-    SubVector<BaseFloat> this_output(output->Row(r));
-    this_output.CopyFromVec(power_spectrum);
-    if (opts_.energy_floor > 0.0 && log_energy < log_energy_floor_) {
-        log_energy = log_energy_floor_;
-    }
-    this_output(0) = log_energy;
-  }
+  // Cut the windows of all frames and apply the window function; the
+  // frames are processed together, as matrices with one row per frame.
+  Matrix<BaseFloat> windows;
+  Vector<BaseFloat> log_energy;
+  ExtractWindows(wave, opts_.frame_opts, feature_window_function_, &windows,
+                 (opts_.raw_energy ? &log_energy : NULL));
+
+  // Compute energy after window function (not the raw one)
+  if (!opts_.raw_energy)
+    ComputeLogEnergies(windows, &log_energy);
+
+  // Convert the windows into power spectra.
+  ComputePowerSpectra(srfft_, &windows);
+  SubMatrix<BaseFloat> power_spectra(windows.ColRange(0, cols_out));
+
+  power_spectra.ApplyFloor(std::numeric_limits<BaseFloat>::min());
+  power_spectra.ApplyLog();
+
+  output->CopyFromMat(power_spectra);
+  if (opts_.energy_floor > 0.0)
+    log_energy.ApplyFloor(log_energy_floor_);
+  output->CopyColFromVec(log_energy, 0);
 }
 
 }  // namespace eesen
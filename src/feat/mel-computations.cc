@@ -133,6 +133,19 @@ MelBanks::MelBanks(const MelBanksOptions &opts,
       bins_[bin].second(0) = 0.0;
     
   }
+  weights_offset_ = bins_[0].first;
+  int32 weights_end = 0;
+  for (int32 bin = 0; bin < num_bins; bin++) {
+    weights_offset_ = std::min(weights_offset_, bins_[bin].first);
+    weights_end = std::max(weights_end,
+                           bins_[bin].first + bins_[bin].second.Dim());
+  }
+  weights_.Resize(num_bins, weights_end - weights_offset_);
+  for (int32 bin = 0; bin < num_bins; bin++)
+    weights_.Row(bin).Range(bins_[bin].first - weights_offset_,
+                            bins_[bin].second.Dim()).CopyFromVec(
+                                bins_[bin].second);
+
   if (debug_) {
     for (size_t i = 0; i < bins_.size(); i++) {
       KALDI_LOG << "bin " << i << ", offset = " << bins_[i].first
@@ -245,6 +258,32 @@ void MelBanks::Compute(const VectorBase<BaseFloat> &power_spectrum,
   }
 }
 
+void MelBanks::Compute(const MatrixBase<BaseFloat> &power_spectra,
+                       Matrix<BaseFloat> *mel_energies_out) const {
+  int32 num_frames = power_spectra.NumRows(), num_bins = bins_.size();
+  KALDI_ASSERT(power_spectra.NumCols() >= weights_offset_ + weights_.NumCols());
+  mel_energies_out->Resize(num_frames, num_bins, kUndefined);
+  if (num_frames == 0) return;
+
+  SubMatrix<BaseFloat> band(power_spectra, 0, num_frames,
+                            weights_offset_, weights_.NumCols());
+  mel_energies_out->AddMatMat(1.0, band, kNoTrans, weights_, kTrans, 0.0);
+  // HTK-like flooring- for testing purposes (we prefer dither)
+  if (htk_mode_) mel_energies_out->ApplyFloor(1.0);
+
+  // See the comment in the vector version of Compute().
+  KALDI_ASSERT(!KALDI_ISNAN(mel_energies_out->Sum()));
+
+  if (debug_) {
+    fprintf(stderr, "MEL BANKS:\n");
+    for (int32 r = 0; r < num_frames; r++) {
+      for (int32 i = 0; i < num_bins; i++)
+        fprintf(stderr, " %f", (*mel_energies_out)(r, i));
+      fprintf(stderr, "\n");
+    }
+  }
+}
+
 void ComputeLifterCoeffs(BaseFloat Q, VectorBase<BaseFloat> *coeffs) {
   // Compute liftering coefficients (scaling on cepstral coeffs)
   // coeffs are numbered slightly differently from HTK: the zeroth
@@ -76,6 +76,13 @@ class MelBanks {
   void Compute(const VectorBase<BaseFloat> &fft_energies,
                Vector<BaseFloat> *mel_energies_out) const;
 
+  /// As Compute() above, but for many frames at once: row r of
+  /// "fft_energies" holds the FFT energies of frame r, and row r of
+  /// "mel_energies_out" will get its Mel energies.  This is done as one
+  /// matrix multiplication with the banded matrix of bin weights.
+  void Compute(const MatrixBase<BaseFloat> &fft_energies,
+               Matrix<BaseFloat> *mel_energies_out) const;
+
   int32 NumBins() const { return bins_.size(); }
 
   // returns vector of central freq of each bin; needed by plp code.
@@ -90,6 +97,12 @@ class MelBanks {
   // (the first nonzero fft-bin), (the vector of weights).
   std::vector<std::pair<int32, Vector<BaseFloat> > > bins_;
 
+  // The same weights as a matrix, one row per bin, covering the fft-bins
+  // from weights_offset_ onward for which any bin is nonzero.  Used by the
+  // matrix version of Compute().
+  Matrix<BaseFloat> weights_;
+  int32 weights_offset_;
+
   bool debug_;
   bool htk_mode_;
   KALDI_DISALLOW_COPY_AND_ASSIGN(MelBanks);
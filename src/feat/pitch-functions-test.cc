@@ -508,11 +508,66 @@ void UnitTestProcess() {
   }
 }
 
+// Make sure that computing the NCCF with FFTs gives the same pitch as
+// computing it directly, up to rounding error, and compare their speed.
+static void UnitTestNccfFft() {
+  KALDI_LOG << "=== UnitTestNccfFft() ===\n";
+  double tot_time_direct = 0.0, tot_time_fft = 0.0;
+  int32 num_frames = 0, num_differ = 0;
+  for (int32 n = 0; n < 10; n++) {
+    PitchExtractionOptions op;
+    if (n % 2 == 1) {  // try other window sizes and lags too.
+      op.frame_length_ms = 20.0 + rand() % 20;
+      op.min_f0 = 40.0 + rand() % 40;
+      op.max_f0 = 300.0 + rand() % 300;
+      op.frames_per_chunk = rand() % 20;
+    }
+    int32 size = 10000 + rand() % 50000;
+    Vector<BaseFloat> v(size);
+    // init with noise plus a sine-wave whose frequency is changing randomly.
+    double cur_freq = 200.0, normalized_time = 0.0;
+    for (int32 i = 0; i < size; i++) {
+      v(i) = RandGauss() + cos(normalized_time * M_2PI);
+      cur_freq += RandGauss();  // let the frequency wander a little.
+      if (cur_freq < 100.0) cur_freq = 100.0;
+      if (cur_freq > 300.0) cur_freq = 300.0;
+      normalized_time += cur_freq / op.samp_freq;
+    }
+
+    Matrix<BaseFloat> m1, m2;
+    Timer timer;
+    ComputeKaldiPitch(op, v, &m1);
+    tot_time_direct += timer.Elapsed();
+    op.nccf_fft = true;
+    timer.Reset();
+    ComputeKaldiPitch(op, v, &m2);
+    tot_time_fft += timer.Elapsed();
+
+    KALDI_ASSERT(m1.NumRows() == m2.NumRows() && m1.NumCols() == 2);
+    // The NCCF is the same up to rounding error; the pitch may differ only
+    // where rounding changes the best path of the Viterbi search, which
+    // should be very rare.
+    for (int32 t = 0; t < m1.NumRows(); t++) {
+      KALDI_ASSERT(fabs(m1(t, 0) - m2(t, 0)) < 1.0e-03);
+      if (fabs(m1(t, 1) - m2(t, 1)) > 1.0e-03 * m1(t, 1))
+        num_differ++;
+    }
+    num_frames += m1.NumRows();
+  }
+  KALDI_LOG << "Pitch differs on " << num_differ << " out of " << num_frames
+            << " frames.";
+  KALDI_ASSERT(num_differ <= num_frames / 1000);
+  KALDI_LOG << "Time taken with direct NCCF " << tot_time_direct
+            << "s, with FFT-based NCCF " << tot_time_fft << "s";
+  KALDI_LOG << "Test passed :)\n";
+}
+
 static void UnitTestFeatNoKeele() {
   UnitTestSimple();
   UnitTestPieces();
   UnitTestDelay();
   UnitTestSearch();
+  UnitTestNccfFft();
 }
 
 static void UnitTestFeatWithKeele() {
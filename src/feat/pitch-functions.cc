@@ -27,6 +27,7 @@
 #include "feat/online-feature.h"
 #include "feat/pitch-functions.h"
 #include "feat/resample.h"
+#include "feat/srfft.h"
 #include "cpucompute/matrix-functions.h"
 
 namespace eesen {
@@ -119,6 +120,97 @@ void ComputeCorrelation(const VectorBase<BaseFloat> &wave,
   }
 }
 
+/**
+   This function computes the same quantities as ComputeCorrelation(), but for
+   several frames at once and using FFTs: row f of "windows" is the wave of
+   frame f, and row f of "inner_prod" and "norm_prod" is set as
+   ComputeCorrelation() would set "inner_prod" and "norm_prod" for it.  The
+   dot products for all lags are obtained from the inverse FFT of the
+   cross-power spectrum of the un-shifted window and the whole wave, and the
+   energies of the shifted windows from a cumulative sum of squares.  "srfft"
+   must be of size fft_size >= windows.NumCols(), so the circular correlation
+   does not wrap around.
+ */
+void ComputeCorrelationFft(const SplitRadixRealFft<BaseFloat> &srfft,
+                           int32 fft_size,
+                           const MatrixBase<BaseFloat> &windows,
+                           int32 first_lag, int32 last_lag,
+                           int32 nccf_window_size,
+                           MatrixBase<BaseFloat> *inner_prod,
+                           MatrixBase<BaseFloat> *norm_prod) {
+  int32 num_frames = windows.NumRows(), full_frame_length = windows.NumCols(),
+      num_lags = last_lag + 1 - first_lag;
+  KALDI_ASSERT(fft_size >= full_frame_length &&
+               last_lag + nccf_window_size <= full_frame_length &&
+               inner_prod->NumRows() == num_frames &&
+               inner_prod->NumCols() == num_lags &&
+               norm_prod->NumRows() == num_frames &&
+               norm_prod->NumCols() == num_lags);
+  // We process blocks of frames, to limit the memory used.  "frames" holds
+  // the zero-padded zero-mean waves, and "heads" only their first
+  // nccf_window_size samples.
+  int32 block_size = std::min<int32>(num_frames, 256);
+  Matrix<BaseFloat> frames(block_size, fft_size), heads(block_size, fft_size);
+  std::vector<BaseFloat> temp_buffer;
+  std::vector<double> sumsq(full_frame_length + 1);
+  for (int32 start = 0; start < num_frames; start += block_size) {
+    int32 this_block_size = std::min(block_size, num_frames - start);
+    if (this_block_size < block_size) {
+      frames.Resize(this_block_size, fft_size);
+      heads.Resize(this_block_size, fft_size);
+    } else {
+      heads.SetZero();  // "frames" is fully overwritten below.
+    }
+    for (int32 b = 0; b < this_block_size; b++) {
+      int32 f = start + b;
+      SubVector<BaseFloat> wave(frames, b);
+      wave.Range(full_frame_length,
+                 fft_size - full_frame_length).SetZero();
+      SubVector<BaseFloat> zero_mean_wave(wave, 0, full_frame_length);
+      zero_mean_wave.CopyFromVec(windows.Row(f));
+      // subtract the mean of the first window, as ComputeCorrelation() does.
+      zero_mean_wave.Add(-zero_mean_wave.Range(0, nccf_window_size).Sum() /
+                         nccf_window_size);
+      heads.Row(b).Range(0, nccf_window_size).CopyFromVec(
+          zero_mean_wave.Range(0, nccf_window_size));
+
+      // sumsq[i] is the sum of squares of the first i samples.
+      const BaseFloat *data = zero_mean_wave.Data();
+      sumsq[0] = 0.0;
+      for (int32 i = 0; i < full_frame_length; i++)
+        sumsq[i + 1] = sumsq[i] + data[i] * data[i];
+      double e1 = sumsq[nccf_window_size];
+      BaseFloat *norm_data = norm_prod->RowData(f);
+      for (int32 lag = first_lag; lag <= last_lag; lag++)
+        norm_data[lag - first_lag] =
+            e1 * (sumsq[lag + nccf_window_size] - sumsq[lag]);
+    }
+
+    srfft.Compute(&frames, true, &temp_buffer);
+    srfft.Compute(&heads, true, &temp_buffer);
+    // Multiply the spectrum of each wave by the conjugate of the spectrum of
+    // its head, in the packed format of SplitRadixRealFft (see srfft.h), so
+    // the inverse FFT gives the correlations.
+    for (int32 b = 0; b < this_block_size; b++) {
+      BaseFloat *x = frames.RowData(b);
+      const BaseFloat *h = heads.RowData(b);
+      x[0] *= h[0];
+      x[1] *= h[1];
+      for (int32 k = 2; k < fft_size; k += 2) {
+        BaseFloat re = x[k] * h[k] + x[k + 1] * h[k + 1],
+            im = x[k + 1] * h[k] - x[k] * h[k + 1];
+        x[k] = re;
+        x[k + 1] = im;
+      }
+    }
+    srfft.Compute(&frames, false, &temp_buffer);
+    SubMatrix<BaseFloat> this_inner_prod(*inner_prod, start, this_block_size,
+                                         0, num_lags);
+    this_inner_prod.CopyFromMat(frames.ColRange(first_lag, num_lags));
+  }
+  inner_prod->Scale(1.0 / fft_size);
+}
+
 /**
    Computes the NCCF as a fraction of the numerator term (a dot product between
    two vectors) and a denominator term which equals sqrt(e1*e2 + nccf_ballast)
@@ -650,6 +742,11 @@ class OnlinePitchFeatureImpl {
   // have to use the initializer from the constructor.
   ArbitraryResample *nccf_resampler_;
 
+  // If opts_.nccf_fft, the FFT used by ComputeCorrelationFft(), of size
+  // nccf_fft_size_; otherwise NULL.
+  SplitRadixRealFft<BaseFloat> *nccf_srfft_;
+  int32 nccf_fft_size_;
+
   // The following objects may change during the lifetime of this object.
 
   // This object is used to resample the signal.
@@ -750,6 +847,16 @@ OnlinePitchFeatureImpl::OnlinePitchFeatureImpl(
                                           upsample_cutoff, lags_offset,
                                           opts.upsample_filter_width);
 
+  nccf_srfft_ = NULL;
+  nccf_fft_size_ = 0;
+  if (opts.nccf_fft) {
+    int32 full_frame_length = opts.NccfWindowSize() + nccf_last_lag_;
+    nccf_fft_size_ = 4;  // the smallest size SplitRadixRealFft allows.
+    while (nccf_fft_size_ < full_frame_length)
+      nccf_fft_size_ *= 2;
+    nccf_srfft_ = new SplitRadixRealFft<BaseFloat>(nccf_fft_size_);
+  }
+
   // add a PitchInfo object for frame -1 (not a real frame).
   frame_info_.push_back(new PitchFrameInfo(lags_.Dim()));
   // zeroes forward_cost_; this is what we want for the fake frame -1.
@@ -1001,6 +1108,7 @@ void OnlinePitchFeatureImpl::RecomputeBacktraces() {
 
 OnlinePitchFeatureImpl::~OnlinePitchFeatureImpl() {
   delete nccf_resampler_;
+  delete nccf_srfft_;
   delete signal_resampler_;
   for (size_t i = 0; i < frame_info_.size(); i++)
     delete frame_info_[i];
@@ -1051,9 +1159,6 @@ void OnlinePitchFeatureImpl::AcceptWaveform(
       basic_frame_length = opts_.NccfWindowSize(),
       full_frame_length = basic_frame_length + nccf_last_lag_;
 
-  Vector<BaseFloat> window(full_frame_length),
-      inner_prod(num_measured_lags),
-      norm_prod(num_measured_lags);
   Matrix<BaseFloat> nccf_pitch(num_new_frames, num_measured_lags),
       nccf_pov(num_new_frames, num_measured_lags);
 
@@ -1063,49 +1168,84 @@ void OnlinePitchFeatureImpl::AcceptWaveform(
   // Because the resampling of the NCCF is more efficient when grouped together,
   // we first compute the NCCF for all frames, then resample as a matrix, then
   // do the Viterbi [that happens inside the constructor of PitchFrameInfo].
+  // The frames are extracted and correlated in blocks, so the FFT path can
+  // transform several frames at a time while the memory used for the windows
+  // stays bounded even when the whole utterance is processed at once.
+
+  int32 block_size = std::min<int32>(num_new_frames, 256);
+  Matrix<BaseFloat> windows(block_size, full_frame_length),
+      inner_prod(block_size, num_measured_lags),
+      norm_prod(block_size, num_measured_lags);
+  std::vector<double> mean_square(block_size);
+
+  for (int32 block_start = start_frame; block_start < end_frame;
+       block_start += block_size) {
+    int32 this_block_size = std::min(block_size, end_frame - block_start);
+    if (this_block_size < block_size) {
+      windows.Resize(this_block_size, full_frame_length);
+      inner_prod.Resize(this_block_size, num_measured_lags);
+      norm_prod.Resize(this_block_size, num_measured_lags);
+    }
+    for (int32 b = 0; b < this_block_size; b++) {
+      // start_sample is index into the whole wave, not just this part.
+      int64 start_sample = static_cast<int64>(block_start + b) * frame_shift;
+      SubVector<BaseFloat> window(windows, b);
+      ExtractFrame(downsampled_wave, start_sample, &window);
+      if (opts_.nccf_ballast_online) {
+        // use only up to end of current frame to compute root-mean-square
+        // value.  end_sample will be the sample-index into "downsampled_wave",
+        // so not really comparable to start_sample.
+        int64 end_sample = start_sample + full_frame_length -
+            downsampled_samples_processed_;
+        KALDI_ASSERT(end_sample > 0);  // or should have processed this frame
+                                       // last time.  Note: end_sample is one
+                                       // past last sample.
+        if (end_sample > downsampled_wave.Dim()) {
+          KALDI_ASSERT(input_finished_);
+          end_sample = downsampled_wave.Dim();
+        }
+        SubVector<BaseFloat> new_part(downsampled_wave, prev_frame_end_sample,
+                                      end_sample - prev_frame_end_sample);
+        cur_num_samp += new_part.Dim();
+        cur_sumsq += VecVec(new_part, new_part);
+        cur_sum += new_part.Sum();
+        prev_frame_end_sample = end_sample;
+      }
+      mean_square[b] = cur_sumsq / cur_num_samp -
+          pow(cur_sum / cur_num_samp, 2.0);
+    }
 
-  for (int32 frame = start_frame; frame < end_frame; frame++) {
-    // start_sample is index into the whole wave, not just this part.
-    int64 start_sample = static_cast<int64>(frame) * frame_shift;
-    ExtractFrame(downsampled_wave, start_sample, &window);
-    if (opts_.nccf_ballast_online) {
-      // use only up to end of current frame to compute root-mean-square value.
-      // end_sample will be the sample-index into "downsampled_wave", so
-      // not really comparable to start_sample.
-      int64 end_sample = start_sample + full_frame_length -
-          downsampled_samples_processed_;
-      KALDI_ASSERT(end_sample > 0);  // or should have processed this frame last
-                                     // time.  Note: end_sample is one past last
-                                     // sample.
-      if (end_sample > downsampled_wave.Dim()) {
-        KALDI_ASSERT(input_finished_);
-        end_sample = downsampled_wave.Dim();
+    if (nccf_srfft_ != NULL) {
+      ComputeCorrelationFft(*nccf_srfft_, nccf_fft_size_, windows,
+                            nccf_first_lag_, nccf_last_lag_,
+                            basic_frame_length, &inner_prod, &norm_prod);
+    } else {
+      for (int32 b = 0; b < this_block_size; b++) {
+        SubVector<BaseFloat> inner_prod_row(inner_prod, b),
+            norm_prod_row(norm_prod, b);
+        ComputeCorrelation(windows.Row(b), nccf_first_lag_, nccf_last_lag_,
+                           basic_frame_length, &inner_prod_row,
+                           &norm_prod_row);
       }
-      SubVector<BaseFloat> new_part(downsampled_wave, prev_frame_end_sample,
-                                    end_sample - prev_frame_end_sample);
-      cur_num_samp += new_part.Dim();
-      cur_sumsq += VecVec(new_part, new_part);
-      cur_sum += new_part.Sum();
-      prev_frame_end_sample = end_sample;
     }
-    double mean_square = cur_sumsq / cur_num_samp -
-        pow(cur_sum / cur_num_samp, 2.0);
-
-    ComputeCorrelation(window, nccf_first_lag_, nccf_last_lag_,
-                       basic_frame_length, &inner_prod, &norm_prod);
-    double nccf_ballast_pov = 0.0,
-        nccf_ballast_pitch = pow(mean_square * basic_frame_length, 2) *
-             opts_.nccf_ballast,
-        avg_norm_prod = norm_prod.Sum() / norm_prod.Dim();
-    SubVector<BaseFloat> nccf_pitch_row(nccf_pitch, frame - start_frame);
-    ComputeNccf(inner_prod, norm_prod, nccf_ballast_pitch,
-                &nccf_pitch_row);
-    SubVector<BaseFloat> nccf_pov_row(nccf_pov, frame - start_frame);
-    ComputeNccf(inner_prod, norm_prod, nccf_ballast_pov,
-                &nccf_pov_row);
-    if (frame < opts_.recompute_frame)
-      nccf_info_.push_back(new NccfInfo(avg_norm_prod, mean_square));
+
+    for (int32 b = 0; b < this_block_size; b++) {
+      int32 frame = block_start + b, frame_idx = frame - start_frame;
+      double nccf_ballast_pov = 0.0,
+          nccf_ballast_pitch = pow(mean_square[b] * basic_frame_length, 2) *
+              opts_.nccf_ballast,
+          avg_norm_prod = norm_prod.Row(b).Sum() / num_measured_lags;
+      SubVector<BaseFloat> nccf_pitch_row(nccf_pitch, frame_idx);
+      ComputeNccf(inner_prod.Row(b), norm_prod.Row(b), nccf_ballast_pitch,
+                  &nccf_pitch_row);
+      SubVector<BaseFloat> nccf_pov_row(nccf_pov, frame_idx);
+      ComputeNccf(inner_prod.Row(b), norm_prod.Row(b), nccf_ballast_pov,
+                  &nccf_pov_row);
+      if (frame < opts_.recompute_frame)
+        nccf_info_.push_back(new NccfInfo(avg_norm_prod, mean_square[b]));
+    }
   }
+  windows.Resize(0, 0);  // no longer needed.
 
   Matrix<BaseFloat> nccf_pitch_resampled(num_new_frames, num_resampled_lags);
   nccf_resampler_->Resample(nccf_pitch, &nccf_pitch_resampled);
@@ -108,6 +108,13 @@ struct PitchExtractionOptions {
   // chunking, which is useful for testing purposes.
   bool nccf_ballast_online;
   bool snip_edges;
+
+  // If true, the cross-correlations for the NCCF are computed with FFTs,
+  // several frames at a time, instead of as a dot product for each lag.  The
+  // NCCF is the same up to rounding error.  At the default settings the speed
+  // is about the same; it helps when the window or the lag range is large,
+  // e.g. with a higher resample frequency or a longer window.
+  bool nccf_fft;
   PitchExtractionOptions():
       samp_freq(16000),
       frame_shift_ms(10.0),
@@ -128,7 +135,8 @@ struct PitchExtractionOptions {
       simulate_first_pass_online(false),
       recompute_frame(500),
       nccf_ballast_online(false),
-      snip_edges(true) { }
+      snip_edges(true),
+      nccf_fft(false) { }
 
   void Register(OptionsItf *po) {
     po->Register("sample-frequency", &samp_freq,
@@ -192,6 +200,10 @@ struct PitchExtractionOptions {
                  "that the number of frames is the file size divided by the "
                  "frame-shift. This makes different types of features give the "
                  "same number of frames.");
+    po->Register("nccf-fft", &nccf_fft, "If true, compute the NCCF with "
+                 "FFTs.  The result differs only by rounding error; this is "
+                 "faster only for large windows or lag ranges (e.g. high "
+                 "--resample-frequency or long --frame-length).");
 
   }
   /// Returns the window-size in samples, after resampling.  This is the
@@ -19,6 +19,14 @@
 // limitations under the License.
 
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 #include <algorithm>
 #include <limits>
 #include "feat/feature-functions.h"
@@ -27,6 +35,76 @@
 
 namespace eesen {
 
+// Returns the dot product of x[0 ... n-1] and w[0 ... n-1].  The filters
+// are short (typically tens of taps), so for each output sample this is
+// cheaper than setting up SubVectors and calling VecVec(); with SSE or AVX
+// it does 4 or 8 multiply-adds per instruction.
+template<typename Real>
+static inline Real FilterDot(const Real *x, const Real *w, int32 n) {
+  Real sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+  int32 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    sum0 += x[i] * w[i];
+    sum1 += x[i + 1] * w[i + 1];
+    sum2 += x[i + 2] * w[i + 2];
+    sum3 += x[i + 3] * w[i + 3];
+  }
+  for (; i < n; i++)
+    sum0 += x[i] * w[i];
+  return (sum0 + sum1) + (sum2 + sum3);
+}
+
+#if defined(__SSE__)
+template<>
+inline float FilterDot(const float *x, const float *w, int32 n) {
+  int32 i = 0;
+  __m128 sum;
+#if defined(__AVX__)
+  __m256 sum8 = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8)
+    sum8 = _mm256_add_ps(sum8, _mm256_mul_ps(_mm256_loadu_ps(x + i),
+                                             _mm256_loadu_ps(w + i)));
+  sum = _mm_add_ps(_mm256_castps256_ps128(sum8),
+                   _mm256_extractf128_ps(sum8, 1));
+#else
+  sum = _mm_setzero_ps();
+#endif
+  for (; i + 4 <= n; i += 4)
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(w + i)));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  float ans = _mm_cvtss_f32(sum);
+  for (; i < n; i++)
+    ans += x[i] * w[i];
+  return ans;
+}
+#endif
+
+#if defined(__SSE2__)
+template<>
+inline double FilterDot(const double *x, const double *w, int32 n) {
+  int32 i = 0;
+  __m128d sum;
+#if defined(__AVX__)
+  __m256d sum4 = _mm256_setzero_pd();
+  for (; i + 4 <= n; i += 4)
+    sum4 = _mm256_add_pd(sum4, _mm256_mul_pd(_mm256_loadu_pd(x + i),
+                                             _mm256_loadu_pd(w + i)));
+  sum = _mm_add_pd(_mm256_castpd256_pd128(sum4),
+                   _mm256_extractf128_pd(sum4, 1));
+#else
+  sum = _mm_setzero_pd();
+#endif
+  for (; i + 2 <= n; i += 2)
+    sum = _mm_add_pd(sum, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(w + i)));
+  sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+  double ans = _mm_cvtsd_f64(sum);
+  for (; i < n; i++)
+    ans += x[i] * w[i];
+  return ans;
+}
+#endif
+
 
 LinearResample::LinearResample(int32 samp_rate_in_hz,
                                int32 samp_rate_out_hz,
@@ -101,10 +179,11 @@ int64 LinearResample::GetNumOutputSamples(int64 input_num_samp,
 
 void LinearResample::SetIndexesAndWeights() {
   first_index_.resize(output_samples_in_unit_);
-  weights_.resize(output_samples_in_unit_);
+  std::vector<int32> num_indices(output_samples_in_unit_);
 
   double window_width = num_zeros_ / (2.0 * filter_cutoff_);
 
+  int32 num_taps = 0;
   for (int32 i = 0; i < output_samples_in_unit_; i++) {
     double output_t = i / static_cast<double>(samp_rate_out_);
     double min_t = output_t - window_width, max_t = output_t + window_width;
@@ -116,37 +195,28 @@ void LinearResample::SetIndexesAndWeights() {
     // that we unnecessarily include something with a zero coefficient,
     // but this is only a slight efficiency issue.
     int32 min_input_index = ceil(min_t * samp_rate_in_),
-        max_input_index = floor(max_t * samp_rate_in_),
-        num_indices = max_input_index - min_input_index + 1;
+        max_input_index = floor(max_t * samp_rate_in_);
     first_index_[i] = min_input_index;
-    weights_[i].Resize(num_indices);
-    for (int32 j = 0; j < num_indices; j++) {
-      int32 input_index = min_input_index + j;
+    num_indices[i] = max_input_index - min_input_index + 1;
+    num_taps = std::max(num_taps, num_indices[i]);
+  }
+
+  // The phases differ by at most one in their number of weights; the extra
+  // taps of the shorter ones are left at zero.
+  weights_.Resize(output_samples_in_unit_, num_taps);
+  for (int32 i = 0; i < output_samples_in_unit_; i++) {
+    double output_t = i / static_cast<double>(samp_rate_out_);
+    for (int32 j = 0; j < num_indices[i]; j++) {
+      int32 input_index = first_index_[i] + j;
       double input_t = input_index / static_cast<double>(samp_rate_in_),
           delta_t = input_t - output_t;
       // sign of delta_t doesn't matter.
-      weights_[i](j) = FilterFunc(delta_t) / samp_rate_in_;
+      weights_(i, j) = FilterFunc(delta_t) / samp_rate_in_;
     }
   }
 }
 
 
-// inline
-void LinearResample::GetIndexes(int64 samp_out,
-                                int64 *first_samp_in,
-                                int32 *samp_out_wrapped) const {
-  // A unit is the smallest nonzero amount of time that is an exact
-  // multiple of the input and output sample periods.  The unit index
-  // is the answer to "which numbered unit we are in".
-  int64 unit_index = samp_out / output_samples_in_unit_;
-  // samp_out_wrapped is equal to samp_out % output_samples_in_unit_
-  *samp_out_wrapped = static_cast<int32>(samp_out -
-                                         unit_index * output_samples_in_unit_);
-  *first_samp_in = first_index_[*samp_out_wrapped] +
-      unit_index * input_samples_in_unit_;
-}
-
-
 void LinearResample::Resample(const VectorBase<BaseFloat> &input,
                               bool flush,
                               Vector<BaseFloat> *output) {
@@ -158,44 +228,58 @@ void LinearResample::Resample(const VectorBase<BaseFloat> &input,
 
   output->Resize(tot_output_samp - output_sample_offset_);
 
+  // A unit is the smallest nonzero amount of time that is an exact multiple
+  // of the input and output sample periods; output sample samp_out is in
+  // unit "unit_index" and uses the filter of phase "phase" (its index within
+  // the unit).  We step both along instead of dividing for each sample.
+  int64 unit_index = output_sample_offset_ / output_samples_in_unit_;
+  int32 phase = static_cast<int32>(output_sample_offset_ -
+                                   unit_index * output_samples_in_unit_);
+  int32 num_taps = weights_.NumCols();
+  const BaseFloat *input_data = input.Data();
+  BaseFloat *output_data = output->Data();
+
   // samp_out is the index into the total output signal, not just the part
   // of it we are producing here.
   for (int64 samp_out = output_sample_offset_;
        samp_out < tot_output_samp;
        samp_out++) {
-    int64 first_samp_in;
-    int32 samp_out_wrapped;
-    GetIndexes(samp_out, &first_samp_in, &samp_out_wrapped);
-    const Vector<BaseFloat> &weights = weights_[samp_out_wrapped];
+    int64 first_samp_in = first_index_[phase] +
+        unit_index * input_samples_in_unit_;
+    const BaseFloat *weights = weights_.RowData(phase);
     // first_input_index is the first index into "input" that we have a weight
     // for.
     int32 first_input_index = static_cast<int32>(first_samp_in -
                                                  input_sample_offset_);
     BaseFloat this_output;
     if (first_input_index >= 0 &&
-        first_input_index + weights.Dim() <= input_dim) {
-      SubVector<BaseFloat> input_part(input, first_input_index, weights.Dim());
-      this_output = VecVec(input_part, weights);
+        first_input_index + num_taps <= input_dim) {
+      this_output = FilterDot(input_data + first_input_index, weights,
+                              num_taps);
     } else {  // Handle edge cases.
       this_output = 0.0;
-      for (int32 i = 0; i < weights.Dim(); i++) {
-        BaseFloat weight = weights(i);
+      for (int32 i = 0; i < num_taps; i++) {
+        BaseFloat weight = weights[i];
         int32 input_index = first_input_index + i;
         if (input_index < 0 && input_remainder_.Dim() + input_index >= 0) {
           this_output += weight *
               input_remainder_(input_remainder_.Dim() + input_index);
         } else if (input_index >= 0 && input_index < input_dim) {
-          this_output += weight * input(input_index);
+          this_output += weight * input_data[input_index];
         } else if (input_index >= input_dim) {
           // We're past the end of the input and are adding zero; should only
           // happen if the user specified flush == true, or else we would not
-          // be trying to output this sample.
-          KALDI_ASSERT(flush);
+          // be trying to output this sample (or for the zero-padded taps of
+          // a phase with fewer weights).
+          KALDI_ASSERT(flush || weight == 0.0);
         }
       }
     }
-    int32 output_index = static_cast<int32>(samp_out - output_sample_offset_);
-    (*output)(output_index) = this_output;
+    output_data[samp_out - output_sample_offset_] = this_output;
+    if (++phase == output_samples_in_unit_) {
+      phase = 0;
+      unit_index++;
+    }
   }
 
   if (flush) {
@@ -282,36 +366,35 @@ void ArbitraryResample::Resample(const MatrixBase<BaseFloat> &input,
 
   KALDI_ASSERT(input.NumRows() == output->NumRows() &&
                input.NumCols() == num_samples_in_ &&
-               output->NumCols() == weights_.size());
-
-  Vector<BaseFloat> output_col(output->NumRows());
-  for (int32 i = 0; i < NumSamplesOut(); i++) {
-    SubMatrix<BaseFloat> input_part(input, 0, input.NumRows(),
-                                    first_index_[i],
-                                    weights_[i].Dim());
-    const Vector<BaseFloat> &weight_vec(weights_[i]);
-    output_col.AddMatVec(1.0, input_part,
-                         kNoTrans, weight_vec, 0.0);
-    output->CopyColFromVec(output_col, i);
+               output->NumCols() == NumSamplesOut());
+
+  int32 num_rows = input.NumRows(), num_samples_out = NumSamplesOut(),
+      num_taps = weights_.NumCols();
+  for (int32 r = 0; r < num_rows; r++) {
+    const BaseFloat *input_row = input.RowData(r);
+    BaseFloat *output_row = output->RowData(r);
+    for (int32 i = 0; i < num_samples_out; i++)
+      output_row[i] = FilterDot(input_row + first_index_[i],
+                                weights_.RowData(i), num_taps);
   }
 }
 
 void ArbitraryResample::Resample(const VectorBase<BaseFloat> &input,
                                  VectorBase<BaseFloat> *output) const {
   KALDI_ASSERT(input.Dim() == num_samples_in_ &&
-               output->Dim() == weights_.size());
+               output->Dim() == NumSamplesOut());
   
-  int32 output_dim = output->Dim();
-  for (int32 i = 0; i < output_dim; i++) {
-    SubVector<BaseFloat> input_part(input, first_index_[i], weights_[i].Dim());
-    (*output)(i) = VecVec(input_part, weights_[i]);
-  }
+  int32 output_dim = output->Dim(), num_taps = weights_.NumCols();
+  const BaseFloat *input_data = input.Data();
+  for (int32 i = 0; i < output_dim; i++)
+    (*output)(i) = FilterDot(input_data + first_index_[i],
+                             weights_.RowData(i), num_taps);
 }
 
 void ArbitraryResample::SetIndexes(const Vector<BaseFloat> &sample_points) {
   int32 num_samples = sample_points.Dim();
   first_index_.resize(num_samples);
-  weights_.resize(num_samples);
+  int32 num_taps = 0;
   BaseFloat filter_width = num_zeros_ / (2.0 * filter_cutoff_);
   for (int32  i = 0; i < num_samples; i++) {
     // the t values are in seconds.
@@ -326,19 +409,27 @@ void ArbitraryResample::SetIndexes(const Vector<BaseFloat> &sample_points) {
     if (index_max >= num_samples_in_)
       index_max = num_samples_in_ - 1;
     first_index_[i] = index_min;
-    weights_[i].Resize(index_max - index_min + 1);
+    num_taps = std::max(num_taps, index_max - index_min + 1);
   }
+  // All the rows of weights_ have num_taps weights; move the start of the
+  // rows that would run past the end of the input back, the weights outside
+  // the window being zero.
+  for (int32 i = 0; i < num_samples; i++)
+    if (first_index_[i] + num_taps > num_samples_in_)
+      first_index_[i] = num_samples_in_ - num_taps;
+  weights_.Resize(num_samples, num_taps);
 }
 
 void ArbitraryResample::SetWeights(const Vector<BaseFloat> &sample_points) {
-  int32 num_samples_out = NumSamplesOut();
+  int32 num_samples_out = NumSamplesOut(), num_taps = weights_.NumCols();
   for (int32 i = 0; i < num_samples_out; i++) {
-    for (int32 j = 0 ; j < weights_[i].Dim(); j++) {
+    for (int32 j = 0 ; j < num_taps; j++) {
       BaseFloat delta_t = sample_points(i) -
           (first_index_[i] + j) / samp_rate_in_;
       // Include at this point the factor of 1.0 / samp_rate_in_ which
-      // appears in the math.
-      weights_[i](j) = FilterFunc(delta_t) / samp_rate_in_;
+      // appears in the math.  FilterFunc() is zero for the padding taps
+      // outside the window.
+      weights_(i, j) = FilterFunc(delta_t) / samp_rate_in_;
     }
   }
 }
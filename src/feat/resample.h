@@ -100,7 +100,7 @@ class ArbitraryResample {
 
   int32 NumSamplesIn() const { return num_samples_in_; }
 
-  int32 NumSamplesOut() const { return weights_.size(); }
+  int32 NumSamplesOut() const { return weights_.NumRows(); }
 
   /// This function does the resampling.
   /// input.NumRows() and output.NumRows() should be equal
@@ -128,7 +128,11 @@ class ArbitraryResample {
 
   std::vector<int32> first_index_;  // The first input-sample index that we sum
                                     // over, for this output-sample index.
-  std::vector<Vector<BaseFloat> > weights_;
+  /// Row i has the weights on input samples first_index_[i],
+  /// first_index_[i] + 1, ...  All the rows have the same width (the widest
+  /// filter, limited to num_samples_in_), padded with zero weights, so that
+  /// each output sample is one contiguous dot product.
+  Matrix<BaseFloat> weights_;
 };
 
 
@@ -194,14 +198,6 @@ class LinearResample {
   int64 GetNumOutputSamples(int64 input_num_samp, bool flush) const;
 
 
-  /// Given an output-sample index, this function outputs to *first_samp_in the
-  /// first input-sample index that we have a weight on (may be negative),
-  /// and to *samp_out_wrapped the index into weights_ where we can get the
-  /// corresponding weights on the input.
-  inline void GetIndexes(int64 samp_out,
-                         int64 *first_samp_in,
-                         int32 *samp_out_wrapped) const;
-
   void SetRemainder(const VectorBase<BaseFloat> &input);
 
   void SetIndexesAndWeights();
@@ -230,8 +226,12 @@ class LinearResample {
   /// extrapolate the correct input-sample index for arbitrary output samples.
   std::vector<int32> first_index_;
 
-  /// Weights on the input samples, for this output-sample index.
-  std::vector<Vector<BaseFloat> > weights_;
+  /// The polyphase filter bank: row i has the weights on the input samples
+  /// for output-sample index i (the "phase", i.e. the output-sample index
+  /// modulo output_samples_in_unit_), starting at first_index_[i].  The rows
+  /// of phases with fewer nonzero weights are padded with zeros so that all
+  /// phases have the same number of taps.
+  Matrix<BaseFloat> weights_;
 
   // the following variables keep track of where we are in a particular signal,
   // if it is being provided over multiple calls to Resample().
@@ -0,0 +1,117 @@
+// feat/srfft-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "feat/srfft.h"
+#include "base/timer.h"
+
+namespace eesen {
+
+// Checks that the batched (matrix) Compute() gives the same as transforming
+// the rows one by one, for complex and real FFTs in both directions.
+template<typename Real>
+void UnitTestSrfftBatch() {
+  for (int32 i = 0; i < 20; i++) {
+    int32 logn = 2 + Rand() % 9, N = 1 << logn,
+        num_rows = 1 + Rand() % 20;
+    bool forward = (Rand() % 2 == 0);
+    Matrix<Real> x(num_rows, N * 2);
+    x.SetRandn();
+
+    Matrix<Real> x_batch(x);
+    SplitRadixComplexFft<Real> complex_fft(N);
+    complex_fft.Compute(&x_batch, forward);
+    for (int32 r = 0; r < num_rows; r++)
+      complex_fft.Compute(x.RowData(r), forward);
+    AssertEqual(x, x_batch, 0.0001);
+
+    SplitRadixRealFft<Real> real_fft(N * 2);
+    real_fft.Compute(&x_batch, forward);
+    for (int32 r = 0; r < num_rows; r++)
+      real_fft.Compute(x.RowData(r), forward);
+    AssertEqual(x, x_batch, 0.0001);
+  }
+}
+
+// Checks that the batched real FFT followed by its inverse gives back the
+// input (times N).
+template<typename Real>
+void UnitTestSrfftBatchInverse() {
+  for (int32 i = 0; i < 10; i++) {
+    int32 N = 4 << (Rand() % 8), num_rows = 1 + Rand() % 20;
+    Matrix<Real> x(num_rows, N), y(num_rows, N);
+    x.SetRandn();
+    y.CopyFromMat(x);
+    SplitRadixRealFft<Real> real_fft(N);
+    real_fft.Compute(&y, true);
+    real_fft.Compute(&y, false);
+    y.Scale(1.0 / N);
+    AssertEqual(x, y, 0.0001);
+  }
+}
+
+// Compares the speed of the batched real FFT with that of transforming the
+// rows one by one, for the usual frame sizes.
+template<typename Real>
+void UnitTestSrfftSpeed() {
+  int32 num_rows = 100, num_iters = 20;
+  for (int32 N = 256; N <= 1024; N *= 2) {
+    Matrix<Real> x(num_rows, N), y(num_rows, N);
+    x.SetRandn();
+    SplitRadixRealFft<Real> real_fft(N);
+    std::vector<Real> temp_buffer;
+
+    // Each pass transforms a fresh copy of the input, as transforming the
+    // output again and again would soon overflow.  Only the transforms are
+    // timed.
+    double row_time = 0.0, batch_time = 0.0;
+    for (int32 iter = 0; iter < num_iters; iter++) {
+      y.CopyFromMat(x);
+      Timer timer;
+      for (int32 r = 0; r < num_rows; r++)
+        real_fft.Compute(y.RowData(r), true, &temp_buffer);
+      row_time += timer.Elapsed();
+    }
+    for (int32 iter = 0; iter < num_iters; iter++) {
+      y.CopyFromMat(x);
+      Timer timer;
+      real_fft.Compute(&y, true, &temp_buffer);
+      batch_time += timer.Elapsed();
+    }
+
+    KALDI_LOG << "For N = " << N << ", " << sizeof(Real) * 8 << "-bit, "
+              << real_fft.NumLanes() << " lanes: "
+              << (1.0e+06 * row_time / (num_rows * num_iters))
+              << " us/frame one by one, "
+              << (1.0e+06 * batch_time / (num_rows * num_iters))
+              << " us/frame batched, speedup "
+              << (row_time / batch_time);
+  }
+}
+
+}  // namespace eesen
+
+
+int main() {
+  using namespace eesen;
+  UnitTestSrfftBatch<float>();
+  UnitTestSrfftBatch<double>();
+  UnitTestSrfftBatchInverse<float>();
+  UnitTestSrfftBatchInverse<double>();
+  UnitTestSrfftSpeed<float>();
+  UnitTestSrfftSpeed<double>();
+  std::cout << "Tests succeeded.\n";
+}
@@ -25,11 +25,122 @@
 // License v2.0.
 
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 #include "feat/srfft.h"
 #include "cpucompute/matrix-functions.h"
 
 namespace eesen {
 
+// FftLanes<Real> has the operations on a SIMD vector of kWidth values, one
+// for each of the frames ("lanes") that the batched FFT transforms at once.
+// The generic version is for one frame; there are specializations for SSE
+// and AVX below.
+template<typename Real>
+struct FftLanes {
+  typedef Real Vec;
+  static const int kWidth = 1;
+  static inline Vec Load(const Real *p) { return *p; }
+  static inline void Store(Real *p, Vec v) { *p = v; }
+  static inline Vec Set(Real r) { return r; }
+  static inline Vec Add(Vec a, Vec b) { return a + b; }
+  static inline Vec Sub(Vec a, Vec b) { return a - b; }
+  static inline Vec Mul(Vec a, Vec b) { return a * b; }
+};
+
+#if defined(__AVX__)
+template<>
+struct FftLanes<float> {
+  typedef __m256 Vec;
+  static const int kWidth = 8;
+  static inline Vec Load(const float *p) { return _mm256_loadu_ps(p); }
+  static inline void Store(float *p, Vec v) { _mm256_storeu_ps(p, v); }
+  static inline Vec Set(float r) { return _mm256_set1_ps(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  static inline Vec Sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+};
+template<>
+struct FftLanes<double> {
+  typedef __m256d Vec;
+  static const int kWidth = 4;
+  static inline Vec Load(const double *p) { return _mm256_loadu_pd(p); }
+  static inline void Store(double *p, Vec v) { _mm256_storeu_pd(p, v); }
+  static inline Vec Set(double r) { return _mm256_set1_pd(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+  static inline Vec Sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+};
+#elif defined(__SSE__)
+template<>
+struct FftLanes<float> {
+  typedef __m128 Vec;
+  static const int kWidth = 4;
+  static inline Vec Load(const float *p) { return _mm_loadu_ps(p); }
+  static inline void Store(float *p, Vec v) { _mm_storeu_ps(p, v); }
+  static inline Vec Set(float r) { return _mm_set1_ps(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+  static inline Vec Sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+};
+#if defined(__SSE2__)
+template<>
+struct FftLanes<double> {
+  typedef __m128d Vec;
+  static const int kWidth = 2;
+  static inline Vec Load(const double *p) { return _mm_loadu_pd(p); }
+  static inline void Store(double *p, Vec v) { _mm_storeu_pd(p, v); }
+  static inline Vec Set(double r) { return _mm_set1_pd(r); }
+  static inline Vec Add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+  static inline Vec Sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+  static inline Vec Mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+};
+#endif
+#endif
+
+// Copies rows row_offset ... row_offset + width - 1 of x, viewed as complex
+// vectors [ r0 im0 r1 im1 ... ], into the interleaved layout of
+// SplitRadixComplexFft::ComputeLanes(); lanes past the last row are zeroed.
+template<typename Real>
+static void GatherLanes(const MatrixBase<Real> &x, MatrixIndexT row_offset,
+                        MatrixIndexT width, Real *xr, Real *xi) {
+  MatrixIndexT num_points = x.NumCols() / 2;
+  for (MatrixIndexT b = 0; b < width; b++) {
+    MatrixIndexT r = row_offset + b;
+    if (r < x.NumRows()) {
+      const Real *row = x.RowData(r);
+      for (MatrixIndexT i = 0; i < num_points; i++) {
+        xr[i * width + b] = row[i * 2];
+        xi[i * width + b] = row[i * 2 + 1];
+      }
+    } else {
+      for (MatrixIndexT i = 0; i < num_points; i++)
+        xr[i * width + b] = xi[i * width + b] = 0.0;
+    }
+  }
+}
+
+// The inverse of GatherLanes().
+template<typename Real>
+static void ScatterLanes(const Real *xr, const Real *xi,
+                         MatrixIndexT row_offset, MatrixIndexT width,
+                         MatrixBase<Real> *x) {
+  MatrixIndexT num_points = x->NumCols() / 2;
+  for (MatrixIndexT b = 0; b < width && row_offset + b < x->NumRows(); b++) {
+    Real *row = x->RowData(row_offset + b);
+    for (MatrixIndexT i = 0; i < num_points; i++) {
+      row[i * 2] = xr[i * width + b];
+      row[i * 2 + 1] = xi[i * width + b];
+    }
+  }
+}
+
 
 template<typename Real>
 SplitRadixComplexFft<Real>::SplitRadixComplexFft(MatrixIndexT N) {
@@ -325,6 +436,179 @@ void SplitRadixComplexFft<Real>::ComputeRecursive(Real *xr, Real *xi, MatrixInde
 }
 
 
+template<typename Real>
+MatrixIndexT SplitRadixComplexFft<Real>::NumLanes() {
+  return FftLanes<Real>::kWidth;
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::Compute(MatrixBase<Real> *x, bool forward,
+                                         std::vector<Real> *temp_buffer) const {
+  KALDI_ASSERT(x->NumCols() == N_ * 2 && temp_buffer != NULL);
+  MatrixIndexT width = NumLanes();
+  temp_buffer->resize(2 * N_ * width);
+  Real *xr = &((*temp_buffer)[0]), *xi = xr + N_ * width;
+  for (MatrixIndexT r = 0; r < x->NumRows(); r += width) {
+    GatherLanes(*x, r, width, xr, xi);
+    ComputeLanes(xr, xi, forward);
+    ScatterLanes(xr, xi, r, width, x);
+  }
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::Compute(MatrixBase<Real> *x, bool forward) {
+  this->Compute(x, forward, &temp_buffer_);
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::ComputeLanes(Real *xr, Real *xi,
+                                              bool forward) const {
+  if (!forward) {  // reverse real and imaginary parts for complex FFT.
+    Real *tmp = xr;
+    xr = xi;
+    xi = tmp;
+  }
+  ComputeRecursiveLanes(xr, xi, logn_);
+  if (logn_ > 1) {
+    BitReversePermuteLanes(xr, logn_);
+    BitReversePermuteLanes(xi, logn_);
+  }
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::BitReversePermuteLanes(Real *x,
+                                                        MatrixIndexT logn) const {
+  // The same as BitReversePermute(), swapping the points of all lanes.
+  typedef FftLanes<Real> L;
+  const MatrixIndexT w = L::kWidth;
+  MatrixIndexT lg2 = logn >> 1, n = 1 << lg2;
+  for (MatrixIndexT off = 1; off < n; off++) {
+    MatrixIndexT fj = n * brseed_[off], i = off, j = fj;
+    typename L::Vec tmp = L::Load(x + i * w);
+    L::Store(x + i * w, L::Load(x + j * w));
+    L::Store(x + j * w, tmp);
+    const MatrixIndexT *brp = &(brseed_[1]);
+    for (MatrixIndexT gno = 1; gno < brseed_[off]; gno++) {
+      i += n;
+      j = fj + *brp++;
+      tmp = L::Load(x + i * w);
+      L::Store(x + i * w, L::Load(x + j * w));
+      L::Store(x + j * w, tmp);
+    }
+  }
+}
+
+// Replaces a and b with a + b and a - b.
+template<class L>
+static inline void LanesButterfly(typename L::Vec *a, typename L::Vec *b) {
+  typename L::Vec tmp = L::Add(*a, *b);
+  *b = L::Sub(*a, *b);
+  *a = tmp;
+}
+
+template<typename Real>
+void SplitRadixComplexFft<Real>::ComputeRecursiveLanes(Real *xr, Real *xi,
+                                                       MatrixIndexT logn) const {
+  // This does the same arithmetic as ComputeRecursive(), on all lanes at once;
+  // the comments there apply.  Point n of the current sub-transform is at
+  // xr + n * w.
+  typedef FftLanes<Real> L;
+  typedef typename L::Vec Vec;
+  const MatrixIndexT w = L::kWidth;
+
+  if (logn < 0)
+    KALDI_ERR << "Error: logn is out of bounds in SRFFT";
+
+  if (logn < 3) {
+    if (logn == 0) return;
+    Vec r0 = L::Load(xr), r1 = L::Load(xr + w),
+        i0 = L::Load(xi), i1 = L::Load(xi + w);
+    if (logn == 1) {  /* length m = 2 */
+      LanesButterfly<L>(&r0, &r1);
+      LanesButterfly<L>(&i0, &i1);
+    } else {  /* length m = 4 */
+      Vec r2 = L::Load(xr + 2 * w), r3 = L::Load(xr + 3 * w),
+          i2 = L::Load(xi + 2 * w), i3 = L::Load(xi + 3 * w);
+      LanesButterfly<L>(&r0, &r2);
+      LanesButterfly<L>(&i0, &i2);
+      LanesButterfly<L>(&r1, &r3);
+      LanesButterfly<L>(&i1, &i3);
+      LanesButterfly<L>(&r0, &r1);
+      LanesButterfly<L>(&i0, &i1);
+      Vec tmp1 = L::Add(r2, i3), tmp2 = L::Add(i2, r3);
+      i2 = L::Sub(i2, r3);
+      r3 = L::Sub(r2, i3);
+      r2 = tmp1;
+      i3 = tmp2;
+      L::Store(xr + 2 * w, r2); L::Store(xr + 3 * w, r3);
+      L::Store(xi + 2 * w, i2); L::Store(xi + 3 * w, i3);
+    }
+    L::Store(xr, r0); L::Store(xr + w, r1);
+    L::Store(xi, i0); L::Store(xi + w, i1);
+    return;
+  }
+
+  MatrixIndexT m = 1 << logn, m2 = m / 2, m4 = m2 / 2, m8 = m4 / 2;
+
+  /* Step 1 */
+  for (MatrixIndexT n = 0; n < m2; n++) {
+    Real *pr1 = xr + n * w, *pr2 = pr1 + m2 * w,
+        *pi1 = xi + n * w, *pi2 = pi1 + m2 * w;
+    Vec r1 = L::Load(pr1), r2 = L::Load(pr2),
+        i1 = L::Load(pi1), i2 = L::Load(pi2);
+    LanesButterfly<L>(&r1, &r2);
+    LanesButterfly<L>(&i1, &i2);
+    L::Store(pr1, r1); L::Store(pr2, r2);
+    L::Store(pi1, i1); L::Store(pi2, i2);
+  }
+
+  /* Step 2 */
+  for (MatrixIndexT n = 0; n < m4; n++) {
+    Real *pr1 = xr + (m2 + n) * w, *pr2 = pr1 + m4 * w,
+        *pi1 = xi + (m2 + n) * w, *pi2 = pi1 + m4 * w;
+    Vec r1 = L::Load(pr1), r2 = L::Load(pr2),
+        i1 = L::Load(pi1), i2 = L::Load(pi2);
+    L::Store(pr1, L::Add(r1, i2));
+    L::Store(pi2, L::Add(i1, r2));
+    L::Store(pi1, L::Sub(i1, r2));
+    L::Store(pr2, L::Sub(r1, i2));
+  }
+
+  /* Steps 3 & 4 */
+  const Real *cn = NULL, *spcn = NULL, *smcn = NULL,
+      *c3n = NULL, *spc3n = NULL, *smc3n = NULL;
+  if (logn >= 4) {
+    MatrixIndexT nel = m4 - 2;
+    cn  = tab_[logn-4]; spcn  = cn + nel;  smcn  = spcn + nel;
+    c3n = smcn + nel;  spc3n = c3n + nel; smc3n = spc3n + nel;
+  }
+  Vec sqhalf = L::Set(M_SQRT1_2), minus_sqhalf = L::Set(-M_SQRT1_2);
+  for (MatrixIndexT n = 1; n < m4; n++) {
+    Real *pr1 = xr + (m2 + n) * w, *pr2 = pr1 + m4 * w,
+        *pi1 = xi + (m2 + n) * w, *pi2 = pi1 + m4 * w;
+    Vec r1 = L::Load(pr1), r2 = L::Load(pr2),
+        i1 = L::Load(pi1), i2 = L::Load(pi2);
+    if (n == m8) {
+      L::Store(pr1, L::Mul(sqhalf, L::Add(r1, i1)));
+      L::Store(pi1, L::Mul(sqhalf, L::Sub(i1, r1)));
+      L::Store(pr2, L::Mul(sqhalf, L::Sub(i2, r2)));
+      L::Store(pi2, L::Mul(minus_sqhalf, L::Add(r2, i2)));
+    } else {
+      Vec tmp = L::Mul(L::Set(*cn++), L::Add(r1, i1));
+      L::Store(pi1, L::Add(L::Mul(L::Set(*spcn++), r1), tmp));
+      L::Store(pr1, L::Add(L::Mul(L::Set(*smcn++), i1), tmp));
+      tmp = L::Mul(L::Set(*c3n++), L::Add(r2, i2));
+      L::Store(pi2, L::Add(L::Mul(L::Set(*spc3n++), r2), tmp));
+      L::Store(pr2, L::Add(L::Mul(L::Set(*smc3n++), i2), tmp));
+    }
+  }
+
+  ComputeRecursiveLanes(xr, xi, logn - 1);
+  ComputeRecursiveLanes(xr + m2 * w, xi + m2 * w, logn - 2);
+  ComputeRecursiveLanes(xr + 3 * m4 * w, xi + 3 * m4 * w, logn - 2);
+}
+
+
 template<typename Real>
 void SplitRadixRealFft<Real>::Compute(Real *data, bool forward) {
   Compute(data, forward, &this->temp_buffer_);
@@ -404,6 +688,93 @@ void SplitRadixRealFft<Real>::Compute(Real *data, bool forward,
   }
 }
 
+template<typename Real>
+void SplitRadixRealFft<Real>::Compute(MatrixBase<Real> *x, bool forward,
+                                      std::vector<Real> *temp_buffer) const {
+  KALDI_ASSERT(x->NumCols() == N_ && temp_buffer != NULL);
+  MatrixIndexT width = NumLanes(), N2 = N_ / 2;
+  temp_buffer->resize(N_ * width);
+  Real *xr = &((*temp_buffer)[0]), *xi = xr + N2 * width;
+  for (MatrixIndexT r = 0; r < x->NumRows(); r += width) {
+    GatherLanes(*x, r, width, xr, xi);
+    ComputeLanes(xr, xi, forward);
+    ScatterLanes(xr, xi, r, width, x);
+  }
+}
+
+template<typename Real>
+void SplitRadixRealFft<Real>::Compute(MatrixBase<Real> *x, bool forward) {
+  Compute(x, forward, &this->temp_buffer_);
+}
+
+template<typename Real>
+void SplitRadixRealFft<Real>::ComputeLanes(Real *xr, Real *xi,
+                                           bool forward) const {
+  // The same arithmetic as the single-frame Compute(), on all lanes at once;
+  // point k of B, C and D in the comments there is at xr + k * w (real part)
+  // and xi + k * w (imaginary part).
+  typedef FftLanes<Real> L;
+  typedef typename L::Vec Vec;
+  const MatrixIndexT w = L::kWidth;
+  MatrixIndexT N = N_, N2 = N/2;
+  if (forward)
+    SplitRadixComplexFft<Real>::ComputeLanes(xr, xi, true);
+
+  Real rootN_re, rootN_im;
+  int forward_sign = forward ? -1 : 1;
+  ComplexImExp(static_cast<Real>(M_2PI/N *forward_sign), &rootN_re, &rootN_im);
+  Real kN_re = -forward_sign, kN_im = 0.0;
+  Vec half = L::Set(0.5), minus_half = L::Set(-0.5);
+  for (MatrixIndexT k = 1; 2*k <= N2; k++) {
+    ComplexMul(rootN_re, rootN_im, &kN_re, &kN_im);
+    MatrixIndexT kdash = N2 - k;
+    Vec Bk_re = L::Load(xr + k * w), Bk_im = L::Load(xi + k * w),
+        Bkdash_re = L::Load(xr + kdash * w), Bkdash_im = L::Load(xi + kdash * w);
+    Vec Ck_re = L::Mul(half, L::Add(Bk_re, Bkdash_re)),
+        Ck_im = L::Mul(half, L::Sub(Bk_im, Bkdash_im)),
+        Dk_re = L::Mul(half, L::Add(Bk_im, Bkdash_im)),
+        Dk_im = L::Mul(minus_half, L::Sub(Bk_re, Bkdash_re));
+    Vec kN_re_vec = L::Set(kN_re), kN_im_vec = L::Set(kN_im);
+    // A_k = C_k + 1^(k/N) D_k
+    L::Store(xr + k * w, L::Add(Ck_re, L::Sub(L::Mul(kN_re_vec, Dk_re),
+                                              L::Mul(kN_im_vec, Dk_im))));
+    L::Store(xi + k * w, L::Add(Ck_im, L::Add(L::Mul(kN_re_vec, Dk_im),
+                                              L::Mul(kN_im_vec, Dk_re))));
+    if (kdash != k) {
+      // A_k' = C_k^* - (1^(k/N))^* D_k^*
+      Vec minus_kN_re_vec = L::Set(-kN_re), zero = L::Set(0.0),
+          minus_Dk_im = L::Sub(zero, Dk_im);
+      L::Store(xr + kdash * w,
+               L::Add(Ck_re, L::Sub(L::Mul(minus_kN_re_vec, Dk_re),
+                                    L::Mul(kN_im_vec, minus_Dk_im))));
+      L::Store(xi + kdash * w,
+               L::Add(L::Sub(zero, Ck_im),
+                      L::Add(L::Mul(minus_kN_re_vec, minus_Dk_im),
+                             L::Mul(kN_im_vec, Dk_re))));
+    }
+  }
+
+  {  // Now handle k = 0.
+    Vec B0_re = L::Load(xr), B0_im = L::Load(xi),
+        zeroth = L::Add(B0_re, B0_im),
+        n2th = L::Sub(B0_re, B0_im);
+    if (!forward) {
+      zeroth = L::Mul(half, zeroth);
+      n2th = L::Mul(half, n2th);
+    }
+    L::Store(xr, zeroth);
+    L::Store(xi, n2th);
+  }
+  if (!forward) {
+    SplitRadixComplexFft<Real>::ComputeLanes(xr, xi, false);
+    Vec two = L::Set(2.0);
+    for (MatrixIndexT i = 0; i < N2; i++) {
+      L::Store(xr + i * w, L::Mul(two, L::Load(xr + i * w)));
+      L::Store(xi + i * w, L::Mul(two, L::Load(xi + i * w)));
+    }
+  }
+}
+
 template class SplitRadixComplexFft<float>;
 template class SplitRadixComplexFft<double>;
 template class SplitRadixRealFft<float>;
@@ -74,16 +74,39 @@ class SplitRadixComplexFft {
   // needed.
   void Compute(Real *x, bool forward, std::vector<Real> *temp_buffer) const;
 
+  // This version of Compute transforms each row of "x", which must have
+  // dimension N*2 and contain [ r0 im0 r1 im1 ... ] as above.  Several rows
+  // are transformed at once with SIMD instructions (SSE or AVX, if the
+  // compiler enables them), which is faster than doing them one by one.  It
+  // uses "temp_buffer" as temporary storage.
+  void Compute(MatrixBase<Real> *x, bool forward,
+               std::vector<Real> *temp_buffer) const;
+
+  // As above, but uses a class-member buffer.
+  void Compute(MatrixBase<Real> *x, bool forward);
+
+  // Returns the number of frames that the batched Compute() transforms at
+  // once (1 if there is no SIMD support).
+  static Integer NumLanes();
+
   ~SplitRadixComplexFft();
 
  protected:
   // temp_buffer_ is allocated only if someone calls Compute with only one Real*
   // argument and we need a temporary buffer while creating interleaved data.
   std::vector<Real> temp_buffer_;
+
+  // Does the complex FFT of NumLanes() frames at once.  xr and xi contain N
+  // points for each frame, interleaved: point i of frame b is at index
+  // i * NumLanes() + b.
+  void ComputeLanes(Real *xr, Real *xi, bool forward) const;
  private:
   void ComputeTables();
   void ComputeRecursive(Real *xr, Real *xi, Integer logn) const;
   void BitReversePermute(Real *x, Integer logn) const;
+  // Versions of the above for the interleaved layout of ComputeLanes().
+  void ComputeRecursiveLanes(Real *xr, Real *xi, Integer logn) const;
+  void BitReversePermuteLanes(Real *x, Integer logn) const;
 
   Integer N_;
   Integer logn_;  // log(N)
@@ -117,7 +140,23 @@ class SplitRadixRealFft: private SplitRadixComplexFft<Real> {
   /// uses a user-supplied buffer.
   void Compute(Real *x, bool forward, std::vector<Real> *temp_buffer) const;
 
+  /// This version transforms each row of "x", which must have dimension N,
+  /// as the versions above do, but several rows at once with SIMD
+  /// instructions; see the corresponding SplitRadixComplexFft::Compute().
+  void Compute(MatrixBase<Real> *x, bool forward,
+               std::vector<Real> *temp_buffer) const;
+
+  /// As above, but uses a class-member buffer.
+  void Compute(MatrixBase<Real> *x, bool forward);
+
+  using SplitRadixComplexFft<Real>::NumLanes;
+
  private:
+  // The real FFT of NumLanes() frames at once, in the interleaved layout of
+  // SplitRadixComplexFft::ComputeLanes(); xr and xi contain the N/2 complex
+  // points that each frame of N reals is viewed as.
+  void ComputeLanes(Real *xr, Real *xi, bool forward) const;
+
   KALDI_DISALLOW_COPY_AND_ASSIGN(SplitRadixRealFft);  
   int N_;
 };
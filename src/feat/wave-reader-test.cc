@@ -0,0 +1,214 @@
+// feat/wave-reader-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+#include <fstream>
+
+#include "feat/wave-reader.h"
+
+using namespace eesen;
+
+// Writes a random wave file with "num_chan" channels to "filename" and
+// returns its samples.
+static Matrix<BaseFloat> WriteRandomWave(const std::string &filename,
+                                         int32 num_chan, int32 num_samp) {
+  Matrix<BaseFloat> data(num_chan, num_samp);
+  for (int32 c = 0; c < num_chan; c++)
+    for (int32 i = 0; i < num_samp; i++)
+      data(c, i) = RandInt(-32768, 32767);
+  WaveData wave(16000, data);
+  std::ofstream os(filename.c_str(), std::ios::out | std::ios::binary);
+  wave.Write(os);
+  KALDI_ASSERT(os.good());
+  return data;
+}
+
+static void UnitTestMappedWaveData() {
+  int32 num_chan = 1 + Rand() % 3, num_samp = 1 + Rand() % 20000;
+  Matrix<BaseFloat> data = WriteRandomWave("tmp.wav", num_chan, num_samp);
+
+  {
+    std::ifstream is("tmp.wav", std::ios::in | std::ios::binary);
+    WaveData wave;
+    wave.Read(is);
+    KALDI_ASSERT(wave.SampFreq() == 16000);
+    AssertEqual(wave.Data(), data);
+  }
+
+  MappedWaveData mapped;
+  KALDI_ASSERT(mapped.Open("tmp.wav"));
+  KALDI_ASSERT(mapped.SampFreq() == 16000 &&
+               mapped.NumChannels() == num_chan &&
+               mapped.NumSamples() == num_samp);
+  for (int32 i = 0; i < 10; i++) {
+    int32 first_samp = Rand() % num_samp,
+        this_num_samp = Rand() % (num_samp - first_samp + 1);
+    Matrix<BaseFloat> range;
+    mapped.ReadRange(first_samp, this_num_samp, &range);
+    AssertEqual(range, data.ColRange(first_samp, this_num_samp));
+    int32 channel = Rand() % num_chan;
+    mapped.ReadRange(first_samp, this_num_samp, &range, channel);
+    AssertEqual(range, data.Range(channel, 1, first_samp, this_num_samp));
+  }
+  mapped.Close();
+  KALDI_ASSERT(!mapped.IsOpen());
+  unlink("tmp.wav");
+}
+
+static void UnitTestRandomAccessWaveRangeReader() {
+  Matrix<BaseFloat> data1 = WriteRandomWave("tmp1.wav", 1, 1000 + Rand() % 1000),
+      data2 = WriteRandomWave("tmp2.wav", 2, 1000 + Rand() % 1000);
+  {
+    // "rec2" is read through a pipe, so it is read whole, not mapped.
+    std::ofstream os("tmp.scp");
+    os << "rec1 tmp1.wav\nrec2 cat tmp2.wav |\n";
+  }
+  RandomAccessWaveRangeReader reader("scp:tmp.scp");
+  KALDI_ASSERT(reader.HasKey("rec1") && reader.HasKey("rec2") &&
+               !reader.HasKey("rec3"));
+  for (int32 i = 0; i < 10; i++) {
+    std::string key = (Rand() % 2 == 0 ? "rec1" : "rec2");
+    const Matrix<BaseFloat> &data = (key == "rec1" ? data1 : data2);
+    KALDI_ASSERT(reader.SampFreq(key) == 16000 &&
+                 reader.NumChannels(key) == data.NumRows() &&
+                 reader.NumSamples(key) == data.NumCols());
+    int32 first_samp = Rand() % data.NumCols(),
+        num_samp = Rand() % (data.NumCols() - first_samp + 1);
+    Matrix<BaseFloat> range;
+    reader.ReadRange(key, first_samp, num_samp, &range);
+    AssertEqual(range, data.ColRange(first_samp, num_samp));
+    int32 channel = Rand() % data.NumRows();
+    reader.ReadRange(key, first_samp, num_samp, &range, channel);
+    AssertEqual(range, data.Range(channel, 1, first_samp, num_samp));
+  }
+  {
+    // In permissive mode, a recording that cannot be read is not there.
+    std::ofstream os("tmp.scp");
+    os << "rec1 tmp1.wav\nrec3 tmp3.wav\n";
+  }
+  RandomAccessWaveRangeReader permissive_reader("scp,p:tmp.scp");
+  KALDI_ASSERT(permissive_reader.HasKey("rec1") &&
+               !permissive_reader.HasKey("rec3"));
+  unlink("tmp1.wav");
+  unlink("tmp2.wav");
+  unlink("tmp.scp");
+}
+
+static void UnitTestSequentialWaveSegmentReader() {
+  // rec1 has 16000 samples and rec2 8000.  A frame shift of 0.0625 seconds
+  // is 1000 samples, and all the times below are exact in binary, so we know
+  // which segments should be grouped into regions.
+  Matrix<BaseFloat> data1 = WriteRandomWave("tmp1.wav", 2, 16000),
+      data2 = WriteRandomWave("tmp2.wav", 1, 8000);
+  {
+    std::ofstream os("tmp.scp");
+    os << "rec1 tmp1.wav\nrec2 tmp2.wav\n";
+  }
+  {
+    std::ofstream os("tmp.segments");
+    os << "seg1 rec1 0.0625 0.25 0\n"     // samples 1000 to 4000.
+       << "seg2 rec1 0.5 0.625 0\n"       // 8000 to 10000.
+       << "seg3 rec1 0.125 0.375 0\n"     // 2000 to 6000: with seg1.
+       << "seg4 rec1 0.15625 0.3125 0\n"  // 2500 to 5000: not aligned.
+       << "seg5 rec1 0.5 0.625 1\n"       // as seg2, but other channel.
+       << "seg6 rec1 0.5\n"               // invalid.
+       << "seg7 rec3 0 0.1\n"             // no such recording.
+       << "seg8 rec2 0 -1\n"              // 0 to 8000.
+       << "seg9 rec2 0.25 0.375\n"        // 4000 to 6000: with seg8.
+       << "seg10 rec2 0.4375 0.75\n";     // 7000 to 8000 (truncated).
+  }
+  // The regions, in the order they should come out.
+  const char *keys[] = { "rec1", "rec1", "rec1", "rec1", "rec2" },
+      *ids[] = { "seg1 seg3", "seg2", "seg4", "seg5", "seg8 seg9 seg10" };
+  int32 channels[] = { 0, 0, 0, 1, -1 },
+      starts[] = { 1000, 2000, 8000, 2500, 8000, 0, 4000, 7000 },
+      ends[] = { 4000, 6000, 10000, 5000, 10000, 8000, 6000, 8000 };
+  int32 num_regions = 5, num_segments = 0;
+
+  SequentialWaveSegmentReader reader("scp:tmp.scp", "tmp.segments", 0.0625);
+  for (int32 r = 0; r < num_regions; r++, reader.Next()) {
+    KALDI_ASSERT(!reader.Done() && reader.Key() == keys[r]);
+    const WaveSegments &value = reader.Value();
+    const Matrix<BaseFloat> &rec_data = (reader.Key() == "rec1" ? data1 :
+                                         data2);
+    // Only the channel of the segments is read, if they give it.
+    Matrix<BaseFloat> data(rec_data);
+    if (channels[r] != -1)
+      data = rec_data.RowRange(channels[r], 1);
+    std::vector<std::string> these_ids;
+    SplitStringToVector(ids[r], " ", true, &these_ids);
+    KALDI_ASSERT(value.ids == these_ids && value.channel == channels[r] &&
+                 value.first_samp.size() == these_ids.size() &&
+                 value.num_samp.size() == these_ids.size());
+    for (size_t i = 0; i < these_ids.size(); i++, num_segments++) {
+      int32 start = starts[num_segments], end = ends[num_segments];
+      KALDI_ASSERT(value.num_samp[i] == end - start);
+      AssertEqual(value.wave.Data().ColRange(value.first_samp[i],
+                                             value.num_samp[i]),
+                  data.ColRange(start, end - start));
+    }
+  }
+  KALDI_ASSERT(reader.Done());
+
+  // With regions of at most 0.25 seconds, no two of the segments fit in one
+  // region, so they come out one by one in the order of the file.
+  const char *short_ids[] = { "seg1", "seg2", "seg3", "seg4", "seg5", "seg8",
+                              "seg9", "seg10" };
+  SequentialWaveSegmentReader short_reader("scp:tmp.scp", "tmp.segments",
+                                           0.0625, 0.5, 0.25);
+  for (int32 i = 0; i < num_segments; i++, short_reader.Next()) {
+    KALDI_ASSERT(!short_reader.Done());
+    const WaveSegments &value = short_reader.Value();
+    KALDI_ASSERT(value.ids.size() == 1 && value.ids[0] == short_ids[i] &&
+                 value.first_samp[0] == 0 &&
+                 value.wave.Data().NumCols() == value.num_samp[0]);
+  }
+  KALDI_ASSERT(short_reader.Done());
+
+  // Without a segments file, each recording is one segment.
+  SequentialWaveSegmentReader whole_reader("scp:tmp.scp", "", 0.0625);
+  for (int32 r = 0; r < 2; r++, whole_reader.Next()) {
+    const Matrix<BaseFloat> &data = (r == 0 ? data1 : data2);
+    KALDI_ASSERT(!whole_reader.Done() &&
+                 whole_reader.Key() == (r == 0 ? "rec1" : "rec2"));
+    const WaveSegments &value = whole_reader.Value();
+    KALDI_ASSERT(value.ids.size() == 1 && value.ids[0] == whole_reader.Key() &&
+                 value.channel == -1 && value.first_samp[0] == 0 &&
+                 value.num_samp[0] == data.NumCols());
+    AssertEqual(value.wave.Data(), data);
+  }
+  KALDI_ASSERT(whole_reader.Done());
+  unlink("tmp1.wav");
+  unlink("tmp2.wav");
+  unlink("tmp.scp");
+  unlink("tmp.segments");
+}
+
+int main() {
+  try {
+    for (int32 i = 0; i < 5; i++) {
+      UnitTestMappedWaveData();
+      UnitTestRandomAccessWaveRangeReader();
+      UnitTestSequentialWaveSegmentReader();
+    }
+    std::cout << "Tests succeeded.\n";
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return 1;
+  }
+}
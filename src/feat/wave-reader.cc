@@ -19,18 +19,28 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <fstream>
 #include <sstream>
 #include <vector>
 
 #include "feat/wave-reader.h"
 #include "base/kaldi-error.h"
 #include "base/kaldi-utils.h"
+#include "util/text-utils.h"
 
 namespace eesen {
 
-// static
-void WaveData::Expect4ByteTag(std::istream &is, const char *expected) {
+static void Expect4ByteTag(std::istream &is, const char *expected) {
   char tmp[5];
   tmp[4] = '\0';
   is.read(tmp, 4);
@@ -40,7 +50,7 @@ void WaveData::Expect4ByteTag(std::istream &is, const char *expected) {
     KALDI_ERR << "WaveData: expected " << expected << ", got " << tmp;
 }
 
-uint32 WaveData::ReadUint32(std::istream &is, bool swap) {
+static uint32 ReadUint32(std::istream &is, bool swap) {
   union {
     char result[4];
     uint32 ans;
@@ -54,7 +64,7 @@ uint32 WaveData::ReadUint32(std::istream &is, bool swap) {
 }
 
 
-uint16 WaveData::ReadUint16(std::istream &is, bool swap) {
+static uint16 ReadUint16(std::istream &is, bool swap) {
   union {
     char result[2];
     int16 ans;
@@ -67,8 +77,7 @@ uint16 WaveData::ReadUint16(std::istream &is, bool swap) {
   return u.ans;
 }
 
-// static
-void WaveData::Read4ByteTag(std::istream &is, char *dest) {
+static void Read4ByteTag(std::istream &is, char *dest) {
   is.read(dest, 4);
   if (is.fail())
     KALDI_ERR << "WaveData: expected 4-byte chunk-name, got read errror";
@@ -105,9 +114,7 @@ void WaveData::WriteUint16(std::ostream &os, int16 i) {
 
 
 
-void WaveData::Read(std::istream &is) {
-  data_.Resize(0, 0);  // clear the data.
-
+void WaveInfo::Read(std::istream &is) {
   char tmp[5];
   tmp[4] = '\0';
   Read4ByteTag(is, &tmp[0]);
@@ -122,6 +129,7 @@ void WaveData::Read(std::istream &is) {
 #else
   bool swap = is_rifx;
 #endif
+  reverse_bytes_ = swap;
   
   uint32 riff_chunk_size = ReadUint32(is, swap);
   Expect4ByteTag(is, "WAVE");
@@ -158,6 +166,8 @@ void WaveData::Read(std::istream &is) {
   if (block_align != num_channels * bits_per_sample/8)
     KALDI_ERR << "Unexpected block_align: " << block_align << " vs. "
               << num_channels << " * " << (bits_per_sample/8);
+  num_channels_ = num_channels;
+  bits_per_sample_ = bits_per_sample;
 
   riff_chunk_read += 8 + subchunk1_size;
   // size of what we just read, 4 bytes for "fmt " + 4
@@ -200,6 +210,56 @@ void WaveData::Read(std::istream &is) {
               << " + " << data_chunk_size << " bytes "
               << "(we do not support reading multiple data chunks).";
   }
+  if (data_chunk_size == 0)
+    KALDI_ERR << "WaveData: empty file (no data)";
+  data_bytes_ = data_chunk_size;
+}
+
+void WaveInfo::ConvertSamples(const char *data_ptr, int64 num_samp,
+                              MatrixBase<BaseFloat> *output) const {
+  KALDI_ASSERT(output->NumRows() == num_channels_ &&
+               output->NumCols() >= num_samp);
+  bool swap = reverse_bytes_;
+  for (int64 i = 0; i < num_samp; i++) {
+    for (int32 j = 0; j < num_channels_; j++) {
+      switch (bits_per_sample_) {
+        case 8:
+          (*output)(j, i) = *data_ptr;
+          data_ptr++;
+          break;
+        case 16:
+          {
+            int16 k = *reinterpret_cast<const uint16*>(data_ptr);
+            if (swap)
+              KALDI_SWAP2(k);
+            (*output)(j, i) =  k;
+            data_ptr += 2;
+            break;
+          }
+        case 32:
+          {
+            int32 k = *reinterpret_cast<const uint32*>(data_ptr);
+            if (swap)
+              KALDI_SWAP4(k);
+            (*output)(j, i) =  k;
+            data_ptr += 4;
+            break;
+          }
+        default:
+          KALDI_ERR << "bits per sample is " << bits_per_sample_;  // already checked this.
+      }
+    }
+  }
+}
+
+
+void WaveData::Read(std::istream &is) {
+  data_.Resize(0, 0);  // clear the data.
+
+  WaveInfo info;
+  info.Read(is);
+  samp_freq_ = info.SampFreq();
+  uint32 data_chunk_size = info.DataBytes();
 
   std::vector<char*> data_pointer_vec;
   std::vector<int> data_size_vec;
@@ -227,7 +287,6 @@ void WaveData::Read(std::istream &is) {
     data_address += data_size_vec[i];
   }
 
-  char *data_ptr = &(chunk_data_vec[0]);
   if (num_bytes_read == 0 && num_bytes_read != data_chunk_size) {
     KALDI_ERR << "WaveData: failed to read data chunk (read no bytes)";
   } else if (num_bytes_read != data_chunk_size) {
@@ -236,41 +295,10 @@ void WaveData::Read(std::istream &is) {
                << num_bytes_read << " < " << data_chunk_size;    
   }
   
-  if (data_chunk_size == 0)
-    KALDI_ERR << "WaveData: empty file (no data)";
-  
-  uint32 num_samp = num_bytes_read / block_align;
-  data_.Resize(num_channels, num_samp);
-  for (uint32 i = 0; i < num_samp; i++) {
-    for (uint32 j = 0; j < num_channels; j++) {
-      switch (bits_per_sample) {
-        case 8:
-          data_(j, i) = *data_ptr;
-          data_ptr++;
-          break;
-        case 16:
-          {
-            int16 k = *reinterpret_cast<uint16*>(data_ptr);
-            if (swap)
-              KALDI_SWAP2(k);
-            data_(j, i) =  k;
-            data_ptr += 2;
-            break;
-          }
-        case 32:
-          {
-            int32 k = *reinterpret_cast<uint32*>(data_ptr);
-            if (swap)
-              KALDI_SWAP4(k);
-            data_(j, i) =  k;
-            data_ptr += 4;
-            break;
-          }
-        default:
-          KALDI_ERR << "bits per sample is " << bits_per_sample;  // already checked this.
-      }
-    }
-  }
+  uint32 num_samp = num_bytes_read / info.BlockAlign();
+  data_.Resize(info.NumChannels(), num_samp);
+  if (num_samp > 0)
+    info.ConvertSamples(&(chunk_data_vec[0]), num_samp, &data_);
 }
 
 
@@ -326,4 +354,443 @@ void WaveData::Write(std::ostream &os) const {
 }
 
 
+bool MappedWaveData::Open(const std::string &filename) {
+  Close();
+#ifdef _MSC_VER
+  KALDI_WARN << "Memory-mapping wave files is not supported on Windows.";
+  return false;
+#else
+  std::ifstream is(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!is.is_open()) {
+    KALDI_WARN << "Could not open wave file " << filename;
+    return false;
+  }
+  try {
+    info_.Read(is);
+  } catch(...) {
+    KALDI_WARN << "Could not read the header of wave file " << filename;
+    return false;
+  }
+  std::streamoff data_offset = is.tellg();
+  if (data_offset < 0) return false;
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat stat_buf;
+  if (fd == -1 || fstat(fd, &stat_buf) != 0) {
+    KALDI_WARN << "Could not open wave file " << filename << ": "
+               << strerror(errno);
+    if (fd != -1) close(fd);
+    return false;
+  }
+  map_size_ = stat_buf.st_size;
+  void *map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping stays valid.
+  if (map == MAP_FAILED) {
+    KALDI_WARN << "Could not map wave file " << filename << ": "
+               << strerror(errno);
+    map_size_ = 0;
+    return false;
+  }
+  map_ = map;
+  data_ = static_cast<const char*>(map_) + data_offset;
+
+  int64 num_bytes = std::min<int64>(info_.DataBytes(),
+                                    map_size_ - data_offset);
+  if (num_bytes < info_.DataBytes())
+    KALDI_WARN << "File " << filename << " is shorter than specified in "
+               << "the header: " << num_bytes << " < "
+               << info_.DataBytes() << " bytes of samples";
+  num_samp_ = num_bytes / info_.BlockAlign();
+  return true;
+#endif
+}
+
+void MappedWaveData::Close() {
+#ifndef _MSC_VER
+  if (map_ != NULL)
+    munmap(map_, map_size_);
+#endif
+  map_ = NULL;
+  map_size_ = 0;
+  data_ = NULL;
+  num_samp_ = 0;
+}
+
+void MappedWaveData::ReadRange(int64 first_samp, int64 num_samp,
+                               Matrix<BaseFloat> *output,
+                               int32 channel) const {
+  KALDI_ASSERT(IsOpen() && first_samp >= 0 && num_samp >= 0 &&
+               first_samp + num_samp <= num_samp_ &&
+               channel >= -1 && channel < info_.NumChannels());
+  const char *data_ptr = data_ + first_samp * info_.BlockAlign();
+  if (channel == -1 || info_.NumChannels() == 1) {
+    output->Resize(info_.NumChannels(), num_samp, kUndefined);
+    info_.ConvertSamples(data_ptr, num_samp, output);
+    return;
+  }
+  // Converts the samples of all channels a block at a time, and keeps only
+  // those of "channel".
+  output->Resize(1, num_samp, kUndefined);
+  int64 block_size = std::min<int64>(num_samp, 4096);
+  Matrix<BaseFloat> block(info_.NumChannels(), block_size, kUndefined);
+  for (int64 start = 0; start < num_samp; start += block_size) {
+    int32 this_block_size = std::min(block_size, num_samp - start);
+    info_.ConvertSamples(data_ptr + start * info_.BlockAlign(),
+                         this_block_size, &block);
+    output->Row(0).Range(start, this_block_size).CopyFromVec(
+        block.Row(channel).Range(0, this_block_size));
+  }
+}
+
+
+RandomAccessWaveRangeReader::RandomAccessWaveRangeReader(
+    const std::string &wav_rspecifier): archive_reader_(NULL) {
+  std::string rxfilename;
+  RspecifierOptions opts;
+  RspecifierType rspecifier_type = ClassifyRspecifier(wav_rspecifier,
+                                                      &rxfilename, &opts);
+  permissive_ = opts.permissive;
+  if (rspecifier_type == kScriptRspecifier) {
+    std::vector<std::pair<std::string, std::string> > script;
+    if (!ReadScriptFile(rxfilename, true, &script))
+      KALDI_ERR << "Could not read script file "
+                << PrintableRxfilename(rxfilename);
+    for (size_t i = 0; i < script.size(); i++)
+      script_[script[i].first] = script[i].second;
+  } else {
+    archive_reader_ = new RandomAccessTableReader<WaveHolder>(wav_rspecifier);
+  }
+}
+
+RandomAccessWaveRangeReader::~RandomAccessWaveRangeReader() {
+  delete archive_reader_;
+}
+
+bool RandomAccessWaveRangeReader::HasKey(const std::string &key) {
+  // The archive reader deals with the permissive option itself.
+  if (archive_reader_ != NULL)
+    return archive_reader_->HasKey(key);
+  if (script_.count(key) == 0)
+    return false;
+  if (permissive_) {
+    // A recording that cannot be read is treated as if it were not there.
+    try {
+      Load(key);
+    } catch(const std::exception &e) {
+      // The error has been printed already.
+      KALDI_WARN << "Could not read recording " << key
+                 << ", treating it as missing (permissive mode).";
+      return false;
+    }
+  }
+  return true;
+}
+
+void RandomAccessWaveRangeReader::Load(const std::string &key) {
+  if (!cur_key_.empty() && key == cur_key_)
+    return;
+  cur_key_ = "";  // set again when the recording has been read.
+  mapped_.Close();
+  wave_.Clear();
+  if (archive_reader_ != NULL) {
+    if (!archive_reader_->HasKey(key))
+      KALDI_ERR << "No such recording " << key;
+    wave_.CopyFrom(archive_reader_->Value(key));
+  } else {
+    std::map<std::string, std::string>::const_iterator iter =
+        script_.find(key);
+    if (iter == script_.end())
+      KALDI_ERR << "No such recording " << key;
+    const std::string &rxfilename = iter->second;
+    if (ClassifyRxfilename(rxfilename) != kFileInput ||
+        !mapped_.Open(rxfilename)) {
+      Input ki(rxfilename, NULL);
+      wave_.Read(ki.Stream());
+    }
+  }
+  cur_key_ = key;
+}
+
+BaseFloat RandomAccessWaveRangeReader::SampFreq(const std::string &key) {
+  Load(key);
+  return (mapped_.IsOpen() ? mapped_.SampFreq() : wave_.SampFreq());
+}
+
+int32 RandomAccessWaveRangeReader::NumChannels(const std::string &key) {
+  Load(key);
+  return (mapped_.IsOpen() ? mapped_.NumChannels() : wave_.Data().NumRows());
+}
+
+int64 RandomAccessWaveRangeReader::NumSamples(const std::string &key) {
+  Load(key);
+  return (mapped_.IsOpen() ? mapped_.NumSamples() : wave_.Data().NumCols());
+}
+
+void RandomAccessWaveRangeReader::ReadRange(const std::string &key,
+                                            int64 first_samp, int64 num_samp,
+                                            Matrix<BaseFloat> *output,
+                                            int32 channel) {
+  Load(key);
+  if (mapped_.IsOpen()) {
+    mapped_.ReadRange(first_samp, num_samp, output, channel);
+  } else {
+    const Matrix<BaseFloat> &data = wave_.Data();
+    KALDI_ASSERT(first_samp >= 0 && num_samp >= 0 &&
+                 first_samp + num_samp <= data.NumCols() &&
+                 channel >= -1 && channel < data.NumRows());
+    if (channel == -1)
+      *output = data.ColRange(first_samp, num_samp);
+    else
+      *output = data.Range(channel, 1, first_samp, num_samp);
+  }
+}
+
+
+SequentialWaveSegmentReader::SequentialWaveSegmentReader(
+    const std::string &wav_rspecifier, const std::string &segments_rxfilename,
+    BaseFloat frame_shift, BaseFloat max_overshoot,
+    BaseFloat max_region_length):
+    wave_reader_(NULL), range_reader_(NULL), frame_shift_(frame_shift),
+    max_overshoot_(max_overshoot), max_region_length_(max_region_length),
+    num_lines_(0), region_index_(0),
+    have_value_(false) {
+  if (segments_rxfilename == "") {
+    wave_reader_ = new SequentialTableReader<WaveHolder>(wav_rspecifier);
+  } else {
+    range_reader_ = new RandomAccessWaveRangeReader(wav_rspecifier);
+    if (!segments_input_.OpenTextMode(segments_rxfilename))
+      KALDI_ERR << "Could not open segments file "
+                << PrintableRxfilename(segments_rxfilename);
+    ReadRecording();
+  }
+}
+
+SequentialWaveSegmentReader::~SequentialWaveSegmentReader() {
+  delete wave_reader_;
+  delete range_reader_;
+}
+
+bool SequentialWaveSegmentReader::Done() {
+  if (wave_reader_ != NULL)
+    return wave_reader_->Done();
+  return region_index_ >= regions_.size();
+}
+
+std::string SequentialWaveSegmentReader::Key() {
+  if (wave_reader_ != NULL)
+    return wave_reader_->Key();
+  KALDI_ASSERT(!Done());
+  return recording_;
+}
+
+const WaveSegments &SequentialWaveSegmentReader::Value() {
+  if (have_value_)
+    return value_;
+  value_.ids.clear();
+  value_.first_samp.clear();
+  value_.num_samp.clear();
+  if (wave_reader_ != NULL) {
+    value_.wave.CopyFrom(wave_reader_->Value());
+    value_.channel = -1;
+    value_.ids.push_back(wave_reader_->Key());
+    value_.first_samp.push_back(0);
+    value_.num_samp.push_back(value_.wave.Data().NumCols());
+  } else {
+    KALDI_ASSERT(!Done());
+    const Region &region = regions_[region_index_];
+    Matrix<BaseFloat> data;
+    // Only the channel of the segments is read, if they give it.
+    range_reader_->ReadRange(recording_, region.first_samp,
+                             region.end_samp - region.first_samp, &data,
+                             region.segments[0].channel);
+    WaveData wave(range_reader_->SampFreq(recording_), data);
+    value_.wave.Swap(&wave);
+    value_.channel = region.segments[0].channel;
+    for (size_t i = 0; i < region.segments.size(); i++) {
+      const Segment &segment = region.segments[i];
+      value_.ids.push_back(segment.id);
+      value_.first_samp.push_back(segment.first_samp - region.first_samp);
+      value_.num_samp.push_back(segment.end_samp - segment.first_samp);
+    }
+  }
+  have_value_ = true;
+  return value_;
+}
+
+void SequentialWaveSegmentReader::Next() {
+  have_value_ = false;
+  if (wave_reader_ != NULL) {
+    wave_reader_->Next();
+  } else {
+    region_index_++;
+    if (region_index_ >= regions_.size())
+      ReadRecording();
+  }
+}
+
+bool SequentialWaveSegmentReader::ParseLine(const std::string &line,
+                                            std::string *recording,
+                                            Segment *segment,
+                                            double *start, double *end) {
+  std::vector<std::string> split_line;
+  SplitStringToVector(line, " \t\r", true, &split_line);
+  if (split_line.size() != 4 && split_line.size() != 5) {
+    KALDI_WARN << "Invalid line in segments file: " << line;
+    return false;
+  }
+  segment->id = split_line[0];
+  *recording = split_line[1];
+  if (!ConvertStringToReal(split_line[2], start) ||
+      !ConvertStringToReal(split_line[3], end)) {
+    KALDI_WARN << "Invalid line in segments file [bad start or end]: "
+               << line;
+    return false;
+  }
+  // An end time of -1 means the end of the recording.
+  if (*start < 0 || (*end != -1.0 && *end <= *start)) {
+    KALDI_WARN << "Invalid line in segments file [empty or invalid segment]: "
+               << line;
+    return false;
+  }
+  segment->channel = -1;
+  if (split_line.size() == 5 &&
+      (!ConvertStringToInteger(split_line[4], &segment->channel) ||
+       segment->channel < 0)) {
+    KALDI_WARN << "Invalid line in segments file [bad channel]: " << line;
+    return false;
+  }
+  return true;
+}
+
+// Orders the segments of a recording by start time (then by line), for
+// dividing them into regions.
+struct SegmentStartLess {
+  template<class S>
+  bool operator () (const S &a, const S &b) const {
+    if (a.first_samp != b.first_samp) return a.first_samp < b.first_samp;
+    return a.line < b.line;
+  }
+};
+
+// Orders segments by their line in the segments file.
+struct SegmentLineLess {
+  template<class S>
+  bool operator () (const S &a, const S &b) const {
+    return a.line < b.line;
+  }
+};
+
+// Orders regions by the first line of their segments (which must be sorted
+// with SegmentLineLess).
+struct RegionLineLess {
+  template<class R>
+  bool operator () (const R &a, const R &b) const {
+    return a.segments[0].line < b.segments[0].line;
+  }
+};
+
+void SequentialWaveSegmentReader::ReadRecording() {
+  regions_.clear();
+  region_index_ = 0;
+  while (regions_.empty()) {
+    recording_ = "";
+    std::vector<Segment> segments;
+    std::string line;
+    while (true) {
+      if (next_line_ != "") {
+        line = next_line_;
+        next_line_ = "";
+      } else if (!std::getline(segments_input_.Stream(), line)) {
+        break;
+      } else {
+        num_lines_++;
+      }
+      std::string recording;
+      Segment segment;
+      double start, end;
+      if (!ParseLine(line, &recording, &segment, &start, &end))
+        continue;
+      if (recording_ == "") {
+        recording_ = recording;
+      } else if (recording != recording_) {
+        next_line_ = line;  // the first line of the next recording.
+        break;
+      }
+      if (!range_reader_->HasKey(recording)) {
+        KALDI_WARN << "Could not find recording " << recording
+                   << ", skipping segment " << segment.id;
+        continue;
+      }
+      BaseFloat samp_freq = range_reader_->SampFreq(recording);
+      int64 num_samp = range_reader_->NumSamples(recording);
+      segment.first_samp = static_cast<int64>(start * samp_freq);
+      segment.end_samp = (end != -1.0 ? static_cast<int64>(end * samp_freq) :
+                          num_samp);
+      if (segment.first_samp >= num_samp) {
+        KALDI_WARN << "Start sample out of range " << segment.first_samp
+                   << " [length:] " << num_samp << ", skipping segment "
+                   << segment.id;
+        continue;
+      }
+      if (segment.end_samp > num_samp) {
+        if (segment.end_samp >=
+            num_samp + static_cast<int64>(max_overshoot_ * samp_freq)) {
+          KALDI_WARN << "End sample too far out of range " << segment.end_samp
+                     << " [length:] " << num_samp << ", skipping segment "
+                     << segment.id;
+          continue;
+        }
+        segment.end_samp = num_samp;  // for small differences, just truncate.
+      }
+      if (segment.end_samp <= segment.first_samp) {
+        KALDI_WARN << "Segment " << segment.id << " is empty, skipping it.";
+        continue;
+      }
+      if (segment.channel >= range_reader_->NumChannels(recording)) {
+        KALDI_WARN << "Invalid channel " << segment.channel << " >= "
+                   << range_reader_->NumChannels(recording)
+                   << ", skipping segment " << segment.id;
+        continue;
+      }
+      segment.line = num_lines_;
+      segments.push_back(segment);
+    }
+    if (recording_ == "")
+      return;  // end of the segments file.
+    if (segments.empty())
+      continue;
+
+    BaseFloat samp_freq = range_reader_->SampFreq(recording_);
+    int64 frame_shift = static_cast<int64>(frame_shift_ * samp_freq + 0.5),
+        max_region_samp = static_cast<int64>(max_region_length_ * samp_freq);
+    std::sort(segments.begin(), segments.end(), SegmentStartLess());
+    for (size_t i = 0; i < segments.size(); i++) {
+      const Segment &segment = segments[i];
+      if (!regions_.empty() && frame_shift > 0) {
+        Region &region = regions_.back();
+        if (segment.channel == region.segments[0].channel &&
+            segment.first_samp < region.end_samp &&
+            (segment.first_samp - region.first_samp) % frame_shift == 0 &&
+            // e.g. a sliding window would otherwise chain the segments of
+            // the whole recording into one region.
+            std::max(region.end_samp, segment.end_samp) - region.first_samp <=
+            max_region_samp) {
+          region.segments.push_back(segment);
+          region.end_samp = std::max(region.end_samp, segment.end_samp);
+          continue;
+        }
+      }
+      regions_.resize(regions_.size() + 1);
+      regions_.back().first_samp = segment.first_samp;
+      regions_.back().end_samp = segment.end_samp;
+      regions_.back().segments.push_back(segment);
+    }
+    for (size_t i = 0; i < regions_.size(); i++)
+      std::sort(regions_[i].segments.begin(), regions_[i].segments.end(),
+                SegmentLineLess());
+    std::sort(regions_.begin(), regions_.end(), RegionLineLess());
+  }
+}
+
+
 }  // end namespace eesen
@@ -43,15 +43,54 @@
 #ifndef KALDI_FEAT_WAVE_READER_H_
 #define KALDI_FEAT_WAVE_READER_H_
 
+#include <algorithm>
 #include <cstring>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "base/kaldi-types.h"
 #include "cpucompute/vector.h"
 #include "cpucompute/matrix.h"
+#include "util/kaldi-table.h"
 
 
 namespace eesen {
 
+/// WaveInfo holds the format of a wave file, as read from its header.
+class WaveInfo {
+ public:
+  WaveInfo(): samp_freq_(0.0), num_channels_(0), bits_per_sample_(0),
+              reverse_bytes_(false), data_bytes_(0) {}
+
+  /// Reads the header, leaving "is" at the start of the samples.  Throws
+  /// on error.  "is" should be opened in binary mode.
+  void Read(std::istream &is);
+
+  BaseFloat SampFreq() const { return samp_freq_; }
+  int32 NumChannels() const { return num_channels_; }
+  int32 BitsPerSample() const { return bits_per_sample_; }
+  /// Bytes per sample period (all the channels).
+  int32 BlockAlign() const { return num_channels_ * bits_per_sample_ / 8; }
+  /// True if the samples are in the opposite byte order to this machine's.
+  bool ReverseBytes() const { return reverse_bytes_; }
+  /// The size in bytes of the samples, according to the header.
+  uint32 DataBytes() const { return data_bytes_; }
+
+  /// Converts "num_samp" sample periods starting at "data" (which must be
+  /// in the format of this file) to float, as columns 0 ... num_samp - 1 of
+  /// *output, which must have NumChannels() rows.
+  void ConvertSamples(const char *data, int64 num_samp,
+                      MatrixBase<BaseFloat> *output) const;
+
+ private:
+  BaseFloat samp_freq_;
+  int32 num_channels_;
+  int32 bits_per_sample_;
+  bool reverse_bytes_;
+  uint32 data_bytes_;
+};
+
 /// This class's purpose is to read in Wave files.
 class WaveData {
  public:
@@ -81,6 +120,7 @@ class WaveData {
 
   void CopyFrom(const WaveData &other) {
     samp_freq_ = other.samp_freq_;
+    data_.Resize(other.data_.NumRows(), other.data_.NumCols(), kUndefined);
     data_.CopyFromMat(other.data_);
   }
 
@@ -89,15 +129,15 @@ class WaveData {
     samp_freq_ = 0.0;
   }
 
+  void Swap(WaveData *other) {
+    data_.Swap(&other->data_);
+    std::swap(samp_freq_, other->samp_freq_);
+  }
+
  private:
   static const uint32 kBlockSize = 1048576;  // 1024 * 1024, use 1M bytes
   Matrix<BaseFloat> data_;
   BaseFloat samp_freq_;
-  static void Expect4ByteTag(std::istream &is, const char *expected);
-  uint32 ReadUint32(std::istream &is, bool swap);
-  uint16 ReadUint16(std::istream &is, bool swap);
-  static void Read4ByteTag(std::istream &is, char *dest);
-
   static void WriteUint32(std::ostream &os, int32 i);
   static void WriteUint16(std::ostream &os, int16 i);
 };
@@ -156,6 +196,197 @@ class WaveHolder {
 };
 
 
+/// MappedWaveData gives access to the samples of a wave file that is mapped
+/// into memory with mmap() instead of being read: only the pages of the
+/// ranges that are asked for are loaded (by the operating system), and only
+/// those samples are converted to float.  This is for long recordings of
+/// which we want segments; the memory used does not depend on the length of
+/// the file.
+class MappedWaveData {
+ public:
+  MappedWaveData(): map_(NULL), map_size_(0), data_(NULL), num_samp_(0) { }
+
+  /// Maps the wave file "filename", which must be an ordinary file (not a
+  /// pipe or the standard input), and reads its header.  Returns false,
+  /// having printed a warning, if it could not be mapped or is not a wave
+  /// file we can read.
+  bool Open(const std::string &filename);
+
+  void Close();
+
+  bool IsOpen() const { return map_ != NULL; }
+
+  const WaveInfo &Info() const { return info_; }
+
+  BaseFloat SampFreq() const { return info_.SampFreq(); }
+
+  int32 NumChannels() const { return info_.NumChannels(); }
+
+  /// The number of samples per channel (less than the header says if the file
+  /// is truncated).
+  int64 NumSamples() const { return num_samp_; }
+
+  /// Outputs samples first_samp ... first_samp + num_samp - 1 of all the
+  /// channels to *output, one row per channel, or only of channel "channel"
+  /// (as a single row) if it is not -1.  The range must be within the file.
+  void ReadRange(int64 first_samp, int64 num_samp, Matrix<BaseFloat> *output,
+                 int32 channel = -1) const;
+
+  ~MappedWaveData() { Close(); }
+
+ private:
+  WaveInfo info_;
+  void *map_;  // the mapping of the whole file.
+  size_t map_size_;
+  const char *data_;  // the start of the samples, in map_.
+  int64 num_samp_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(MappedWaveData);
+};
+
+
+/// RandomAccessWaveRangeReader reads ranges of samples, e.g. the segments
+/// in a "segments" file, from the recordings of a wave table, looked up by
+/// key.  For an "scp:" table whose entries are ordinary files the current
+/// recording is mapped (see MappedWaveData), so only the requested ranges
+/// are read and converted and the memory used does not grow with the length
+/// of the recordings.  Other entries (e.g. commands ending in "|") and
+/// archives are read whole, as RandomAccessTableReader<WaveHolder> does.
+/// Consecutive requests for the same recording do not read it again, so it
+/// is best to have the requests sorted by recording.  With the "p"
+/// (permissive) option, e.g. "scp,p:wav.scp", HasKey() returns false for
+/// recordings that cannot be read, as for other tables.
+class RandomAccessWaveRangeReader {
+ public:
+  explicit RandomAccessWaveRangeReader(const std::string &wav_rspecifier);
+
+  bool HasKey(const std::string &key);
+
+  /// The following functions are for recording "key", for which HasKey()
+  /// must return true; they throw if it cannot be read.
+  BaseFloat SampFreq(const std::string &key);
+  int32 NumChannels(const std::string &key);
+  int64 NumSamples(const std::string &key);
+
+  /// Outputs samples first_samp ... first_samp + num_samp - 1 of all the
+  /// channels of recording "key", one row per channel, or only of channel
+  /// "channel" (as a single row) if it is not -1.
+  void ReadRange(const std::string &key, int64 first_samp, int64 num_samp,
+                 Matrix<BaseFloat> *output, int32 channel = -1);
+
+  ~RandomAccessWaveRangeReader();
+
+ private:
+  // Makes "key" the current recording, reading or mapping it if it is not.
+  void Load(const std::string &key);
+
+  // For "scp:" tables, the rxfilename of each recording; else empty.
+  std::map<std::string, std::string> script_;
+  bool permissive_;
+  // For other tables (archives).
+  RandomAccessTableReader<WaveHolder> *archive_reader_;
+
+  std::string cur_key_;
+  MappedWaveData mapped_;  // the current recording, if it is mapped;
+  WaveData wave_;          // else the current recording.
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(RandomAccessWaveRangeReader);
+};
+
+
+/// A region of a recording and the segments in it, as output by
+/// SequentialWaveSegmentReader: "wave" has the samples of the region, and
+/// segment i is samples first_samp[i] ... first_samp[i] + num_samp[i] - 1
+/// of it.  If the segments file gives the channel, "wave" has only that
+/// channel.
+struct WaveSegments {
+  WaveData wave;
+  int32 channel;  // The channel given in the segments file, or -1 if none.
+  std::vector<std::string> ids;
+  std::vector<int32> first_samp;
+  std::vector<int32> num_samp;
+
+  WaveSegments(): channel(-1) { }
+};
+
+
+/// SequentialWaveSegmentReader reads the segments of recordings for the
+/// feature-extraction programs, so they can work on the recordings directly
+/// instead of on segments cut out by extract-segments.  It can be used as
+/// the reader in RunTableMap().
+///
+/// If "segments_rxfilename" is empty, each wave file in "wav_rspecifier" is
+/// one segment, with the same key.  Otherwise it is a segments file, with
+/// lines "<segment-id> <recording-id> <start-time> <end-time> [<channel>]" as
+/// for extract-segments, and the segments are read from the recordings in
+/// "wav_rspecifier" with RandomAccessWaveRangeReader, so only the segments
+/// are read.  Segments on consecutive lines with the same recording that
+/// overlap, have the same channel and start a multiple of "frame_shift"
+/// seconds apart are output as one region, so that the frames they share can
+/// be computed once (see ComputeSegmentFeatures()), as long as the region
+/// stays within "max_region_length" seconds; if frame_shift is zero, each
+/// segment is a region.  The segments come out in the order of the
+/// file, except that those of a region come out together, at the place of
+/// the first of them.
+class SequentialWaveSegmentReader {
+ public:
+  SequentialWaveSegmentReader(const std::string &wav_rspecifier,
+                              const std::string &segments_rxfilename,
+                              BaseFloat frame_shift,
+                              BaseFloat max_overshoot = 0.5,
+                              BaseFloat max_region_length = 300.0);
+
+  bool Done();
+  /// The recording-id of the region.
+  std::string Key();
+  const WaveSegments &Value();
+  void Next();
+  void FreeCurrent() { value_.wave.Clear(); }
+
+  ~SequentialWaveSegmentReader();
+
+ private:
+  struct Segment {
+    std::string id;
+    int64 first_samp, end_samp;
+    int32 channel;
+    int32 line;  // order in the segments file.
+  };
+  struct Region {
+    int64 first_samp, end_samp;
+    std::vector<Segment> segments;
+  };
+
+  // Reads the lines of the next recording in the segments file and divides
+  // them into regions_.
+  void ReadRecording();
+  // Parses a line of the segments file; returns false, with a warning, if it
+  // is invalid.
+  bool ParseLine(const std::string &line, std::string *recording,
+                 Segment *segment, double *start, double *end);
+
+  // If there is no segments file.
+  SequentialTableReader<WaveHolder> *wave_reader_;
+
+  // If there is a segments file.
+  RandomAccessWaveRangeReader *range_reader_;
+  Input segments_input_;
+  BaseFloat frame_shift_;
+  BaseFloat max_overshoot_;
+  BaseFloat max_region_length_;
+  int32 num_lines_;
+  std::string next_line_;  // line read for the next recording, if not "".
+  std::string recording_;
+  std::vector<Region> regions_;  // the regions of recording_, of which...
+  size_t region_index_;          // ... this one is the current one.
+
+  WaveSegments value_;
+  bool have_value_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(SequentialWaveSegmentReader);
+};
+
+
 }  // namespace eesen
 
 #endif  // KALDI_FEAT_WAVE_READER_H_
@@ -0,0 +1,136 @@
+// featbin/apply-cmvn-and-deltas.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "cpucompute/matrix.h"
+#include "feat/cmvn.h"
+#include "feat/feature-functions.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+
+    const char *usage =
+        "Apply cepstral mean and (optionally) variance normalization, add deltas\n"
+        "and optionally splice frames, in one pass over the features.  This\n"
+        "does what apply-cmvn | add-deltas [| splice-feats] does, without the\n"
+        "pipes and the intermediate matrices.\n"
+        "Per-utterance by default, or per-speaker if utt2spk option provided\n"
+        "Usage: apply-cmvn-and-deltas [options] (cmvn-stats-rspecifier|cmvn-stats-rxfilename) "
+        "feats-rspecifier feats-wspecifier\n"
+        "e.g.: apply-cmvn-and-deltas --norm-vars=true --utt2spk=ark:data/utt2spk \\\n"
+        "   scp:data/cmvn.scp scp:data/feats.scp ark:-\n"
+        "See also: apply-cmvn, add-deltas\n";
+
+    ParseOptions po(usage);
+    CmvnAndDeltasOptions opts;
+    std::string utt2spk_rspecifier;
+    bool norm_means = true;
+    std::string skip_dims_str;
+
+    po.Register("utt2spk", &utt2spk_rspecifier,
+                "rspecifier for utterance to speaker map");
+    po.Register("norm-means", &norm_means, "You can set this to false to turn "
+                "off mean normalization.");
+    po.Register("skip-dims", &skip_dims_str, "Dimensions for which to skip "
+                "normalization: colon-separated list of integers, e.g. 13:14:15)");
+    opts.Register(&po);
+
+    po.Read(argc, argv);
+    if (po.NumArgs() != 3) {
+      po.PrintUsage();
+      exit(1);
+    }
+    if (opts.norm_vars && !norm_means)
+      KALDI_ERR << "You cannot normalize the variance but not the mean.";
+    std::vector<int32> skip_dims;
+    if (!SplitStringToIntegers(skip_dims_str, ":", false, &skip_dims)) {
+      KALDI_ERR << "Bad --skip-dims option (should be colon-separated list of "
+                <<  "integers)";
+    }
+
+    int32 num_done = 0, num_err = 0;
+
+    std::string cmvn_rspecifier_or_rxfilename = po.GetArg(1),
+        feat_rspecifier = po.GetArg(2),
+        feat_wspecifier = po.GetArg(3);
+
+    SequentialBaseFloatMatrixReader feat_reader(feat_rspecifier);
+    BaseFloatMatrixWriter feat_writer(feat_wspecifier);
+
+    // Either per-utterance or per-speaker stats, or a single matrix of
+    // (global) stats.
+    RandomAccessDoubleMatrixReaderMapped *cmvn_reader = NULL;
+    Matrix<double> global_stats;
+    if (ClassifyRspecifier(cmvn_rspecifier_or_rxfilename, NULL, NULL)
+        != kNoRspecifier) {
+      cmvn_reader = new RandomAccessDoubleMatrixReaderMapped(
+          cmvn_rspecifier_or_rxfilename, utt2spk_rspecifier);
+    } else {
+      if (utt2spk_rspecifier != "")
+        KALDI_ERR << "--utt2spk option not compatible with rxfilename as input "
+                  << "(did you forget ark:?)";
+      bool binary;
+      Input ki(cmvn_rspecifier_or_rxfilename, &binary);
+      global_stats.Read(ki.Stream(), binary);
+      if (!skip_dims.empty())
+        FakeStatsForSomeDims(skip_dims, &global_stats);
+    }
+
+    for (; !feat_reader.Done(); feat_reader.Next()) {
+      std::string utt = feat_reader.Key();
+      const Matrix<BaseFloat> &feats = feat_reader.Value();
+      if (feats.NumRows() == 0) {
+        KALDI_WARN << "Empty feature matrix for utterance " << utt;
+        num_err++;
+        continue;
+      }
+      const MatrixBase<double> *cmvn_stats = NULL;
+      Matrix<double> stats;
+      if (norm_means) {
+        if (cmvn_reader == NULL) {
+          cmvn_stats = &global_stats;
+        } else {
+          if (!cmvn_reader->HasKey(utt)) {
+            KALDI_WARN << "No normalization statistics available for key "
+                       << utt << ", producing no output for this utterance";
+            num_err++;
+            continue;
+          }
+          stats = cmvn_reader->Value(utt);
+          if (!skip_dims.empty())
+            FakeStatsForSomeDims(skip_dims, &stats);
+          cmvn_stats = &stats;
+        }
+      }
+      Matrix<BaseFloat> new_feats;
+      ApplyCmvnAndDeltas(opts, cmvn_stats, feats, &new_feats);
+      feat_writer.Write(utt, new_feats);
+      num_done++;
+    }
+    delete cmvn_reader;
+
+    KALDI_LOG << "Applied cepstral mean " << (opts.norm_vars ? "and variance " : "")
+              << "normalization" << (opts.add_deltas ? " and deltas" : "")
+              << " to " << num_done << " utterances, errors on " << num_err;
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -18,38 +18,211 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <vector>
+
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "cpucompute/matrix.h"
 #include "feat/cmvn.h"
+#include "thread/kaldi-table-map.h"
 
 namespace eesen {
 
-bool AccCmvnStatsWrapper(std::string utt,
-                         const MatrixBase<BaseFloat> &feats,
-                         RandomAccessBaseFloatVectorReader *weights_reader,
-                         Matrix<double> *cmvn_stats) {
-  if (!weights_reader->IsOpen()) {
-    AccCmvnStats(feats, NULL, cmvn_stats);
+// The features of an utterance, and its per-frame weights if --weights was
+// given (Read() and Write() only deal with the features).  Features that
+// were stored compressed (e.g. by copy-feats --compress=true) are kept
+// compressed, and the stats are accumulated directly from the compressed
+// data.
+class CmvnInput {
+ public:
+  CmvnInput(): is_compressed_(false), has_weights_(false) { }
+
+  void Read(std::istream &is, bool binary) {
+    is_compressed_ = (binary && Peek(is, binary) == 'C');
+    if (is_compressed_)
+      compressed_.Read(is, binary);
+    else
+      mat_.Read(is, binary);
+  }
+
+  void Write(std::ostream &os, bool binary) const {
+    if (is_compressed_)
+      compressed_.Write(os, binary);
+    else
+      mat_.Write(os, binary);
+  }
+
+  int32 NumRows() const {
+    return (is_compressed_ ? compressed_.NumRows() : mat_.NumRows());
+  }
+  int32 NumCols() const {
+    return (is_compressed_ ? compressed_.NumCols() : mat_.NumCols());
+  }
+
+  void SetWeights(const Vector<BaseFloat> &weights) {
+    weights_ = weights;
+    has_weights_ = true;
+  }
+  bool HasWeights() const { return has_weights_; }
+  const Vector<BaseFloat> &Weights() const { return weights_; }
+
+  void AccStats(const VectorBase<BaseFloat> *weights,
+                MatrixBase<double> *stats) const {
+    if (is_compressed_)
+      AccCmvnStats(compressed_, weights, stats);
+    else
+      AccCmvnStats(mat_, weights, stats);
+  }
+
+ private:
+  bool is_compressed_;
+  Matrix<BaseFloat> mat_;
+  CompressedMatrix compressed_;
+  bool has_weights_;
+  Vector<BaseFloat> weights_;
+};
+
+typedef unordered_map<std::string, int32, StringHasher> Utt2SpkMap;
+
+// Reads the features for RunTableMap().  The weights are looked up here,
+// in the reading thread, because the random-access reader is not
+// thread-safe.  If "utt2spk" is not NULL, the utterances that are not in it
+// are skipped.
+class CmvnInputReader {
+ public:
+  CmvnInputReader(const std::string &feats_rspecifier,
+                  RandomAccessBaseFloatVectorReader *weights_reader,
+                  const Utt2SpkMap *utt2spk):
+      feat_reader_(feats_rspecifier), weights_reader_(weights_reader),
+      utt2spk_(utt2spk) {
+    SkipUnwanted();
+  }
+
+  bool Done() { return feat_reader_.Done(); }
+  std::string Key() { return feat_reader_.Key(); }
+  void Next() {
+    feat_reader_.Next();
+    SkipUnwanted();
+  }
+
+  const CmvnInput &Value() {
+    if (!weights_reader_->IsOpen())
+      return feat_reader_.Value();  // Avoid copying the features.
+    std::string utt = feat_reader_.Key();
+    input_ = feat_reader_.Value();
+    if (weights_reader_->HasKey(utt))
+      input_.SetWeights(weights_reader_->Value(utt));
+    return input_;
+  }
+
+  void FreeCurrent() {
+    feat_reader_.FreeCurrent();
+    input_ = CmvnInput();
+  }
+
+ private:
+  void SkipUnwanted() {
+    if (utt2spk_ == NULL) return;
+    for (; !feat_reader_.Done(); feat_reader_.Next())
+      if (utt2spk_->count(feat_reader_.Key()) != 0) break;
+  }
+
+  SequentialTableReader<KaldiObjectHolder<CmvnInput> > feat_reader_;
+  RandomAccessBaseFloatVectorReader *weights_reader_;
+  const Utt2SpkMap *utt2spk_;
+  CmvnInput input_;
+};
+
+// Accumulates the stats of an utterance (see RunTableMap()).  Write() either
+// writes them, for per-utterance stats, or adds them to the stats of the
+// speaker or to the global stats; it is called in the order the utterances
+// were read, so the sums don't depend on the number of threads.
+class AccCmvnStatsFunc {
+ public:
+  typedef CmvnInput Input;
+  typedef Matrix<double> Output;
+
+  // If "writer" is not NULL, the stats of each utterance are written to it.
+  // Otherwise they are added to (*stats)[s], where s is the index that
+  // "utt2spk" gives for the speaker, or 0 if "utt2spk" is NULL.
+  AccCmvnStatsFunc(bool use_weights, DoubleMatrixWriter *writer,
+                   const Utt2SpkMap *utt2spk,
+                   std::vector<Matrix<double> > *stats):
+      use_weights_(use_weights), writer_(writer), utt2spk_(utt2spk),
+      stats_(stats), num_utts_(stats == NULL ? 0 : stats->size(), 0),
+      num_done_(0), num_err_(0) { }
+
+  bool Process(const std::string &utt, CmvnInput *input,
+               Matrix<double> *stats) const {
+    const VectorBase<BaseFloat> *weights = NULL;
+    if (use_weights_) {
+      if (!input->HasWeights()) {
+        KALDI_WARN << "No weights available for utterance " << utt;
+        return false;
+      }
+      if (input->Weights().Dim() != input->NumRows()) {
+        KALDI_WARN << "Weights for utterance " << utt
+                   << " have wrong dimension " << input->Weights().Dim()
+                   << " vs. " << input->NumRows();
+        return false;
+      }
+      weights = &(input->Weights());
+    }
+    InitCmvnStats(input->NumCols(), stats);
+    input->AccStats(weights, stats);
     return true;
-  } else {
-    if (!weights_reader->HasKey(utt)) {
-      KALDI_WARN << "No weights available for utterance " << utt;
-      return false;
+  }
+
+  void Write(const std::string &utt, bool ok,
+             const Matrix<double> &utt_stats) {
+    int32 s = 0;
+    if (utt2spk_ != NULL) {
+      Utt2SpkMap::const_iterator iter = utt2spk_->find(utt);
+      KALDI_ASSERT(iter != utt2spk_->end());  // CmvnInputReader checked it.
+      s = iter->second;
     }
-    const Vector<BaseFloat> &weights = weights_reader->Value(utt);
-    if (weights.Dim() != feats.NumRows()) {
-      KALDI_WARN << "Weights for utterance " << utt << " have wrong dimension "
-                 << weights.Dim() << " vs. " << feats.NumRows();
-      return false;
+    if (writer_ == NULL)
+      num_utts_[s]++;
+    if (!ok) {
+      num_err_++;
+      return;
     }
-    AccCmvnStats(feats, &weights, cmvn_stats);
-    return true;
+    if (writer_ != NULL) {
+      writer_->Write(utt, utt_stats);
+    } else {
+      Matrix<double> &stats = (*stats_)[s];
+      if (stats.NumRows() == 0) {
+        stats = utt_stats;
+      } else if (stats.NumCols() != utt_stats.NumCols()) {
+        KALDI_WARN << "Utterance " << utt << " has feature dimension "
+                   << (utt_stats.NumCols() - 1) << ", expected "
+                   << (stats.NumCols() - 1);
+        num_err_++;
+        return;
+      } else {
+        stats.AddMat(1.0, utt_stats);
+      }
+    }
+    num_done_++;
   }
-}
-                  
 
-}
+  // The number of utterances read for (*stats)[s], including those with
+  // errors.
+  int32 NumUtts(int32 s) const { return num_utts_[s]; }
+  int32 NumDone() const { return num_done_; }
+  int32 NumErr() const { return num_err_; }
+
+ private:
+  bool use_weights_;
+  DoubleMatrixWriter *writer_;
+  const Utt2SpkMap *utt2spk_;
+  std::vector<Matrix<double> > *stats_;
+  std::vector<int32> num_utts_;
+  int32 num_done_;
+  int32 num_err_;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
@@ -60,6 +233,8 @@ int main(int argc, char *argv[]) {
         "Compute cepstral mean and variance normalization statistics\n"
         "If wspecifier provided: per-utterance by default, or per-speaker if\n"
         "spk2utt option provided; if wxfilename: global\n"
+        "The features are read sequentially (in any order) and processed by\n"
+        "--num-threads threads; compressed features are not decompressed.\n"
         "Usage: compute-cmvn-stats  [options] feats-rspecifier (stats-wspecifier|stats-wxfilename)\n";
     
     ParseOptions po(usage);
@@ -69,6 +244,8 @@ int main(int argc, char *argv[]) {
     po.Register("binary", &binary, "write in binary mode (applies only to global CMN/CVN)");
     po.Register("weights", &weights_rspecifier, "rspecifier for a vector of floats "
                 "for each utterance, that's a per-frame weight.");
+    TaskSequencerConfig sequencer_config;
+    sequencer_config.Register(&po);
     
     po.Read(argc, argv);
 
@@ -82,6 +259,7 @@ int main(int argc, char *argv[]) {
     std::string wspecifier_or_wxfilename = po.GetArg(2);
 
     RandomAccessBaseFloatVectorReader weights_reader(weights_rspecifier);
+    bool use_weights = weights_reader.IsOpen();
     
     if (ClassifyWspecifier(wspecifier_or_wxfilename, NULL, NULL, NULL)
         != kNoWspecifier) { // writing to a Table: per-speaker or per-utt CMN/CVN.
@@ -90,77 +268,66 @@ int main(int argc, char *argv[]) {
       DoubleMatrixWriter writer(wspecifier);
 
       if (spk2utt_rspecifier != "") {
+        // The stats of the utterances are added to those of their speaker
+        // as they are read, so the features can be read in any order.
+        std::vector<std::string> spks;
+        std::vector<int32> spk_num_utts;
+        Utt2SpkMap utt2spk;
         SequentialTokenVectorReader spk2utt_reader(spk2utt_rspecifier);
-        RandomAccessBaseFloatMatrixReader feat_reader(rspecifier);
-        
         for (; !spk2utt_reader.Done(); spk2utt_reader.Next()) {
-          std::string spk = spk2utt_reader.Key();
           const std::vector<std::string> &uttlist = spk2utt_reader.Value();
-          bool is_init = false;
-          Matrix<double> stats;
+          int32 s = spks.size();
+          spks.push_back(spk2utt_reader.Key());
+          spk_num_utts.push_back(0);
           for (size_t i = 0; i < uttlist.size(); i++) {
-            std::string utt = uttlist[i];
-            if (!feat_reader.HasKey(utt)) {
-              KALDI_WARN << "Did not find features for utterance " << utt;
-              num_err++;
-              continue;
-            }
-            const Matrix<BaseFloat> &feats = feat_reader.Value(utt);
-            if (!is_init) {
-              InitCmvnStats(feats.NumCols(), &stats);
-              is_init = true;
-            }
-            if (!AccCmvnStatsWrapper(utt, feats, &weights_reader, &stats)) {
-              num_err++;
-            } else {
-              num_done++;
-            }
+            if (utt2spk.insert(std::make_pair(uttlist[i], s)).second)
+              spk_num_utts[s]++;
+            else
+              KALDI_WARN << "Utterance " << uttlist[i] << " appears more "
+                         << "than once in " << spk2utt_rspecifier;
+          }
+        }
+
+        std::vector<Matrix<double> > stats(spks.size());
+        CmvnInputReader feat_reader(rspecifier, &weights_reader, &utt2spk);
+        AccCmvnStatsFunc func(use_weights, NULL, &utt2spk, &stats);
+        RunTableMap(sequencer_config, &feat_reader, &func);
+        num_done = func.NumDone();
+        num_err = func.NumErr();
+
+        for (size_t s = 0; s < spks.size(); s++) {
+          int32 num_missing = spk_num_utts[s] - func.NumUtts(s);
+          if (num_missing > 0) {
+            KALDI_WARN << "Did not find features for " << num_missing
+                       << " of the " << spk_num_utts[s]
+                       << " utterances of speaker " << spks[s];
+            num_err += num_missing;
           }
-          if (stats.NumRows() == 0) {
-            KALDI_WARN << "No stats accumulated for speaker " << spk;
+          if (stats[s].NumRows() == 0) {
+            KALDI_WARN << "No stats accumulated for speaker " << spks[s];
           } else {
-            writer.Write(spk, stats);
+            writer.Write(spks[s], stats[s]);
           }
         }
       } else {  // per-utterance normalization
-        SequentialBaseFloatMatrixReader feat_reader(rspecifier);
-        
-        for (; !feat_reader.Done(); feat_reader.Next()) {
-          std::string utt = feat_reader.Key();
-          Matrix<double> stats;
-          const Matrix<BaseFloat> &feats = feat_reader.Value();
-          InitCmvnStats(feats.NumCols(), &stats);
-
-          if (!AccCmvnStatsWrapper(utt, feats, &weights_reader, &stats)) {
-            num_err++;
-            continue;
-          }
-          writer.Write(feat_reader.Key(), stats);          
-          num_done++;
-        }
+        CmvnInputReader feat_reader(rspecifier, &weights_reader, NULL);
+        AccCmvnStatsFunc func(use_weights, &writer, NULL, NULL);
+        RunTableMap(sequencer_config, &feat_reader, &func);
+        num_done = func.NumDone();
+        num_err = func.NumErr();
       }
     } else { // accumulate global stats
       if (spk2utt_rspecifier != "")
         KALDI_ERR << "--spk2utt option not compatible with wxfilename as output "
                    << "(did you forget ark:?)";
       std::string wxfilename = wspecifier_or_wxfilename;
-      bool is_init = false;
-      Matrix<double> stats;
-      SequentialBaseFloatMatrixReader feat_reader(rspecifier);
-      for (; !feat_reader.Done(); feat_reader.Next()) {
-        std::string utt = feat_reader.Key();
-        const Matrix<BaseFloat> &feats = feat_reader.Value();
-        if (!is_init) {
-          InitCmvnStats(feats.NumCols(), &stats);
-          is_init = true;
-        }
-        if (!AccCmvnStatsWrapper(utt, feats, &weights_reader, &stats)) {
-          num_err++;
-        } else {
-          num_done++;
-        }
-      }
-      Matrix<float> stats_float(stats);
+      std::vector<Matrix<double> > stats(1);
+      CmvnInputReader feat_reader(rspecifier, &weights_reader, NULL);
+      AccCmvnStatsFunc func(use_weights, NULL, NULL, &stats);
+      RunTableMap(sequencer_config, &feat_reader, &func);
+      num_done = func.NumDone();
+      num_err = func.NumErr();
+      Matrix<float> stats_float(stats[0]);
       WriteKaldiObject(stats_float, wxfilename, binary);
       KALDI_LOG << "Wrote global CMVN stats to "
                 << PrintableWxfilename(wxfilename);
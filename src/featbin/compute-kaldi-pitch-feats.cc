@@ -22,6 +22,85 @@
 #include "util/common-utils.h"
 #include "feat/pitch-functions.h"
 #include "feat/wave-reader.h"
+#include "thread/kaldi-mutex.h"
+#include "thread/kaldi-table-map.h"
+
+namespace eesen {
+
+// Computes the pitch of an utterance (see RunTableMap()).
+class ComputePitchFunc {
+ public:
+  typedef WaveData Input;
+  typedef Matrix<BaseFloat> Output;
+
+  ComputePitchFunc(const PitchExtractionOptions &pitch_opts, int32 channel,
+                   BaseFloatMatrixWriter *feat_writer):
+      pitch_opts_(pitch_opts), channel_(channel), feat_writer_(feat_writer),
+      num_done_(0), num_err_(0) { }
+
+  bool Process(const std::string &utt, WaveData *wave_data,
+               Matrix<BaseFloat> *features) const {
+    int32 num_chan = wave_data->Data().NumRows(), this_chan = channel_;
+    {
+      KALDI_ASSERT(num_chan > 0); 
+      // reading code if no channels.
+      if (channel_ == -1) {
+        this_chan = 0;
+        if (num_chan != 1)
+          KALDI_WARN << "Channel not specified but you have data with "
+                     << num_chan  << " channels; defaulting to zero";
+      } else {
+        if (this_chan >= num_chan) {
+          KALDI_WARN << "File with id " << utt << " has "
+                     << num_chan << " channels but you specified channel "
+                     << channel_ << ", producing no output.";
+          return false;
+        }
+      }
+    }
+    
+    if (pitch_opts_.samp_freq != wave_data->SampFreq())
+      KALDI_ERR << "Sample frequency mismatch: you specified "
+                << pitch_opts_.samp_freq << " but data has "
+                << wave_data->SampFreq() << " (use --sample-frequency "
+                << "option).  Utterance is " << utt;
+    
+    SubVector<BaseFloat> waveform(wave_data->Data(), this_chan);
+    try {
+      ComputeKaldiPitch(pitch_opts_, waveform, features);
+    } catch (...) {
+      KALDI_WARN << "Failed to compute pitch for utterance "
+                 << utt;
+      num_err_mutex_.Lock();
+      num_err_++;
+      num_err_mutex_.Unlock();
+      return false;
+    }
+    return true;
+  }
+
+  void Write(const std::string &utt, bool ok,
+             const Matrix<BaseFloat> &features) {
+    if (!ok) return;
+    feat_writer_->Write(utt, features);
+    if (num_done_ % 50 == 0 && num_done_ != 0)
+      KALDI_VLOG(2) << "Processed " << num_done_ << " utterances";
+    num_done_++;
+  }
+
+  int32 NumDone() const { return num_done_; }
+  int32 NumErr() const { return num_err_; }
+
+ private:
+  PitchExtractionOptions pitch_opts_;
+  int32 channel_;
+  BaseFloatMatrixWriter *feat_writer_;
+  int32 num_done_;
+  mutable int32 num_err_;  // incremented by Process().
+  mutable Mutex num_err_mutex_;
+};
+
+}  // namespace eesen
 
 
 int main(int argc, char *argv[]) {
@@ -47,6 +126,10 @@ int main(int argc, char *argv[]) {
                         // similar.
 
     pitch_opts.Register(&po);
+    TaskSequencerConfig sequencer_config;
+    // Utterances are read while others are being processed, and written in
+    // the order they were read.
+    sequencer_config.Register(&po);
     
     po.Read(argc, argv);
 
@@ -61,53 +144,10 @@ int main(int argc, char *argv[]) {
     SequentialTableReader<WaveHolder> wav_reader(wav_rspecifier);
     BaseFloatMatrixWriter feat_writer(feat_wspecifier);
 
-    int32 num_done = 0, num_err = 0;
-    for (; !wav_reader.Done(); wav_reader.Next()) {
-      std::string utt = wav_reader.Key();  
-      const WaveData &wave_data = wav_reader.Value(); 
-      
-      int32 num_chan = wave_data.Data().NumRows(), this_chan = channel;
-      {
-        KALDI_ASSERT(num_chan > 0); 
-        // reading code if no channels.
-        if (channel == -1) {
-          this_chan = 0;
-          if (num_chan != 1)
-            KALDI_WARN << "Channel not specified but you have data with "
-                       << num_chan  << " channels; defaulting to zero";
-        } else {
-          if (this_chan >= num_chan) {
-            KALDI_WARN << "File with id " << utt << " has "
-                       << num_chan << " channels but you specified channel "
-                       << channel << ", producing no output.";
-            continue;
-          }
-        }
-      }
-      
-      if (pitch_opts.samp_freq != wave_data.SampFreq())
-        KALDI_ERR << "Sample frequency mismatch: you specified "
-                  << pitch_opts.samp_freq << " but data has "
-                  << wave_data.SampFreq() << " (use --sample-frequency "
-                  << "option).  Utterance is " << utt;
-      
-      
-      SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
-      Matrix<BaseFloat> features;
-      try {
-        ComputeKaldiPitch(pitch_opts, waveform, &features);
-      } catch (...) {
-        KALDI_WARN << "Failed to compute pitch for utterance "
-                   << utt;
-        num_err++;        
-        continue;
-      }
-      
-      feat_writer.Write(utt, features);
-      if (num_done % 50 == 0 && num_done != 0)
-        KALDI_VLOG(2) << "Processed " << num_done << " utterances";
-      num_done++;
-    }
+    ComputePitchFunc func(pitch_opts, channel, &feat_writer);
+    RunTableMap(sequencer_config, &wav_reader, &func);
+
+    int32 num_done = func.NumDone(), num_err = func.NumErr();
     KALDI_LOG << "Done " << num_done << " utterances, " << num_err
               << " with errors.";
     return (num_done != 0 ? 0 : 1);
@@ -22,13 +22,187 @@
 #include "util/common-utils.h"
 #include "feat/feature-mfcc.h"
 #include "feat/wave-reader.h"
+#include "thread/kaldi-mutex.h"
+#include "thread/kaldi-table-map.h"
+
+namespace eesen {
+
+// Computes the MFCC features of the utterances, or segments, in a region
+// of a recording (see RunTableMap() and SequentialWaveSegmentReader).
+class ComputeMfccFunc {
+ public:
+  typedef WaveSegments Input;
+  // The features of each segment, empty if they could not be computed.
+  typedef std::vector<std::pair<std::string, Matrix<BaseFloat> > > Output;
+
+  ComputeMfccFunc(const MfccOptions &mfcc_opts, int32 channel,
+                  BaseFloat min_duration, bool subtract_mean,
+                  BaseFloat vtln_warp, const std::string &vtln_map_rspecifier,
+                  const std::string &utt2spk_rspecifier,
+                  BaseFloatMatrixWriter *kaldi_writer,
+                  TableWriter<HtkMatrixHolder> *htk_writer):
+      mfcc_opts_(mfcc_opts), mfcc_(mfcc_opts), channel_(channel),
+      min_duration_(min_duration), subtract_mean_(subtract_mean),
+      vtln_warp_(vtln_warp), use_vtln_map_(vtln_map_rspecifier != ""),
+      vtln_map_reader_(vtln_map_rspecifier, utt2spk_rspecifier),
+      kaldi_writer_(kaldi_writer), htk_writer_(htk_writer),
+      num_utts_(0), num_success_(0) { }
+
+  bool Process(const std::string &recording, WaveSegments *segments,
+               Output *output) const {
+    const WaveData &wave_data = segments->wave;
+    size_t num_segments = segments->ids.size();
+    output->resize(num_segments);
+    for (size_t i = 0; i < num_segments; i++)
+      (*output)[i].first = segments->ids[i];
+
+    // If the segments file gives the channel, the reader has read only that
+    // one.
+    int32 channel = (segments->channel != -1 ? 0 : channel_),
+        num_chan = wave_data.Data().NumRows(), this_chan = channel;
+    {  // This block works out the channel (0=left, 1=right...)
+      KALDI_ASSERT(num_chan > 0);  // should have been caught in
+      // reading code if no channels.
+      if (channel == -1) {
+        this_chan = 0;
+        if (num_chan != 1)
+          KALDI_WARN << "Channel not specified but you have data with "
+                     << num_chan  << " channels; defaulting to zero";
+      } else {
+        if (this_chan >= num_chan) {
+          KALDI_WARN << "File with id " << recording << " has "
+                     << num_chan << " channels but you specified channel "
+                     << channel << ", producing no output.";
+          return false;
+        }
+      }
+    }
+    if (mfcc_opts_.frame_opts.samp_freq != wave_data.SampFreq())
+      KALDI_ERR << "Sample frequency mismatch: you specified "
+                << mfcc_opts_.frame_opts.samp_freq << " but data has "
+                << wave_data.SampFreq() << " (use --sample-frequency "
+                << "option).  Utterance is " << recording;
+
+    // The segments to compute, with their VTLN warp factors.
+    std::vector<size_t> index;
+    std::vector<int32> first_samp, num_samp;
+    std::vector<BaseFloat> vtln_warps;
+    for (size_t i = 0; i < num_segments; i++) {
+      const std::string &utt = segments->ids[i];
+      BaseFloat duration = segments->num_samp[i] / wave_data.SampFreq();
+      if (duration < min_duration_) {
+        KALDI_WARN << "File: " << utt << " is too short ("
+                   << duration << " sec): producing no output.";
+        continue;
+      }
+      BaseFloat vtln_warp_local = vtln_warp_;  // Work out VTLN warp factor.
+      if (use_vtln_map_) {
+        // The reader is shared by the threads.
+        vtln_map_mutex_.Lock();
+        bool has_key = vtln_map_reader_.HasKey(utt);
+        if (has_key) vtln_warp_local = vtln_map_reader_.Value(utt);
+        vtln_map_mutex_.Unlock();
+        if (!has_key) {
+          KALDI_WARN << "No vtln-map entry for utterance-id (or speaker-id) "
+                     << utt;
+          continue;
+        }
+      }
+      index.push_back(i);
+      first_samp.push_back(segments->first_samp[i]);
+      num_samp.push_back(segments->num_samp[i]);
+      vtln_warps.push_back(vtln_warp_local);
+    }
+
+    SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
+    std::vector<Matrix<BaseFloat> > features;
+    try {
+      // The const version of Compute() can be called from several threads.
+      ComputeSegmentFeatures(mfcc_, mfcc_opts_.frame_opts, waveform,
+                             first_samp, num_samp, vtln_warps, &features);
+    } catch (...) {
+      KALDI_WARN << "Failed to compute features for recording "
+                 << recording;
+      return false;
+    }
+    for (size_t k = 0; k < index.size(); k++) {
+      Matrix<BaseFloat> &this_features = (*output)[index[k]].second;
+      this_features.Swap(&features[k]);
+      if (this_features.NumRows() == 0) {
+        KALDI_WARN << "File: " << segments->ids[index[k]] << " is too short "
+                   << "for a frame: producing no output.";
+        continue;
+      }
+      if (subtract_mean_) {
+        Vector<BaseFloat> mean(this_features.NumCols());
+        mean.AddRowSumMat(1.0, this_features);
+        mean.Scale(1.0 / this_features.NumRows());
+        for (int32 i = 0; i < this_features.NumRows(); i++)
+          this_features.Row(i).AddVec(-1.0, mean);
+      }
+    }
+    return true;
+  }
+
+  void Write(const std::string &recording, bool ok, const Output &output) {
+    for (size_t i = 0; i < output.size(); i++) {
+      num_utts_++;
+      const std::string &utt = output[i].first;
+      const Matrix<BaseFloat> &features = output[i].second;
+      if (!ok || features.NumRows() == 0) continue;
+      if (kaldi_writer_->IsOpen()) {
+        kaldi_writer_->Write(utt, features);
+      } else {
+        std::pair<Matrix<BaseFloat>, HtkHeader> p;
+        p.first.Resize(features.NumRows(), features.NumCols());
+        p.first.CopyFromMat(features);
+        HtkHeader header = {
+          features.NumRows(),
+          100000,  // 10ms shift
+          static_cast<int16>(sizeof(float)*(features.NumCols())),
+          static_cast<uint16>( 006 | // MFCC
+          (mfcc_opts_.use_energy ? 0100 : 020000)) // energy; otherwise c0
+        };
+        p.second = header;
+        htk_writer_->Write(utt, p);
+      }
+      if (num_utts_ % 10 == 0)
+        KALDI_LOG << "Processed " << num_utts_ << " utterances";
+      KALDI_VLOG(2) << "Processed features for key " << utt;
+      num_success_++;
+    }
+  }
+
+  int32 NumUtts() const { return num_utts_; }
+  int32 NumSuccess() const { return num_success_; }
+
+ private:
+  MfccOptions mfcc_opts_;
+  Mfcc mfcc_;
+  int32 channel_;
+  BaseFloat min_duration_;
+  bool subtract_mean_;
+  BaseFloat vtln_warp_;
+  bool use_vtln_map_;
+  mutable RandomAccessBaseFloatReaderMapped vtln_map_reader_;
+  mutable Mutex vtln_map_mutex_;
+  BaseFloatMatrixWriter *kaldi_writer_;
+  TableWriter<HtkMatrixHolder> *htk_writer_;
+  int32 num_utts_, num_success_;
+};
+
+}  // namespace eesen
 
 int main(int argc, char *argv[]) {
   try {
     using namespace eesen;
     const char *usage =
         "Create MFCC feature files.\n"
-        "Usage:  compute-mfcc-feats [options...] <wav-rspecifier> <feats-wspecifier>\n";
+        "Usage:  compute-mfcc-feats [options...] <wav-rspecifier> <feats-wspecifier>\n"
+        "With --segments, <wav-rspecifier> has the recordings, and features are\n"
+        "written for each segment, without extracting the segments first.\n"
+        "e.g.: compute-mfcc-feats --segments=data/train/segments "
+        "scp:data/train/wav.scp ark:-\n";
 
     // construct all the global objects
     ParseOptions po(usage);
@@ -37,10 +211,12 @@ int main(int argc, char *argv[]) {
     BaseFloat vtln_warp = 1.0;
     std::string vtln_map_rspecifier;
     std::string utt2spk_rspecifier;
+    std::string segments_rxfilename;
     int32 channel = -1;
     BaseFloat min_duration = 0.0;
     // Define defaults for gobal options
     std::string output_format = "kaldi";
+    TaskSequencerConfig sequencer_config;
 
     // Register the MFCC option struct
     mfcc_opts.Register(&po);
@@ -60,6 +236,13 @@ int main(int argc, char *argv[]) {
                 "0 -> left, 1 -> right)");
     po.Register("min-duration", &min_duration, "Minimum duration of segments "
                 "to process (in seconds).");
+    po.Register("segments", &segments_rxfilename, "Segments file, with lines "
+                "<segment-id> <recording-id> <start-time> <end-time> [<channel>] "
+                "as for extract-segments; if given, features are computed for "
+                "these segments of the recordings.");
+    // Utterances are read while others are being processed, and written in
+    // the order they were read.
+    sequencer_config.Register(&po);
 
     po.Read(argc, argv);
 
@@ -72,17 +255,17 @@ int main(int argc, char *argv[]) {
 
     std::string output_wspecifier = po.GetArg(2);
 
-    Mfcc mfcc(mfcc_opts);
-
-    SequentialTableReader<WaveHolder> reader(wav_rspecifier);
+    // Overlapping segments are read together, to compute the frames they
+    // share once.
+    SequentialWaveSegmentReader reader(
+        wav_rspecifier, segments_rxfilename,
+        mfcc_opts.frame_opts.frame_shift_ms * 0.001);
     BaseFloatMatrixWriter kaldi_writer;  // typedef to TableWriter<something>.
     TableWriter<HtkMatrixHolder> htk_writer;
 
     if (utt2spk_rspecifier != "")
       KALDI_ASSERT(vtln_map_rspecifier != "" && "the utt2spk option is only "
                    "needed if the vtln-map option is used.");
-    RandomAccessBaseFloatReaderMapped vtln_map_reader(vtln_map_rspecifier,
-                                                      utt2spk_rspecifier);
     
     if (output_format == "kaldi") {
       if (!kaldi_writer.Open(output_wspecifier))
@@ -96,88 +279,12 @@ int main(int argc, char *argv[]) {
       KALDI_ERR << "Invalid output_format string " << output_format;
     }
 
-    int32 num_utts = 0, num_success = 0;
-    for (; !reader.Done(); reader.Next()) {
-      num_utts++;
-      std::string utt = reader.Key();
-      const WaveData &wave_data = reader.Value();
-      if (wave_data.Duration() < min_duration) {
-        KALDI_WARN << "File: " << utt << " is too short ("
-                   << wave_data.Duration() << " sec): producing no output.";
-        continue;
-      }
-      int32 num_chan = wave_data.Data().NumRows(), this_chan = channel;
-      {  // This block works out the channel (0=left, 1=right...)
-        KALDI_ASSERT(num_chan > 0);  // should have been caught in
-        // reading code if no channels.
-        if (channel == -1) {
-          this_chan = 0;
-          if (num_chan != 1)
-            KALDI_WARN << "Channel not specified but you have data with "
-                       << num_chan  << " channels; defaulting to zero";
-        } else {
-          if (this_chan >= num_chan) {
-            KALDI_WARN << "File with id " << utt << " has "
-                       << num_chan << " channels but you specified channel "
-                       << channel << ", producing no output.";
-            continue;
-          }
-        }
-      }
-      BaseFloat vtln_warp_local;  // Work out VTLN warp factor.
-      if (vtln_map_rspecifier != "") {
-        if (!vtln_map_reader.HasKey(utt)) {
-          KALDI_WARN << "No vtln-map entry for utterance-id (or speaker-id) "
-                     << utt;
-          continue;
-        }
-        vtln_warp_local = vtln_map_reader.Value(utt);
-      } else {
-        vtln_warp_local = vtln_warp;
-      }
-      if (mfcc_opts.frame_opts.samp_freq != wave_data.SampFreq())
-        KALDI_ERR << "Sample frequency mismatch: you specified "
-                  << mfcc_opts.frame_opts.samp_freq << " but data has "
-                  << wave_data.SampFreq() << " (use --sample-frequency "
-                  << "option).  Utterance is " << utt;
-
-      SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
-      Matrix<BaseFloat> features;
-      try {
-        mfcc.Compute(waveform, vtln_warp_local, &features, NULL);
-      } catch (...) {
-        KALDI_WARN << "Failed to compute features for utterance "
-                   << utt;
-        continue;
-      }
-      if (subtract_mean) {
-        Vector<BaseFloat> mean(features.NumCols());
-        mean.AddRowSumMat(1.0, features);
-        mean.Scale(1.0 / features.NumRows());
-        for (int32 i = 0; i < features.NumRows(); i++)
-          features.Row(i).AddVec(-1.0, mean);
-      }
-      if (output_format == "kaldi") {
-        kaldi_writer.Write(utt, features);
-      } else {
-        std::pair<Matrix<BaseFloat>, HtkHeader> p;
-        p.first.Resize(features.NumRows(), features.NumCols());
-        p.first.CopyFromMat(features);
-        HtkHeader header = {
-          features.NumRows(),
-          100000,  // 10ms shift
-          static_cast<int16>(sizeof(float)*(features.NumCols())),
-          static_cast<uint16>( 006 | // MFCC
-          (mfcc_opts.use_energy ? 0100 : 020000)) // energy; otherwise c0
-        };
-        p.second = header;
-        htk_writer.Write(utt, p);
-      }
-      if (num_utts % 10 == 0)
-        KALDI_LOG << "Processed " << num_utts << " utterances";
-      KALDI_VLOG(2) << "Processed features for key " << utt;
-      num_success++;
-    }
+    ComputeMfccFunc func(mfcc_opts, channel, min_duration, subtract_mean,
+                         vtln_warp, vtln_map_rspecifier, utt2spk_rspecifier,
+                         &kaldi_writer, &htk_writer);
+    RunTableMap(sequencer_config, &reader, &func);
+
+    int32 num_utts = func.NumUtts(), num_success = func.NumSuccess();
     KALDI_LOG << " Done " << num_success << " out of " << num_utts
               << " utterances.";
     return (num_success != 0 ? 0 : 1);
@@ -68,7 +68,9 @@ int main(int argc, char *argv[]) {
     std::string segments_rxfilename = po.GetArg(2);
     std::string wav_wspecifier = po.GetArg(3);
 
-    RandomAccessTableReader<WaveHolder> reader(wav_rspecifier);
+    // Reads just the segments of the recordings, mapping the wave files
+    // where it can, so that long recordings are not loaded whole.
+    RandomAccessWaveRangeReader reader(wav_rspecifier);
     TableWriter<WaveHolder> writer(wav_wspecifier);
     Input ki(segments_rxfilename);  // no binary argment: never binary.
 
@@ -127,16 +129,14 @@ int main(int argc, char *argv[]) {
         continue;
       }
       
-      const WaveData &wave = reader.Value(recording);
-      const Matrix<BaseFloat> &wave_data = wave.Data();
-      BaseFloat samp_freq = wave.SampFreq();  // read sampling fequency
-      int32 num_samp = wave_data.NumCols(),  // number of samples in recording
-        num_chan = wave_data.NumRows();  // number of channels in recording
+      BaseFloat samp_freq = reader.SampFreq(recording);  // read sampling fequency
+      int64 num_samp = reader.NumSamples(recording);  // number of samples in recording
+      int32 num_chan = reader.NumChannels(recording);  // number of channels in recording
 
       // Convert starting time of the segment to corresponding sample number.
       // If end time is -1 then use the whole file starting from start time.
-      int32 start_samp = start * samp_freq,
-          end_samp = (end != -1)? (end * samp_freq) : num_samp;
+      int64 start_samp = start * samp_freq,
+          end_samp = (end != -1)? static_cast<int64>(end * samp_freq) : num_samp;
       KALDI_ASSERT(start_samp >= 0 && end_samp > 0 && "Invalid start or end.");
 
       // start sample must be less than total number of samples,
@@ -151,7 +151,7 @@ int main(int argc, char *argv[]) {
        */
       if (end_samp > num_samp) {
         if ((end_samp >=
-             num_samp + static_cast<int32>(max_overshoot * samp_freq))) {
+             num_samp + static_cast<int64>(max_overshoot * samp_freq))) {
           KALDI_WARN << "End sample too far out of range " << end_samp
                      << " [length:] " << num_samp << ", skipping segment "
                      << segment;
@@ -161,7 +161,7 @@ int main(int argc, char *argv[]) {
       }
       // Skip if segment size is less than minimum segment length (default 0.1s)
       if (end_samp <=
-          start_samp + static_cast<int32>(min_segment_length * samp_freq)) {
+          start_samp + static_cast<int64>(min_segment_length * samp_freq)) {
         KALDI_WARN << "Segment " << segment << " too short, skipping it.";
         continue;
       }
@@ -185,8 +185,10 @@ int main(int argc, char *argv[]) {
       /*
        * This function  return a portion of a wav data from the orignial wav data matrix 
        */
-      SubMatrix<BaseFloat> segment_matrix(wave_data, channel, 1, start_samp, end_samp-start_samp);
-      WaveData segment_wave(samp_freq, segment_matrix);
+      Matrix<BaseFloat> segment_data;
+      reader.ReadRange(recording, start_samp, end_samp - start_samp,
+                       &segment_data);
+      WaveData segment_wave(samp_freq, segment_data.RowRange(channel, 1));
       writer.Write(segment, segment_wave); // write segment in wave format.
       num_success++;
     }
@@ -0,0 +1,147 @@
+// featbin/wav-resample.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/resample.h"
+#include "feat/wave-reader.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace eesen;
+
+    const char *usage =
+        "Resample wave files to a given sample frequency, e.g. to use 8k, 16k\n"
+        "and 44.1k recordings together.  All the channels are resampled; files\n"
+        "that already have the requested frequency are copied unchanged.\n"
+        "Usage:  wav-resample [options] <wav-rspecifier> <wav-wspecifier>\n"
+        "e.g. wav-resample --sample-frequency=16000 scp:wav.scp ark:- | "
+        "compute-fbank-feats ark:- ark:feats.ark\n"
+        "See also: extract-segments\n";
+
+    ParseOptions po(usage);
+    int32 samp_freq = 16000, num_zeros = 6;
+    BaseFloat lowpass_cutoff = -1.0;
+    po.Register("sample-frequency", &samp_freq,
+                "Sample frequency of the output, in Hz.");
+    po.Register("lowpass-cutoff", &lowpass_cutoff,
+                "Cutoff of the low-pass filter, in Hz; must be less than half "
+                "of the input and output sample frequencies.  If <= 0, "
+                "0.99 times half of the lower of the two is used.");
+    po.Register("num-zeros", &num_zeros,
+                "Width of the filter, in zeros of the sinc function on each "
+                "side; more is sharper but slower.");
+
+    po.Read(argc, argv);
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+    if (samp_freq <= 0 || num_zeros <= 0)
+      KALDI_ERR << "Invalid --sample-frequency or --num-zeros option.";
+
+    std::string wav_rspecifier = po.GetArg(1),
+        wav_wspecifier = po.GetArg(2);
+
+    SequentialTableReader<WaveHolder> reader(wav_rspecifier);
+    TableWriter<WaveHolder> writer(wav_wspecifier);
+
+    // The resamplers for each input frequency we have seen; the filter weights
+    // are computed just once for each.
+    std::map<int32, LinearResample*> resamplers;
+    int32 num_done = 0, num_err = 0, num_resampled = 0;
+    int64 num_clipped = 0;
+
+    for (; !reader.Done(); reader.Next()) {
+      std::string key = reader.Key();
+      const WaveData &wave = reader.Value();
+      int32 samp_freq_in = static_cast<int32>(wave.SampFreq() + 0.5);
+      if (samp_freq_in <= 0 || samp_freq_in != wave.SampFreq()) {
+        KALDI_WARN << "Sample frequency " << wave.SampFreq() << " of "
+                   << key << " is not a positive integer, not resampling it.";
+        num_err++;
+        continue;
+      }
+      if (samp_freq_in == samp_freq) {
+        writer.Write(key, wave);
+        num_done++;
+        continue;
+      }
+
+      LinearResample *resampler = resamplers[samp_freq_in];
+      if (resampler == NULL) {
+        BaseFloat cutoff = lowpass_cutoff;
+        if (cutoff <= 0.0)
+          cutoff = 0.99 * 0.5 * std::min(samp_freq_in, samp_freq);
+        if (cutoff * 2 >= std::min(samp_freq_in, samp_freq))
+          KALDI_ERR << "--lowpass-cutoff=" << cutoff << " is too high for "
+                    << "resampling from " << samp_freq_in << " to "
+                    << samp_freq << " Hz.";
+        resampler = new LinearResample(samp_freq_in, samp_freq, cutoff,
+                                       num_zeros);
+        resamplers[samp_freq_in] = resampler;
+      }
+
+      const Matrix<BaseFloat> &data = wave.Data();
+      Matrix<BaseFloat> resampled;
+      for (int32 c = 0; c < data.NumRows(); c++) {
+        Vector<BaseFloat> channel;
+        resampler->Resample(data.Row(c), true, &channel);
+        if (c == 0)
+          resampled.Resize(data.NumRows(), channel.Dim());
+        resampled.Row(c).CopyFromVec(channel);
+      }
+      if (resampled.NumCols() == 0) {
+        KALDI_WARN << "Wave file " << key << " is too short to resample.";
+        num_err++;
+        continue;
+      }
+      // The filter can overshoot on loud inputs; clip to the 16-bit range
+      // that WaveData::Write() requires.
+      for (int32 r = 0; r < resampled.NumRows(); r++) {
+        BaseFloat *row = resampled.RowData(r);
+        for (int32 i = 0; i < resampled.NumCols(); i++) {
+          if (row[i] > 32767.0) {
+            row[i] = 32767.0;
+            num_clipped++;
+          } else if (row[i] < -32768.0) {
+            row[i] = -32768.0;
+            num_clipped++;
+          }
+        }
+      }
+      writer.Write(key, WaveData(samp_freq, resampled));
+      num_done++;
+      num_resampled++;
+    }
+
+    for (std::map<int32, LinearResample*>::iterator iter = resamplers.begin();
+         iter != resamplers.end(); ++iter)
+      delete iter->second;
+
+    if (num_clipped != 0)
+      KALDI_WARN << "Clipped " << num_clipped << " samples.";
+    KALDI_LOG << "Done " << num_done << " wave files (" << num_resampled
+              << " resampled), " << num_err << " with errors.";
+    return (num_done != 0 ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -253,6 +253,21 @@ bool CacheDeterministicOnDemandFst<Arc>::GetArc(StateId s, Label ilabel,
   }  
 }
 
+template<class Arc>
+typename Arc::Weight ScaleDeterministicOnDemandFst<Arc>::Final(StateId s) {
+  Weight w = det_fst_->Final(s);
+  if (w == Weight::Zero()) return w;
+  return Weight(scale_ * w.Value());
+}
+
+template<class Arc>
+bool ScaleDeterministicOnDemandFst<Arc>::GetArc(StateId s, Label ilabel,
+                                                Arc *oarc) {
+  if (!det_fst_->GetArc(s, ilabel, oarc)) return false;
+  oarc->weight = Weight(scale_ * oarc->weight.Value());
+  return true;
+}
+
 template<class Arc>
 LmExampleDeterministicOnDemandFst<Arc>::LmExampleDeterministicOnDemandFst(
     void *lm, Label bos_symbol, Label eos_symbol):
@@ -212,6 +212,33 @@ class CacheDeterministicOnDemandFst: public DeterministicOnDemandFst<Arc> {
 };
 
 
+/// This class scales the weights of a DeterministicOnDemandFst; with
+/// scale = -1 it can be used to subtract the scores of one language model
+/// when composing it with another (see ComposeDeterministicOnDemandFst).
+template<class Arc>
+class ScaleDeterministicOnDemandFst: public DeterministicOnDemandFst<Arc> {
+ public:
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+  typedef typename Arc::Label Label;
+
+  /// We don't take ownership of this pointer.  The argument is "really" const.
+  ScaleDeterministicOnDemandFst(float scale,
+                                DeterministicOnDemandFst<Arc> *det_fst):
+      scale_(scale), det_fst_(det_fst) { }
+
+  virtual StateId Start() { return det_fst_->Start(); }
+
+  virtual Weight Final(StateId s);
+
+  virtual bool GetArc(StateId s, Label ilabel, Arc *oarc);
+
+ private:
+  float scale_;
+  DeterministicOnDemandFst<Arc> *det_fst_;
+};
+
+
 /// This class is for didactic purposes, it does not really do anything.
 /// It shows how you would wrap a language model.  Note: you should probably
 /// have <s> and </s> not be real words in your LM, but <s> correspond somehow
@@ -0,0 +1,196 @@
+// lat/determinize-lattice-incremental-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lat/determinize-lattice-incremental.h"
+#include "lat/kaldi-lattice.h"
+
+namespace eesen {
+
+// A random lattice with the structure of the lattices of a decoder: tokens on
+// frames 0 ... num_frames (one on frame 0), emitting links from each frame to
+// the next, and epsilon links within a frame (to tokens with higher index).
+struct FrameLattice {
+  struct Link {
+    int32 ilabel, olabel;
+    LatticeWeight weight;
+    int32 token;  // on the next frame if ilabel != 0, else on this frame.
+  };
+  int32 num_frames;
+  std::vector<int32> num_tokens;
+  std::vector<std::vector<std::vector<Link> > > links;  // [frame][token]
+  std::vector<LatticeWeight> final_weights;  // for the tokens on the last frame.
+};
+
+// Random costs with few ties, which could be broken differently.
+static BaseFloat RandCost() { return (Rand() % 100000) / 1024.0; }
+
+static void RandFrameLattice(FrameLattice *lat) {
+  lat->num_frames = 1 + Rand() % 10;
+  lat->num_tokens.resize(lat->num_frames + 1);
+  lat->links.resize(lat->num_frames + 1);
+  for (int32 f = 0; f <= lat->num_frames; f++) {
+    lat->num_tokens[f] = (f == 0 ? 1 : 1 + Rand() % 3);
+    lat->links[f].resize(lat->num_tokens[f]);
+  }
+  for (int32 f = 0; f <= lat->num_frames; f++) {
+    for (int32 i = 0; i < lat->num_tokens[f]; i++) {
+      for (int32 j = i + 1; j < lat->num_tokens[f]; j++) {
+        if (Rand() % 3 != 0) continue;
+        FrameLattice::Link link;
+        link.ilabel = 0;
+        link.olabel = (Rand() % 3 == 0 ? 1 + Rand() % 3 : 0);
+        link.weight = LatticeWeight(RandCost(), 0.0);
+        link.token = j;
+        lat->links[f][i].push_back(link);
+      }
+      if (f == lat->num_frames) continue;
+      for (int32 j = 0; j < lat->num_tokens[f + 1]; j++) {
+        if (Rand() % 2 != 0) continue;
+        FrameLattice::Link link;
+        link.ilabel = 1 + Rand() % 3;
+        link.olabel = (Rand() % 3 == 0 ? 1 + Rand() % 3 : 0);
+        link.weight = LatticeWeight(RandCost(), RandCost());
+        link.token = j;
+        lat->links[f][i].push_back(link);
+      }
+    }
+  }
+  for (int32 i = 0; i < lat->num_tokens[lat->num_frames]; i++)
+    lat->final_weights.push_back(Rand() % 3 == 0 ? LatticeWeight::Zero() :
+                                 LatticeWeight(RandCost(), 0.0));
+}
+
+// Adds arcs for the links out of the tokens on frames begin_frame ...
+// end_frame - 1 to "raw", using the state for each token in "states".
+static void AddFrameLinks(const FrameLattice &lat, int32 begin_frame,
+                          int32 end_frame,
+                          const std::vector<std::vector<int32> > &states,
+                          Lattice *raw) {
+  for (int32 f = begin_frame; f < end_frame; f++) {
+    for (int32 i = 0; i < lat.num_tokens[f]; i++) {
+      for (size_t k = 0; k < lat.links[f][i].size(); k++) {
+        const FrameLattice::Link &link = lat.links[f][i][k];
+        int32 next_frame = (link.ilabel != 0 ? f + 1 : f);
+        raw->AddArc(states[f][i],
+                    LatticeArc(link.ilabel, link.olabel, link.weight,
+                               states[next_frame][link.token]));
+      }
+    }
+  }
+}
+
+static void DeterminizeInOneGo(const FrameLattice &lat, BaseFloat beam,
+                               CompactLattice *clat) {
+  Lattice raw;
+  std::vector<std::vector<int32> > states(lat.num_frames + 1);
+  for (int32 f = 0; f <= lat.num_frames; f++)
+    for (int32 i = 0; i < lat.num_tokens[f]; i++)
+      states[f].push_back(raw.AddState());
+  raw.SetStart(states[0][0]);
+  AddFrameLinks(lat, 0, lat.num_frames + 1, states, &raw);
+  for (int32 i = 0; i < lat.num_tokens[lat.num_frames]; i++)
+    raw.SetFinal(states[lat.num_frames][i], lat.final_weights[i]);
+  fst::Connect(&raw);
+  fst::DeterminizeLatticePhonePrunedWrapper(&raw, beam, clat);
+}
+
+static void DeterminizeInChunks(const FrameLattice &lat, BaseFloat beam,
+                                CompactLattice *clat) {
+  typedef LatticeIncrementalDeterminizer::Label Label;
+  typedef LatticeIncrementalDeterminizer::StateId StateId;
+  LatticeIncrementalDeterminizer determinizer(
+      beam, fst::DeterminizeLatticePhonePrunedOptions());
+  // Random chunk boundaries.
+  std::vector<int32> boundaries;
+  for (int32 f = 1; f < lat.num_frames; f++)
+    if (Rand() % 2 == 0) boundaries.push_back(f);
+  boundaries.push_back(lat.num_frames);
+
+  int32 begin_frame = 0;
+  std::vector<Label> prev_labels;  // token labels on begin_frame.
+  for (size_t c = 0; c < boundaries.size(); c++) {
+    int32 end_frame = boundaries[c];
+    bool is_last = (c + 1 == boundaries.size());
+    Lattice raw;
+    unordered_map<Label, StateId> token_label2state;
+    determinizer.InitializeRawLatticeChunk(&raw, &token_label2state);
+    std::vector<std::vector<int32> > states(lat.num_frames + 1);
+    for (int32 f = begin_frame; f <= end_frame; f++) {
+      for (int32 i = 0; i < lat.num_tokens[f]; i++) {
+        StateId s = fst::kNoStateId;
+        if (f == begin_frame && c > 0) {
+          unordered_map<Label, StateId>::const_iterator iter =
+              token_label2state.find(prev_labels[i]);
+          if (iter != token_label2state.end()) s = iter->second;
+        }
+        states[f].push_back(s != fst::kNoStateId ? s : raw.AddState());
+      }
+    }
+    if (c == 0) raw.SetStart(states[0][0]);
+    AddFrameLinks(lat, begin_frame, (is_last ? end_frame + 1 : end_frame),
+                  states, &raw);
+    unordered_map<Label, BaseFloat> token_label2final_cost;
+    prev_labels.clear();
+    if (is_last) {
+      for (int32 i = 0; i < lat.num_tokens[end_frame]; i++)
+        raw.SetFinal(states[end_frame][i], lat.final_weights[i]);
+    } else {
+      // The final costs only affect pruning, so they can be anything here.
+      StateId final_state = raw.AddState();
+      raw.SetFinal(final_state, LatticeWeight::One());
+      for (int32 i = 0; i < lat.num_tokens[end_frame]; i++) {
+        Label label = LatticeIncrementalDeterminizer::kTokenLabelOffset + i;
+        BaseFloat final_cost = RandCost() - 50.0;
+        token_label2final_cost[label] = final_cost;
+        prev_labels.push_back(label);
+        raw.AddArc(states[end_frame][i],
+                   LatticeArc(0, label, LatticeWeight(final_cost, 0.0),
+                              final_state));
+      }
+    }
+    determinizer.AcceptRawLatticeChunk(&raw, token_label2final_cost);
+    begin_frame = end_frame;
+  }
+  *clat = determinizer.GetDeterminizedLattice();
+  fst::Connect(clat);
+}
+
+// Checks that determinizing in chunks gives the same lattice as determinizing
+// all of it (with a beam large enough that nothing is pruned).
+void TestDeterminizeLatticeIncremental() {
+  for (int32 i = 0; i < 200; i++) {
+    FrameLattice lat;
+    RandFrameLattice(&lat);
+    BaseFloat beam = 1.0e+06;
+    CompactLattice clat1, clat2;
+    DeterminizeInOneGo(lat, beam, &clat1);
+    DeterminizeInChunks(lat, beam, &clat2);
+    KALDI_ASSERT(clat2.Properties(fst::kIDeterministic, true) &
+                 fst::kIDeterministic);
+    KALDI_ASSERT((clat1.NumStates() == 0) == (clat2.NumStates() == 0));
+    if (clat1.NumStates() != 0)
+      KALDI_ASSERT(fst::RandEquivalent(clat1, clat2, 5, 0.01, Rand(), 100));
+  }
+}
+
+}  // namespace eesen
+
+int main() {
+  using namespace eesen;
+  TestDeterminizeLatticeIncremental();
+  std::cout << "Test OK\n";
+}
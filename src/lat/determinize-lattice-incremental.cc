@@ -0,0 +1,305 @@
+// lat/determinize-lattice-incremental.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <limits>
+
+#include "lat/determinize-lattice-incremental.h"
+#include "util/stl-utils.h"
+
+namespace eesen {
+
+const LatticeIncrementalDeterminizer::Label
+LatticeIncrementalDeterminizer::kTokenLabelOffset;
+const LatticeIncrementalDeterminizer::Label
+LatticeIncrementalDeterminizer::kStateLabelOffset;
+
+LatticeIncrementalDeterminizer::LatticeIncrementalDeterminizer(
+    BaseFloat lattice_beam,
+    const fst::DeterminizeLatticePhonePrunedOptions &det_opts):
+    lattice_beam_(lattice_beam), det_opts_(det_opts) {
+  // Pushing and minimizing would move weights and strings across the arcs
+  // with state labels and token labels; the caller can do it at the end.
+  det_opts_.minimize = false;
+  Init();
+}
+
+void LatticeIncrementalDeterminizer::Init() {
+  clat_.DeleteStates();
+  final_state_ = fst::kNoStateId;
+  final_arc_sources_.clear();
+  preds_.clear();
+  forward_costs_.clear();
+  free_states_.clear();
+  token_label2final_cost_.clear();
+  failed_ = false;
+  redet_states_.clear();
+  is_redet_.clear();
+  boundary_states_.clear();
+  redeterminize_all_ = false;
+}
+
+LatticeIncrementalDeterminizer::StateId
+LatticeIncrementalDeterminizer::NewState() {
+  if (!free_states_.empty()) {
+    StateId s = free_states_.back();
+    free_states_.pop_back();
+    return s;
+  }
+  preds_.resize(preds_.size() + 1);
+  forward_costs_.push_back(std::numeric_limits<BaseFloat>::infinity());
+  return clat_.AddState();
+}
+
+void LatticeIncrementalDeterminizer::FreeState(StateId s) {
+  clat_.DeleteArcs(s);
+  clat_.SetFinal(s, CompactLatticeWeight::Zero());
+  preds_[s].clear();
+  forward_costs_[s] = std::numeric_limits<BaseFloat>::infinity();
+  free_states_.push_back(s);
+}
+
+LatticeIncrementalDeterminizer::StateId
+LatticeIncrementalDeterminizer::GetRawState(
+    StateId s, unordered_map<StateId, StateId> *state_map, Lattice *olat) {
+  unordered_map<StateId, StateId>::const_iterator iter = state_map->find(s);
+  if (iter != state_map->end()) return iter->second;
+  StateId ans = olat->AddState();
+  (*state_map)[s] = ans;
+  return ans;
+}
+
+void LatticeIncrementalDeterminizer::AddRawPath(
+    StateId src, Label word, const LatticeWeight &weight,
+    const std::vector<int32> &string, StateId dest, Lattice *olat) {
+  if (string.empty()) {
+    olat->AddArc(src, LatticeArc(0, word, weight, dest));
+    return;
+  }
+  StateId cur = src;
+  for (size_t i = 0; i < string.size(); i++) {
+    StateId next = (i + 1 == string.size() ? dest : olat->AddState());
+    olat->AddArc(cur, LatticeArc(string[i], (i == 0 ? word : 0),
+                                 (i == 0 ? weight : LatticeWeight::One()),
+                                 next));
+    cur = next;
+  }
+}
+
+void LatticeIncrementalDeterminizer::InitializeRawLatticeChunk(
+    Lattice *olat, unordered_map<Label, StateId> *token_label2state) {
+  olat->DeleteStates();
+  token_label2state->clear();
+  redet_states_.clear();
+  boundary_states_.clear();
+  redeterminize_all_ = false;
+  if (clat_.Start() == fst::kNoStateId)
+    return;  // The first chunk, or the lattice became empty.
+
+  // The states to determinize again are those with final-arcs and all states
+  // reachable from them: the new frames may add to the set of raw states
+  // that each of them stands for.
+  if (is_redet_.size() < static_cast<size_t>(clat_.NumStates()))
+    is_redet_.resize(clat_.NumStates(), false);
+  std::vector<StateId> queue(final_arc_sources_);
+  while (!queue.empty()) {
+    StateId s = queue.back();
+    queue.pop_back();
+    if (is_redet_[s]) continue;
+    is_redet_[s] = true;
+    redet_states_.push_back(s);
+    for (fst::ArcIterator<CompactLattice> aiter(clat_, s); !aiter.Done();
+         aiter.Next()) {
+      StateId next = aiter.Value().nextstate;
+      if (next != final_state_ && !is_redet_[next])
+        queue.push_back(next);
+    }
+  }
+  std::sort(redet_states_.begin(), redet_states_.end());
+  redeterminize_all_ = is_redet_[clat_.Start()];
+
+  unordered_map<StateId, StateId> state_map;  // from clat_ to olat.
+  if (redeterminize_all_) {
+    olat->SetStart(GetRawState(clat_.Start(), &state_map, olat));
+  } else {
+    StateId start = olat->AddState();
+    olat->SetStart(start);
+    for (size_t i = 0; i < redet_states_.size(); i++) {
+      const std::vector<StateId> &preds = preds_[redet_states_[i]];
+      for (size_t j = 0; j < preds.size(); j++)
+        if (!is_redet_[preds[j]]) boundary_states_.push_back(preds[j]);
+    }
+    SortAndUniq(&boundary_states_);
+    // Each boundary state is reached from the start state by an arc with its
+    // state label; the weight is its forward cost, so that the pruning in
+    // determinization sees the real costs.  Its arcs into the part that is
+    // determinized again are copied.
+    for (size_t i = 0; i < boundary_states_.size(); i++) {
+      StateId s = boundary_states_[i], raw_s = GetRawState(s, &state_map, olat);
+      olat->AddArc(start, LatticeArc(0, kStateLabelOffset + s,
+                                     LatticeWeight(forward_costs_[s], 0.0),
+                                     raw_s));
+      for (fst::ArcIterator<CompactLattice> aiter(clat_, s); !aiter.Done();
+           aiter.Next()) {
+        const CompactLatticeArc &arc = aiter.Value();
+        if (is_redet_[arc.nextstate])
+          AddRawPath(raw_s, arc.ilabel, arc.weight.Weight(),
+                     arc.weight.String(),
+                     GetRawState(arc.nextstate, &state_map, olat), olat);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < redet_states_.size(); i++) {
+    StateId s = redet_states_[i], raw_s = GetRawState(s, &state_map, olat);
+    KALDI_ASSERT(clat_.Final(s) == CompactLatticeWeight::Zero());
+    for (fst::ArcIterator<CompactLattice> aiter(clat_, s); !aiter.Done();
+         aiter.Next()) {
+      const CompactLatticeArc &arc = aiter.Value();
+      if (arc.nextstate == final_state_) {
+        // A final-arc: it leads to the token, without the final cost that
+        // was added for pruning.
+        Label token_label = arc.ilabel;
+        unordered_map<Label, BaseFloat>::const_iterator iter =
+            token_label2final_cost_.find(token_label);
+        if (iter == token_label2final_cost_.end())
+          KALDI_ERR << "No final cost for token label " << token_label;
+        StateId token_state;
+        unordered_map<Label, StateId>::const_iterator titer =
+            token_label2state->find(token_label);
+        if (titer == token_label2state->end()) {
+          token_state = olat->AddState();
+          (*token_label2state)[token_label] = token_state;
+        } else {
+          token_state = titer->second;
+        }
+        const LatticeWeight &weight = arc.weight.Weight();
+        AddRawPath(raw_s, 0,
+                   LatticeWeight(weight.Value1() - iter->second,
+                                 weight.Value2()),
+                   arc.weight.String(), token_state, olat);
+      } else {
+        AddRawPath(raw_s, arc.ilabel, arc.weight.Weight(),
+                   arc.weight.String(),
+                   GetRawState(arc.nextstate, &state_map, olat), olat);
+      }
+    }
+  }
+}
+
+bool LatticeIncrementalDeterminizer::AcceptRawLatticeChunk(
+    Lattice *raw_fst,
+    const unordered_map<Label, BaseFloat> &token_label2final_cost) {
+  if (failed_) return false;
+  CompactLattice chunk_clat;
+  bool ans = fst::DeterminizeLatticePhonePrunedWrapper(
+      raw_fst, lattice_beam_, &chunk_clat, det_opts_);
+  // (the wrapper calls Connect() on the output.)
+  if (chunk_clat.Start() == fst::kNoStateId) {
+    KALDI_WARN << "Lattice became empty during incremental determinization.";
+    Init();
+    failed_ = true;
+    return false;
+  }
+  if (!fst::TopSort(&chunk_clat))
+    KALDI_ERR << "Cycles in determinized lattice.";
+
+  StateId chunk_start = chunk_clat.Start(),
+      num_chunk_states = chunk_clat.NumStates();
+  // Maps each state of chunk_clat to a state of clat_.
+  std::vector<StateId> state_map(num_chunk_states, fst::kNoStateId);
+  bool replace_all = (clat_.Start() == fst::kNoStateId || redeterminize_all_);
+  if (replace_all) {
+    clat_.DeleteStates();
+    preds_.clear();
+    forward_costs_.clear();
+    free_states_.clear();
+    is_redet_.clear();
+    for (StateId s = 0; s < num_chunk_states; s++)
+      state_map[s] = NewState();
+    clat_.SetStart(state_map[chunk_start]);
+    forward_costs_[state_map[chunk_start]] = 0.0;
+  } else {
+    // The states that were determinized again are replaced by the states of
+    // the chunk, and the arcs of the boundary states into them by the arcs
+    // out of the states the start state's arcs lead to.
+    for (size_t i = 0; i < boundary_states_.size(); i++) {
+      StateId s = boundary_states_[i];
+      std::vector<CompactLatticeArc> arcs;
+      for (fst::ArcIterator<CompactLattice> aiter(clat_, s); !aiter.Done();
+           aiter.Next())
+        if (!is_redet_[aiter.Value().nextstate])
+          arcs.push_back(aiter.Value());
+      clat_.DeleteArcs(s);
+      for (size_t j = 0; j < arcs.size(); j++)
+        clat_.AddArc(s, arcs[j]);
+    }
+    for (size_t i = 0; i < redet_states_.size(); i++) {
+      FreeState(redet_states_[i]);
+      is_redet_[redet_states_[i]] = false;
+    }
+    if (final_state_ != fst::kNoStateId)
+      FreeState(final_state_);
+
+    KALDI_ASSERT(chunk_clat.Final(chunk_start) ==
+                 CompactLatticeWeight::Zero());
+    for (fst::ArcIterator<CompactLattice> aiter(chunk_clat, chunk_start);
+         !aiter.Done(); aiter.Next()) {
+      const CompactLatticeArc &arc = aiter.Value();
+      KALDI_ASSERT(arc.ilabel >= kStateLabelOffset &&
+                   arc.weight.String().empty());
+      state_map[arc.nextstate] = arc.ilabel - kStateLabelOffset;
+    }
+    for (StateId s = 0; s < num_chunk_states; s++)
+      if (s != chunk_start && state_map[s] == fst::kNoStateId)
+        state_map[s] = NewState();
+  }
+
+  // chunk_clat is topologically sorted, so the forward costs can be worked
+  // out in this order.
+  final_state_ = fst::kNoStateId;
+  final_arc_sources_.clear();
+  for (StateId s = 0; s < num_chunk_states; s++) {
+    if (s == chunk_start && !replace_all) continue;
+    StateId src = state_map[s];
+    if (chunk_clat.Final(s) != CompactLatticeWeight::Zero())
+      clat_.SetFinal(src, chunk_clat.Final(s));
+    for (fst::ArcIterator<CompactLattice> aiter(chunk_clat, s); !aiter.Done();
+         aiter.Next()) {
+      CompactLatticeArc arc = aiter.Value();
+      StateId dest = state_map[arc.nextstate];
+      arc.nextstate = dest;
+      clat_.AddArc(src, arc);
+      preds_[dest].push_back(src);
+      const LatticeWeight &weight = arc.weight.Weight();
+      forward_costs_[dest] = std::min(
+          forward_costs_[dest],
+          forward_costs_[src] + weight.Value1() + weight.Value2());
+      if (arc.ilabel >= kTokenLabelOffset && arc.ilabel < kStateLabelOffset) {
+        KALDI_ASSERT(final_state_ == fst::kNoStateId || final_state_ == dest);
+        final_state_ = dest;
+        final_arc_sources_.push_back(src);
+      }
+    }
+  }
+  token_label2final_cost_ = token_label2final_cost;
+  redet_states_.clear();
+  boundary_states_.clear();
+  return ans;
+}
+
+}  // namespace eesen
@@ -0,0 +1,147 @@
+// lat/determinize-lattice-incremental.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_LAT_DETERMINIZE_LATTICE_INCREMENTAL_H_
+#define KALDI_LAT_DETERMINIZE_LATTICE_INCREMENTAL_H_
+
+#include <vector>
+
+#include "lat/kaldi-lattice.h"
+#include "lat/determinize-lattice-pruned.h"
+
+namespace eesen {
+
+/**
+   LatticeIncrementalDeterminizer determinizes the lattice of an utterance in
+   chunks of frames, as they are decoded, so that when the utterance ends only
+   the last chunk has to be determinized.  The result is the same as
+   determinizing the whole raw lattice with
+   DeterminizeLatticePhonePrunedWrapper() (except for the effects of pruning).
+
+   The caller (normally the decoder) builds the raw lattice of each chunk: the
+   tokens on frames begin..end, and the links out of the tokens on frames
+   begin..end-1 (begin..end for the last chunk).  Except for the last chunk,
+   each token on the end frame gets an arc to a single extra final state, with
+   a "token label" (kTokenLabelOffset plus a number) as its word label; the
+   determinized lattice then ends in arcs with token labels ("final-arcs").
+
+   When the next chunk is added, the states of the determinized lattice that
+   the new frames could change have to be determinized again: those with
+   final-arcs and all states reachable from them.  InitializeRawLatticeChunk()
+   copies them into the raw lattice of the new chunk, with their final-arcs
+   leading to the raw states of the corresponding tokens.  The states with arcs
+   into this part are represented by arcs from the start state with "state
+   labels" (kStateLabelOffset plus the state); after determinization these
+   tell us where to attach the new part.  The work per chunk is proportional to
+   the size of the chunk plus the part that is determinized again, which is
+   normally little more than the words that are still in progress.
+*/
+class LatticeIncrementalDeterminizer {
+ public:
+  typedef LatticeArc::StateId StateId;
+  typedef LatticeArc::Label Label;
+
+  // Both of these must be larger than any word label.
+  static const Label kTokenLabelOffset = 100000000;
+  static const Label kStateLabelOffset = 200000000;
+
+  LatticeIncrementalDeterminizer(
+      BaseFloat lattice_beam,
+      const fst::DeterminizeLatticePhonePrunedOptions &det_opts);
+
+  /// Starts a new utterance.
+  void Init();
+
+  /// Starts the raw lattice of the next chunk in *olat.  For the first chunk
+  /// this leaves *olat empty, and the caller sets the start state.
+  /// Otherwise it adds the start state and the part of the determinized
+  /// lattice that is determinized again; "token_label2state" is set to the
+  /// state for each token label on its final-arcs, which the caller should
+  /// use for the corresponding token.  (Tokens without one cannot be reached
+  /// in this chunk.)
+  void InitializeRawLatticeChunk(
+      Lattice *olat, unordered_map<Label, StateId> *token_label2state);
+
+  /// Determinizes the raw lattice of a chunk and adds it to the determinized
+  /// lattice.  "token_label2final_cost" gives, for each token label on the
+  /// arcs to the extra final state, the graph cost of that arc; it is empty
+  /// for the last chunk, where the tokens have their final-probs instead.
+  /// These costs are only used for pruning: they should approximate the cost
+  /// from the token to the end of the utterance (up to a constant).  Returns
+  /// false if determinization terminated earlier than the beam, or if the
+  /// lattice became empty.  Modifies "raw_fst".
+  bool AcceptRawLatticeChunk(
+      Lattice *raw_fst,
+      const unordered_map<Label, BaseFloat> &token_label2final_cost);
+
+  /// Returns the determinized lattice so far.  Until the last chunk has been
+  /// added it ends in final-arcs.  It may contain states that are not
+  /// reachable; call Connect() on a copy.
+  const CompactLattice &GetDeterminizedLattice() const { return clat_; }
+
+ private:
+  // Returns a new state of clat_, reusing a free one if there is one.
+  StateId NewState();
+
+  // Removes the arcs and final-prob of state s of clat_ and puts it on the
+  // list of free states.
+  void FreeState(StateId s);
+
+  // Returns the state in "olat" for state s of clat_, adding it if needed.
+  StateId GetRawState(StateId s, unordered_map<StateId, StateId> *state_map,
+                      Lattice *olat);
+
+  // Adds to "olat" a path from "src" to "dest" that is equivalent to an arc
+  // of a CompactLattice with word "word", weight "weight" and string
+  // "string": one arc per transition-id, the first one with the word and the
+  // weight.
+  static void AddRawPath(StateId src, Label word, const LatticeWeight &weight,
+                         const std::vector<int32> &string, StateId dest,
+                         Lattice *olat);
+
+  BaseFloat lattice_beam_;
+  fst::DeterminizeLatticePhonePrunedOptions det_opts_;
+
+  // The determinized lattice.  Its final-arcs all go to final_state_.
+  CompactLattice clat_;
+  StateId final_state_;  // kNoStateId if there are no final-arcs.
+  // The states with final-arcs (may contain repeats).
+  std::vector<StateId> final_arc_sources_;
+  // For each state of clat_, the states with arcs to it (may contain
+  // repeats), and the cost of the best path to it.
+  std::vector<std::vector<StateId> > preds_;
+  std::vector<BaseFloat> forward_costs_;
+  // States of clat_ that are not in use.
+  std::vector<StateId> free_states_;
+  // The token_label2final_cost given with the last chunk.
+  unordered_map<Label, BaseFloat> token_label2final_cost_;
+  // Set if the lattice became empty; then nothing more is done.
+  bool failed_;
+
+  // The following are set by InitializeRawLatticeChunk() for
+  // AcceptRawLatticeChunk(): the states that are determinized again, which
+  // are marked in is_redet_; the other states with arcs to them; and whether
+  // the start state is one of them (then the whole lattice is replaced).
+  std::vector<StateId> redet_states_;
+  std::vector<bool> is_redet_;
+  std::vector<StateId> boundary_states_;
+  bool redeterminize_all_;
+};
+
+}  // namespace eesen
+
+#endif  // KALDI_LAT_DETERMINIZE_LATTICE_INCREMENTAL_H_
@@ -154,6 +154,74 @@ void TestLatticeTableCross(bool binary) {
   }
 }
 
+// Writes CompactLattice in the compact encoding; reads it back as
+// CompactLattice and as Lattice.
+void TestCompactLatticeTableEncoded(bool float16_weights) {
+  CompactLatticeWriteOptions write_opts;
+  write_opts.compact = true;
+  write_opts.float16_weights = float16_weights;
+  SetCompactLatticeWriteOptions(write_opts);
+
+  CompactLatticeWriter writer("ark:tmpf");
+  int N = 10;
+  std::vector<CompactLattice*> lat_vec(N);
+  for (int i = 0; i < N; i++) {
+    char buf[2];
+    buf[0] = '0' + i;
+    buf[1] = '\0';
+    std::string key = "key" + std::string(buf);
+    CompactLattice *fst = RandCompactLattice();
+    // The encoding renumbers the states in topological order, so sort them
+    // first to be able to compare with fst::Equal() (this fails, leaving the
+    // FST unchanged, if it is cyclic, and then the numbering is kept).  The
+    // weights of the random lattices are exact in half precision.
+    fst::TopSort(fst);
+    lat_vec[i] = fst;
+    writer.Write(key, *fst);
+  }
+  writer.Close();
+  SetCompactLatticeWriteOptions(CompactLatticeWriteOptions());
+
+  RandomAccessCompactLatticeReader reader("ark:tmpf");
+  RandomAccessLatticeReader lattice_reader("ark:tmpf");
+  for (int i = 0; i < N; i++) {
+    char buf[2];
+    buf[0] = '0' + i;
+    buf[1] = '\0';
+    std::string key = "key" + std::string(buf);
+    const CompactLattice &fst = reader.Value(key);
+    KALDI_ASSERT(fst::Equal(fst, *(lat_vec[i])));
+    CompactLattice fst2;
+    ConvertLattice(lattice_reader.Value(key), &fst2);
+    KALDI_ASSERT(fst::Equal(fst2, *(lat_vec[i])));
+    delete lat_vec[i];
+  }
+}
+
+// A lattice with states but no start state: no state is reached when the
+// encoding sorts them, so it must keep their numbering.
+void TestCompactLatticeEncodedNoStart() {
+  CompactLatticeWriteOptions write_opts;
+  write_opts.compact = true;
+  SetCompactLatticeWriteOptions(write_opts);
+
+  CompactLattice *fst = RandCompactLattice();
+  // An arc to an earlier state, so that it isn't known to be sorted.
+  CompactLatticeArc::StateId s1 = fst->AddState(), s2 = fst->AddState();
+  fst->AddArc(s2, CompactLatticeArc(1, 1, CompactLatticeWeight::One(), s1));
+  fst->SetStart(fst::kNoStateId);
+  KALDI_ASSERT(fst->Properties(fst::kTopSorted, false) == 0);
+  {
+    CompactLatticeWriter writer("ark:tmpf");
+    writer.Write("key", *fst);
+  }
+  SetCompactLatticeWriteOptions(CompactLatticeWriteOptions());
+
+  SequentialCompactLatticeReader reader("ark:tmpf");
+  KALDI_ASSERT(!reader.Done() && reader.Key() == "key");
+  KALDI_ASSERT(fst::Equal(reader.Value(), *fst));
+  delete fst;
+}
 
 
 } // end namespace eesen
@@ -167,6 +235,10 @@ int main() {
     TestLatticeTable(binary);
     TestLatticeTableCross(binary);
   }
+  TestCompactLatticeTableEncoded(false);
+  TestCompactLatticeTableEncoded(true);
+  for (int i = 0; i < 5; i++)
+    TestCompactLatticeEncodedNoStart();
   std::cout << "Test OK\n";
   
   unlink("tmpf");
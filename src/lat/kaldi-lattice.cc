@@ -59,9 +59,350 @@ Lattice* ConvertToLattice(Lattice *ifst) {
 }
 
 
+// The options used by WriteCompactLattice() in binary mode; see
+// SetCompactLatticeWriteOptions().
+static CompactLatticeWriteOptions g_compact_lattice_write_opts;
+
+void SetCompactLatticeWriteOptions(const CompactLatticeWriteOptions &opts) {
+  g_compact_lattice_write_opts = opts;
+}
+
+/* The compact lattice encoding (see WriteCompactLatticeEncoded()) is: the
+   token "<CompactLattice>", a byte of flags (kCompactLatticeFloat16), the size
+   in bytes of the rest as a varint, and then, with all integers stored as
+   varints (7 bits per byte, least significant first):
+     num-states, start-state + 1 (0 if there is none), and for each state:
+       2 * num-arcs + is-final,
+       [if final] the final-weight,
+       for each arc: 2 * ilabel + (olabel != ilabel), [olabel if different],
+                     the zigzag-coded difference nextstate - state,
+                     and the weight.
+   A weight is Value1() and Value2() as 32-bit or 16-bit floats, then the
+   number of runs of identical transition-ids in the string, then for each run
+   the transition-id and the length of the run.
+*/
+static const char kCompactLatticeFloat16 = 1;
+
+static inline void PutVarint(uint64 value, std::string *buf) {
+  while (value >= 128) {
+    buf->push_back(static_cast<char>((value & 127) | 128));
+    value >>= 7;
+  }
+  buf->push_back(static_cast<char>(value));
+}
+
+static inline bool GetVarint(const char **pos, const char *end,
+                             uint64 *value) {
+  uint64 ans = 0;
+  for (int32 shift = 0; shift < 64; shift += 7) {
+    if (*pos == end) return false;
+    unsigned char c = static_cast<unsigned char>(*((*pos)++));
+    ans |= static_cast<uint64>(c & 127) << shift;
+    if ((c & 128) == 0) {
+      *value = ans;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads a varint that must fit in 32 bits (e.g. a label, which is stored as
+// unsigned).
+static inline bool GetVarint32(const char **pos, const char *end,
+                               uint32 *value) {
+  uint64 v;
+  if (!GetVarint(pos, end, &v) || v > 0xFFFFFFFFu) return false;
+  *value = static_cast<uint32>(v);
+  return true;
+}
+
+// Shifts right by <shift> bits (1 <= shift < 32), rounding to nearest, ties
+// to even.
+static inline uint32 ShiftRightRoundEven(uint32 v, int32 shift) {
+  uint32 half = 1u << (shift - 1), rem = v & ((1u << shift) - 1),
+      ans = v >> shift;
+  if (rem > half || (rem == half && (ans & 1) != 0)) ans++;
+  return ans;
+}
+
+// Converts to IEEE half precision, rounding to nearest; values too large
+// become infinity (see FitsInFloat16()).
+static uint16 FloatToHalf(float f) {
+  uint32 x;
+  memcpy(&x, &f, sizeof(x));
+  uint32 sign = (x >> 16) & 0x8000, mantissa = x & 0x7fffff;
+  int32 float_exponent = (x >> 23) & 0xff;
+  if (float_exponent == 0xff)  // inf or NaN.
+    return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+  int32 exponent = float_exponent - 127 + 15;
+  if (exponent >= 31) return sign | 0x7c00;
+  if (exponent <= 0) {  // zero or subnormal in half precision.
+    if (exponent < -10) return sign;
+    return sign | ShiftRightRoundEven(mantissa | 0x800000, 14 - exponent);
+  }
+  // If rounding the mantissa carries, it correctly increments the exponent.
+  return sign + (static_cast<uint32>(exponent) << 10) +
+      ShiftRightRoundEven(mantissa, 13);
+}
+
+static float HalfToFloat(uint16 h) {
+  uint32 sign = static_cast<uint32>(h & 0x8000) << 16,
+      mantissa = h & 0x3ff, x;
+  int32 exponent = (h >> 10) & 0x1f;
+  if (exponent == 0) {  // zero or subnormal; this is exact.
+    float f = std::ldexp(static_cast<float>(mantissa), -24);
+    return (sign != 0 ? -f : f);
+  } else if (exponent == 31) {
+    x = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    x = sign | (static_cast<uint32>(exponent + 127 - 15) << 23) |
+        (mantissa << 13);
+  }
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// True if f is not changed to infinity by FloatToHalf().
+static inline bool FitsInFloat16(float f) {
+  return KALDI_ISINF(f) || KALDI_ISNAN(f) || std::fabs(f) < 65520.0f;
+}
+
+static bool WeightFitsInFloat16(const CompactLatticeWeight &w) {
+  return FitsInFloat16(w.Weight().Value1()) &&
+      FitsInFloat16(w.Weight().Value2());
+}
+
+static void PutFloat(float f, bool float16, std::string *buf) {
+  if (float16) {
+    uint16 h = FloatToHalf(f);
+    buf->append(reinterpret_cast<const char*>(&h), sizeof(h));
+  } else {
+    buf->append(reinterpret_cast<const char*>(&f), sizeof(f));
+  }
+}
+
+static bool GetFloat(const char **pos, const char *end, bool float16,
+                     float *f) {
+  if (float16) {
+    uint16 h;
+    if (end - *pos < static_cast<ptrdiff_t>(sizeof(h))) return false;
+    memcpy(&h, *pos, sizeof(h));
+    *pos += sizeof(h);
+    *f = HalfToFloat(h);
+  } else {
+    if (end - *pos < static_cast<ptrdiff_t>(sizeof(*f))) return false;
+    memcpy(f, *pos, sizeof(*f));
+    *pos += sizeof(*f);
+  }
+  return true;
+}
+
+static void PutWeight(const CompactLatticeWeight &w, bool float16,
+                      std::string *buf) {
+  PutFloat(w.Weight().Value1(), float16, buf);
+  PutFloat(w.Weight().Value2(), float16, buf);
+  const std::vector<int32> &str = w.String();
+  size_t num_runs = 0;
+  for (size_t i = 0; i < str.size(); i++)
+    if (i == 0 || str[i] != str[i - 1]) num_runs++;
+  PutVarint(num_runs, buf);
+  for (size_t i = 0; i < str.size(); ) {
+    size_t j = i + 1;
+    while (j < str.size() && str[j] == str[i]) j++;
+    PutVarint(static_cast<uint32>(str[i]), buf);
+    PutVarint(j - i, buf);
+    i = j;
+  }
+}
+
+static bool GetWeight(const char **pos, const char *end, bool float16,
+                      CompactLatticeWeight *w) {
+  float value1, value2;
+  uint64 num_runs;
+  if (!GetFloat(pos, end, float16, &value1) ||
+      !GetFloat(pos, end, float16, &value2) ||
+      !GetVarint(pos, end, &num_runs) ||
+      num_runs > static_cast<uint64>(end - *pos))
+    return false;
+  std::vector<int32> str;
+  for (uint64 r = 0; r < num_runs; r++) {
+    uint32 value, length;
+    if (!GetVarint32(pos, end, &value) || !GetVarint32(pos, end, &length) ||
+        length == 0 || str.size() + length > 0x7FFFFFFFu)
+      return false;
+    str.insert(str.end(), length, static_cast<int32>(value));
+  }
+  *w = CompactLatticeWeight(LatticeWeight(value1, value2), str);
+  return true;
+}
+
+bool WriteCompactLatticeEncoded(std::ostream &os, const CompactLattice &clat,
+                                bool float16_weights) {
+  typedef CompactLatticeArc::StateId StateId;
+  StateId num_states = clat.NumStates();
+
+  // new_state[s] is the number of state s in the output: its position in
+  // topological order, so that most next-states are just after the state.
+  std::vector<StateId> new_state;
+  bool acyclic = false;
+  if (clat.Properties(fst::kTopSorted, false) == 0) {
+    fst::TopOrderVisitor<CompactLatticeArc> visitor(&new_state, &acyclic);
+    fst::DfsVisit(clat, &visitor);
+  }
+  // Keep the numbering if the lattice is already sorted or is cyclic, or if
+  // the visitor did not number all the states (with no start state, DfsVisit()
+  // visits none).
+  if (!acyclic || static_cast<StateId>(new_state.size()) != num_states) {
+    new_state.resize(num_states);
+    for (StateId s = 0; s < num_states; s++) new_state[s] = s;
+  }
+  std::vector<StateId> old_state(num_states);
+  for (StateId s = 0; s < num_states; s++) old_state[new_state[s]] = s;
+
+  // Half precision is only used if no weight would overflow.
+  if (float16_weights) {
+    for (StateId s = 0; s < num_states && float16_weights; s++) {
+      if (!WeightFitsInFloat16(clat.Final(s))) float16_weights = false;
+      for (fst::ArcIterator<CompactLattice> aiter(clat, s);
+           !aiter.Done() && float16_weights; aiter.Next())
+        if (!WeightFitsInFloat16(aiter.Value().weight))
+          float16_weights = false;
+    }
+  }
+
+  std::string buf;
+  PutVarint(num_states, &buf);
+  PutVarint(clat.Start() == fst::kNoStateId ? 0 : new_state[clat.Start()] + 1,
+            &buf);
+  for (StateId n = 0; n < num_states; n++) {
+    StateId s = old_state[n];
+    CompactLatticeWeight final_weight = clat.Final(s);
+    bool is_final = (final_weight != CompactLatticeWeight::Zero());
+    PutVarint(2 * static_cast<uint64>(clat.NumArcs(s)) + (is_final ? 1 : 0),
+              &buf);
+    if (is_final) PutWeight(final_weight, float16_weights, &buf);
+    for (fst::ArcIterator<CompactLattice> aiter(clat, s); !aiter.Done();
+         aiter.Next()) {
+      const CompactLatticeArc &arc = aiter.Value();
+      bool same_labels = (arc.ilabel == arc.olabel);
+      PutVarint(2 * static_cast<uint64>(static_cast<uint32>(arc.ilabel)) +
+                (same_labels ? 0 : 1), &buf);
+      if (!same_labels) PutVarint(static_cast<uint32>(arc.olabel), &buf);
+      int64 diff = static_cast<int64>(new_state[arc.nextstate]) - n;
+      PutVarint(diff >= 0 ? 2 * static_cast<uint64>(diff) :
+                2 * static_cast<uint64>(-(diff + 1)) + 1, &buf);
+      PutWeight(arc.weight, float16_weights, &buf);
+    }
+  }
+
+  WriteToken(os, true, "<CompactLattice>");
+  os.put(float16_weights ? kCompactLatticeFloat16 : 0);
+  std::string size_buf;
+  PutVarint(buf.size(), &size_buf);
+  os.write(size_buf.data(), size_buf.size());
+  os.write(buf.data(), buf.size());
+  return os.good();
+}
+
+bool ReadCompactLatticeEncoded(std::istream &is, CompactLattice **clat) {
+  typedef CompactLatticeArc::StateId StateId;
+  KALDI_ASSERT(*clat == NULL);
+  std::string token;
+  try {
+    ReadToken(is, true, &token);
+  } catch (const std::exception &) {
+    KALDI_WARN << "Reading compact lattice: error reading token.";
+    return false;
+  }
+  if (token != "<CompactLattice>") {
+    KALDI_WARN << "Reading compact lattice: expected <CompactLattice>, got "
+               << token;
+    return false;
+  }
+  int flags = is.get();
+  char size_buf[10];
+  int32 size_len = 0;
+  for (; size_len < 10; size_len++) {
+    int c = is.get();
+    if (c == -1) break;
+    size_buf[size_len] = static_cast<char>(c);
+    if ((c & 128) == 0) { size_len++; break; }
+  }
+  const char *pos = size_buf;
+  uint64 size;
+  if (flags == -1 || (flags & ~kCompactLatticeFloat16) != 0 ||
+      !GetVarint(&pos, size_buf + size_len, &size)) {
+    KALDI_WARN << "Reading compact lattice: bad header.";
+    return false;
+  }
+  std::vector<char> buf(size);
+  if (size != 0) is.read(&(buf[0]), size);
+  if (!is.good()) {
+    KALDI_WARN << "Reading compact lattice: stream failure.";
+    return false;
+  }
+
+  bool float16 = ((flags & kCompactLatticeFloat16) != 0);
+  const char *end = (size == 0 ? pos : &(buf[0]) + size);
+  pos = (size == 0 ? pos : &(buf[0]));
+  uint64 num_states, start;
+  CompactLattice *ans = new CompactLattice();
+  bool ok = GetVarint(&pos, end, &num_states) &&
+      num_states <= static_cast<uint64>(end - pos) &&
+      GetVarint(&pos, end, &start) && start <= num_states;
+  if (ok) {
+    for (uint64 n = 0; n < num_states; n++) ans->AddState();
+    if (start != 0) ans->SetStart(start - 1);
+  }
+  for (StateId s = 0; ok && s < static_cast<StateId>(num_states); s++) {
+    uint64 code;
+    if (!GetVarint(&pos, end, &code)) { ok = false; break; }
+    if ((code & 1) != 0) {
+      CompactLatticeWeight final_weight;
+      if (!GetWeight(&pos, end, float16, &final_weight)) { ok = false; break; }
+      ans->SetFinal(s, final_weight);
+    }
+    for (uint64 num_arcs = code >> 1; num_arcs > 0; num_arcs--) {
+      uint64 label_code, diff_code;
+      uint32 olabel;
+      if (!GetVarint(&pos, end, &label_code) ||
+          (label_code >> 1) > 0xFFFFFFFFu) { ok = false; break; }
+      uint32 ilabel = static_cast<uint32>(label_code >> 1);
+      olabel = ilabel;
+      if ((label_code & 1) != 0 && !GetVarint32(&pos, end, &olabel)) {
+        ok = false;
+        break;
+      }
+      if (!GetVarint(&pos, end, &diff_code)) { ok = false; break; }
+      int64 diff = ((diff_code & 1) != 0 ?
+                    -static_cast<int64>(diff_code >> 1) - 1 :
+                    static_cast<int64>(diff_code >> 1)),
+          nextstate = s + diff;
+      CompactLatticeWeight weight;
+      if (nextstate < 0 || nextstate >= static_cast<int64>(num_states) ||
+          !GetWeight(&pos, end, float16, &weight)) { ok = false; break; }
+      ans->AddArc(s, CompactLatticeArc(static_cast<int32>(ilabel),
+                                       static_cast<int32>(olabel), weight,
+                                       static_cast<StateId>(nextstate)));
+    }
+  }
+  if (!ok || pos != end) {
+    KALDI_WARN << "Reading compact lattice: corrupted data.";
+    delete ans;
+    return false;
+  }
+  *clat = ans;
+  return true;
+}
+
+
 bool WriteCompactLattice(std::ostream &os, bool binary,
                          const CompactLattice &t) {
   if (binary) {
+    if (g_compact_lattice_write_opts.compact)
+      return WriteCompactLatticeEncoded(
+          os, t, g_compact_lattice_write_opts.float16_weights);
     fst::FstWriteOptions opts;
     // Leave all the options default.  Normally these lattices wouldn't have any
     // osymbols/isymbols so no point directing it not to write them (who knows what
@@ -311,6 +652,8 @@ bool ReadCompactLattice(std::istream &is, bool binary,
                         CompactLattice **clat) {
   KALDI_ASSERT(*clat == NULL);
   if (binary) {
+    if (is.peek() == '<')  // The compact encoding starts with a token.
+      return ReadCompactLatticeEncoded(is, clat);
     fst::FstHeader hdr;
     if (!hdr.Read(is, "<unknown>")) {
       KALDI_WARN << "Reading compact lattice: error reading FST header.";
@@ -380,8 +723,9 @@ bool CompactLatticeHolder::Read(std::istream &is) {
     // cannot begin with space because it starts with the FST Type() which is not
     // space).
     return ReadCompactLattice(is, false, &t_);
-  } else if (c != 214) { // 214 is first char of FST magic number,
-    // on little-endian machines which is all we support (\326 octal)
+  } else if (c != 214 && c != '<') { // 214 is first char of FST magic
+    // number, on little-endian machines which is all we support (\326 octal);
+    // '<' starts the compact encoding (see WriteCompactLatticeEncoded()).
     KALDI_WARN << "Reading compact lattice: does not appear to be an FST "
                << " [non-space but no magic number detected], file pos is "
                << is.tellg();
@@ -430,6 +774,12 @@ bool ReadLattice(std::istream &is, bool binary,
                  Lattice **lat) {
   KALDI_ASSERT(*lat == NULL);
   if (binary) {
+    if (is.peek() == '<') {  // The compact encoding of a CompactLattice.
+      CompactLattice *clat = NULL;
+      if (!ReadCompactLatticeEncoded(is, &clat)) return false;
+      *lat = ConvertToLattice(clat);
+      return true;
+    }
     fst::FstHeader hdr;
     if (!hdr.Read(is, "<unknown>")) {
       KALDI_WARN << "Reading lattice: error reading FST header.";
@@ -502,8 +852,9 @@ bool LatticeHolder::Read(std::istream &is) {
     // cannot begin with space because it starts with the FST Type() which is not
     // space).
     return ReadLattice(is, false, &t_);
-  } else if (c != 214) { // 214 is first char of FST magic number,
-    // on little-endian machines which is all we support (\326 octal)
+  } else if (c != 214 && c != '<') { // 214 is first char of FST magic
+    // number, on little-endian machines which is all we support (\326 octal);
+    // '<' starts the compact encoding (see WriteCompactLatticeEncoded()).
     KALDI_WARN << "Reading compact lattice: does not appear to be an FST "
                << " [non-space but no magic number detected], file pos is "
                << is.tellg();
@@ -66,6 +66,47 @@ bool ReadLattice(std::istream &is, bool binary,
                  Lattice **lat);
 
 
+/// Options for how WriteCompactLattice() (and so CompactLatticeWriter) writes
+/// lattices in binary mode.  By default the OpenFst binary format is used.  If
+/// "compact" is true, a more compact encoding is used instead (see
+/// WriteCompactLatticeEncoded()); the readers in this file detect it
+/// automatically, but OpenFst cannot read it.
+struct CompactLatticeWriteOptions {
+  bool compact;
+  bool float16_weights;
+
+  CompactLatticeWriteOptions(): compact(false), float16_weights(false) { }
+
+  void Register(OptionsItf *po) {
+    po->Register("compact-lattice-format", &compact, "If true, write "
+                 "lattices in binary mode in a compact encoding (varint "
+                 "labels, delta-coded states, run-length coded alignments) "
+                 "that only Kaldi lattice readers understand.");
+    po->Register("float16-lattice-weights", &float16_weights, "If true (and "
+                 "--compact-lattice-format=true), store the lattice weights as "
+                 "16-bit floats; this is lossy (about 3 significant digits).");
+  }
+};
+
+/// Sets the options used by WriteCompactLattice() in binary mode.  These are
+/// global; call this once from main(), before writing any lattices.
+void SetCompactLatticeWriteOptions(const CompactLatticeWriteOptions &opts);
+
+/// Writes the lattice in the compact binary encoding: the states are
+/// renumbered in topological order (if the lattice is acyclic), the
+/// next-states are stored as differences from the source state and the
+/// labels as variable-length integers, the strings of transition-ids are
+/// run-length coded, and the weights are stored as 32-bit or (if
+/// float16_weights is true) 16-bit floats.  The output starts with the token
+/// "<CompactLattice>".  Returns false on stream failure.
+bool WriteCompactLatticeEncoded(std::ostream &os, const CompactLattice &clat,
+                                bool float16_weights);
+
+/// Reads a lattice written by WriteCompactLatticeEncoded(); requires that
+/// *clat be NULL when called.  Returns false on error.
+bool ReadCompactLatticeEncoded(std::istream &is, CompactLattice **clat);
+
+
 class CompactLatticeHolder {
  public:
   typedef CompactLattice T;
@@ -737,6 +737,78 @@ int32 LongestSentenceLength(const CompactLattice &clat) {
   return lattice_max_length;
 }
 
+void ExpandLatticeFrames(const std::vector<int32> &frame_lengths,
+                         Lattice *lat) {
+  typedef LatticeArc::StateId StateId;
+  std::vector<int32> state_times;
+  int32 num_frames = LatticeStateTimes(*lat, &state_times);
+  KALDI_ASSERT(num_frames <= static_cast<int32>(frame_lengths.size()));
+
+  StateId num_states = lat->NumStates();  // new states are added at the end.
+  std::vector<LatticeArc> arcs;
+  for (StateId s = 0; s < num_states; s++) {
+    int32 t = state_times[s];
+    arcs.clear();
+    for (fst::ArcIterator<Lattice> aiter(*lat, s); !aiter.Done(); aiter.Next())
+      arcs.push_back(aiter.Value());
+    lat->DeleteArcs(s);
+    for (size_t i = 0; i < arcs.size(); i++) {
+      LatticeArc arc = arcs[i];
+      if (arc.ilabel == 0 || frame_lengths[t] == 1) {
+        lat->AddArc(s, arc);
+        continue;
+      }
+      KALDI_ASSERT(frame_lengths[t] > 1);
+      StateId final_nextstate = arc.nextstate, cur_state = s;
+      for (int32 j = 0; j < frame_lengths[t]; j++) {
+        StateId nextstate = (j + 1 == frame_lengths[t] ? final_nextstate :
+                             lat->AddState());
+        if (j == 0)
+          lat->AddArc(cur_state, LatticeArc(arc.ilabel, arc.olabel,
+                                            arc.weight, nextstate));
+        else
+          lat->AddArc(cur_state, LatticeArc(arc.ilabel, 0,
+                                            LatticeWeight::One(), nextstate));
+        cur_state = nextstate;
+      }
+    }
+  }
+  // The added states have higher numbers than the states they lead to.
+  TopSortLatticeIfNeeded(lat);
+}
+
+void ExpandCompactLatticeFrames(const std::vector<int32> &frame_lengths,
+                                CompactLattice *clat) {
+  typedef CompactLatticeArc::StateId StateId;
+  std::vector<int32> state_times;
+  int32 num_frames = CompactLatticeStateTimes(*clat, &state_times);
+  KALDI_ASSERT(num_frames <= static_cast<int32>(frame_lengths.size()));
+
+  std::vector<int32> expanded;
+  for (StateId s = 0; s < clat->NumStates(); s++) {
+    int32 t = state_times[s];
+    for (fst::MutableArcIterator<CompactLattice> aiter(clat, s);
+         !aiter.Done(); aiter.Next()) {
+      CompactLatticeArc arc = aiter.Value();
+      const std::vector<int32> &str = arc.weight.String();
+      expanded.clear();
+      for (size_t i = 0; i < str.size(); i++)
+        expanded.insert(expanded.end(), frame_lengths[t + i], str[i]);
+      arc.weight.SetString(expanded);
+      aiter.SetValue(arc);
+    }
+    CompactLatticeWeight final_weight = clat->Final(s);
+    if (final_weight != CompactLatticeWeight::Zero()) {
+      const std::vector<int32> &str = final_weight.String();
+      expanded.clear();
+      for (size_t i = 0; i < str.size(); i++)
+        expanded.insert(expanded.end(), frame_lengths[t + i], str[i]);
+      final_weight.SetString(expanded);
+      clat->SetFinal(s, final_weight);
+    }
+  }
+}
+
 void ComposeCompactLatticeDeterministic(
     const CompactLattice& clat,
     fst::DeterministicOnDemandFst<fst::StdArc>* det_fst,
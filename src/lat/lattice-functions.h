@@ -138,6 +138,23 @@ int32 LongestSentenceLength(const CompactLattice &lat);
 bool RescoreLattice(DecodableInterface *decodable,
                     Lattice *lat);
 
+/// This function undoes the effect of decoding with collapsed frames (see
+/// DecodableMatrixScaledCollapsed): frame t of the input lattice stands for
+/// frame_lengths[t] frames of the original utterance, and each emitting arc on
+/// frame t is replaced by a chain of frame_lengths[t] arcs with the same
+/// ilabel (the weight and olabel go on the first of them), so that the lattice
+/// has the original number of frames.  Requires that lat be topologically
+/// sorted, and that frame_lengths has one entry for each frame of the lattice.
+void ExpandLatticeFrames(const std::vector<int32> &frame_lengths,
+                         Lattice *lat);
+
+/// As ExpandLatticeFrames, but for CompactLattice: each element of the
+/// transition-id strings on the arcs and final-probs is repeated
+/// frame_lengths[t] times, where t is the frame it belongs to.  The weights are
+/// unchanged.  Requires that clat be topologically sorted.
+void ExpandCompactLatticeFrames(const std::vector<int32> &frame_lengths,
+                                CompactLattice *clat);
+
 /// This function Composes a CompactLattice format lattice with a
 /// DeterministicOnDemandFst<fst::StdFst> format fst, and outputs another
 /// CompactLattice format lattice. The first element (the one that corresponds
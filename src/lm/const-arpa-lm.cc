@@ -19,7 +19,16 @@
 
 #include <sstream>
 
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "lm/const-arpa-lm.h"
+#include "thread/kaldi-mutex.h"
+#include "thread/kaldi-thread.h"
 #include "util/stl-utils.h"
 #include "util/text-utils.h"
 
@@ -43,104 +52,110 @@ struct ArpaLine {
   }
 };
 
-// Auxiliary class to build ConstArpaLm. We first use this class to figure out
-// the relative address of different LmStates, and then put everything into one
-// block in memory.
-class LmState {
- public:
-  LmState(const bool is_unigram,
-          const float logprob, const float backoff_logprob) :
-      is_unigram_(is_unigram),
-      logprob_(logprob), backoff_logprob_(backoff_logprob) {}
+// The n-grams of one order, while we build ConstArpaLm.  They are kept in flat
+// arrays rather than as one object each, which keeps the memory down for large
+// language models.  After ConstArpaLmBuilder::Read() they are sorted
+// lexicographically, so the children of an n-gram (the (n+1)-grams that extend
+// it) are contiguous in the arrays of the next order, and sorted by word.
+struct NgramArray {
+  // N-gram order.
+  int32 order;
 
-  void SetMyAddress(const int64 address) {
-    my_address_ = address;
-  }
+  // Number of n-grams.
+  int32 size;
 
-  void AddChild(const std::pair<int32, LmState*>& child) {
-    children_.push_back(child);
-  }
+  // Words of n-gram i are words[i * order] ... words[i * order + order - 1].
+  std::vector<int32> words;
 
-  int64 MyAddress() const {
-    return my_address_;
-  }
+  // Language model log probability, and backoff log probability.
+  std::vector<float> logprobs;
+  std::vector<float> backoff_logprobs;
 
-  bool IsUnigram() const {
-    return is_unigram_;
-  }
+  // The children of n-gram i are n-grams first_child[i] ...
+  // first_child[i] + num_children[i] - 1 of the next order.  Empty for the
+  // highest order.
+  std::vector<int32> first_child;
+  std::vector<int32> num_children;
 
-  float Logprob() const {
-    return logprob_;
-  }
+  // Used by ConstArpaLmBuilder::Build(): first the size of the subtree of the
+  // n-gram in <lm_states_>, then the address of its LmState, relative to
+  // <lm_states_>.
+  std::vector<int64> address;
 
-  float BackoffLogprob() const {
-    return backoff_logprob_;
-  }
+  NgramArray(): order(0), size(0) { }
 
-  int32 NumChildren() const {
-    return children_.size();
+  const int32* Words(int32 i) const {
+    return &(words[0]) + static_cast<int64>(i) * order;
   }
 
-  std::pair<int32, LmState*> GetChild(const int32 index) {
-    KALDI_ASSERT(index < children_.size());
-    KALDI_ASSERT(index >= 0);
-    return children_[index];
+  int32 NumChildren(int32 i) const {
+    return num_children.empty() ? 0 : num_children[i];
   }
 
-  void SortChildren() {
-    std::sort(children_.begin(), children_.end());
+  // Checks if n-gram i is a leaf.
+  bool IsLeaf(int32 i) const {
+    return (backoff_logprobs[i] == 0.0 && NumChildren(i) == 0);
   }
+};
 
-  // Checks if the current LmState is a leaf.
-  bool IsLeaf() const {
-    return (backoff_logprob_ == 0.0 && children_.empty());
+// Compares n-grams of order <order> lexicographically, by index into <words>.
+class NgramIndexLess {
+ public:
+  NgramIndexLess(const int32 *words, int32 order):
+      words_(words), order_(order) { }
+  bool operator () (int32 a, int32 b) const {
+    const int32 *wa = words_ + static_cast<int64>(a) * order_,
+        *wb = words_ + static_cast<int64>(b) * order_;
+    return std::lexicographical_compare(wa, wa + order_, wb, wb + order_);
   }
+ private:
+  const int32 *words_;
+  int32 order_;
+};
 
-  // Computes the size of the memory that the current LmState would take in
-  // <lm_states> array. It's the number of 4-byte chunks.
-  int32 MemSize() const {
-    if (IsLeaf() && !is_unigram_) {
-      // We don't create an entry in this case; the logprob will be stored in
-      // the same int32 that we would normally store the pointer in.
-      return 0;
-    } else {
-      // We store the following information:
-      // logprob, backoff_logprob, children.size() and children data.
-      return (3 + 2 * children_.size());
-    }
+// Calls (*range_func)(begin, end) from <num_threads> threads, which split the
+// range [0, size) between them.  <RangeFunc> must be safe to call concurrently
+// on disjoint ranges.
+template<class RangeFunc>
+class RangeTask: public MultiThreadable {
+ public:
+  RangeTask(int64 size, RangeFunc *range_func):
+      size_(size), range_func_(range_func) { }
+  void operator () () {
+    int64 begin = size_ * thread_id_ / num_threads_,
+        end = size_ * (thread_id_ + 1) / num_threads_;
+    if (begin < end) (*range_func_)(begin, end);
   }
-
  private:
-  // Unigram states will have LmStates even if they are leaves, therefore we
-  // need to note when this is a unigram or not.
-  bool is_unigram_;
-
-  // When we compute the addresses of the LmStates as offsets into <lm_states_>
-  // pointer, and put the offsets here. Note that this is just offset, not
-  // actual pointer.
-  int64 my_address_;
-
-  // Language model log probability of the current sequence. For example, if
-  // this state is "A B", then it would be the logprob of "A -> B".
-  float logprob_;
-
-  // Language model backoff log probability of the current sequence, e.g., state
-  // "A B -> X" backing off to "B -> X".
-  float backoff_logprob_;
-
-  // List of children. 
-  std::vector<std::pair<int32, LmState*> > children_;
+  int64 size_;
+  RangeFunc *range_func_;
 };
 
+template<class RangeFunc>
+void RunRangeMultiThreaded(int32 num_threads, int64 size,
+                           RangeFunc *range_func) {
+  RangeTask<RangeFunc> task(size, range_func);
+  // With zero threads, MultiThreader runs the task in this thread.  The
+  // threads are joined when <threader> goes out of scope.
+  MultiThreader<RangeTask<RangeFunc> > threader(
+      std::min<int64>(num_threads > 1 ? num_threads : 0, size), task);
+}
+
 // Class to build ConstArpaLm from Arpa format language model. It relies on the
-// auxiliary class LmState above.
+// auxiliary struct NgramArray above.
 class ConstArpaLmBuilder {
  public:
   ConstArpaLmBuilder(
       const bool natural_base, const int32 bos_symbol,
-      const int32 eos_symbol, const int32 unk_symbol) :
+      const int32 eos_symbol, const int32 unk_symbol,
+      const int32 quantize_bits = 0, const int32 num_threads = 1) :
       natural_base_(natural_base), bos_symbol_(bos_symbol),
-      eos_symbol_(eos_symbol), unk_symbol_(unk_symbol) {
+      eos_symbol_(eos_symbol), unk_symbol_(unk_symbol),
+      quantize_bits_(quantize_bits), num_threads_(num_threads) {
+    if (quantize_bits_ != 0 && quantize_bits_ != 8 && quantize_bits_ != 16)
+      KALDI_ERR << "Log probabilities can only be quantized to 8 or 16 bits, "
+                << "not " << quantize_bits_;
+    KALDI_ASSERT(num_threads_ > 0);
     ngram_order_ = 0;
     num_words_ = 0;
     overflow_buffer_size_ = 0;
@@ -150,22 +165,20 @@ class ConstArpaLmBuilder {
     lm_states_ = NULL;
     unigram_states_ = NULL;
     overflow_buffer_ = NULL; 
+    codebooks_ = NULL;
   }
 
   ~ConstArpaLmBuilder() {
-    unordered_map<std::vector<int32>,
-                  LmState*, VectorHasher<int32> >::iterator iter;
-    for (iter = seq_to_state_.begin(); iter != seq_to_state_.end(); ++iter) {
-      delete iter->second;
-    }
     if (is_built_) {
       delete[] lm_states_;
       delete[] unigram_states_;
       delete[] overflow_buffer_;
+      delete[] codebooks_;
     }
   }
 
-  // Reads in the Arpa format language model, parses it and creates LmStates.
+  // Reads in the Arpa format language model, parses it and creates the
+  // NgramArrays.
   void Read(std::istream &is, bool binary);
 
   // Writes ConstArpaLm.
@@ -180,7 +193,51 @@ class ConstArpaLmBuilder {
     max_address_offset_ = max_address_offset;
   }
 
+  // The following are public so that the functors that do the work in
+  // parallel can call them.
+
+  // Parses lines <begin> to <end> - 1 of <lines> (the starts of which are in
+  // <line_starts>) into n-grams <first_ngram> + <begin> ... of <ngrams>.
+  // Returns false, setting <error_line>, if a line cannot be parsed.
+  bool ParseLines(const std::string &lines,
+                  const std::vector<int64> &line_starts,
+                  int64 begin, int64 end, int32 first_ngram,
+                  NgramArray *ngrams, int64 *error_line) const;
+
+  // Computes the size of the memory that n-gram i of order <order> would take
+  // in <lm_states> array. It's the number of 4-byte chunks.
+  int32 MemSize(const int32 order, const int32 i) const;
+
+  // Returns the number of children of n-gram i of order <order> that are
+  // leaves.
+  int32 NumLeafChildren(const int32 order, const int32 i) const;
+
+  // Puts the LmState of n-gram i of order <order> into <lm_states_>, at its
+  // address.  For children whose relative address is too large, the pair of
+  // (index in <lm_states_> of the child info, child address plus one) is
+  // appended to <overflows>, which is protected by <overflow_mutex>; the child
+  // info is filled in later, by Build().
+  void WriteLmState(const int32 order, const int32 i,
+                    std::vector<std::pair<int64, int64> > *overflows,
+                    Mutex *overflow_mutex);
+
+  // The n-grams of each order; ngrams_[n - 1] has order n.
+  std::vector<NgramArray> ngrams_;
+
  private:
+  // Reads the lines of an "\N-grams:" section from <is> into <ngrams>, a batch
+  // at a time, and parses each batch in parallel.  <line> is the last line
+  // read, and on exit it is the first line after the section.
+  void ReadNgrams(std::istream &is, int32 expected_count, std::string *line,
+                  NgramArray *ngrams);
+
+  // Sorts the n-grams of <ngrams> lexicographically, in parallel.
+  void SortNgrams(NgramArray *ngrams);
+
+  // Sets the children of the n-grams of order <order>, which are n-grams of
+  // order <order> + 1.
+  void LinkChildren(const int32 order);
+
   // If true, use natural base e for log-prob, otherwise use base 10. The
   // default base in Arpa format language model is base 10.
   bool natural_base_;
@@ -202,6 +259,13 @@ class ConstArpaLmBuilder {
   // provided.
   int32 unk_symbol_;
 
+  // Bits of the codebook indexes if we quantize the log probabilities (8 or
+  // 16), or 0.
+  int32 quantize_bits_;
+
+  // Number of threads used for parsing and building.
+  int32 num_threads_;
+
   // N-gram order of language model. This can be figured out from "/data/"
   // section in Arpa format language model.
   int32 ngram_order_;
@@ -220,20 +284,247 @@ class ConstArpaLmBuilder {
   // Memory blcok for storing LmStates.
   int32* lm_states_;
 
-  // Memory block for storing pointers of unigram LmStates.
-  int32** unigram_states_;
+  // Memory block for storing addresses of unigram LmStates (relative to
+  // <lm_states_>, plus one; zero if there is no LmState).
+  int64* unigram_states_;
+
+  // Memory block for storing addresses of the LmStates that have large relative
+  // address to their parents (relative to <lm_states_>, plus one).
+  int64* overflow_buffer_;
+
+  // Memory block for storing the codebooks if we quantize, in the order
+  // described for ConstArpaLm::codebooks_; NULL otherwise.
+  float* codebooks_;
+
+  // Works out the codebooks from the log probabilities in <ngrams_>.
+  void BuildCodebooks();
+
+  // Returns the index of the entry of codebook <codebook> (an index into
+  // <codebooks_> as in ConstArpaLm::Dequantize()) closest to <value>.
+  uint32 Quantize(const int32 codebook, const float value) const;
+};
+
+namespace {
+
+// Number of lines of an "\N-grams:" section that we read before parsing them.
+const int64 kArpaBatchSize = 1 << 20;
+
+// Parses a range of the lines read by ConstArpaLmBuilder::ReadNgrams().
+class ParseLinesFunc {
+ public:
+  ParseLinesFunc(const ConstArpaLmBuilder *builder, const std::string *lines,
+                 const std::vector<int64> *line_starts, int32 first_ngram,
+                 NgramArray *ngrams):
+      builder_(builder), lines_(lines), line_starts_(line_starts),
+      first_ngram_(first_ngram), ngrams_(ngrams), error_line_(-1) { }
+  void operator () (int64 begin, int64 end) {
+    int64 error_line;
+    if (!builder_->ParseLines(*lines_, *line_starts_, begin, end,
+                              first_ngram_, ngrams_, &error_line)) {
+      // Several threads may fail; we keep the first bad line of the file.
+      error_mutex_.Lock();
+      if (error_line_ == -1 || error_line < error_line_)
+        error_line_ = error_line;
+      error_mutex_.Unlock();
+    }
+  }
+  // Returns the first line that could not be parsed, or -1.
+  int64 ErrorLine() const { return error_line_; }
+ private:
+  const ConstArpaLmBuilder *builder_;
+  const std::string *lines_;
+  const std::vector<int64> *line_starts_;
+  int32 first_ngram_;
+  NgramArray *ngrams_;
+  Mutex error_mutex_;
+  int64 error_line_;
+};
+
+// Sorts ranges of an array of n-gram indexes.
+class SortRangesFunc {
+ public:
+  SortRangesFunc(std::vector<int32> *indexes, const NgramIndexLess &less,
+                 const std::vector<int64> *boundaries,
+                 const std::vector<int64> *middles):
+      indexes_(indexes), less_(less), boundaries_(boundaries),
+      middles_(middles) { }
+  // Range i is boundaries[i] ... boundaries[i + 1] - 1.  If <middles_> is NULL,
+  // sorts each range; otherwise range i is the concatenation of two sorted
+  // ranges, the second starting at middles[i], and we merge them.
+  void operator () (int64 begin, int64 end) {
+    for (int64 i = begin; i < end; ++i) {
+      std::vector<int32>::iterator range_begin = indexes_->begin() +
+          (*boundaries_)[i], range_end = indexes_->begin() +
+          (*boundaries_)[i + 1];
+      if (middles_ == NULL) {
+        std::sort(range_begin, range_end, less_);
+      } else {
+        std::vector<int32>::iterator range_middle = indexes_->begin() +
+            (*middles_)[i];
+        if (range_middle != range_end)
+          std::inplace_merge(range_begin, range_middle, range_end, less_);
+      }
+    }
+  }
+ private:
+  std::vector<int32> *indexes_;
+  NgramIndexLess less_;
+  const std::vector<int64> *boundaries_;
+  const std::vector<int64> *middles_;
+};
+
+// Puts the n-grams of <ngrams> in the order given by <indexes>, writing
+// <words>, <logprobs> and <backoff_logprobs>.
+class PermuteNgramsFunc {
+ public:
+  PermuteNgramsFunc(const NgramArray *ngrams,
+                    const std::vector<int32> *indexes,
+                    std::vector<int32> *words, std::vector<float> *logprobs,
+                    std::vector<float> *backoff_logprobs):
+      ngrams_(ngrams), indexes_(indexes), words_(words), logprobs_(logprobs),
+      backoff_logprobs_(backoff_logprobs) { }
+  void operator () (int64 begin, int64 end) {
+    int32 order = ngrams_->order;
+    for (int64 i = begin; i < end; ++i) {
+      int32 j = (*indexes_)[i];
+      const int32 *words = ngrams_->Words(j);
+      std::copy(words, words + order, words_->begin() + i * order);
+      (*logprobs_)[i] = ngrams_->logprobs[j];
+      (*backoff_logprobs_)[i] = ngrams_->backoff_logprobs[j];
+    }
+  }
+ private:
+  const NgramArray *ngrams_;
+  const std::vector<int32> *indexes_;
+  std::vector<int32> *words_;
+  std::vector<float> *logprobs_;
+  std::vector<float> *backoff_logprobs_;
+};
 
-  // Memory block for storing pointers of the LmStates that have large relative
-  // address to their parents.
-  int32** overflow_buffer_;
+// Finds the children of a range of n-grams of <parents>, among the (sorted)
+// n-grams of <children>.
+class LinkChildrenFunc {
+ public:
+  LinkChildrenFunc(NgramArray *parents, const NgramArray *children):
+      parents_(parents), children_(children) { }
+  void operator () (int64 begin, int64 end) {
+    int32 order = parents_->order;
+    for (int64 i = begin; i < end; ++i) {
+      const int32 *words = parents_->Words(i);
+      // Binary search for the first child whose history is not less than
+      // <words>, then for the first whose history is greater.
+      int32 lo = 0, hi = children_->size;
+      while (lo < hi) {
+        int32 mid = lo + (hi - lo) / 2;
+        const int32 *mid_words = children_->Words(mid);
+        if (std::lexicographical_compare(mid_words, mid_words + order,
+                                         words, words + order))
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      int32 first = lo;
+      hi = children_->size;
+      while (lo < hi) {
+        int32 mid = lo + (hi - lo) / 2;
+        const int32 *mid_words = children_->Words(mid);
+        if (!std::lexicographical_compare(words, words + order,
+                                          mid_words, mid_words + order))
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      parents_->first_child[i] = first;
+      parents_->num_children[i] = lo - first;
+    }
+  }
+ private:
+  NgramArray *parents_;
+  const NgramArray *children_;
+};
+
+// Computes the size of the subtrees of the LmStates of a range of n-grams of
+// order <order>, given those of order <order> + 1, into NgramArray::address.
+class SubtreeSizeFunc {
+ public:
+  SubtreeSizeFunc(ConstArpaLmBuilder *builder, int32 order):
+      builder_(builder), order_(order) { }
+  void operator () (int64 begin, int64 end) {
+    NgramArray &ngrams = builder_->ngrams_[order_ - 1];
+    for (int64 i = begin; i < end; ++i) {
+      int64 size = builder_->MemSize(order_, i);
+      int32 num_children = ngrams.NumChildren(i);
+      if (num_children > 0) {
+        const std::vector<int64> &child_sizes =
+            builder_->ngrams_[order_].address;
+        for (int32 c = ngrams.first_child[i];
+             c < ngrams.first_child[i] + num_children; ++c)
+          size += child_sizes[c];
+      }
+      ngrams.address[i] = size;
+    }
+  }
+ private:
+  ConstArpaLmBuilder *builder_;
+  int32 order_;
+};
+
+// Given the addresses of a range of n-grams of order <order>, turns the subtree
+// sizes of their children into addresses: the children follow their parent in
+// <lm_states_>, in order.
+class ChildAddressFunc {
+ public:
+  ChildAddressFunc(ConstArpaLmBuilder *builder, int32 order):
+      builder_(builder), order_(order) { }
+  void operator () (int64 begin, int64 end) {
+    NgramArray &ngrams = builder_->ngrams_[order_ - 1];
+    for (int64 i = begin; i < end; ++i) {
+      int32 num_children = ngrams.NumChildren(i);
+      if (num_children == 0) continue;
+      std::vector<int64> &child_addresses = builder_->ngrams_[order_].address;
+      int64 address = ngrams.address[i] + builder_->MemSize(order_, i);
+      for (int32 c = ngrams.first_child[i];
+           c < ngrams.first_child[i] + num_children; ++c) {
+        int64 size = child_addresses[c];
+        child_addresses[c] = address;
+        address += size;
+      }
+    }
+  }
+ private:
+  ConstArpaLmBuilder *builder_;
+  int32 order_;
+};
 
-  // Hash table from word sequences to LmStates.
-  unordered_map<std::vector<int32>,
-                LmState*, VectorHasher<int32> > seq_to_state_;
+// Puts the LmStates of a range of n-grams of order <order> into <lm_states_>.
+class WriteLmStatesFunc {
+ public:
+  WriteLmStatesFunc(ConstArpaLmBuilder *builder, int32 order,
+                    std::vector<std::pair<int64, int64> > *overflows,
+                    Mutex *overflow_mutex):
+      builder_(builder), order_(order), overflows_(overflows),
+      overflow_mutex_(overflow_mutex) { }
+  void operator () (int64 begin, int64 end) {
+    for (int64 i = begin; i < end; ++i)
+      builder_->WriteLmState(order_, i, overflows_, overflow_mutex_);
+  }
+ private:
+  ConstArpaLmBuilder *builder_;
+  int32 order_;
+  std::vector<std::pair<int64, int64> > *overflows_;
+  Mutex *overflow_mutex_;
 };
 
-// Reads in the Arpa format language model, parses it and puts the word sequence
-// into the corresponding LmState in <seq_to_state_>.
+// Skips spaces and tabs.
+inline const char* SkipArpaWhiteSpace(const char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r') ++p;
+  return p;
+}
+
+}  // namespace
+
+// Reads in the Arpa format language model, parses it and puts the n-grams of
+// each order into <ngrams_>, sorted.
 void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
   if (binary) {
     KALDI_ERR << "binary-mode reading is not implemented for "
@@ -286,109 +577,254 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
   }
   KALDI_ASSERT(num_ngrams.size() > 0);
   ngram_order_ = num_ngrams.size() - 1;
+  ngrams_.resize(ngram_order_);
 
   // Processes "\N-grams:" section.
-  int32 max_word_id = 0;
   for (int32 order = 1; order < num_ngrams.size(); ++order) {
+    NgramArray &ngrams = ngrams_[order - 1];
+    ngrams.order = order;
     // Skips n-grams with zero count.
     if (num_ngrams[order] == 0) continue;
 
-    keyword_found = false;
-    int32 ngram_count = 0;
     std::ostringstream keyword;
     keyword << "\\" << order << "-grams:";
-    // We use "do ... while" loop since one line has already been read.
-    do {
-      // The section keywords starts with backslash. We terminate the while loop
-      // if a new section is found.
-      if (!line.empty() && line[0] == '\\') {
-        if (line.find("-grams:") != std::string::npos && keyword_found) break;
-        if (line.find("\\end\\") != std::string::npos) break;
-      }
-
+    // Looks for keyword "\N-gram:"; one line has already been read.
+    while (true) {
       std::vector<std::string> col;
       SplitStringToVector(line, " \t", true, &col);
+      if (col.size() == 1 && col[0] == keyword.str()) break;
+      if (!getline(is, line))
+        KALDI_ERR << "Section " << keyword.str() << " not found.";
+    }
+    KALDI_LOG << "Reading \"" << keyword.str() << "\" section.";
+    ReadNgrams(is, num_ngrams[order], &line, &ngrams);
+    if (ngrams.size == 0) {
+      KALDI_ERR << "Header said there would be " << num_ngrams[order]
+                << " n-grams of order " << order << ", but we saw 0";
+    }
+    SortNgrams(&ngrams);
+  }
 
-      // Looks for keyword "\N-gram:" if the keyword has not been located.
-      if (!keyword_found && col.size() == 1 && col[0] == keyword.str()) {
-        KALDI_LOG << "Reading \"" << keyword.str() << "\" section.";
-        ngram_count = 0;
-        keyword_found = true;
-        continue;
-      }
+  // The children of the n-grams of each order.  We assume that if a n-gram
+  // exists in the Arpa format language model, then the "history" n-gram also
+  // exists. For example, if "A B C" is a valid n-gram, then "A B" is also a
+  // valid n-gram.
+  for (int32 order = 1; order < ngram_order_; ++order)
+    LinkChildren(order);
 
-      // Enters "\N-grams:" section if the keyword has been located.
-      if (keyword_found && col.size() > 0) {
-        KALDI_ASSERT(col.size() >= 1 + order);
-        KALDI_ASSERT(col.size() <= 2 + order);  // backoff_logprob could be 0.
-        ngram_count++;
+  // <num_words_> is <max_word_id> plus 1; the unigrams are sorted.
+  KALDI_ASSERT(ngrams_[0].size > 0);
+  num_words_ = ngrams_[0].words.back() + 1;
+}
 
-        // If backoff_logprob is 0, it will not appear in Arpa format language
-        // model. We put it back so the processing afterwards will be easier.
-        if (col.size() == 1 + order) {
-          col.push_back("0");
+void ConstArpaLmBuilder::ReadNgrams(std::istream &is, int32 expected_count,
+                                    std::string *line, NgramArray *ngrams) {
+  int32 order = ngrams->order;
+  ngrams->words.resize(static_cast<int64>(expected_count) * order);
+  ngrams->logprobs.resize(expected_count);
+  ngrams->backoff_logprobs.resize(expected_count);
+  ngrams->size = 0;
+
+  // The lines of the current batch, each terminated by '\0', and where they
+  // start.
+  std::string lines;
+  std::vector<int64> line_starts;
+  bool section_end = false;
+  while (!section_end) {
+    lines.clear();
+    line_starts.clear();
+    while (line_starts.size() < kArpaBatchSize) {
+      if (!getline(is, *line)) {
+        section_end = true;
+        break;
+      }
+      // The section keywords starts with backslash. We stop if a new section
+      // is found.
+      if (!line->empty() && (*line)[0] == '\\') {
+        if (line->find("-grams:") != std::string::npos ||
+            line->find("\\end\\") != std::string::npos) {
+          section_end = true;
+          break;
         }
+      }
+      if (*SkipArpaWhiteSpace(line->c_str()) == '\0') continue;
+      line_starts.push_back(lines.size());
+      lines.append(*line);
+      lines.push_back('\0');
+    }
+    if (ngrams->size + line_starts.size() > expected_count) {
+      KALDI_ERR << "Header said there would be " << expected_count
+                << " n-grams of order " << order << ", but we saw more.";
+    }
+    if (line_starts.empty()) continue;
+
+    ParseLinesFunc func(this, &lines, &line_starts, ngrams->size, ngrams);
+    RunRangeMultiThreaded(num_threads_, line_starts.size(), &func);
+    int64 error_line = func.ErrorLine();
+    if (error_line != -1) {
+      KALDI_ERR << "Error parsing line of order " << order << " in Arpa "
+                << "file: " << lines.c_str() + line_starts[error_line];
+    }
+    ngrams->size += line_starts.size();
+  }
 
-        // Creates LmState for the current word sequence.
-        bool is_unigram = (order == 1) ? true : false;
-        float logprob;
-        float backoff_logprob;
-        KALDI_ASSERT(ConvertStringToReal(col[0], &logprob));
-        KALDI_ASSERT(ConvertStringToReal(col[1 + order], &backoff_logprob));
-        if (natural_base_) {
-          logprob *= log(10);
-          backoff_logprob *= log(10);
-        }
-        LmState *lm_state = new LmState(is_unigram, logprob, backoff_logprob);
-
-        // Inserts the current LmState to <seq_to_state_>.
-        std::vector<int32> seq(order, 0);
-        for (int32 index = 0; index < order; ++index) {
-          int32 word;
-          KALDI_ASSERT(ConvertStringToInteger(col[1 + index], &word));
-          seq[index] = word;
-        }
-        KALDI_ASSERT(seq_to_state_.find(seq) == seq_to_state_.end());
-        seq_to_state_[seq] = lm_state;
-
-        // If n-gram order is larger than 1, we have to add possible child to
-        // existing LmStates. We have the following two assumptions:
-        // 1. N-grams are processed from small order to larger ones, i.e., from
-        //    1, 2, ... to the highest order.
-        // 2. If a n-gram exists in the Arpa format language model, then the
-        //    "history" n-gram also exists. For example, if "A B C" is a valid
-        //    n-gram, then "A B" is also a valid n-gram.
-        if (order > 1) {
-          std::vector<int32> hist(seq.begin(), seq.begin() + order - 1);
-          int32 word = seq[seq.size() - 1];
-          KALDI_ASSERT(seq_to_state_.find(hist) != seq_to_state_.end());
-          seq_to_state_[hist]->AddChild(std::make_pair(word, lm_state));
-        } else {
-          // Figures out <max_word_id>.
-          KALDI_ASSERT(seq.size() == 1);
-          if (seq[0] > max_word_id) {
-            max_word_id = seq[0];
-          }
-        }
+  // There may be fewer n-grams than the header said, e.g. if lines with OOV
+  // words were removed.
+  ngrams->words.resize(static_cast<int64>(ngrams->size) * order);
+  ngrams->logprobs.resize(ngrams->size);
+  ngrams->backoff_logprobs.resize(ngrams->size);
+}
+
+bool ConstArpaLmBuilder::ParseLines(const std::string &lines,
+                                    const std::vector<int64> &line_starts,
+                                    int64 begin, int64 end, int32 first_ngram,
+                                    NgramArray *ngrams,
+                                    int64 *error_line) const {
+  int32 order = ngrams->order;
+  for (int64 l = begin; l < end; ++l) {
+    const char *p = lines.c_str() + line_starts[l];
+    char *next;
+    int32 i = first_ngram + l;
+
+    // Logprob, word sequence, and backoff_logprob; if backoff_logprob is 0, it
+    // will not appear in Arpa format language model.
+    float logprob = strtod(p, &next);
+    bool ok = (next != p);
+    int32 *words = &(ngrams->words[0]) + static_cast<int64>(i) * order;
+    for (int32 k = 0; k < order && ok; ++k) {
+      p = SkipArpaWhiteSpace(next);
+      long word = strtol(p, &next, 10);
+      ok = (next != p && word >= 0 && word <= std::numeric_limits<int32>::max()
+            && (*next == ' ' || *next == '\t' || *next == '\r' ||
+                *next == '\0'));
+      words[k] = word;
+    }
+    float backoff_logprob = 0.0;
+    if (ok) {
+      p = SkipArpaWhiteSpace(next);
+      if (*p != '\0') {
+        backoff_logprob = strtod(p, &next);
+        ok = (next != p && *SkipArpaWhiteSpace(next) == '\0');
       }
-    } while (getline(is, line) && !is.eof());
-    if (ngram_count > num_ngrams[order] ||
-        (ngram_count == 0 && num_ngrams[order] != 0)) {
-      KALDI_ERR << "Header said there would be " << num_ngrams[order]
-                << " n-grams of order " << order << ", but we saw "
-                << ngram_count;
+    }
+    if (!ok) {
+      *error_line = l;
+      return false;
+    }
+    if (natural_base_) {
+      logprob *= log(10);
+      backoff_logprob *= log(10);
+    }
+    ngrams->logprobs[i] = logprob;
+    ngrams->backoff_logprobs[i] = backoff_logprob;
+  }
+  return true;
+}
+
+void ConstArpaLmBuilder::SortNgrams(NgramArray *ngrams) {
+  int32 size = ngrams->size, order = ngrams->order;
+  NgramIndexLess less(&(ngrams->words[0]), order);
+  std::vector<int32> indexes(size);
+  for (int32 i = 0; i < size; ++i) indexes[i] = i;
+
+  // Sorts <num_threads_> ranges in parallel, and then merges them pairwise,
+  // which halves the number of ranges each time.
+  std::vector<int64> boundaries;
+  int32 num_ranges = std::max<int32>(1, std::min<int32>(num_threads_, size));
+  for (int32 r = 0; r <= num_ranges; ++r)
+    boundaries.push_back(static_cast<int64>(size) * r / num_ranges);
+  {
+    SortRangesFunc func(&indexes, less, &boundaries, NULL);
+    RunRangeMultiThreaded(num_threads_, num_ranges, &func);
+  }
+  while (boundaries.size() > 2) {
+    // Range r of <merged> is ranges 2r and 2r + 1 of <boundaries> (or just 2r,
+    // the last time if the number of ranges is odd, in which case its middle
+    // is its end and there is nothing to merge).
+    std::vector<int64> merged, middles;
+    for (size_t r = 0; r + 1 < boundaries.size(); r += 2) {
+      merged.push_back(boundaries[r]);
+      middles.push_back(boundaries[r + 1]);
+    }
+    merged.push_back(boundaries.back());
+    SortRangesFunc func(&indexes, less, &merged, &middles);
+    RunRangeMultiThreaded(num_threads_, middles.size(), &func);
+    boundaries.swap(merged);
+  }
+
+  // Checks for duplicates.
+  for (int32 i = 1; i < size; ++i) {
+    if (!less(indexes[i - 1], indexes[i])) {
+      const int32 *words = ngrams->Words(indexes[i]);
+      std::ostringstream os;
+      for (int32 k = 0; k < order; ++k) os << words[k] << ' ';
+      KALDI_ERR << "Duplicate n-gram in Arpa file: " << os.str();
     }
   }
 
-  // <num_words_> is <max_word_id> plus 1.
-  num_words_ = max_word_id + 1;
+  std::vector<int32> words(ngrams->words.size());
+  std::vector<float> logprobs(size), backoff_logprobs(size);
+  {
+    PermuteNgramsFunc func(ngrams, &indexes, &words, &logprobs,
+                           &backoff_logprobs);
+    RunRangeMultiThreaded(num_threads_, size, &func);
+  }
+  ngrams->words.swap(words);
+  ngrams->logprobs.swap(logprobs);
+  ngrams->backoff_logprobs.swap(backoff_logprobs);
+}
+
+void ConstArpaLmBuilder::LinkChildren(const int32 order) {
+  NgramArray &parents = ngrams_[order - 1];
+  const NgramArray &children = ngrams_[order];
+  parents.first_child.resize(parents.size);
+  parents.num_children.resize(parents.size);
+  LinkChildrenFunc func(&parents, &children);
+  RunRangeMultiThreaded(num_threads_, parents.size, &func);
+
+  int64 num_linked = 0;
+  for (int32 i = 0; i < parents.size; ++i)
+    num_linked += parents.num_children[i];
+  if (num_linked != children.size) {
+    KALDI_ERR << "Some n-grams of order " << (order + 1) << " in the Arpa file "
+              << "have a history that is not an n-gram of order " << order;
+  }
+}
+
+int32 ConstArpaLmBuilder::NumLeafChildren(const int32 order,
+                                          const int32 i) const {
+  const NgramArray &ngrams = ngrams_[order - 1];
+  int32 num_children = ngrams.NumChildren(i), num_leaves = 0;
+  for (int32 c = 0; c < num_children; ++c)
+    if (ngrams_[order].IsLeaf(ngrams.first_child[i] + c)) ++num_leaves;
+  return num_leaves;
+}
+
+int32 ConstArpaLmBuilder::MemSize(const int32 order, const int32 i) const {
+  const NgramArray &ngrams = ngrams_[order - 1];
+  int32 num_children = ngrams.NumChildren(i);
+  if (order > 1 && ngrams.IsLeaf(i)) {
+    // We don't create an entry in this case; the logprob will be stored in
+    // the same int32 that we would normally store the pointer in.  Unigram
+    // states have LmStates even if they are leaves.
+    return 0;
+  } else if (quantize_bits_ == 0) {
+    // We store the following information:
+    // logprob, backoff_logprob, children.size() and children data.
+    return (3 + 2 * num_children);
+  } else {
+    // We store the codes, the number of leaf and other children, the other
+    // children, the words of the leaf children and their codes.
+    int32 num_leaves = NumLeafChildren(order, i);
+    return (3 + 2 * (num_children - num_leaves) + num_leaves +
+            (num_leaves * quantize_bits_ + 31) / 32);
+  }
 }
 
 // ConstArpaLm can be built in the following steps, assuming we have already
-// created LmStates <seq_to_state_>:
-// 1. Sort LmStates lexicographically.
-//    This enables us to compute relative address. When we say lexicographic, we
-//    treat the word-ids as letters. After sorting, the LmStates are in the
+// read the n-grams into <ngrams_>, sorted, and linked them to their children:
+// 1. Work out the addresses of the LmStates, relative to <lm_states_>.  The
+//    LmStates are in lexicographic order of their word sequences, i.e. in the
 //    following order:
 //    ...
 //    A B
@@ -396,10 +832,10 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
 //    A B B
 //    A B C
 //    ...
-//    where each line represents a LmState.
-// 2. Update <my_address> in LmState, which is relative to the first element in
-//    <sorted_vec>.
-// 3. Put the following structure into the memory block
+//    so each LmState is followed by the subtree of its children.  We compute
+//    the size of each subtree from the highest order down, then the addresses
+//    from the unigrams up.
+// 2. Put the following structure into the memory block
 //    struct LmState {
 //      float logprob;
 //      float backoff_logprob;
@@ -410,41 +846,32 @@ void ConstArpaLmBuilder::Read(std::istream &is, bool binary) {
 //    At the same time, we will also create two special buffers:
 //    <unigram_states_>
 //    <overflow_buffer_>
+// All these steps are done in parallel over the n-grams of each order.
 void ConstArpaLmBuilder::Build() {
-  // STEP 1: sorting LmStates lexicographically.
-  // Vector for holding the sorted LmStates.
-  std::vector<std::pair<std::vector<int32>, LmState*> > sorted_vec;
-  unordered_map<std::vector<int32>,
-                LmState*, VectorHasher<int32> >::iterator iter;
-  for (iter = seq_to_state_.begin(); iter != seq_to_state_.end(); ++iter) {
-    if (iter->second->MemSize() > 0) {
-      sorted_vec.push_back(std::make_pair(iter->first, iter->second));
-    }
-  }
-
-  // Using the default "<" operation will sort LmState lexicographically,
-  // because of the following two facts:
-  // 1. "<" operation is defined for std::pair, and it compares std::pair
-  //    lexicographically, i.e., it first compares the first elements, and only
-  //    compares the second when the first elements are equivalent.
-  // 2. "<" operation is defined for std::vector, and it also compares
-  //    std::vector lexicographically by default.
-  std::sort(sorted_vec.begin(), sorted_vec.end());
-
-  // STEP 2: updating <my_address> in LmState.
-  for (int32 i = 0; i < sorted_vec.size(); ++i) {
-    lm_states_size_ += sorted_vec[i].second->MemSize();
-    if (i == 0) {
-      sorted_vec[i].second->SetMyAddress(0);
-    } else {
-      sorted_vec[i].second->SetMyAddress(sorted_vec[i - 1].second->MyAddress()
-          + sorted_vec[i - 1].second->MemSize());
-    }
+  // STEP 1: working out the addresses.
+  for (int32 order = ngram_order_; order >= 1; --order) {
+    ngrams_[order - 1].address.resize(ngrams_[order - 1].size);
+    SubtreeSizeFunc func(this, order);
+    RunRangeMultiThreaded(num_threads_, ngrams_[order - 1].size, &func);
+  }
+  int64 address = 0;
+  NgramArray &unigrams = ngrams_[0];
+  for (int32 i = 0; i < unigrams.size; ++i) {
+    int64 size = unigrams.address[i];
+    unigrams.address[i] = address;
+    address += size;
+  }
+  if (address > std::numeric_limits<int32>::max())
+    KALDI_ERR << "Language model is too large for ConstArpaLm.";
+  lm_states_size_ = address;
+  for (int32 order = 1; order < ngram_order_; ++order) {
+    ChildAddressFunc func(this, order);
+    RunRangeMultiThreaded(num_threads_, ngrams_[order - 1].size, &func);
   }
+  if (quantize_bits_ != 0) BuildCodebooks();
 
-  // STEP 3: creating memory block to store LmStates.
+  // STEP 2: creating memory block to store LmStates.
   // Reserves a memory block for LmStates.
-  int32 lm_states_index = 0;
   try {
     lm_states_ = new int32[lm_states_size_];
   } catch(const std::exception &e) {
@@ -452,86 +879,207 @@ void ConstArpaLmBuilder::Build() {
   }
 
   // Puts data into memory block.
-  unigram_states_ = new int32*[num_words_];
-  std::vector<int32*> overflow_buffer_vec;
+  unigram_states_ = new int64[num_words_];
   for (int32 i = 0; i < num_words_; ++i) {
-    unigram_states_[i] = NULL;
+    unigram_states_[i] = 0;
+  }
+  std::vector<std::pair<int64, int64> > overflows;
+  Mutex overflow_mutex;
+  for (int32 order = 1; order <= ngram_order_; ++order) {
+    WriteLmStatesFunc func(this, order, &overflows, &overflow_mutex);
+    RunRangeMultiThreaded(num_threads_, ngrams_[order - 1].size, &func);
   }
-  for (int32 i = 0; i < sorted_vec.size(); ++i) {
-    // Current address.
-    int32* parent_address = lm_states_ + lm_states_index;
 
+  // Creates a separate loop up table for unigrams to improve efficiency, since
+  // those will be looked up pretty frequently.
+  for (int32 i = 0; i < unigrams.size; ++i)
+    unigram_states_[unigrams.words[i]] = unigrams.address[i] + 1;
+
+  // Puts the addresses that cannot be represented by 30 bits into
+  // <overflow_buffer_>.  We sort them by where they are used first, so that
+  // the output does not depend on the order the threads got to them.
+  std::sort(overflows.begin(), overflows.end());
+  overflow_buffer_size_ = overflows.size();
+  overflow_buffer_ = new int64[overflow_buffer_size_];
+  for (int32 i = 0; i < overflow_buffer_size_; ++i) {
+    overflow_buffer_[i] = overflows[i].second;
+    int32 child_info = i * 2;
+    child_info |= 1;
+    child_info *= -1;
+    lm_states_[overflows[i].first] = child_info;
+  }
+
+  // We no longer need the n-grams.
+  std::vector<NgramArray>().swap(ngrams_);
+  is_built_ = true;
+}
+
+void ConstArpaLmBuilder::WriteLmState(
+    const int32 order, const int32 i,
+    std::vector<std::pair<int64, int64> > *overflows, Mutex *overflow_mutex) {
+  if (MemSize(order, i) == 0) return;
+  const NgramArray &ngrams = ngrams_[order - 1];
+  // Current address, relative to <lm_states_>.
+  int64 parent_address = ngrams.address[i];
+  int64 lm_states_index = parent_address;
+  float logprob = ngrams.logprobs[i];
+  float backoff_logprob = ngrams.backoff_logprobs[i];
+  int32 num_children = ngrams.NumChildren(i);
+  int32 num_leaves = 0;
+
+  if (quantize_bits_ == 0) {
     // Adds logprob.
-    float logprob = sorted_vec[i].second->Logprob();
     lm_states_[lm_states_index++] = *reinterpret_cast<int32*>(&logprob);
 
     // Adds backoff_logprob.
-    float backoff_logprob = sorted_vec[i].second->BackoffLogprob();
     lm_states_[lm_states_index++] = *reinterpret_cast<int32*>(&backoff_logprob);
 
     // Adds num_children.
-    lm_states_[lm_states_index++] = sorted_vec[i].second->NumChildren();
-
-    // Adds children, there are 3 cases:
-    // 1. Child is a leaf and not unigram
-    // 2. Child is not a leaf or is unigram
-    //    2.1 Relative address can be represented by 30 bits
-    //    2.2 Relative address cannot be represented by 30 bits
-    sorted_vec[i].second->SortChildren();
-    for (int32 j = 0; j < sorted_vec[i].second->NumChildren(); ++j) {
-      int32 child_info;
-      if (sorted_vec[i].second->GetChild(j).second->MemSize() == 0) {
-        // Child is a leaf and not unigram. In this case we will not create an
-        // entry in <lm_states_>; instead, we put the logprob in the place where
-        // we normally store the poitner.
-        float child_logprob =
-            sorted_vec[i].second->GetChild(j).second->Logprob();
-        child_info = *reinterpret_cast<int32*>(&child_logprob);
-        child_info &= ~1;   // Sets the last bit to 0 so <child_info> is even.
+    lm_states_[lm_states_index++] = num_children;
+  } else {
+    // Adds the codebook indexes of logprob and backoff_logprob.
+    uint32 codes = Quantize(2 * (order - 1), logprob) |
+        (Quantize(2 * (order - 1) + 1, backoff_logprob) << quantize_bits_);
+    lm_states_[lm_states_index++] = static_cast<int32>(codes);
+
+    // Adds the number of leaf children, and of the other children.
+    num_leaves = NumLeafChildren(order, i);
+    lm_states_[lm_states_index++] = num_leaves;
+    lm_states_[lm_states_index++] = num_children - num_leaves;
+  }
+
+  // Adds children, there are 3 cases:
+  // 1. Child is a leaf and not unigram
+  // 2. Child is not a leaf or is unigram
+  //    2.1 Relative address can be represented by 30 bits
+  //    2.2 Relative address cannot be represented by 30 bits
+  // In the quantized case, leaf children are added after the others.  The
+  // children are sorted by word.
+  const NgramArray *children = (num_children > 0) ? &ngrams_[order] : NULL;
+  for (int32 j = 0; j < num_children; ++j) {
+    int32 c = ngrams.first_child[i] + j;
+    int32 child_info;
+    if (children->IsLeaf(c)) {
+      if (quantize_bits_ != 0) continue;
+      // Child is a leaf and not unigram. In this case we will not create an
+      // entry in <lm_states_>; instead, we put the logprob in the place where
+      // we normally store the poitner.
+      float child_logprob = children->logprobs[c];
+      child_info = *reinterpret_cast<int32*>(&child_logprob);
+      child_info &= ~1;   // Sets the last bit to 0 so <child_info> is even.
+    } else {
+      // Child is not a leaf or is unigram.
+      int64 offset = children->address[c] - parent_address;
+      KALDI_ASSERT(offset > 0);
+      if (offset <= max_address_offset_) {
+        // Relative address can be represented by 30 bits.
+        child_info = offset * 2;
+        child_info |= 1;
       } else {
-        // Child is not a leaf or is unigram.
-        int64 offset = sorted_vec[i].second->GetChild(j).second->MyAddress()
-            - sorted_vec[i].second->MyAddress();
-        KALDI_ASSERT(offset > 0);
-        if (offset <= max_address_offset_) {
-          // Relative address can be represented by 30 bits.
-          child_info = offset * 2;
-          child_info |= 1;
-        } else {
-          // Relative address cannot be represented by 30 bits, we have to put
-          // the child address into <overflow_buffer_>.
-          int32* abs_address = parent_address + offset;
-          overflow_buffer_vec.push_back(abs_address);
-          int32 overflow_buffer_index = overflow_buffer_vec.size() - 1;
-          child_info = overflow_buffer_index * 2;
-          child_info |= 1;
-          child_info *= -1;
-        }
+        // Relative address cannot be represented by 30 bits, we have to put
+        // the child address into <overflow_buffer_>; Build() does that, and
+        // sets the child info.  As for <unigram_states_>, we add one to the
+        // address.
+        overflow_mutex->Lock();
+        overflows->push_back(std::make_pair(lm_states_index + 1,
+                                            parent_address + offset + 1));
+        overflow_mutex->Unlock();
+        child_info = 0;
       }
-      // Child word.
-      lm_states_[lm_states_index++] = sorted_vec[i].second->GetChild(j).first;
-      // Child info.
-      lm_states_[lm_states_index++] = child_info;
     }
+    // Child word.
+    lm_states_[lm_states_index++] = children->Words(c)[order];
+    // Child info.
+    lm_states_[lm_states_index++] = child_info;
+  }
 
-    // If the current state corresponds to an unigram, then create a separate
-    // loop up table to improve efficiency, since those will be looked up pretty
-    // frequently.
-    if (sorted_vec[i].second->IsUnigram()) {
-      KALDI_ASSERT(sorted_vec[i].first.size() == 1);
-      unigram_states_[sorted_vec[i].first[0]] = parent_address;
+  if (num_leaves > 0) {
+    // Adds the words of the leaf children, and then their logprob codebook
+    // indexes, packed into whole int32s.
+    int32 *leaf_words = lm_states_ + lm_states_index;
+    lm_states_index += num_leaves;
+    int32 *leaf_codes = lm_states_ + lm_states_index;
+    int32 codes_size = (num_leaves * quantize_bits_ + 31) / 32;
+    std::fill(leaf_codes, leaf_codes + codes_size, 0);
+    lm_states_index += codes_size;
+    int32 k = 0;
+    for (int32 j = 0; j < num_children; ++j) {
+      int32 c = ngrams.first_child[i] + j;
+      if (!children->IsLeaf(c)) continue;
+      leaf_words[k] = children->Words(c)[order];
+      uint32 code = Quantize(2 * order, children->logprobs[c]);
+      if (quantize_bits_ == 8)
+        reinterpret_cast<unsigned char*>(leaf_codes)[k] = code;
+      else
+        reinterpret_cast<uint16*>(leaf_codes)[k] = code;
+      ++k;
     }
+    KALDI_ASSERT(k == num_leaves);
   }
-  KALDI_ASSERT(lm_states_size_ == lm_states_index);
+  KALDI_ASSERT(lm_states_index == parent_address + MemSize(order, i));
+}
 
-  // Move <overflow_buffer_> from vector holder to array.
-  overflow_buffer_size_ = overflow_buffer_vec.size();
-  overflow_buffer_ = new int32*[overflow_buffer_size_];
-  for (int32 i = 0; i < overflow_buffer_size_; ++i) {
-    overflow_buffer_[i] = overflow_buffer_vec[i];
+void ConstArpaLmBuilder::BuildCodebooks() {
+  KALDI_ASSERT(quantize_bits_ > 0 && ngram_order_ > 0);
+  // Each codebook entry is the mean of a range of the sorted values, with the
+  // same number of values in each range, so the codebooks are sorted.
+  // Backoff log probabilities of zero, which are very common, are represented
+  // exactly by entry 0 of the backoff codebooks, so we leave them out.
+  int32 codebook_size = 1 << quantize_bits_;
+  codebooks_ = new float[2 * ngram_order_ * codebook_size];
+  std::fill(codebooks_, codebooks_ + 2 * ngram_order_ * codebook_size, 0.0);
+  for (int32 c = 0; c < 2 * ngram_order_; ++c) {
+    const NgramArray &ngrams = ngrams_[c / 2];
+    std::vector<float> vals;
+    if (c % 2 == 0) {
+      vals = ngrams.logprobs;
+    } else {
+      for (int32 i = 0; i < ngrams.size; ++i)
+        if (ngrams.backoff_logprobs[i] != 0.0)
+          vals.push_back(ngrams.backoff_logprobs[i]);
+    }
+    std::sort(vals.begin(), vals.end());
+    int64 num_values = vals.size();
+    if (num_values == 0) continue;
+    int32 first_entry = (c % 2 == 1) ? 1 : 0;  // Entry 0 of backoff is 0.0.
+    int32 num_bins = codebook_size - first_entry;
+    float *codebook = codebooks_ + c * codebook_size + first_entry;
+    for (int32 b = 0; b < num_bins; ++b) {
+      int64 begin = b * num_values / num_bins,
+          end = (b + 1) * num_values / num_bins;
+      if (begin == end) {
+        // Fewer values than entries.
+        codebook[b] = vals[std::min(begin, num_values - 1)];
+      } else {
+        double sum = 0.0;
+        for (int64 k = begin; k < end; ++k) sum += vals[k];
+        codebook[b] = sum / (end - begin);
+      }
+    }
+    KALDI_VLOG(1) << "Quantized " << num_values << ((c % 2 == 1) ?
+        " nonzero backoff" : "") << " log probabilities of order "
+        << (c / 2 + 1) << " into " << std::min<int64>(num_bins, num_values)
+        << " bins.";
   }
+}
 
-  is_built_ = true;
+uint32 ConstArpaLmBuilder::Quantize(const int32 codebook,
+                                    const float value) const {
+  int32 codebook_size = 1 << quantize_bits_;
+  const float *entries = codebooks_ + codebook * codebook_size;
+  const float *begin = entries, *end = entries + codebook_size;
+  if (codebook % 2 == 1) {
+    if (value == 0.0) return 0;
+    ++begin;
+  }
+  // The codebooks are sorted; finds the closest entry.
+  const float *iter = std::lower_bound(begin, end, value);
+  if (iter == end) {
+    --iter;
+  } else if (iter != begin && value - *(iter - 1) < *iter - value) {
+    --iter;
+  }
+  return iter - entries;
 }
 
 void ConstArpaLmBuilder::Write(std::ostream &os, bool binary) const {
@@ -543,57 +1091,162 @@ void ConstArpaLmBuilder::Write(std::ostream &os, bool binary) const {
   // Creates ConstArpaLm.
   ConstArpaLm const_arpa_lm(bos_symbol_, eos_symbol_, unk_symbol_, ngram_order_,
                             num_words_, overflow_buffer_size_, lm_states_size_,
-                            unigram_states_, overflow_buffer_, lm_states_);
+                            unigram_states_, overflow_buffer_, lm_states_,
+                            quantize_bits_, codebooks_);
   const_arpa_lm.Write(os, binary);
 }
 
+namespace {
+
+// Layout of the header that follows the token <ConstArpaLmMapped>; all its
+// fields are int64.
+enum ConstArpaLmHeaderField {
+  kByteOrderMark = 0,
+  kBosSymbol,
+  kEosSymbol,
+  kUnkSymbol,
+  kNgramOrder,
+  kNumWords,
+  kOverflowBufferSize,
+  kLmStatesSize,
+  kQuantizeBits,
+  kLmStatesOffset,
+  kUnigramStatesOffset,
+  kOverflowBufferOffset,
+  kCodebooksOffset,
+  kFileSize,
+  kNumHeaderFields
+};
+
+const int64 kConstArpaLmByteOrderMark = 0x0102030405060708LL;
+
+const char *kConstArpaLmToken = "<ConstArpaLmMapped>";
+
+// The header starts at this offset from the beginning of the file; the binary
+// header "\0B" and the token <ConstArpaLmMapped> come before it.
+const int64 kConstArpaLmHeaderOffset = kConstArpaLmAlignment;
+
+// Offset of the end of the token, i.e. the size of the binary header "\0B",
+// the token and the space written after it.
+inline int64 ConstArpaLmTokenEnd() {
+  return 2 + strlen(kConstArpaLmToken) + 1;
+}
+
+inline int64 AlignConstArpaLmOffset(int64 offset) {
+  return (offset + kConstArpaLmAlignment - 1) / kConstArpaLmAlignment *
+      kConstArpaLmAlignment;
+}
+
+// Number of floats in the codebooks of a language model (see
+// ConstArpaLm::codebooks_).
+inline int64 ConstArpaLmCodebooksSize(int64 ngram_order, int64 quantize_bits) {
+  return (quantize_bits == 0) ? 0 : 2 * ngram_order << quantize_bits;
+}
+
+// Works out the section offsets of a language model with the given sizes.
+void ComputeConstArpaLmOffsets(int64 lm_states_size, int64 num_words,
+                               int64 overflow_buffer_size,
+                               int64 codebooks_size, int64 *header) {
+  header[kByteOrderMark] = kConstArpaLmByteOrderMark;
+  header[kLmStatesOffset] = AlignConstArpaLmOffset(
+      kConstArpaLmHeaderOffset + kNumHeaderFields * sizeof(int64));
+  header[kUnigramStatesOffset] = AlignConstArpaLmOffset(
+      header[kLmStatesOffset] + lm_states_size * sizeof(int32));
+  header[kOverflowBufferOffset] = AlignConstArpaLmOffset(
+      header[kUnigramStatesOffset] + num_words * sizeof(int64));
+  header[kCodebooksOffset] = AlignConstArpaLmOffset(
+      header[kOverflowBufferOffset] + overflow_buffer_size * sizeof(int64));
+  header[kFileSize] = header[kCodebooksOffset] +
+      codebooks_size * sizeof(float);
+}
+
+// Writes zeros up to <offset>; <pos> is the current offset from the beginning
+// of the file.
+void WritePaddingTo(std::ostream &os, int64 offset, int64 *pos) {
+  KALDI_ASSERT(*pos <= offset);
+  for (; *pos < offset; ++(*pos)) os.put('\0');
+}
+
+// Skips input up to <offset>.
+void ReadPaddingTo(std::istream &is, int64 offset, int64 *pos) {
+  if (*pos > offset)
+    KALDI_ERR << "Corrupted ConstArpaLm file (bad section offset).";
+  is.ignore(offset - *pos);
+  *pos = offset;
+}
+
+void WriteSection(std::ostream &os, const void *data, int64 num_bytes,
+                  int64 *pos) {
+  os.write(reinterpret_cast<const char*>(data), num_bytes);
+  *pos += num_bytes;
+}
+
+void ReadSection(std::istream &is, void *data, int64 num_bytes, int64 *pos) {
+  is.read(reinterpret_cast<char*>(data), num_bytes);
+  if (is.fail())
+    KALDI_ERR << "Error reading ConstArpaLm (file truncated?)";
+  *pos += num_bytes;
+}
+
+}  // namespace
+
+ConstArpaLm::~ConstArpaLm() {
+  if (memory_assigned_) {
+    delete[] lm_states_;
+    delete[] unigram_states_;
+    delete[] overflow_buffer_;
+    delete[] codebooks_;
+  }
+#ifndef _MSC_VER
+  if (mapped_data_ != NULL)
+    munmap(mapped_data_, mapped_size_);
+#endif
+}
+
 void ConstArpaLm::Write(std::ostream &os, bool binary) const {
   KALDI_ASSERT(initialized_);
   if (!binary) {
     KALDI_ERR << "text-mode writing is not implemented for ConstArpaLm.";
   }
 
-  // Misc info.
-  WriteBasicType(os, binary, bos_symbol_);
-  WriteBasicType(os, binary, eos_symbol_);
-  WriteBasicType(os, binary, unk_symbol_);
-  WriteBasicType(os, binary, ngram_order_);
-
-  // LmStates section.
-  WriteBasicType(os, binary, lm_states_size_);
-  for (int32 i = 0; i < lm_states_size_; ++i) {
-    WriteBasicType(os, binary, lm_states_[i]);
-  }
-
-  // Unigram section. We write memory offset to disk instead of the absolute
-  // pointers.
-  WriteBasicType(os, binary, num_words_);
-  for (int32 i = 0; i < num_words_; ++i) {
-    // The relative address here is a little bit tricky:
-    // 1. If the original address is NULL, then we set the relative address to
-    //    zero.
-    // 2. If the original address is not NULL, we set it to the following:
-    //      unigram_states_[i] - lm_states_ + 1
-    //    we plus 1 to ensure that the above value is positive.
-    int64 tmp_address = (unigram_states_[i] == NULL) ? 0 :
-        unigram_states_[i] - lm_states_ + 1;
-    WriteBasicType(os, binary, tmp_address);
-  }
-
-  // Overflow section. We write memory offset to disk instead of the absolute
-  // pointers.
-  WriteBasicType(os, binary, overflow_buffer_size_);
-  for (int32 i = 0; i < overflow_buffer_size_; ++i) {
-    // The relative address here is a little bit tricky:
-    // 1. If the original address is NULL, then we set the relative address to
-    //    zero.
-    // 2. If the original address is not NULL, we set it to the following:
-    //      overflow_buffer_[i] - lm_states_ + 1
-    //    we plus 1 to ensure that the above value is positive.
-    int64 tmp_address = (overflow_buffer_[i] == NULL) ? 0 :
-        overflow_buffer_[i] - lm_states_ + 1;
-    WriteBasicType(os, binary, tmp_address);
-  }
+  int64 header[kNumHeaderFields];
+  int64 codebooks_size = ConstArpaLmCodebooksSize(ngram_order_,
+                                                  quantize_bits_);
+  ComputeConstArpaLmOffsets(lm_states_size_, num_words_,
+                            overflow_buffer_size_, codebooks_size, header);
+  header[kBosSymbol] = bos_symbol_;
+  header[kEosSymbol] = eos_symbol_;
+  header[kUnkSymbol] = unk_symbol_;
+  header[kNgramOrder] = ngram_order_;
+  header[kNumWords] = num_words_;
+  header[kOverflowBufferSize] = overflow_buffer_size_;
+  header[kLmStatesSize] = lm_states_size_;
+  header[kQuantizeBits] = quantize_bits_;
+
+  // The offsets are from the beginning of the file, assuming the binary header
+  // "\0B" was written just before we were called.  That is not true inside an
+  // archive, but then the file cannot be mapped anyway and Read() only needs
+  // the offsets to be consistent.
+  WriteToken(os, binary, kConstArpaLmToken);
+  int64 pos = ConstArpaLmTokenEnd();
+  WritePaddingTo(os, kConstArpaLmHeaderOffset, &pos);
+  WriteSection(os, header, sizeof(header), &pos);
+
+  WritePaddingTo(os, header[kLmStatesOffset], &pos);
+  WriteSection(os, lm_states_, lm_states_size_ * sizeof(int32), &pos);
+
+  WritePaddingTo(os, header[kUnigramStatesOffset], &pos);
+  WriteSection(os, unigram_states_, num_words_ * sizeof(int64), &pos);
+
+  WritePaddingTo(os, header[kOverflowBufferOffset], &pos);
+  WriteSection(os, overflow_buffer_, overflow_buffer_size_ * sizeof(int64),
+               &pos);
+
+  WritePaddingTo(os, header[kCodebooksOffset], &pos);
+  WriteSection(os, codebooks_, codebooks_size * sizeof(float), &pos);
+  KALDI_ASSERT(pos == header[kFileSize]);
+  if (os.fail())
+    KALDI_ERR << "Error writing ConstArpaLm.";
 }
 
 void ConstArpaLm::Read(std::istream &is, bool binary) {
@@ -602,50 +1255,174 @@ void ConstArpaLm::Read(std::istream &is, bool binary) {
     KALDI_ERR << "text-mode reading is not implemented for ConstArpaLm.";
   }
 
-  // Misc info.
-  ReadBasicType(is, binary, &bos_symbol_);
-  ReadBasicType(is, binary, &eos_symbol_);
-  ReadBasicType(is, binary, &unk_symbol_);
-  ReadBasicType(is, binary, &ngram_order_);
+  if (is.peek() == '<') {
+    // Current layout.  We read the sections into memory; ReadMapped() avoids
+    // this if we are reading from a file.
+    ExpectToken(is, binary, kConstArpaLmToken);
+    int64 pos = ConstArpaLmTokenEnd();
+    int64 header[kNumHeaderFields];
+    ReadPaddingTo(is, kConstArpaLmHeaderOffset, &pos);
+    ReadSection(is, header, sizeof(header), &pos);
+    if (header[kByteOrderMark] != kConstArpaLmByteOrderMark)
+      KALDI_ERR << "ConstArpaLm was written on a machine with different "
+                << "byte order.";
+    bos_symbol_ = header[kBosSymbol];
+    eos_symbol_ = header[kEosSymbol];
+    unk_symbol_ = header[kUnkSymbol];
+    ngram_order_ = header[kNgramOrder];
+    num_words_ = header[kNumWords];
+    overflow_buffer_size_ = header[kOverflowBufferSize];
+    lm_states_size_ = header[kLmStatesSize];
+    quantize_bits_ = header[kQuantizeBits];
+    KALDI_ASSERT(quantize_bits_ == 0 || quantize_bits_ == 8 ||
+                 quantize_bits_ == 16);
+
+    ReadPaddingTo(is, header[kLmStatesOffset], &pos);
+    lm_states_ = new int32[lm_states_size_];
+    ReadSection(is, lm_states_, lm_states_size_ * sizeof(int32), &pos);
+
+    ReadPaddingTo(is, header[kUnigramStatesOffset], &pos);
+    unigram_states_ = new int64[num_words_];
+    ReadSection(is, unigram_states_, num_words_ * sizeof(int64), &pos);
+
+    ReadPaddingTo(is, header[kOverflowBufferOffset], &pos);
+    overflow_buffer_ = new int64[overflow_buffer_size_];
+    ReadSection(is, overflow_buffer_, overflow_buffer_size_ * sizeof(int64),
+                &pos);
+
+    if (quantize_bits_ != 0) {
+      int64 codebooks_size = ConstArpaLmCodebooksSize(ngram_order_,
+                                                      quantize_bits_);
+      ReadPaddingTo(is, header[kCodebooksOffset], &pos);
+      codebooks_ = new float[codebooks_size];
+      ReadSection(is, codebooks_, codebooks_size * sizeof(float), &pos);
+    }
+  } else {
+    // Older layout, with every number written by WriteBasicType(); it is
+    // never quantized.
+    // Misc info.
+    ReadBasicType(is, binary, &bos_symbol_);
+    ReadBasicType(is, binary, &eos_symbol_);
+    ReadBasicType(is, binary, &unk_symbol_);
+    ReadBasicType(is, binary, &ngram_order_);
+
+    // LmStates section.
+    ReadBasicType(is, binary, &lm_states_size_);
+    lm_states_ = new int32[lm_states_size_];
+    for (int32 i = 0; i < lm_states_size_; ++i) {
+      ReadBasicType(is, binary, &lm_states_[i]);
+    }
 
-  // LmStates section.
-  ReadBasicType(is, binary, &lm_states_size_);
-  lm_states_ = new int32[lm_states_size_];
-  for (int32 i = 0; i < lm_states_size_; ++i) {
-    ReadBasicType(is, binary, &lm_states_[i]);
-  }
+    // Unigram section. The relative addresses on disk are the same as in
+    // <unigram_states_>.
+    ReadBasicType(is, binary, &num_words_);
+    unigram_states_ = new int64[num_words_];
+    for (int32 i = 0; i < num_words_; ++i) {
+      ReadBasicType(is, binary, &unigram_states_[i]);
+    }
 
-  // Unigram section. We write memory offset to disk instead of the absolute
-  // pointers.
-  ReadBasicType(is, binary, &num_words_);
-  unigram_states_ = new int32*[num_words_];
-  for (int32 i = 0; i < num_words_; ++i) {
-    int64 tmp_address;
-    ReadBasicType(is, binary, &tmp_address);
-    // Check out how we compute the relative address in ConstArpaLm::Write().
-    unigram_states_[i] =
-        (tmp_address == 0) ? NULL : lm_states_ + tmp_address - 1;
+    // Overflow section, likewise.
+    ReadBasicType(is, binary, &overflow_buffer_size_);
+    overflow_buffer_ = new int64[overflow_buffer_size_];
+    for (int32 i = 0; i < overflow_buffer_size_; ++i) {
+      ReadBasicType(is, binary, &overflow_buffer_[i]);
+    }
   }
+  KALDI_ASSERT(ngram_order_ > 0);
+  KALDI_ASSERT(bos_symbol_ < num_words_ && bos_symbol_ > 0);
+  KALDI_ASSERT(eos_symbol_ < num_words_ && eos_symbol_ > 0);
+  KALDI_ASSERT(unk_symbol_ < num_words_ &&
+               (unk_symbol_ > 0 || unk_symbol_ == -1));
+  lm_states_end_ = lm_states_ + lm_states_size_ - 1;
+  memory_assigned_ = true;
+  initialized_ = true;
+}
 
-  // Overflow section. We write memory offset to disk instead of the absolute
-  // pointers.
-  ReadBasicType(is, binary, &overflow_buffer_size_);
-  overflow_buffer_ = new int32*[overflow_buffer_size_];
-  for (int32 i = 0; i < overflow_buffer_size_; ++i) {
-    int64 tmp_address;
-    ReadBasicType(is, binary, &tmp_address);
-    // Check out how we compute the relative address in ConstArpaLm::Write().
-    overflow_buffer_[i] =
-        (tmp_address == 0) ? NULL : lm_states_ + tmp_address - 1;
+bool ConstArpaLm::ReadMapped(const std::string &filename) {
+  KALDI_ASSERT(!initialized_);
+#ifdef _MSC_VER
+  return false;
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(
+          kConstArpaLmHeaderOffset + kNumHeaderFields * sizeof(int64))) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // The mapping stays valid after closing the file.
+  if (data == MAP_FAILED) return false;
+
+  char *bytes = static_cast<char*>(data);
+  std::string token = std::string("\0B", 2) + kConstArpaLmToken + " ";
+  const int64 *header = reinterpret_cast<const int64*>(
+      bytes + kConstArpaLmHeaderOffset);
+  if (token.compare(0, token.size(), bytes, token.size()) != 0 ||
+      header[kByteOrderMark] != kConstArpaLmByteOrderMark) {
+    munmap(data, size);
+    return false;
   }
+  // Checks that the sections are where they should be.
+  int64 expected[kNumHeaderFields];
+  ComputeConstArpaLmOffsets(header[kLmStatesSize], header[kNumWords],
+                            header[kOverflowBufferSize],
+                            ConstArpaLmCodebooksSize(header[kNgramOrder],
+                                                     header[kQuantizeBits]),
+                            expected);
+  if (header[kLmStatesOffset] != expected[kLmStatesOffset] ||
+      header[kUnigramStatesOffset] != expected[kUnigramStatesOffset] ||
+      header[kOverflowBufferOffset] != expected[kOverflowBufferOffset] ||
+      header[kCodebooksOffset] != expected[kCodebooksOffset] ||
+      (header[kQuantizeBits] != 0 && header[kQuantizeBits] != 8 &&
+       header[kQuantizeBits] != 16) ||
+      header[kFileSize] != expected[kFileSize] ||
+      header[kFileSize] > static_cast<int64>(size)) {
+    KALDI_WARN << "Corrupted ConstArpaLm file " << filename;
+    munmap(data, size);
+    return false;
+  }
+
+  bos_symbol_ = header[kBosSymbol];
+  eos_symbol_ = header[kEosSymbol];
+  unk_symbol_ = header[kUnkSymbol];
+  ngram_order_ = header[kNgramOrder];
+  num_words_ = header[kNumWords];
+  overflow_buffer_size_ = header[kOverflowBufferSize];
+  lm_states_size_ = header[kLmStatesSize];
+  quantize_bits_ = header[kQuantizeBits];
+  // Note: the mapping is read-only, but nothing in this class writes to it.
+  lm_states_ = reinterpret_cast<int32*>(bytes + header[kLmStatesOffset]);
+  unigram_states_ = reinterpret_cast<int64*>(
+      bytes + header[kUnigramStatesOffset]);
+  overflow_buffer_ = reinterpret_cast<int64*>(
+      bytes + header[kOverflowBufferOffset]);
+  codebooks_ = (quantize_bits_ == 0) ? NULL :
+      reinterpret_cast<float*>(bytes + header[kCodebooksOffset]);
+  mapped_data_ = data;
+  mapped_size_ = size;
+
   KALDI_ASSERT(ngram_order_ > 0);
   KALDI_ASSERT(bos_symbol_ < num_words_ && bos_symbol_ > 0);
   KALDI_ASSERT(eos_symbol_ < num_words_ && eos_symbol_ > 0);
   KALDI_ASSERT(unk_symbol_ < num_words_ &&
                (unk_symbol_ > 0 || unk_symbol_ == -1));
   lm_states_end_ = lm_states_ + lm_states_size_ - 1;
-  memory_assigned_ = true;
-  initialized_ = true;;
+  memory_assigned_ = false;
+  initialized_ = true;
+  return true;
+#endif
+}
+
+void ReadConstArpaLm(const std::string &rxfilename, ConstArpaLm *lm) {
+  if (ClassifyRxfilename(rxfilename) == kFileInput &&
+      lm->ReadMapped(rxfilename)) {
+    KALDI_VLOG(1) << "Memory-mapped ConstArpaLm from " << rxfilename;
+    return;
+  }
+  ReadKaldiObject(rxfilename, lm);
 }
 
 bool ConstArpaLm::HistoryStateExists(const std::vector<int32>& hist) const {
@@ -665,8 +1442,10 @@ bool ConstArpaLm::HistoryStateExists(const std::vector<int32>& hist) const {
     // not NULL, we still have to check if it has child.
     KALDI_ASSERT(lm_state >= lm_states_);
     KALDI_ASSERT(lm_state + 2 <= lm_states_end_);
-    // <lm_state + 2> points to <num_children>.
-    if (*(lm_state + 2) > 0) {
+    // <lm_state + 2> points to <num_children>; in the quantized layout,
+    // <lm_state + 1> points to the number of leaf children.
+    if (*(lm_state + 2) > 0 ||
+        (quantize_bits_ != 0 && *(lm_state + 1) > 0)) {
       return true;
     } else {
       return false;
@@ -675,55 +1454,68 @@ bool ConstArpaLm::HistoryStateExists(const std::vector<int32>& hist) const {
   return true;
 }
 
-float ConstArpaLm::GetNgramLogprob(const int32 word,
-                                   const std::vector<int32>& hist) const {
-  KALDI_ASSERT(initialized_);
-
-  // If the history size plus one is larger than <ngram_order_>, remove the old
-  // words.
-  std::vector<int32> mapped_hist(hist);
-  while (mapped_hist.size() >= ngram_order_) {
-    mapped_hist.erase(mapped_hist.begin(), mapped_hist.begin() + 1);
-  }
-  KALDI_ASSERT(mapped_hist.size() + 1 <= ngram_order_);
-
+int32 ConstArpaLm::MapWord(const int32 word) const {
   // TODO(guoguo): check with Dan if this is reasonable.
   // Maps possible out-of-vocabulary words to <unk>. If a word does not have a
   // corresponding LmState, we treat it as <unk>. We map it to <unk> if <unk> is
   // specified.
-  int32 mapped_word = word;
   if (unk_symbol_ != -1) {
-    KALDI_ASSERT(mapped_word >= 0);
-    if (mapped_word >= num_words_ || unigram_states_[mapped_word] == NULL) {
-      mapped_word = unk_symbol_;
-    }
-    for (int32 i = 0; i < mapped_hist.size(); ++i) {
-      KALDI_ASSERT(mapped_hist[i] >= 0);
-      if (mapped_hist[i] >= num_words_ ||
-          unigram_states_[mapped_hist[i]] == NULL) {
-        mapped_hist[i] = unk_symbol_;
-      }
+    KALDI_ASSERT(word >= 0);
+    if (word >= num_words_ || unigram_states_[word] == 0) {
+      return unk_symbol_;
     }
   }
+  return word;
+}
+
+const int32* ConstArpaLm::MapHistory(const std::vector<int32>& hist,
+                                     std::vector<int32>* buffer,
+                                     int32* mapped_size) const {
+  // If the history size plus one is larger than <ngram_order_>, remove the old
+  // words.
+  size_t begin = (hist.size() >= ngram_order_) ?
+      hist.size() - ngram_order_ + 1 : 0;
+  *mapped_size = hist.size() - begin;
+  KALDI_ASSERT(*mapped_size + 1 <= ngram_order_);
+  if (*mapped_size == 0) return NULL;
+  for (size_t i = begin; i < hist.size(); ++i) {
+    if (MapWord(hist[i]) != hist[i]) {
+      buffer->resize(hist.size() - begin);
+      for (size_t j = begin; j < hist.size(); ++j)
+        (*buffer)[j - begin] = MapWord(hist[j]);
+      return &((*buffer)[0]);
+    }
+  }
+  return &(hist[begin]);
+}
+
+float ConstArpaLm::GetNgramLogprob(const int32 word,
+                                   const std::vector<int32>& hist) const {
+  KALDI_ASSERT(initialized_);
+
+  std::vector<int32> buffer;  // Only used if a word of <hist> is mapped.
+  int32 mapped_size;
+  const int32* mapped_hist = MapHistory(hist, &buffer, &mapped_size);
+  int32 mapped_word = MapWord(word);
 
   // Loops up n-gram probability.
-  return GetNgramLogprobRecurse(mapped_word, mapped_hist);
+  return GetNgramLogprobRecurse(mapped_word, mapped_hist, mapped_size);
 }
 
 float ConstArpaLm::GetNgramLogprobRecurse(
-    const int32 word, const std::vector<int32>& hist) const {
+    const int32 word, const int32* hist, int32 hist_size) const {
   KALDI_ASSERT(initialized_);
-  KALDI_ASSERT(hist.size() + 1 <= ngram_order_);
+  KALDI_ASSERT(hist_size + 1 <= ngram_order_);
 
   // Unigram case.
-  if (hist.size() == 0) {
-    if (word >= num_words_ || unigram_states_[word] == NULL) {
+  if (hist_size == 0) {
+    if (word >= num_words_ || unigram_states_[word] == 0) {
       // If <unk> is defined, then the word sequence should have already been
       // mapped to <unk> is necessary; this is for the case where <unk> is not
       // defined.
       return std::numeric_limits<float>::min();
     } else {
-      return *reinterpret_cast<float*>(unigram_states_[word]);
+      return StateLogprob(AddressToLmState(unigram_states_[word]), 1);
     }
   }
 
@@ -731,40 +1523,49 @@ float ConstArpaLm::GetNgramLogprobRecurse(
   float logprob = 0.0;
   float backoff_logprob = 0.0;
   int32* state;
-  if ((state = GetLmState(hist)) != NULL) {
+  if ((state = GetLmState(hist, hist_size)) != NULL) {
     int32 child_info;
     int32* child_lm_state = NULL;
     if (GetChildInfo(word, state, &child_info)) {
-      DecodeChildInfo(child_info, state, &child_lm_state, &logprob);
+      DecodeChildInfo(child_info, state, hist_size + 1,
+                      &child_lm_state, &logprob);
+      return logprob;
+    } else if (quantize_bits_ != 0 &&
+               GetLeafLogprob(word, state, hist_size, &logprob)) {
       return logprob;
     } else {
-      backoff_logprob = *reinterpret_cast<float*>(state + 1);
+      backoff_logprob = StateBackoffLogprob(state, hist_size);
     }
   }
-  std::vector<int32> new_hist(hist);
-  new_hist.erase(new_hist.begin(), new_hist.begin() + 1);
-  return backoff_logprob + GetNgramLogprobRecurse(word, new_hist);
+  // Backs off to the history without its oldest word.
+  return backoff_logprob +
+      GetNgramLogprobRecurse(word, hist + 1, hist_size - 1);
 }
 
 int32* ConstArpaLm::GetLmState(const std::vector<int32>& seq) const {
+  if (seq.empty()) return NULL;
+  return GetLmState(&(seq[0]), seq.size());
+}
+
+int32* ConstArpaLm::GetLmState(const int32* seq, int32 seq_size) const {
   KALDI_ASSERT(initialized_);
 
   // No LmState exists for empty word sequence.
-  if (seq.size() == 0) return NULL;
+  if (seq_size == 0) return NULL;
 
   // If <unk> is defined, then the word sequence should have already been mapped
   // to <unk> is necessary; this is for the case where <unk> is not defined.
-  if (seq[0] >= num_words_ || unigram_states_[seq[0]] == NULL) return NULL;
-  int32* parent = unigram_states_[seq[0]];
+  if (seq[0] >= num_words_ || unigram_states_[seq[0]] == 0) return NULL;
+  int32* parent = AddressToLmState(unigram_states_[seq[0]]);
 
   int32 child_info;
   int32* child_lm_state = NULL;
   float logprob;
-  for (int32 i = 1; i < seq.size(); ++i) {
+  for (int32 i = 1; i < seq_size; ++i) {
     if (!GetChildInfo(seq[i], parent, &child_info)) {
       return NULL;
     }
-    DecodeChildInfo(child_info, parent, &child_lm_state, &logprob);
+    DecodeChildInfo(child_info, parent, i + 1, &child_lm_state, &logprob);
     if (child_lm_state == NULL) {
       return NULL;
     } else {
@@ -809,6 +1610,7 @@ bool ConstArpaLm::GetChildInfo(const int32 word,
 
 void ConstArpaLm::DecodeChildInfo(const int32 child_info,
                                   int32* parent,
+                                  const int32 child_order,
                                   int32** child_lm_state,
                                   float* logprob) const {
   KALDI_ASSERT(initialized_);
@@ -823,14 +1625,55 @@ void ConstArpaLm::DecodeChildInfo(const int32 child_info,
     int32 child_offset = child_info / 2;
     if (child_offset > 0) {
       *child_lm_state = parent + child_offset;
-      *logprob = *reinterpret_cast<float*>(*child_lm_state);
     } else {
       KALDI_ASSERT(-child_offset < overflow_buffer_size_);
-      *child_lm_state = overflow_buffer_[-child_offset];
-      *logprob = *reinterpret_cast<float*>(*child_lm_state);
+      *child_lm_state = AddressToLmState(overflow_buffer_[-child_offset]);
     }
     KALDI_ASSERT(*child_lm_state >= lm_states_);
     KALDI_ASSERT(*child_lm_state <= lm_states_end_);
+    *logprob = StateLogprob(*child_lm_state, child_order);
+  }
+}
+
+bool ConstArpaLm::GetLeafLogprob(const int32 word, const int32* parent,
+                                 const int32 parent_order,
+                                 float* logprob) const {
+  KALDI_ASSERT(quantize_bits_ != 0);
+  int32 num_leaves = *(parent + 1);
+  if (num_leaves == 0) return false;
+  const int32 *leaf_words = parent + 3 + 2 * *(parent + 2);
+  const int32 *leaf_codes = leaf_words + num_leaves;
+  KALDI_ASSERT(leaf_codes + (num_leaves * quantize_bits_ + 31) / 32 - 1 <=
+               lm_states_end_);
+
+  // The words are sorted.
+  const int32 *iter = std::lower_bound(leaf_words, leaf_codes, word);
+  if (iter == leaf_codes || *iter != word) return false;
+  int32 index = iter - leaf_words;
+  uint32 code = (quantize_bits_ == 8) ?
+      reinterpret_cast<const unsigned char*>(leaf_codes)[index] :
+      reinterpret_cast<const uint16*>(leaf_codes)[index];
+  *logprob = Dequantize(parent_order + 1, false, code);
+  return true;
+}
+
+float ConstArpaLm::StateLogprob(const int32* lm_state,
+                                const int32 order) const {
+  if (quantize_bits_ == 0) {
+    return *reinterpret_cast<const float*>(lm_state);
+  } else {
+    uint32 codes = static_cast<uint32>(*lm_state);
+    return Dequantize(order, false, codes & ((1u << quantize_bits_) - 1));
+  }
+}
+
+float ConstArpaLm::StateBackoffLogprob(const int32* lm_state,
+                                       const int32 order) const {
+  if (quantize_bits_ == 0) {
+    return *reinterpret_cast<const float*>(lm_state + 1);
+  } else {
+    uint32 codes = static_cast<uint32>(*lm_state);
+    return Dequantize(order, true, codes >> quantize_bits_);
   }
 }
 
@@ -845,8 +1688,8 @@ void ConstArpaLm::WriteArpaRecurse(int32* lm_state,
   // Inserts the current LmState to <output>.
   ArpaLine arpa_line;
   arpa_line.words = seq;
-  arpa_line.logprob = *reinterpret_cast<float*>(lm_state);
-  arpa_line.backoff_logprob = *reinterpret_cast<float*>(lm_state + 1);
+  arpa_line.logprob = StateLogprob(lm_state, seq.size());
+  arpa_line.backoff_logprob = StateBackoffLogprob(lm_state, seq.size());
   output->push_back(arpa_line);
 
   // Scans for possible children, and recursively adds child to <output>.
@@ -858,7 +1701,8 @@ void ConstArpaLm::WriteArpaRecurse(int32* lm_state,
     int32 child_info = *(lm_state + 4 + 2 * i);
     float logprob;
     int32* child_lm_state = NULL;
-    DecodeChildInfo(child_info, lm_state, &child_lm_state, &logprob);
+    DecodeChildInfo(child_info, lm_state, new_seq.size(),
+                    &child_lm_state, &logprob);
 
     if (child_lm_state == NULL) {
       // Leaf case.
@@ -871,6 +1715,22 @@ void ConstArpaLm::WriteArpaRecurse(int32* lm_state,
       WriteArpaRecurse(child_lm_state, new_seq, output);
     }
   }
+
+  // Leaf children of the quantized layout.
+  if (quantize_bits_ != 0) {
+    int32 num_leaves = *(lm_state + 1);
+    const int32 *leaf_words = lm_state + 3 + 2 * num_children;
+    for (int32 i = 0; i < num_leaves; ++i) {
+      ArpaLine child_arpa_line;
+      child_arpa_line.words = seq;
+      child_arpa_line.words.push_back(leaf_words[i]);
+      bool found = GetLeafLogprob(leaf_words[i], lm_state, seq.size(),
+                                  &child_arpa_line.logprob);
+      KALDI_ASSERT(found);
+      child_arpa_line.backoff_logprob = 0.0;
+      output->push_back(child_arpa_line);
+    }
+  }
 }
 
 void ConstArpaLm::WriteArpa(std::ostream &os) const {
@@ -878,9 +1738,9 @@ void ConstArpaLm::WriteArpa(std::ostream &os) const {
 
   std::vector<ArpaLine> tmp_output;
   for (int32 i = 0; i < num_words_; ++i) {
-    if (unigram_states_[i] != NULL) {
+    if (unigram_states_[i] != 0) {
       std::vector<int32> seq(1, i);
-      WriteArpaRecurse(unigram_states_[i], seq, &tmp_output);
+      WriteArpaRecurse(AddressToLmState(unigram_states_[i]), seq, &tmp_output);
     }
   }
 
@@ -935,7 +1795,10 @@ void ConstArpaLm::WriteArpa(std::ostream &os) const {
 }
 
 ConstArpaLmDeterministicFst::ConstArpaLmDeterministicFst(
-    const ConstArpaLm& lm) : lm_(lm) {
+    const ConstArpaLm& lm, int32 cache_size) :
+    lm_(lm), cache_size_(cache_size), cache_head_(-1), cache_tail_(-1),
+    num_queries_(0), num_cache_hits_(0) {
+  KALDI_ASSERT(cache_size_ >= 0);
   // Creates a history state for <s>.
   std::vector<Label> bos_state(1, lm_.BosSymbol());
   state_to_wseq_.push_back(bos_state);
@@ -951,19 +1814,11 @@ fst::StdArc::Weight ConstArpaLmDeterministicFst::Final(StateId s) {
   return Weight(-logprob);
 }
 
-bool ConstArpaLmDeterministicFst::GetArc(StateId s,
-                                         Label ilabel, fst::StdArc *oarc) {
-  // At this point, we should have created the state.
-  KALDI_ASSERT(static_cast<size_t>(s) < state_to_wseq_.size());
-  std::vector<Label> wseq = state_to_wseq_[s];
-
-  float logprob = lm_.GetNgramLogprob(ilabel, wseq);
-  if (logprob == std::numeric_limits<float>::min()) {
-    return false;
-  }
-
+ConstArpaLmDeterministicFst::StateId ConstArpaLmDeterministicFst::NextState(
+    StateId s, Label ilabel) {
   // Locates the next state in ConstArpaLm. Note that OOV and backoff have been
   // taken care of in ConstArpaLm.
+  std::vector<Label> wseq(state_to_wseq_[s]);
   wseq.push_back(ilabel);
   while (wseq.size() >= lm_.NgramOrder()) {
     // History state has at most lm_.NgramOrder() -1 words in the state.
@@ -986,21 +1841,113 @@ bool ConstArpaLmDeterministicFst::GetArc(StateId s,
   if (result.second == true)
     state_to_wseq_.push_back(wseq);
 
-  // Creates the arc.
+  return result.first->second;
+}
+
+bool ConstArpaLmDeterministicFst::MakeArc(Label ilabel, float logprob,
+                                          StateId nextstate,
+                                          fst::StdArc *oarc) const {
   oarc->ilabel = ilabel;
   oarc->olabel = ilabel;
-  oarc->nextstate = result.first->second;
+  oarc->nextstate = nextstate;
+  if (nextstate == fst::kNoStateId) {
+    oarc->weight = Weight::Zero();
+    return false;
+  }
   oarc->weight = Weight(-logprob);
+  return true;
+}
 
+bool ConstArpaLmDeterministicFst::GetArc(StateId s,
+                                         Label ilabel, fst::StdArc *oarc) {
+  // At this point, we should have created the state.
+  KALDI_ASSERT(static_cast<size_t>(s) < state_to_wseq_.size());
+  num_queries_++;
+  uint64 key = CacheKey(s, ilabel);
+  float logprob;
+  StateId nextstate;
+  if (LookupCache(key, &logprob, &nextstate)) {
+    num_cache_hits_++;
+    return MakeArc(ilabel, logprob, nextstate, oarc);
+  }
+
+  logprob = lm_.GetNgramLogprob(ilabel, state_to_wseq_[s]);
+  if (logprob == std::numeric_limits<float>::min()) {
+    nextstate = fst::kNoStateId;
+  } else {
+    nextstate = NextState(s, ilabel);
+  }
+  InsertCache(key, logprob, nextstate);
+  return MakeArc(ilabel, logprob, nextstate, oarc);
+}
+
+void ConstArpaLmDeterministicFst::UnlinkCacheEntry(int32 index) {
+  CacheEntry &entry = cache_[index];
+  if (entry.prev != -1) cache_[entry.prev].next = entry.next;
+  else cache_head_ = entry.next;
+  if (entry.next != -1) cache_[entry.next].prev = entry.prev;
+  else cache_tail_ = entry.prev;
+}
+
+void ConstArpaLmDeterministicFst::PushFrontCacheEntry(int32 index) {
+  CacheEntry &entry = cache_[index];
+  entry.prev = -1;
+  entry.next = cache_head_;
+  if (cache_head_ != -1) cache_[cache_head_].prev = index;
+  cache_head_ = index;
+  if (cache_tail_ == -1) cache_tail_ = index;
+}
+
+bool ConstArpaLmDeterministicFst::LookupCache(uint64 key, float* logprob,
+                                              StateId* nextstate) {
+  if (cache_size_ == 0) return false;
+  unordered_map<uint64, int32>::const_iterator iter = cache_index_.find(key);
+  if (iter == cache_index_.end()) return false;
+  int32 index = iter->second;
+  if (index != cache_head_) {
+    UnlinkCacheEntry(index);
+    PushFrontCacheEntry(index);
+  }
+  *logprob = cache_[index].logprob;
+  *nextstate = cache_[index].nextstate;
   return true;
 }
 
+void ConstArpaLmDeterministicFst::InsertCache(uint64 key, float logprob,
+                                              StateId nextstate) {
+  if (cache_size_ == 0) return;
+  int32 index;
+  unordered_map<uint64, int32>::const_iterator iter = cache_index_.find(key);
+  if (iter != cache_index_.end()) {
+    // Already cached; the entry is updated.
+    index = iter->second;
+    UnlinkCacheEntry(index);
+  } else if (cache_.size() < static_cast<size_t>(cache_size_)) {
+    index = cache_.size();
+    cache_.resize(cache_.size() + 1);
+  } else {
+    // Reuses the least recently used entry.
+    index = cache_tail_;
+    UnlinkCacheEntry(index);
+    cache_index_.erase(cache_[index].key);
+  }
+  CacheEntry &entry = cache_[index];
+  entry.key = key;
+  entry.logprob = logprob;
+  entry.nextstate = nextstate;
+  PushFrontCacheEntry(index);
+  cache_index_[key] = index;
+}
+
 bool BuildConstArpaLm(const bool natural_base, const int32 bos_symbol,
                       const int32 eos_symbol, const int32 unk_symbol,
                       const std::string& arpa_rxfilename,
-                      const std::string& const_arpa_wxfilename) {
+                      const std::string& const_arpa_wxfilename,
+                      const int32 quantize_bits,
+                      const int32 num_threads) {
   ConstArpaLmBuilder lm_builder(natural_base, bos_symbol,
-                                eos_symbol, unk_symbol);
+                                eos_symbol, unk_symbol, quantize_bits,
+                                num_threads);
   ReadKaldiObject(arpa_rxfilename, &lm_builder);
   lm_builder.Build();
   WriteKaldiObject(lm_builder, const_arpa_wxfilename, true);
@@ -26,6 +26,9 @@
 
 namespace eesen {
 
+// Alignment, in bytes, of the sections of the ConstArpaLm file layout.
+static const int32 kConstArpaLmAlignment = 64;
+
 // Forward declaration of Auxiliary struct ArpaLine.
 struct ArpaLine;
 
@@ -38,25 +41,37 @@ class ConstArpaLm {
     lm_states_ = NULL;
     unigram_states_ = NULL;
     overflow_buffer_ = NULL;
+    codebooks_ = NULL;
+    quantize_bits_ = 0;
+    mapped_data_ = NULL;
+    mapped_size_ = 0;
     memory_assigned_ = false;
     initialized_ = false;
   }
 
   // Special constructor, will be used when you initialize ConstArpaLm from
-  // scratch through this constructor.
+  // scratch through this constructor.  If <quantize_bits> is nonzero,
+  // <lm_states> is in the quantized layout (see <lm_states_>) and <codebooks>
+  // holds the codebooks (see <codebooks_>).
   ConstArpaLm(const int32 bos_symbol, const int32 eos_symbol,
               const int32 unk_symbol, const int32 ngram_order,
               const int32 num_words, const int32 overflow_buffer_size,
-              const int32 lm_states_size, int32** unigram_states,
-              int32** overflow_buffer, int32* lm_states) :
+              const int32 lm_states_size, int64* unigram_states,
+              int64* overflow_buffer, int32* lm_states,
+              const int32 quantize_bits = 0, float* codebooks = NULL) :
       bos_symbol_(bos_symbol), eos_symbol_(eos_symbol),
       unk_symbol_(unk_symbol), ngram_order_(ngram_order),
       num_words_(num_words), overflow_buffer_size_(overflow_buffer_size),
-      lm_states_size_(lm_states_size), unigram_states_(unigram_states),
-      overflow_buffer_(overflow_buffer), lm_states_(lm_states) {
+      lm_states_size_(lm_states_size), quantize_bits_(quantize_bits),
+      unigram_states_(unigram_states), overflow_buffer_(overflow_buffer),
+      lm_states_(lm_states), codebooks_(codebooks),
+      mapped_data_(NULL), mapped_size_(0) {
     KALDI_ASSERT(unigram_states_ != NULL);
     KALDI_ASSERT(overflow_buffer_ != NULL);
     KALDI_ASSERT(lm_states_ != NULL);
+    KALDI_ASSERT(quantize_bits_ == 0 || quantize_bits_ == 8 ||
+                 quantize_bits_ == 16);
+    KALDI_ASSERT(quantize_bits_ == 0 || codebooks_ != NULL);
     KALDI_ASSERT(ngram_order_ > 0);
     KALDI_ASSERT(bos_symbol_ < num_words_ && bos_symbol_ > 0);
     KALDI_ASSERT(eos_symbol_ < num_words_ && eos_symbol_ > 0);
@@ -67,18 +82,27 @@ class ConstArpaLm {
     initialized_ = true;
   }
 
-  ~ConstArpaLm() {
-    if (memory_assigned_) {
-      delete[] lm_states_;
-      delete[] unigram_states_;
-      delete[] overflow_buffer_;
-    }
-  }
+  ~ConstArpaLm();
 
-  // Reads the ConstArpaLm format language model.
+  // Reads the ConstArpaLm format language model.  Both the current layout
+  // (see Write()) and the older one, in which every number was written with
+  // WriteBasicType(), can be read.
   void Read(std::istream &is, bool binary);
 
-  // Writes the language model in ConstArpaLm format.
+  // Memory-maps the file <filename> and uses the language model in place,
+  // without copying it; the memory is shared with any other process that maps
+  // the same file.  Returns false, without changing this object, if the file
+  // cannot be mapped or is not in the layout written by Write() (e.g. if it is
+  // in the older layout); in that case, use Read().
+  bool ReadMapped(const std::string &filename);
+
+  // Writes the language model in ConstArpaLm format.  After the token
+  // <ConstArpaLmMapped> follows a header of int64 numbers and then the
+  // <lm_states_>, <unigram_states_>, <overflow_buffer_> and <codebooks_>
+  // sections, each aligned to kConstArpaLmAlignment bytes from the beginning of
+  // the file, in native byte order.  The unigram and overflow sections hold addresses
+  // relative to <lm_states_>, so a file can be used in place after mapping it
+  // (see ReadMapped()).
   void Write(std::ostream &os, bool binary) const;
 
   // Creates Arpa format language model from ConstArpaLm format, and writes it
@@ -87,6 +111,7 @@ class ConstArpaLm {
 
   // Wrapper of GetNgramLogprobRecurse. It first maps possible out-of-vocabulary
   // words to <unk>, if <unk> is defined, and then calls GetNgramLogprobRecurse.
+  // The history is only copied if some of its words have to be mapped.
   float GetNgramLogprob(const int32 word, const std::vector<int32>& hist) const;
 
   // Returns true if the history word sequence <hist> has successor, which means
@@ -98,11 +123,26 @@ class ConstArpaLm {
   int32 UnkSymbol() const { return unk_symbol_; }
   int32 NgramOrder() const { return ngram_order_; }
 
+  // Number of bits of the codebook indexes if the log-probabilities are
+  // quantized (8 or 16), or 0 if they are stored as floats.
+  int32 QuantizeBits() const { return quantize_bits_; }
+
  private:
-  // Loops up n-gram probability for given word sequence. Backoff is handled by
-  // recursively calling this function. 
-  float GetNgramLogprobRecurse(const int32 word,
-                               const std::vector<int32>& hist) const;
+  // Maps <word> to <unk> if it is out of vocabulary and <unk> is defined.
+  int32 MapWord(const int32 word) const;
+
+  // Keeps the last <ngram_order_> - 1 words of <hist>, mapped with MapWord(),
+  // and returns a pointer to them and their number in <mapped_size>.  The
+  // pointer is into <hist> unless some of the words are mapped, in which case
+  // they are copied to <buffer>.
+  const int32* MapHistory(const std::vector<int32>& hist,
+                          std::vector<int32>* buffer,
+                          int32* mapped_size) const;
+
+  // Loops up n-gram probability for given word sequence <hist>, of <hist_size>
+  // words. Backoff is handled by recursively calling this function.
+  float GetNgramLogprobRecurse(const int32 word, const int32* hist,
+                               int32 hist_size) const;
 
   // Given a word sequence, find the address of the corresponding LmState.
   // Returns NULL if no corresponding LmState is found.
@@ -111,6 +151,13 @@ class ConstArpaLm {
   // is not an unigram, we still return NULL, since there is no LmState struct
   // reserved for this sequence. 
   int32* GetLmState(const std::vector<int32>& seq) const;
+  int32* GetLmState(const int32* seq, int32 seq_size) const;
+
+  // Converts a relative address, as stored in <unigram_states_> and
+  // <overflow_buffer_>, to the LmState it points to (NULL for address zero).
+  inline int32* AddressToLmState(const int64 address) const {
+    return (address == 0) ? NULL : lm_states_ + address - 1;
+  }
 
   // Given a pointer to the parent, find the child_info that corresponds to
   // given word. The parent has the following structure:
@@ -120,20 +167,45 @@ class ConstArpaLm {
   //   int32 num_children;
   //   std::pair<int32, int32> [] children;
   // }
-  // It returns false if the child is not found.
+  // It returns false if the child is not found.  In the quantized layout (see
+  // <lm_states_>) only the children that have LmStates are found here; see
+  // GetLeafLogprob() for the others.
   bool GetChildInfo(const int32 word, int32* parent, int32* child_info) const;
 
   // Decodes <child_info> to get log probability and child LmState. In the leaf
   // case, only <logprob> will be returned, and <child_address> will be NULL.
+  // <child_order> is the n-gram order of the child, which is needed to
+  // dequantize its log probability.
   void DecodeChildInfo(const int32 child_info, int32* parent,
-                       int32** child_lm_state, float* logprob) const;
+                       const int32 child_order, int32** child_lm_state,
+                       float* logprob) const;
+
+  // Quantized layout only: looks up <word> among the leaf children of
+  // <parent>, whose n-gram order is <parent_order>, and outputs its log
+  // probability.  Returns false if it is not found.
+  bool GetLeafLogprob(const int32 word, const int32* parent,
+                      const int32 parent_order, float* logprob) const;
+
+  // Returns the log probability and the backoff log probability stored in the
+  // LmState <lm_state>, whose n-gram order is <order>.
+  float StateLogprob(const int32* lm_state, const int32 order) const;
+  float StateBackoffLogprob(const int32* lm_state, const int32 order) const;
+
+  // Returns entry <code> of the codebook for log probabilities (or backoff log
+  // probabilities, if <backoff> is true) of n-grams of order <order>.
+  inline float Dequantize(const int32 order, const bool backoff,
+                          const uint32 code) const {
+    return codebooks_[((2 * (order - 1) + (backoff ? 1 : 0))
+                       << quantize_bits_) + code];
+  }
 
   void WriteArpaRecurse(int32* lm_state,
                         const std::vector<int32>& seq,
                         std::vector<ArpaLine> *output) const;
 
   // We assign memory in Read(). If it is called, we have to release memory in
-  // the destructor.
+  // the destructor.  It is not set by ReadMapped(), which uses the mapped file
+  // in place.
   bool memory_assigned_;
 
   // Makes sure that the language model has been loaded before using it.
@@ -163,20 +235,26 @@ class ConstArpaLm {
   // Size of the <lm_states_> array, which will be needed by I/O.
   int32 lm_states_size_;
 
+  // Bits per codebook index if the log probabilities are quantized, 8 or 16;
+  // 0 if they are stored as floats.
+  int32 quantize_bits_;
+
   // Points to the end of <lm_states_>. We use this information to check if
   // there is any illegal visit to the un-reserved memory.
   int32* lm_states_end_;
 
-  // Loopup table for pointers of unigrams. The pointer could be NULL, for
-  // example for those words that are in words.txt, but not in the language
-  // model.
-  int32** unigram_states_;
+  // Loopup table for unigrams.  It holds the address of the LmState of each
+  // unigram relative to <lm_states_>, plus one; zero means there is no
+  // LmState, for example for those words that are in words.txt, but not in the
+  // language model.  See AddressToLmState().
+  int64* unigram_states_;
 
   // Technically a 32-bit number cannot represent a possibly 64-bit pointer. We
   // therefore use "relative" address instead of "absolute" address, which will
   // be a small number most of the time. This buffer is for the case where the
-  // relative address has more than 30-bits.
-  int32** overflow_buffer_;
+  // relative address has more than 30-bits; it holds addresses relative to
+  // <lm_states_> in the same way as <unigram_states_>.
+  int64* overflow_buffer_;
 
   // Memory chunk that contains the actual LmStates. One LmState has the
   // following structure:
@@ -192,12 +270,44 @@ class ConstArpaLm {
   // bytes, therefore one LmState will occupy the following number of bytes:
   //
   // x = 1 + 1 + 1 + 2 * children.size() = 3 + 2 * children.size() 
+  //
+  // If <quantize_bits_> is nonzero, the log probabilities are stored as
+  // indexes into <codebooks_>, and the children that are leaves are stored
+  // apart from the others, without the child info:
+  //
+  // struct LmState {
+  //   uint32 codes;  // logprob index | (backoff_logprob index << bits)
+  //   int32 num_leaf_children;
+  //   int32 num_children;  // the others
+  //   std::pair<int32, int32> [] children;
+  //   int32 [] leaf_children;  // words
+  //   uint8 or uint16 [] leaf_codes;  // logprob indexes, padded to 4 bytes
+  // }
+  //
+  // A leaf then takes 1.25 or 1.5 int32s instead of 2, and since most n-grams
+  // of the highest order are leaves, this saves a third or more of the memory.
   int32* lm_states_;
+
+  // Codebooks for the quantized layout (NULL otherwise): for each n-gram order
+  // n = 1, 2, ..., one codebook for log probabilities followed by one for
+  // backoff log probabilities, each with 2^<quantize_bits_> entries.  See
+  // Dequantize().
+  float* codebooks_;
+
+  // If ReadMapped() was used, the mapped file (which is read-only); the
+  // pointers above point into it.
+  void* mapped_data_;
+  size_t mapped_size_;
 };
 
 /**
  This class wraps a ConstArpaLm format language model with the interface defined
  in DeterministicOnDemandFst.
+
+ Lattice rescoring and on-the-fly composition ask for the same (state, word)
+ arcs over and over, so the arcs are kept in a cache of bounded size, from which
+ the least recently used ones are dropped.  The class keeps a map of states, so
+ it is not thread-safe; use one object per thread.
  */
 class ConstArpaLmDeterministicFst :
     public fst::DeterministicOnDemandFst<fst::StdArc> {
@@ -206,7 +316,9 @@ class ConstArpaLmDeterministicFst :
   typedef fst::StdArc::StateId StateId;
   typedef fst::StdArc::Label Label;
 
-  ConstArpaLmDeterministicFst(const ConstArpaLm& lm);
+  // Caches up to <cache_size> arcs (including the absence of arcs); zero
+  // disables the cache.
+  ConstArpaLmDeterministicFst(const ConstArpaLm& lm, int32 cache_size = 100000);
 
   // We cannot use "const" because the pure virtual function in the interface is
   // not const.
@@ -218,22 +330,81 @@ class ConstArpaLmDeterministicFst :
 
   virtual bool GetArc(StateId s, Label ilabel, fst::StdArc* oarc);
 
+  // Statistics of the cache, e.g. for logging the hit rate.
+  int64 NumQueries() const { return num_queries_; }
+  int64 NumCacheHits() const { return num_cache_hits_; }
+
  private:
   typedef unordered_map<std::vector<Label>,
                         StateId, VectorHasher<Label> > MapType;
+
+  // Returns the state we go to from state <s> with word <ilabel>, creating it
+  // if necessary.
+  StateId NextState(StateId s, Label ilabel);
+
+  // Fills in <oarc> for the arc from state <s> with label <ilabel>, given its
+  // log probability and next state; returns false if there is no such arc.
+  bool MakeArc(Label ilabel, float logprob, StateId nextstate,
+               fst::StdArc* oarc) const;
+
+  // Entry of the cache.  The entries form a doubly-linked list from the most to
+  // the least recently used, through indexes into <cache_>.
+  struct CacheEntry {
+    uint64 key;         // state and word, see CacheKey()
+    float logprob;
+    StateId nextstate;  // fst::kNoStateId if there is no arc
+    int32 prev;
+    int32 next;
+  };
+
+  static inline uint64 CacheKey(StateId s, Label ilabel) {
+    return (static_cast<uint64>(static_cast<uint32>(s)) << 32) |
+        static_cast<uint32>(ilabel);
+  }
+
+  // Looks up <key> in the cache, making it the most recently used entry.
+  bool LookupCache(uint64 key, float* logprob, StateId* nextstate);
+
+  // Adds <key> to the cache, dropping the least recently used entry if the
+  // cache is full.
+  void InsertCache(uint64 key, float logprob, StateId nextstate);
+
+  // Unlinks entry <index> from the list, and links it at the front.
+  void UnlinkCacheEntry(int32 index);
+  void PushFrontCacheEntry(int32 index);
+
   StateId start_state_;
   MapType wseq_to_state_;
   std::vector<std::vector<Label> > state_to_wseq_;
   const ConstArpaLm& lm_;
+
+  int32 cache_size_;
+  std::vector<CacheEntry> cache_;
+  unordered_map<uint64, int32> cache_index_;  // key -> index in <cache_>
+  int32 cache_head_;  // most recently used entry, or -1
+  int32 cache_tail_;  // least recently used entry, or -1
+  int64 num_queries_;
+  int64 num_cache_hits_;
 };
 
+// Reads a ConstArpaLm from <rxfilename>, memory-mapping it if it is a file in
+// the current layout (see ConstArpaLm::ReadMapped()), and otherwise reading it
+// like ReadKaldiObject() does.
+void ReadConstArpaLm(const std::string &rxfilename, ConstArpaLm *lm);
+
 // Reads in an Arpa format language model and converts it into ConstArpaLm
 // format. We assume that the words in the input Arpa format language model have
 // been converted into integers.
+// If <quantize_bits> is 8 or 16, the log probabilities are quantized to
+// that many bits, with a separate codebook for each n-gram order.
+// The n-gram sections are parsed, sorted and turned into LmStates using
+// <num_threads> threads; the output does not depend on <num_threads>.
 bool BuildConstArpaLm(const bool natural_base, const int32 bos_symbol,
                       const int32 eos_symbol, const int32 unk_symbol,
                       const std::string& arpa_rxfilename,
-                      const std::string& const_arpa_wxfilename);
+                      const std::string& const_arpa_wxfilename,
+                      const int32 quantize_bits = 0,
+                      const int32 num_threads = 1);
 
 } // namespace eesen
 
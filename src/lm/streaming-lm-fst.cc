@@ -0,0 +1,380 @@
+// lm/streaming-lm-fst.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+
+#include "lm/streaming-lm-fst.h"
+#include "util/kaldi-io.h"
+
+namespace eesen {
+
+StreamingLmFstConverter::StreamingLmFstConverter():
+    use_natural_log_(true), symbols_(NULL), trie_(1024), trie_size_(0),
+    node_state_(1, -1) {
+  for (size_t i = 0; i < trie_.size(); i++)
+    trie_[i].parent = -1;
+}
+
+int32 StreamingLmFstConverter::WordId(const string &word) {
+  if (!history_words_.empty()) {
+    unordered_map<std::string, int32, StringHasher>::const_iterator iter =
+        history_words_.find(word);
+    if (iter != history_words_.end()) return iter->second;
+  }
+  int64 label = symbols_->Find(word);
+  if (label >= 0) {
+    KALDI_ASSERT(label < std::numeric_limits<int32>::max());
+    return label;
+  }
+  int32 id = -1 - static_cast<int32>(history_words_.size());
+  history_words_[word] = id;
+  return id;
+}
+
+// Mixes the parent node and the word into an index into the hash table.
+static inline size_t TrieHash(int32 parent, int32 word, size_t mask) {
+  uint64 key = (static_cast<uint64>(static_cast<uint32>(parent)) << 32) |
+      static_cast<uint32>(word);
+  key *= 0x9E3779B97F4A7C15ULL;
+  return (key >> 32) & mask;
+}
+
+void StreamingLmFstConverter::ResizeTrie() {
+  std::vector<TrieEntry> old_trie(trie_.size() * 2);
+  old_trie.swap(trie_);
+  for (size_t i = 0; i < trie_.size(); i++)
+    trie_[i].parent = -1;
+  size_t mask = trie_.size() - 1;
+  for (size_t i = 0; i < old_trie.size(); i++) {
+    const TrieEntry &entry = old_trie[i];
+    if (entry.parent == -1) continue;
+    size_t j = TrieHash(entry.parent, entry.word, mask);
+    while (trie_[j].parent != -1) j = (j + 1) & mask;
+    trie_[j] = entry;
+  }
+}
+
+int32 StreamingLmFstConverter::FindOrAddChild(int32 parent, int32 word) {
+  size_t mask = trie_.size() - 1;
+  size_t i = TrieHash(parent, word, mask);
+  // Linear probing; the table is at most half full.
+  while (trie_[i].parent != -1) {
+    if (trie_[i].parent == parent && trie_[i].word == word)
+      return trie_[i].node;
+    i = (i + 1) & mask;
+  }
+  int32 node = node_state_.size();
+  node_state_.push_back(-1);
+  trie_[i].parent = parent;
+  trie_[i].word = word;
+  trie_[i].node = node;
+  if (++trie_size_ * 2 > static_cast<int64>(trie_.size())) ResizeTrie();
+  return node;
+}
+
+StreamingLmFstConverter::StateId StreamingLmFstConverter::AddState() {
+  StateId s = final_.size();
+  final_.push_back(false);
+  backoff_state_.push_back(-1);
+  first_arc_.push_back(-1);
+  last_arc_.push_back(-1);
+  return s;
+}
+
+void StreamingLmFstConverter::AddArc(StateId src, Label label,
+                                     LmWeight weight, StateId dst) {
+  if (arcs_.size() >= static_cast<size_t>(std::numeric_limits<int32>::max()))
+    KALDI_ERR << "Too many arcs in language model FST.";
+  int32 a = arcs_.size();
+  CompactArc arc;
+  arc.label = label;
+  arc.weight = weight;
+  arc.nextstate = dst;
+  arc.next_arc = -1;
+  arcs_.push_back(arc);
+  if (first_arc_[src] == -1)
+    first_arc_[src] = a;
+  else
+    arcs_[last_arc_[src]].next_arc = a;
+  last_arc_[src] = a;
+}
+
+StreamingLmFstConverter::StateId StreamingLmFstConverter::FindOrAddState(
+    const std::vector<int32> &word_ids, int32 begin, int32 end,
+    bool *newly_added) {
+  int32 node = 0;
+  for (int32 i = begin; i < end; i++)
+    node = FindOrAddChild(node, word_ids[i]);
+  *newly_added = false;
+  if (node_state_[node] == -1) {
+    node_state_[node] = AddState();
+    *newly_added = true;
+  }
+  return node_state_[node];
+}
+
+// The states are those of LmFstConverter::AddArcsForNgramProb(), which
+// describes a word sequence by the positions <kstart> down to <kend> in an
+// array with the most recent word at position 1; here, those are words
+// ilev - kstart ... ilev - kend of <words>.
+void StreamingLmFstConverter::AddNgram(int32 ilev, int32 maxlev,
+                                       float log_prob, float log_bow,
+                                       const std::vector<string> &words,
+                                       const string &start_sent,
+                                       const string &end_sent) {
+  const string &curwrd = words[ilev - 1];
+  LmWeight prob = ConvertArpaLogProbToWeight(log_prob);
+  LmWeight bow  = ConvertArpaLogProbToWeight(log_bow);
+
+  // Add the label first so the current word gets its label as its id in the
+  // history trie.
+  Label label = symbols_->AddSymbol(curwrd);
+  std::vector<int32> word_ids(ilev);
+  for (int32 i = 0; i < ilev; i++)
+    word_ids[i] = WordId(words[i]);
+
+  StateId src, dst = -1, dbo = -1;
+  bool new_src, new_dbo, new_dst = false;
+  if (ilev >= 2) {
+    // General case works from N down to 2-grams
+    src = FindOrAddState(word_ids, 0, ilev - 1, &new_src);
+    if (ilev != maxlev) {
+      // add all intermediate levels from 2 to current
+      // last ones will be current backoff source and destination
+      for (int32 iilev = 2; iilev <= ilev; iilev++) {
+        dst = FindOrAddState(word_ids, ilev - iilev, ilev, &new_dst);
+        dbo = FindOrAddState(word_ids, ilev - iilev + 1, ilev, &new_dbo);
+        backoff_state_[dst] = dbo;
+      }
+    } else {
+      for (int32 iilev = 2; iilev <= ilev; iilev++) {
+        dst = FindOrAddState(word_ids, ilev - iilev + 1, ilev, &new_dst);
+        dbo = FindOrAddState(word_ids, ilev - iilev + 2, ilev, &new_dbo);
+        backoff_state_[dst] = dbo;
+      }
+    }
+  } else {
+    // special case for 1-grams: start from 0-gram
+    if (curwrd != start_sent) {
+      src = FindOrAddState(word_ids, 0, 0, &new_src);
+    } else {
+      // extra special case if in addition we are at beginning of sentence
+      // starts from initial state and has no cost
+      src = 0;
+      prob = LmWeight::One();
+    }
+    dst = FindOrAddState(word_ids, 0, 1, &new_dst);
+    dbo = FindOrAddState(word_ids, 0, 0, &new_dbo);
+    backoff_state_[dst] = dbo;
+  }
+
+  // state is final if last word is end of sentence
+  if (curwrd == end_sent) final_[dst] = true;
+
+  AddArc(src, label, prob, dst);
+
+  // add backoffs to any newly created destination state
+  // but only if non-final
+  if (!final_[dst] && new_dst && dbo != dst)
+    AddArc(dst, 0, bow, dbo);
+}
+
+void StreamingLmFstConverter::ConnectUnusedStates() {
+  int32 connected = 0;
+  for (StateId s = 0; s < NumStates(); s++) {
+    if (backoff_state_[s] != -1 && first_arc_[s] == -1 && !final_[s]) {
+      AddArc(s, 0, LmWeight::One(), backoff_state_[s]);
+      connected++;
+    }
+  }
+  KALDI_LOG << "Connected " << connected
+            << " states without outgoing arcs.";
+}
+
+void StreamingLmFstConverter::Read(std::istream &strm,
+                                   bool use_natural_log,
+                                   const string &start_sent,
+                                   const string &end_sent) {
+  KALDI_ASSERT(symbols_ == NULL && "Read() can only be called once.");
+  use_natural_log_ = use_natural_log;
+  symbols_ = new fst::SymbolTable("lmInputSymbols");
+  symbols_->AddSymbol("<eps>");
+  symbols_->AddSymbol(start_sent);
+  symbols_->AddSymbol(end_sent);
+  AddState();  // The start state.
+
+  string inpline;
+  size_t pos1, pos2;
+  int32 ilev, maxlev = 0;
+
+  // process \data\ section
+  while (getline(strm, inpline) && !strm.eof()) {
+    std::istringstream ss(inpline);
+    std::string token;
+    ss >> token >> std::ws;
+    if (token == "\\data\\" && ss.eof()) break;
+  }
+  if (strm.eof()) {
+    KALDI_ERR << "\\data\\ token not found in arpa file.";
+  }
+
+  while (getline(strm, inpline) && !strm.eof()) {
+    // break out of loop if another section is found
+    if (inpline.find("-grams:") != string::npos) break;
+    if (inpline.find("\\end\\") != string::npos) break;
+
+    // look for valid "ngram N = M" lines
+    pos1 = inpline.find("ngram");
+    pos2 = inpline.find("=");
+    if (pos1 == string::npos ||  pos2 == string::npos || pos2 <= pos1) {
+      continue;  // not valid, continue looking
+    }
+    ilev = atoi(inpline.substr(pos1+5, pos2-(pos1+5)).c_str());
+    if (ilev > maxlev) {
+      maxlev = ilev;
+    }
+  }
+  if (maxlev == 0) {
+    KALDI_ERR << "No ngrams found in specified file";
+  }
+
+  std::vector<string> words;
+  // process "\N-grams:" sections, we may have already read a "\N-grams:" line
+  // if so, process it, otherwise get another line
+  while (inpline.find("-grams:") != string::npos
+         || (getline(strm, inpline) && !strm.eof())) {
+    pos1 = inpline.find("\\");
+    pos2 = inpline.find("-grams:");
+    if (pos1 == string::npos || pos2 == string::npos || pos2 <= pos1) {
+      continue;  // not valid line, continue looking for one
+    }
+    ilev = atoi(inpline.substr(pos1+1, pos2-(pos1+1)).c_str());
+    KALDI_LOG << "Processing " << ilev << "-grams";
+    words.resize(ilev);
+
+    // process individual n-grams
+    while (getline(strm, inpline) && !strm.eof()) {
+      // break out of inner loop if another section is found
+      if (!inpline.empty() && inpline[0] == '\\') {
+        if (inpline.find("-grams:") != string::npos) break;
+        if (inpline.find("\\end\\") != string::npos) break;
+      }
+      // parse ngram line: first field = prob, other fields = words,
+      // last field = backoff (optional)
+      const char *cur_cstr = inpline.c_str();
+      while (*cur_cstr && isspace(*cur_cstr))
+        cur_cstr++;
+      if (*cur_cstr == '\0')  // Ignore empty lines.
+        continue;
+      char *next_cstr;
+      float prob = STRTOF(cur_cstr, &next_cstr);
+      if (next_cstr == cur_cstr)
+        KALDI_ERR << "Bad line in LM file [parsing " << ilev << "-grams]: "
+                  << inpline;
+      cur_cstr = next_cstr;
+      while (*cur_cstr && isspace(*cur_cstr))
+        cur_cstr++;
+
+      for (int32 i = 0; i < ilev; i++) {
+        if (*cur_cstr == '\0')
+          KALDI_ERR << "Bad line in LM file [parsing " << ilev << "-grams]: "
+                    << inpline;
+        const char *end_cstr = strpbrk(cur_cstr, " \t");
+        if (end_cstr == NULL) {
+          words[i].assign(cur_cstr);
+          cur_cstr += strlen(cur_cstr);
+        } else {
+          words[i].assign(cur_cstr, end_cstr - cur_cstr);
+          cur_cstr = end_cstr;
+          while (*cur_cstr && isspace(*cur_cstr))
+            cur_cstr++;
+        }
+      }
+      float bow = 0;
+      if (ilev < maxlev && *cur_cstr != '\0') {
+        // try converting anything left in the line to a backoff weight
+        char *end_cstr;
+        bow = STRTOF(cur_cstr, &end_cstr);
+        if (end_cstr != cur_cstr) {  // got something.
+          while (*end_cstr != '\0' && isspace(*end_cstr))
+            end_cstr++;
+          if (*end_cstr != '\0')
+            KALDI_ERR << "Junk " << end_cstr << " at end of line [parsing "
+                      << ilev << "-grams]" << inpline;
+        } else {
+          KALDI_ERR << "Junk " << cur_cstr << " at end of line [parsing "
+                    << ilev << "-grams]" << inpline;
+        }
+      }
+      AddNgram(ilev, maxlev, prob, bow, words, start_sent, end_sent);
+    }  // end of loop on individual n-gram lines
+  }
+
+  // The history trie is no longer needed.
+  std::vector<TrieEntry>().swap(trie_);
+  std::vector<StateId>().swap(node_state_);
+  history_words_.clear();
+
+  ConnectUnusedStates();
+  KALDI_LOG << "Built language model FST with " << NumStates()
+            << " states and " << NumArcs() << " arcs.";
+}
+
+bool StreamingLmFstConverter::Write(std::ostream &strm,
+                                    const string &source) const {
+  KALDI_ASSERT(symbols_ != NULL);
+  // This is what fst::VectorFst<fst::StdArc>::Write() writes.
+  fst::FstHeader hdr;
+  hdr.SetFstType("vector");
+  hdr.SetArcType(fst::StdArc::Type());
+  hdr.SetVersion(2);
+  hdr.SetFlags(fst::FstHeader::HAS_ISYMBOLS | fst::FstHeader::HAS_OSYMBOLS);
+  // The input and output labels of each arc are the same.
+  hdr.SetProperties(fst::kExpanded | fst::kMutable | fst::kAcceptor);
+  hdr.SetStart(0);
+  hdr.SetNumStates(NumStates());
+  hdr.SetNumArcs(NumArcs());
+  if (!hdr.Write(strm, source)) return false;
+  if (!symbols_->Write(strm) || !symbols_->Write(strm)) return false;
+
+  for (StateId s = 0; s < NumStates(); s++) {
+    LmWeight final_weight = final_[s] ? LmWeight::One() : LmWeight::Zero();
+    final_weight.Write(strm);
+    int64 narcs = 0;
+    for (int32 a = first_arc_[s]; a != -1; a = arcs_[a].next_arc)
+      narcs++;
+    fst::WriteType(strm, narcs);
+    for (int32 a = first_arc_[s]; a != -1; a = arcs_[a].next_arc) {
+      const CompactArc &arc = arcs_[a];
+      fst::WriteType(strm, arc.label);
+      fst::WriteType(strm, arc.label);
+      arc.weight.Write(strm);
+      fst::WriteType(strm, arc.nextstate);
+    }
+  }
+  return !strm.fail();
+}
+
+bool StreamingLmFstConverter::Write(const std::string &filename) const {
+  // interpret "" as stdout for compatibility with OpenFst conventions.
+  std::string wxfilename(filename == "" ? "-" : filename.c_str());
+  bool write_binary = true, write_header = false;
+  Output ko(wxfilename, write_binary, write_header);
+  return Write(ko.Stream(), PrintableWxfilename(wxfilename));
+}
+
+}  // end namespace eesen
@@ -0,0 +1,160 @@
+// lm/streaming-lm-fst.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_LM_STREAMING_LM_FST_H_
+#define KALDI_LM_STREAMING_LM_FST_H_
+
+#include <string>
+#include <vector>
+
+#include "fst/fstlib.h"
+#include "base/kaldi-common.h"
+#include "lm/kaldi-lmtable.h"
+
+namespace eesen {
+
+/// @addtogroup LanguageModel
+/// @{
+
+/**
+  * @brief Converts an ARPA language model into an FST with little memory.
+  *
+  * This builds the same FST as LangModelFst::Read() with kArpaLm (same
+  * states, arcs and symbol table, in the same order), but it does not build a
+  * VectorFst, and it does not keep a map from history strings to states.
+  * The n-grams are read a line at a time, and the word histories are kept in
+  * a trie whose nodes are stored in an open-addressing hash table keyed by
+  * (parent node, word).  The arcs are stored in a flat array, each one
+  * linked to the next arc of the same state, and Write() writes them out in
+  * the binary format of VectorFst.  The peak memory is close to the size of
+  * the output FST.
+*/
+class StreamingLmFstConverter {
+ public:
+  typedef fst::StdArc::Weight LmWeight;
+  typedef fst::StdArc::StateId StateId;
+  typedef fst::StdArc::Label Label;
+
+  StreamingLmFstConverter();
+
+  ~StreamingLmFstConverter() { delete symbols_; }
+
+  /// Reads the ARPA language model from <strm> and builds the FST.
+  void Read(std::istream &strm,
+            bool use_natural_log = true,
+            const string &start_sent = "<s>",
+            const string &end_sent = "</s>");
+
+  /// Writes the FST in the binary format of fst::VectorFst<fst::StdArc>,
+  /// with the word symbol table as input and output symbols.  Returns false
+  /// on error.
+  bool Write(std::ostream &strm, const string &source) const;
+
+  /// Writes the FST to the named output file (see Output), like
+  /// LangModelFst::Write().
+  bool Write(const std::string &wxfilename) const;
+
+  int32 NumStates() const { return final_.size(); }
+  int64 NumArcs() const { return arcs_.size(); }
+
+ private:
+  // An arc; the input and output labels are the same.
+  struct CompactArc {
+    Label label;
+    LmWeight weight;
+    StateId nextstate;
+    int32 next_arc;  // Next arc of the same state, or -1.
+  };
+
+  // An entry of the hash table of the history trie.
+  struct TrieEntry {
+    int32 parent;  // Parent node, or -1 if the entry is unused.
+    int32 word;
+    int32 node;
+  };
+
+  // Adds the arcs for one n-gram; <words> are in the order they appear in the
+  // ARPA file.  This does the same as LmFstConverter::AddArcsForNgramProb().
+  void AddNgram(int32 ilev, int32 maxlev, float log_prob, float log_bow,
+                const std::vector<string> &words,
+                const string &start_sent, const string &end_sent);
+
+  // Returns the state for the word sequence <word_ids>[begin] ...
+  // <word_ids>[end - 1], creating it if needed (and setting <newly_added>).
+  StateId FindOrAddState(const std::vector<int32> &word_ids,
+                         int32 begin, int32 end, bool *newly_added);
+
+  // Returns the child of <parent> in the history trie for <word>, creating it
+  // if needed.
+  int32 FindOrAddChild(int32 parent, int32 word);
+
+  // Doubles the size of the hash table of the history trie.
+  void ResizeTrie();
+
+  // Returns the integer used for <word> in the history trie: its label, or if
+  // it is not in the symbol table (it was only seen in histories so far), a
+  // negative integer.
+  int32 WordId(const string &word);
+
+  StateId AddState();
+
+  void AddArc(StateId src, Label label, LmWeight weight, StateId dst);
+
+  LmWeight ConvertArpaLogProbToWeight(float lp) const {
+    if (use_natural_log_) {
+      // convert from arpa base 10 log to natural base, then to cost
+      return -2.302585*lp;
+    } else {
+      // keep original base but convert to cost
+      return -lp;
+    }
+  }
+
+  // Adds epsilon arcs to the backoff state, from states that have no arcs and
+  // are not final, like LmFstConverter::ConnectUnusedStates().
+  void ConnectUnusedStates();
+
+  bool use_natural_log_;
+
+  fst::SymbolTable *symbols_;
+
+  // Words that were seen in histories before they were in the symbol table,
+  // and their (negative) ids in the history trie.
+  unordered_map<std::string, int32, StringHasher> history_words_;
+
+  // The history trie.  Node 0 is the empty history; <node_state_> is the
+  // state of each node, or -1 if it has no state.
+  std::vector<TrieEntry> trie_;
+  int64 trie_size_;  // Number of used entries in <trie_>.
+  std::vector<StateId> node_state_;
+
+  // Indexed by state.
+  std::vector<bool> final_;
+  std::vector<StateId> backoff_state_;  // -1 if none.
+  std::vector<int32> first_arc_;  // -1 if none.
+  std::vector<int32> last_arc_;
+
+  std::vector<CompactArc> arcs_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(StreamingLmFstConverter);
+};
+
+/// @} LanguageModel
+
+}  // end namespace eesen
+
+#endif  // KALDI_LM_STREAMING_LM_FST_H_
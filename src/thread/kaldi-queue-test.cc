@@ -0,0 +1,137 @@
+// thread/kaldi-queue-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "base/kaldi-common.h"
+#include "thread/kaldi-queue.h"
+#include "thread/kaldi-thread.h"
+
+namespace eesen {
+
+// Pushes the integers 0 ... num_items - 1 and then closes the queue.
+class MyProducer: public MultiThreadable {
+ public:
+  MyProducer(BoundedQueue<int32> *queue, int32 num_items):
+      queue_(queue), num_items_(num_items) { }
+  void operator() () {
+    for (int32 i = 0; i < num_items_; i++) {
+      int32 spin = Rand() % 1000;
+      for (int32 j = 0; j < spin; j++);
+      queue_->Push(new int32(i));
+    }
+    queue_->Close();
+  }
+ private:
+  BoundedQueue<int32> *queue_;
+  int32 num_items_;
+};
+
+// Sums the items it pops until the queue is exhausted.
+class MyConsumer: public MultiThreadable {
+ public:
+  MyConsumer(BoundedQueue<int32> *queue, Mutex *mutex, int64 *sum,
+             int32 *count):
+      queue_(queue), mutex_(mutex), sum_(sum), count_(count) { }
+  void operator() () {
+    int32 *item;
+    while ((item = queue_->Pop()) != NULL) {
+      mutex_->Lock();
+      *sum_ += *item;
+      (*count_)++;
+      mutex_->Unlock();
+      delete item;
+    }
+  }
+ private:
+  BoundedQueue<int32> *queue_;
+  Mutex *mutex_;
+  int64 *sum_;
+  int32 *count_;
+};
+
+// One producer and a consumer in this thread: the items come out in order.
+void TestBoundedQueueOrder() {
+  int32 num_items = Rand() % 1000;
+  BoundedQueue<int32> queue(1 + Rand() % 5);
+  MultiThreader<MyProducer> producer(1, MyProducer(&queue, num_items));
+  for (int32 i = 0; i < num_items; i++) {
+    int32 *item = queue.Pop();
+    KALDI_ASSERT(item != NULL && *item == i);
+    delete item;
+  }
+  KALDI_ASSERT(queue.Pop() == NULL);
+  KALDI_ASSERT(queue.Pop() == NULL);  // stays at the end.
+}
+
+// Several consumers: each item is popped exactly once.
+void TestBoundedQueueConsumers() {
+  int32 num_items = Rand() % 1000;
+  BoundedQueue<int32> queue(1 + Rand() % 5);
+  Mutex mutex;
+  int64 sum = 0;
+  int32 count = 0;
+  {
+    MultiThreader<MyConsumer> consumers(1 + Rand() % 4,
+                                        MyConsumer(&queue, &mutex, &sum,
+                                                   &count));
+    MyProducer producer(&queue, num_items);
+    producer();
+  }  // the destructor of "consumers" waits for them to finish.
+  KALDI_ASSERT(count == num_items);
+  KALDI_ASSERT(sum == static_cast<int64>(num_items) * (num_items - 1) / 2);
+}
+
+// Abort() wakes the producers waiting in Push() and the consumers waiting in
+// Pop(), so that the threads can be joined.
+void TestBoundedQueueAbort() {
+  {
+    int32 num_items = 100 + Rand() % 1000;
+    BoundedQueue<int32> queue(1 + Rand() % 5);
+    MultiThreader<MyProducer> producers(1 + Rand() % 3,
+                                        MyProducer(&queue, num_items));
+    int32 num_popped = Rand() % 10;
+    for (int32 i = 0; i < num_popped; i++)
+      delete queue.Pop();
+    queue.Abort();
+    KALDI_ASSERT(queue.Pop() == NULL);
+    KALDI_ASSERT(!queue.Push(new int32(0)));
+  }  // the destructor of "producers" waits for them to finish.
+  {
+    BoundedQueue<int32> queue(1 + Rand() % 5);
+    Mutex mutex;
+    int64 sum = 0;
+    int32 count = 0, num_items = Rand() % 5;
+    MultiThreader<MyConsumer> consumers(1 + Rand() % 4,
+                                        MyConsumer(&queue, &mutex, &sum,
+                                                   &count));
+    for (int32 i = 0; i < num_items; i++)
+      queue.Push(new int32(i));
+    queue.Abort();  // instead of Close().
+  }
+}
+
+}  // end namespace eesen.
+
+int main() {
+  using namespace eesen;
+  for (int32 i = 0; i < 50; i++) {
+    TestBoundedQueueOrder();
+    TestBoundedQueueConsumers();
+    TestBoundedQueueAbort();
+  }
+  KALDI_LOG << "Test OK.";
+}
@@ -0,0 +1,134 @@
+// thread/kaldi-queue.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_THREAD_KALDI_QUEUE_H_
+#define KALDI_THREAD_KALDI_QUEUE_H_ 1
+
+#include <deque>
+
+#include "base/kaldi-common.h"
+#include "thread/kaldi-mutex.h"
+#include "thread/kaldi-semaphore.h"
+
+namespace eesen {
+
+/**
+   BoundedQueue is for connecting the stages of a pipeline that run in
+   different threads, e.g. feature extraction, the network forward pass and
+   decoding: each stage Pop()s items from the queue of the previous stage and
+   Push()es its results to the queue of the next one.  Push() blocks while the
+   queue holds "capacity" items, which bounds the memory if a later stage is
+   slower, and Pop() blocks while it is empty.
+
+   The producer calls Close() after the last item; after the remaining items
+   have been popped, Pop() returns NULL (to all consumers, if there are
+   several).
+
+   If a stage fails, Abort() stops the queue: threads waiting in Push() or
+   Pop() return, and from then on Push() deletes its item and returns false,
+   and Pop() returns NULL.  Otherwise a producer could wait forever for a
+   consumer that is gone.
+ */
+template<class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(int32 capacity): slots_(capacity), items_(0),
+                                         aborted_(false) {
+    KALDI_ASSERT(capacity > 0);
+  }
+
+  /// Adds an item, waiting while the queue is full.  Takes ownership of
+  /// "item", which must not be NULL.  Returns false (having deleted "item")
+  /// if the queue was aborted.
+  bool Push(T *item) {
+    KALDI_ASSERT(item != NULL);
+    return PushInternal(item);
+  }
+
+  /// Marks the end of the items; call it once, after the last Push().
+  void Close() { PushInternal(NULL); }
+
+  /// Removes the oldest item and gives its ownership to the caller, waiting
+  /// while the queue is empty.  Returns NULL if the queue has been closed
+  /// and all the items have been popped, or if it was aborted.
+  T *Pop() {
+    items_.Wait();
+    mutex_.Lock();
+    if (aborted_) {
+      mutex_.Unlock();
+      items_.Signal();  // wakes the next thread waiting in Pop().
+      return NULL;
+    }
+    T *ans = queue_.front();
+    if (ans == NULL) {
+      // Leave the end marker in the queue for any other consumers.
+      mutex_.Unlock();
+      items_.Signal();
+      return NULL;
+    }
+    queue_.pop_front();
+    mutex_.Unlock();
+    slots_.Signal();
+    return ans;
+  }
+
+  /// Makes the threads waiting in Push() and Pop() return, and all later
+  /// calls fail; see the class comment.  May be called from any thread, and
+  /// more than once.
+  void Abort() {
+    mutex_.Lock();
+    aborted_ = true;
+    mutex_.Unlock();
+    // Each thread woken passes the signal on to the next one waiting.
+    slots_.Signal();
+    items_.Signal();
+  }
+
+  ~BoundedQueue() {
+    for (typename std::deque<T*>::iterator iter = queue_.begin();
+         iter != queue_.end(); ++iter)
+      delete *iter;
+  }
+
+ private:
+  bool PushInternal(T *item) {
+    slots_.Wait();
+    mutex_.Lock();
+    if (aborted_) {
+      mutex_.Unlock();
+      slots_.Signal();  // wakes the next thread waiting in Push().
+      delete item;
+      return false;
+    }
+    queue_.push_back(item);
+    mutex_.Unlock();
+    items_.Signal();
+    return true;
+  }
+
+  Semaphore slots_;  // number of items that can be pushed without waiting.
+  Semaphore items_;  // number of items (including the end marker) queued.
+  Mutex mutex_;      // protects queue_ and aborted_.
+  std::deque<T*> queue_;
+  bool aborted_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(BoundedQueue);
+};
+
+}  // namespace eesen
+
+#endif  // KALDI_THREAD_KALDI_QUEUE_H_
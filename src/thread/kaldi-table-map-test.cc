@@ -0,0 +1,143 @@
+// thread/kaldi-table-map-test.cc
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <sstream>
+
+#include "base/kaldi-common.h"
+#include "thread/kaldi-table-map.h"
+
+namespace eesen {
+
+// Has the interface of SequentialTableReader that RunTableMap() uses; the
+// items are the integers 0 ... num_items - 1.
+class MyReader {
+ public:
+  explicit MyReader(int32 num_items): i_(0), num_items_(num_items) { }
+  bool Done() const { return i_ >= num_items_; }
+  void Next() { i_++; }
+  std::string Key() const {
+    std::ostringstream os;
+    os << "utt" << i_;
+    return os.str();
+  }
+  const int32 &Value() const { return i_; }
+  void FreeCurrent() { }
+ private:
+  int32 i_;
+  int32 num_items_;
+};
+
+// Squares the items, spinning for a while; fails for multiples of 7.  Throws
+// from Process() for item <process_error_item> and from Write() for item
+// <write_error_item>, if they are not -1.
+class MyTableFunc {
+ public:
+  typedef int32 Input;
+  typedef int32 Output;
+
+  MyTableFunc(): num_done(0), num_err(0), process_error_item(-1),
+                 write_error_item(-1) { }
+
+  bool Process(const std::string &key, int32 *input, int32 *output) const {
+    int32 spin = 1000000 * Rand() % 100;
+    for (int32 i = 0; i < spin; i++);
+    if (*input == process_error_item)
+      KALDI_ERR << "Process() failed for " << key;
+    if (*input % 7 == 0) return false;
+    *output = *input * *input;
+    return true;
+  }
+
+  void Write(const std::string &key, bool ok, const int32 &output) {
+    std::ostringstream os;
+    os << "utt" << (num_done + num_err);
+    KALDI_ASSERT(key == os.str());
+    if (num_done + num_err == write_error_item)
+      KALDI_ERR << "Write() failed for " << key;
+    if (ok) {
+      outputs.push_back(output);
+      num_done++;
+    } else {
+      num_err++;
+    }
+  }
+
+  std::vector<int32> outputs;
+  int32 num_done;
+  int32 num_err;
+  int32 process_error_item;
+  int32 write_error_item;
+};
+
+void TestRunTableMap() {
+  TaskSequencerConfig config;
+  config.num_threads = 1 + Rand() % 10;
+  if (Rand() % 2 == 1)
+    config.num_threads_total = config.num_threads + Rand() % config.num_threads;
+
+  int32 num_items = Rand() % 100;
+  MyReader reader(num_items);
+  MyTableFunc func;
+  RunTableMap(config, &reader, &func);
+  KALDI_ASSERT(func.num_done + func.num_err == num_items);
+  int32 j = 0;
+  for (int32 i = 0; i < num_items; i++) {
+    if (i % 7 == 0) continue;
+    KALDI_ASSERT(func.outputs[j++] == i * i);
+  }
+  KALDI_ASSERT(j == func.num_done);
+}
+
+// Checks that an exception in Process() or Write() comes out of
+// RunTableMap(), after the items before it have been written.
+void TestRunTableMapError() {
+  TaskSequencerConfig config;
+  config.num_threads = 1 + Rand() % 10;
+
+  int32 num_items = 1 + Rand() % 100, error_item = Rand() % num_items;
+  MyReader reader(num_items);
+  MyTableFunc func;
+  std::string expected;
+  if (Rand() % 2 == 0) {
+    func.process_error_item = error_item;
+    expected = "Process() failed";
+  } else {
+    func.write_error_item = error_item;
+    expected = "Write() failed";
+  }
+  bool threw = false;
+  try {
+    RunTableMap(config, &reader, &func);
+  } catch(const std::exception &e) {
+    threw = true;
+    KALDI_ASSERT(std::string(e.what()).find(expected) != std::string::npos);
+  }
+  KALDI_ASSERT(threw);
+  KALDI_ASSERT(func.num_done + func.num_err == error_item);
+}
+
+}  // end namespace eesen.
+
+int main() {
+  using namespace eesen;
+  for (int32 i = 0; i < 200; i++)
+    TestRunTableMap();
+  for (int32 i = 0; i < 50; i++)
+    TestRunTableMapError();
+  KALDI_LOG << "Test OK.";
+}
@@ -0,0 +1,158 @@
+// thread/kaldi-table-map.h
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_THREAD_KALDI_TABLE_MAP_H_
+#define KALDI_THREAD_KALDI_TABLE_MAP_H_ 1
+
+#include <stdexcept>
+#include <string>
+
+#include "thread/kaldi-mutex.h"
+#include "thread/kaldi-task-sequence.h"
+
+namespace eesen {
+
+/**
+   RunTableMap() is for the common kind of command-line program that reads a
+   table (e.g. lattices), processes each item independently, and writes the
+   results.  It processes the items in parallel with TaskSequencer, and writes
+   the results in the order the items were read.  The number of items that
+   are being processed or waiting to be written is bounded by
+   --num-threads-total (see TaskSequencerConfig), which bounds the memory.
+
+   Class F describes the processing; it must have:
+
+     typedef ... Input;   // The type of the items of the table.
+     typedef ... Output;  // The type of the result for one item.
+
+     // Processes one item; it may modify <input>.  Returns false if the item
+     // could not be processed.  This is called from several threads at once,
+     // so it must not modify the object (except through locks).
+     bool Process(const std::string &key, Input *input, Output *output) const;
+
+     // Writes the result for one item, or handles the failure if <ok> is
+     // false.  This is called in the order the items were read, one at a time,
+     // so it can write to tables and streams and update counts.
+     void Write(const std::string &key, bool ok, const Output &output);
+
+   Class Reader is a SequentialTableReader whose values are of type
+   F::Input.  If config.num_threads is 1, the items are processed in this
+   thread.
+
+   If Process() or Write() throws (e.g. KALDI_ERR), the items after it are
+   not written, and RunTableMap() throws an exception with the same message
+   once the items already started have finished.
+ */
+
+// The first error of a RunTableMap() call.
+class TableMapError {
+ public:
+  bool HasError() {
+    mutex_.Lock();
+    bool ans = !message_.empty();
+    mutex_.Unlock();
+    return ans;
+  }
+  // Records <message>, unless there was an error before.
+  void SetError(const std::string &message) {
+    mutex_.Lock();
+    if (message_.empty())
+      message_ = (message.empty() ? "Unknown error" : message);
+    mutex_.Unlock();
+  }
+  // Throws the error, if there was one.
+  void Check() {
+    if (HasError())
+      throw std::runtime_error(message_);
+  }
+ private:
+  Mutex mutex_;
+  std::string message_;
+};
+
+template<class F>
+class TableMapTask {
+ public:
+  TableMapTask(F *f, const std::string &key, const typename F::Input &input,
+               TableMapError *error):
+      f_(f), key_(key), input_(input), ok_(false), error_(error) { }
+
+  void operator () () {
+    try {
+      ok_ = f_->Process(key_, &input_, &output_);
+    } catch(const std::exception &e) {
+      // This may be in a thread of TaskSequencer, where an exception would
+      // call std::terminate().
+      process_error_ = e.what();
+      if (process_error_.empty()) process_error_ = "Unknown error";
+    }
+  }
+
+  // The destructors are called in the order the items were read.  An
+  // exception must not leave them, so the error is passed on to
+  // RunTableMap() instead.
+  ~TableMapTask() {
+    if (error_->HasError()) return;
+    if (!process_error_.empty()) {
+      error_->SetError(process_error_);
+      return;
+    }
+    try {
+      f_->Write(key_, ok_, output_);
+    } catch(const std::exception &e) {
+      error_->SetError(e.what());
+    }
+  }
+
+ private:
+  F *f_;
+  std::string key_;
+  typename F::Input input_;
+  typename F::Output output_;
+  bool ok_;
+  std::string process_error_;  // Set if Process() threw.
+  TableMapError *error_;
+};
+
+template<class Reader, class F>
+void RunTableMap(const TaskSequencerConfig &config, Reader *reader, F *f) {
+  TableMapError error;
+  if (config.num_threads <= 1) {
+    for (; !reader->Done() && !error.HasError(); reader->Next()) {
+      TableMapTask<F> task(f, reader->Key(), reader->Value(), &error);
+      reader->FreeCurrent();
+      task();
+    }  // The destructor of "task" writes the output.
+  } else {
+    TaskSequencer<TableMapTask<F> > sequencer(config);
+    for (; !reader->Done() && !error.HasError(); reader->Next()) {
+      TableMapTask<F> *task = new TableMapTask<F>(f, reader->Key(),
+                                                  reader->Value(), &error);
+      // The input may share its data with the reader's copy (e.g. a
+      // VectorFst), whose reference count is not thread-safe, so the reader
+      // must let go of it before the task starts.
+      reader->FreeCurrent();
+      sequencer.Run(task);
+    }
+    sequencer.Wait();
+  }
+  error.Check();
+}
+
+}  // namespace eesen
+
+#endif  // KALDI_THREAD_KALDI_TABLE_MAP_H_
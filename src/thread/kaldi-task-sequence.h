@@ -22,7 +22,7 @@
 
 #include <pthread.h>
 #include "thread/kaldi-thread.h"
-#include "itf/options-itf.h"
+#include "util/options-itf.h"
 #include "thread/kaldi-semaphore.h"
 
 